@@ -0,0 +1,345 @@
+#include "AssetPackage.h"
+
+#include "Hash.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+namespace core {
+
+namespace {
+
+constexpr uint32_t PackageMagic = 0x50324B56; // "VK2P"
+constexpr uint32_t PackageVersion = 1;
+
+// Assets are aligned so they can be copied into staging memory, or handed to Vulkan, in place
+constexpr uint64_t PackageAlignment = 16;
+
+////////////////////////////////////////////////////////////////////////////////
+
+uint64_t AlignOffset(uint64_t offset) {
+	return (offset + PackageAlignment - 1) & ~(PackageAlignment - 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Bytes per block and block width and height of the formats textures can be stored in
+bool GetBlockInfo(VkFormat format, uint32_t & outBlockBytes, uint32_t & outBlockSize) {
+	switch (format) {
+	case VK_FORMAT_R8G8B8A8_UNORM:
+	case VK_FORMAT_R8G8B8A8_SRGB:
+	case VK_FORMAT_B8G8R8A8_UNORM:
+	case VK_FORMAT_B8G8R8A8_SRGB:
+		outBlockBytes = 4;
+		outBlockSize = 1;
+		return true;
+	case VK_FORMAT_R16G16B16A16_SFLOAT:
+		outBlockBytes = 8;
+		outBlockSize = 1;
+		return true;
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+	case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+	case VK_FORMAT_BC4_UNORM_BLOCK:
+	case VK_FORMAT_BC4_SNORM_BLOCK:
+		outBlockBytes = 8;
+		outBlockSize = 4;
+		return true;
+	case VK_FORMAT_BC2_UNORM_BLOCK:
+	case VK_FORMAT_BC2_SRGB_BLOCK:
+	case VK_FORMAT_BC3_UNORM_BLOCK:
+	case VK_FORMAT_BC3_SRGB_BLOCK:
+	case VK_FORMAT_BC5_UNORM_BLOCK:
+	case VK_FORMAT_BC5_SNORM_BLOCK:
+	case VK_FORMAT_BC6H_UFLOAT_BLOCK:
+	case VK_FORMAT_BC6H_SFLOAT_BLOCK:
+	case VK_FORMAT_BC7_UNORM_BLOCK:
+	case VK_FORMAT_BC7_SRGB_BLOCK:
+		outBlockBytes = 16;
+		outBlockSize = 4;
+		return true;
+	default:
+		return false;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Size of a texture's data, mips tightly packed largest first, and the copy of each mip.
+// Zero if the format isn't supported or the dimensions make no sense.
+uint64_t ComputeTextureLayout(
+	VkFormat format
+	, VkExtent2D extent
+	, uint32_t mipLevels
+	, uint32_t arrayLayers
+	, std::vector<VkBufferImageCopy> * outRegions)
+{
+	uint32_t blockBytes = 0;
+	uint32_t blockSize = 0;
+	if (!GetBlockInfo(format, blockBytes, blockSize))
+		return 0;
+
+	if (extent.width == 0 || extent.height == 0 || mipLevels == 0 || mipLevels > 32 || arrayLayers == 0)
+		return 0;
+	// No more mips than down to 1x1
+	if ((std::max(extent.width, extent.height) >> (mipLevels - 1)) == 0)
+		return 0;
+
+	uint64_t size = 0;
+	for (uint32_t mip = 0; mip < mipLevels; mip++) {
+		const uint32_t width = std::max(1u, extent.width >> mip);
+		const uint32_t height = std::max(1u, extent.height >> mip);
+
+		if (outRegions) {
+			VkBufferImageCopy region = {};
+			region.bufferOffset = size;
+			region.bufferRowLength = 0;
+			region.bufferImageHeight = 0;
+			region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			region.imageSubresource.mipLevel = mip;
+			region.imageSubresource.baseArrayLayer = 0;
+			region.imageSubresource.layerCount = arrayLayers;
+			region.imageOffset = { 0, 0, 0 };
+			region.imageExtent = { width, height, 1 };
+			outRegions->push_back(region);
+		}
+
+		// Mips smaller than a block still take a whole one
+		const uint64_t blocksX = (width + blockSize - 1) / blockSize;
+		const uint64_t blocksY = (height + blockSize - 1) / blockSize;
+		size += blocksX * blocksY * blockBytes * arrayLayers;
+	}
+
+	return size;
+}
+
+} // anonymous namespace
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool AssetPackage::Open(const std::string & path) {
+	Close();
+
+	// Read straight from the mapping, the layout can't change without bumping the version
+	static_assert(sizeof(Entry) == 80, "Package entries are read from disk as is");
+
+	if (!File.Open(path))
+		return false;
+
+	const uint8_t * data = File.GetData();
+	const size_t size = File.GetSize();
+	if (size < sizeof(Header)) {
+		Close();
+		return false;
+	}
+
+	const Header * header = reinterpret_cast<const Header *>(data);
+	const uint64_t tocEnd = sizeof(Header) + static_cast<uint64_t>(header->EntryCount) * sizeof(Entry);
+	if (header->Magic != PackageMagic || header->Version != PackageVersion || tocEnd > size) {
+		Close();
+		return false;
+	}
+
+	Entries = std::span<const Entry>(
+		reinterpret_cast<const Entry *>(data + sizeof(Header))
+		, header->EntryCount
+	);
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void AssetPackage::Close() {
+	Entries = {};
+	File.Close();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool AssetPackage::FindMesh(std::string_view name, MeshAsset & outMesh) const {
+	const Entry * entry = FindEntry(name, AssetType::Mesh);
+	if (!entry)
+		return false;
+
+	const uint64_t positionsSize = static_cast<uint64_t>(entry->VertexCount) * sizeof(Vec3);
+	const uint64_t indicesSize = static_cast<uint64_t>(entry->IndexCount) * sizeof(uint32_t);
+	if (entry->VertexCount == 0
+		|| entry->IndexCount == 0
+		|| entry->IndexOffset < positionsSize
+		|| entry->IndexOffset % sizeof(uint32_t) != 0
+		|| entry->IndexOffset + indicesSize > entry->Size)
+		return false;
+
+	const uint8_t * data = File.GetData() + entry->Offset;
+	outMesh.Positions = std::span<const Vec3>(reinterpret_cast<const Vec3 *>(data), entry->VertexCount);
+	outMesh.Indices = std::span<const uint32_t>(reinterpret_cast<const uint32_t *>(data + entry->IndexOffset), entry->IndexCount);
+	outMesh.Bounds = { entry->Bounds[0], entry->Bounds[1], entry->Bounds[2], entry->Bounds[3] };
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool AssetPackage::FindTexture(std::string_view name, TextureAsset & outTexture) const {
+	const Entry * entry = FindEntry(name, AssetType::Texture);
+	if (!entry)
+		return false;
+
+	const VkFormat format = static_cast<VkFormat>(entry->Format);
+	const VkExtent2D extent = { entry->Width, entry->Height };
+
+	std::vector<VkBufferImageCopy> regions;
+	const uint64_t size = ComputeTextureLayout(format, extent, entry->MipLevels, entry->ArrayLayers, &regions);
+	if (size == 0 || size != entry->Size)
+		return false;
+
+	outTexture.Format = format;
+	outTexture.Extent = extent;
+	outTexture.MipLevels = entry->MipLevels;
+	outTexture.ArrayLayers = entry->ArrayLayers;
+	outTexture.Data = std::span<const uint8_t>(File.GetData() + entry->Offset, entry->Size);
+	outTexture.Regions = std::move(regions);
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+const AssetPackage::Entry * AssetPackage::FindEntry(std::string_view name, AssetType type) const {
+	const uint64_t key = HashString(name);
+	auto it = std::lower_bound(
+		Entries.begin()
+		, Entries.end()
+		, key
+		, [](const Entry & entry, uint64_t key) { return entry.Key < key; }
+	);
+	if (it == Entries.end() || it->Key != key || it->Type != type)
+		return nullptr;
+
+	// Ignore entries pointing outside the file, or not aligned for the copy
+	if (it->Offset % PackageAlignment != 0 || it->Offset > File.GetSize() || it->Size > File.GetSize() - it->Offset)
+		return nullptr;
+
+	return &*it;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void AssetPackageWriter::AddMesh(std::string_view name, std::span<const Vec3> positions, std::span<const uint32_t> indices) {
+	if (positions.empty() || indices.empty())
+		throw std::runtime_error("Empty meshes can't be added to a package");
+
+	PendingAsset asset;
+	asset.Entry.Type = AssetPackage::AssetType::Mesh;
+	asset.Entry.VertexCount = static_cast<uint32_t>(positions.size());
+	asset.Entry.IndexCount = static_cast<uint32_t>(indices.size());
+	asset.Entry.IndexOffset = AlignOffset(positions.size_bytes());
+
+	const Vec4 bounds = ComputeBoundingSphere(positions.data(), positions.size());
+	asset.Entry.Bounds[0] = bounds.X;
+	asset.Entry.Bounds[1] = bounds.Y;
+	asset.Entry.Bounds[2] = bounds.Z;
+	asset.Entry.Bounds[3] = bounds.W;
+
+	// Positions, then the indices aligned after them
+	asset.Data.resize(asset.Entry.IndexOffset + indices.size_bytes());
+	std::copy_n(reinterpret_cast<const uint8_t *>(positions.data()), positions.size_bytes(), asset.Data.begin());
+	std::copy_n(reinterpret_cast<const uint8_t *>(indices.data()), indices.size_bytes(), asset.Data.begin() + asset.Entry.IndexOffset);
+
+	Add(name, std::move(asset));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void AssetPackageWriter::AddTexture(
+	std::string_view name
+	, VkFormat format
+	, VkExtent2D extent
+	, uint32_t mipLevels
+	, uint32_t arrayLayers
+	, std::span<const uint8_t> data)
+{
+	const uint64_t size = ComputeTextureLayout(format, extent, mipLevels, arrayLayers, nullptr);
+	if (size == 0)
+		throw std::runtime_error("Unsupported texture format or dimensions for a package");
+	if (size != data.size())
+		throw std::runtime_error("Texture data doesn't match its format and dimensions");
+
+	PendingAsset asset;
+	asset.Entry.Type = AssetPackage::AssetType::Texture;
+	asset.Entry.Format = static_cast<uint32_t>(format);
+	asset.Entry.Width = extent.width;
+	asset.Entry.Height = extent.height;
+	asset.Entry.MipLevels = mipLevels;
+	asset.Entry.ArrayLayers = arrayLayers;
+	asset.Data.assign(data.begin(), data.end());
+
+	Add(name, std::move(asset));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool AssetPackageWriter::Write(const std::string & path) const {
+	// Lay out the table of contents, sorted for binary search on load, followed by the aligned assets
+	std::vector<const PendingAsset *> sorted;
+	sorted.reserve(Assets.size());
+	for (const PendingAsset & asset : Assets)
+		sorted.push_back(&asset);
+	std::sort(sorted.begin(), sorted.end(), [](const PendingAsset * a, const PendingAsset * b) { return a->Entry.Key < b->Entry.Key; });
+
+	std::vector<AssetPackage::Entry> entries;
+	entries.reserve(sorted.size());
+
+	uint64_t offset = sizeof(AssetPackage::Header) + sorted.size() * sizeof(AssetPackage::Entry);
+	for (const PendingAsset * asset : sorted) {
+		offset = AlignOffset(offset);
+		AssetPackage::Entry entry = asset->Entry;
+		entry.Offset = offset;
+		entry.Size = asset->Data.size();
+		entries.push_back(entry);
+		offset += entry.Size;
+	}
+
+	// Write next to an older package and swap it in, so a crash never leaves a partial file
+	const std::string tempPath = path + ".tmp";
+	{
+		std::ofstream outFile(tempPath, std::ios::binary);
+		if (!outFile.is_open())
+			return false;
+
+		AssetPackage::Header header = { PackageMagic, PackageVersion, static_cast<uint32_t>(entries.size()), 0 };
+		outFile.write(reinterpret_cast<const char *>(&header), sizeof(header));
+		outFile.write(reinterpret_cast<const char *>(entries.data()), entries.size() * sizeof(AssetPackage::Entry));
+
+		for (size_t i = 0; i < sorted.size(); i++) {
+			static const char padding[PackageAlignment] = {};
+			outFile.write(padding, entries[i].Offset - static_cast<uint64_t>(outFile.tellp()));
+			outFile.write(reinterpret_cast<const char *>(sorted[i]->Data.data()), sorted[i]->Data.size());
+		}
+
+		if (!outFile)
+			return false;
+	}
+
+	std::error_code error;
+	std::filesystem::rename(tempPath, path, error);
+	return !error;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void AssetPackageWriter::Add(std::string_view name, PendingAsset && asset) {
+	asset.Entry.Key = HashString(name);
+
+	for (const PendingAsset & other : Assets) {
+		if (other.Entry.Key == asset.Entry.Key)
+			throw std::runtime_error("An asset named " + std::string(name) + " is already in the package");
+	}
+
+	Assets.push_back(std::move(asset));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+} // namespace core
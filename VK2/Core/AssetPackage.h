@@ -0,0 +1,147 @@
+#pragma once
+
+#include "MappedFile.h"
+#include "Math.h"
+#include "VkBootStrap/VkBootstrapDispatch.h"
+
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace core {
+
+////////////////////////////////////////////////////////////////////////////////
+// Mesh in a package, pointing into the mapping
+struct MeshAsset {
+	// Same layout as GpuScene's vertex and index buffers
+	std::span<const Vec3> Positions;
+	std::span<const uint32_t> Indices;
+	// Bounding sphere in object space, computed when the package was written
+	Vec4 Bounds;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Texture in a package, pointing into the mapping.
+// Data holds every mip level, largest first, each with all of its array layers.
+struct TextureAsset {
+	VkFormat Format = VK_FORMAT_UNDEFINED;
+	VkExtent2D Extent = {};
+	uint32_t MipLevels = 0;
+	uint32_t ArrayLayers = 0;
+	std::span<const uint8_t> Data;
+	// One copy per mip level, buffer offsets relative to Data, ready for StreamingUploader::UploadImage
+	std::vector<VkBufferImageCopy> Regions;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Read-only archive of meshes and textures, memory mapped as a whole.
+//
+// Assets are stored the way the GPU consumes them, so loading one is a lookup
+// in the table of contents and a copy from the mapping into staging memory,
+// without parsing or converting anything in between. Meshes are GpuScene's
+// vertex and index streams, textures are block compressed (BCn) or plain
+// texels laid out for vkCmdCopyBufferToImage. Only the pages of the assets
+// that are actually read get loaded.
+//
+// What the Find functions return points into the mapping, and is valid for as
+// long as the package is open. Lookups are thread safe.
+class AssetPackage {
+public:
+	AssetPackage() = default;
+
+	AssetPackage(const AssetPackage &) = delete;
+	AssetPackage & operator=(const AssetPackage &) = delete;
+
+	// Returns false if the file doesn't exist, is truncated or was written by another version
+	bool Open(const std::string & path);
+	void Close();
+
+	bool IsOpen() const { return File.IsOpen(); }
+
+	// False if the package has no such asset, or its entry is broken
+	bool FindMesh(std::string_view name, MeshAsset & outMesh) const;
+	bool FindTexture(std::string_view name, TextureAsset & outTexture) const;
+
+private:
+	friend class AssetPackageWriter;
+
+	enum class AssetType : uint32_t {
+		Mesh,
+		Texture,
+	};
+
+	// Layout of the package file. All offsets are from the start of the file.
+	struct Header {
+		uint32_t Magic;
+		uint32_t Version;
+		uint32_t EntryCount;
+		uint32_t Reserved;
+	};
+
+	// Table of contents entry, sorted by key
+	struct Entry {
+		// HashString of the name
+		uint64_t Key = 0;
+		uint64_t Offset = 0;
+		uint64_t Size = 0;
+		AssetType Type = AssetType::Mesh;
+		// VkFormat of the texels, unused by meshes
+		uint32_t Format = 0;
+
+		// Meshes, indices start IndexOffset bytes into the asset
+		uint32_t VertexCount = 0;
+		uint32_t IndexCount = 0;
+		uint64_t IndexOffset = 0;
+		float Bounds[4] = {};
+
+		// Textures
+		uint32_t Width = 0;
+		uint32_t Height = 0;
+		uint32_t MipLevels = 0;
+		uint32_t ArrayLayers = 0;
+	};
+
+	// Null if there is no entry with that name and type, or it points outside the file
+	const Entry * FindEntry(std::string_view name, AssetType type) const;
+
+private:
+	MappedFile File;
+	std::span<const Entry> Entries;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Builds packages offline, e.g. at the end of the asset pipeline once textures
+// are compressed. Keeps a copy of everything added until written.
+class AssetPackageWriter {
+public:
+	// Indices are relative to the mesh's first vertex. Bounds are computed here, so loading doesn't have to.
+	void AddMesh(std::string_view name, std::span<const Vec3> positions, std::span<const uint32_t> indices);
+
+	// data holds every mip level largest first, each with all of its array layers, tightly packed.
+	// Throws if the format isn't supported or the size doesn't match.
+	void AddTexture(
+		std::string_view name
+		, VkFormat format
+		, VkExtent2D extent
+		, uint32_t mipLevels
+		, uint32_t arrayLayers
+		, std::span<const uint8_t> data);
+
+	// Returns false if the file couldn't be written
+	bool Write(const std::string & path) const;
+
+private:
+	struct PendingAsset {
+		AssetPackage::Entry Entry;
+		std::vector<uint8_t> Data;
+	};
+
+	// Throws if an asset with the same key was added already
+	void Add(std::string_view name, PendingAsset && asset);
+
+private:
+	std::vector<PendingAsset> Assets;
+};
+
+} // namespace core
@@ -0,0 +1,161 @@
+#include "AsyncCompute.h"
+
+#include <stdexcept>
+
+namespace core {
+
+////////////////////////////////////////////////////////////////////////////////
+
+AsyncCompute::AsyncCompute(
+	const vkb::DispatchTable & vk
+	, VkQueue computeQueue
+	, uint32_t computeQueueFamily
+	, uint32_t graphicsQueueFamily
+	, uint32_t frameCount)
+	: Vk(vk)
+	, ComputeQueue(computeQueue)
+	, ComputeQueueFamily(computeQueueFamily)
+	, GraphicsQueueFamily(graphicsQueueFamily)
+	, Timeline(vk)
+	, Frames(frameCount)
+{
+	VkCommandPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.pNext = nullptr;
+
+	// Pools are reset as a whole once the frame comes around again
+	poolInfo.queueFamilyIndex = ComputeQueueFamily;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+	for (FrameCommands & frame : Frames) {
+		if (Vk.createCommandPool(&poolInfo, nullptr, &frame.Pool))
+			throw std::runtime_error("Failed to create compute command pool");
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+AsyncCompute::~AsyncCompute() {
+	// Destroying command pool will destroy all command buffers that have been allocated from it
+	for (FrameCommands & frame : Frames)
+		Vk.destroyCommandPool(frame.Pool, nullptr);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void AsyncCompute::BeginFrame(uint32_t frameIndex) {
+	CurrentFrame = frameIndex;
+	FrameCommands & frame = Frames[CurrentFrame];
+
+	// Graphics normally waited for these already, but compute work nobody consumed isn't covered by the frame wait
+	if (!Timeline.Wait(frame.LastValue, 1000000000))
+		throw std::runtime_error("Timed out waiting for compute work");
+
+	Vk.resetCommandPool(frame.Pool, 0);
+	frame.UsedBuffers = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+VkCommandBuffer AsyncCompute::BeginCommands() {
+	FrameCommands & frame = Frames[CurrentFrame];
+
+	if (frame.UsedBuffers == frame.Buffers.size()) {
+		VkCommandBufferAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.pNext = nullptr;
+
+		allocInfo.commandPool = frame.Pool;
+		allocInfo.commandBufferCount = 1;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+
+		VkCommandBuffer buffer;
+		if (Vk.allocateCommandBuffers(&allocInfo, &buffer))
+			throw std::runtime_error("Failed to allocate a compute command buffer.");
+
+		frame.Buffers.push_back(buffer);
+	}
+
+	VkCommandBuffer cmd = frame.Buffers[frame.UsedBuffers++];
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.pNext = nullptr;
+
+	beginInfo.pInheritanceInfo = nullptr;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	Vk.beginCommandBuffer(cmd, &beginInfo);
+	return cmd;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+uint64_t AsyncCompute::Submit(VkCommandBuffer cmd, VkPipelineStageFlags graphicsWaitStage, const SemaphoreWaits * waits) {
+	Vk.endCommandBuffer(cmd);
+
+	const uint64_t value = Timeline.Advance();
+	VkSemaphore timeline = Timeline.Get();
+
+	VkTimelineSemaphoreSubmitInfo timelineInfo = {};
+	timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+	timelineInfo.pNext = nullptr;
+
+	timelineInfo.signalSemaphoreValueCount = 1;
+	timelineInfo.pSignalSemaphoreValues = &value;
+
+	VkSubmitInfo submit = {};
+	submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submit.pNext = &timelineInfo;
+
+	if (waits) {
+		timelineInfo.waitSemaphoreValueCount = static_cast<uint32_t>(waits->Values.size());
+		timelineInfo.pWaitSemaphoreValues = waits->Values.data();
+
+		submit.waitSemaphoreCount = static_cast<uint32_t>(waits->Semaphores.size());
+		submit.pWaitSemaphores = waits->Semaphores.data();
+		submit.pWaitDstStageMask = waits->Stages.data();
+	}
+
+	submit.commandBufferCount = 1;
+	submit.pCommandBuffers = &cmd;
+
+	submit.signalSemaphoreCount = 1;
+	submit.pSignalSemaphores = &timeline;
+
+	if (Vk.queueSubmit(ComputeQueue, 1, &submit, VK_NULL_HANDLE))
+		throw std::runtime_error("Failed to submit to the compute queue");
+
+	Frames[CurrentFrame].LastValue = value;
+
+	if (graphicsWaitStage != 0) {
+		// Waiting on the newest value covers every earlier submission too
+		GraphicsWaitValue = value;
+		GraphicsWaitStages |= graphicsWaitStage;
+	}
+
+	return value;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void AsyncCompute::AddGraphicsWaits(SemaphoreWaits & waits) {
+	if (GraphicsWaitStages == 0)
+		return;
+
+	waits.Add(Timeline.Get(), GraphicsWaitValue, GraphicsWaitStages);
+	GraphicsWaitStages = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+std::vector<uint32_t> AsyncCompute::GetQueueFamilies() const {
+	if (!IsAsync())
+		return { GraphicsQueueFamily };
+
+	return { GraphicsQueueFamily, ComputeQueueFamily };
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+} // namespace core
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "TimelineSemaphore.h"
+#include "VkBootStrap/VkBootstrapDispatch.h"
+
+#include <vector>
+
+namespace core {
+
+////////////////////////////////////////////////////////////////////////////////
+// Submits compute work (culling, particles, post-processing) to a separate
+// compute queue so it overlaps the graphics queue's raster work instead of
+// running in between it.
+//
+// Every submission signals the next value on the compute timeline. Graphics
+// work that consumes the results waits on that value at the stage that first
+// reads them, so everything before that stage still overlaps. Compute work can
+// in turn wait on other queues through the waits passed to Submit().
+//
+// Resources written on one queue family and read on the other either need
+// VK_SHARING_MODE_CONCURRENT with GetQueueFamilies(), or a release/acquire
+// barrier pair recorded by the caller. Not thread safe, only the thread
+// submitting to the graphics queue may use it.
+class AsyncCompute {
+public:
+	AsyncCompute(
+		const vkb::DispatchTable & vk
+		, VkQueue computeQueue
+		, uint32_t computeQueueFamily
+		, uint32_t graphicsQueueFamily
+		, uint32_t frameCount);
+	// The device must be idle
+	~AsyncCompute();
+
+	AsyncCompute(const AsyncCompute &) = delete;
+	AsyncCompute & operator=(const AsyncCompute &) = delete;
+
+	// Recycle the command buffers of the frame submitted frameCount frames ago.
+	// Only blocks if that frame's compute work is somehow still executing.
+	void BeginFrame(uint32_t frameIndex);
+
+	// Command buffer for the compute queue, already begun
+	VkCommandBuffer BeginCommands();
+
+	// End and submit cmd, returning the timeline value signaled once it has executed.
+	// If graphicsWaitStage isn't 0, the next graphics submission waits for it at that stage.
+	uint64_t Submit(
+		VkCommandBuffer cmd
+		, VkPipelineStageFlags graphicsWaitStage = 0
+		, const SemaphoreWaits * waits = nullptr);
+
+	// Add the waits for compute results requested through Submit() to the graphics submission.
+	// Call once everything the frame submits to the compute queue has been submitted.
+	void AddGraphicsWaits(SemaphoreWaits & waits);
+
+	// True if compute runs on its own queue family instead of sharing the graphics queue
+	bool IsAsync() const { return ComputeQueueFamily != GraphicsQueueFamily; }
+
+	// Families for VK_SHARING_MODE_CONCURRENT resources shared between both queues
+	std::vector<uint32_t> GetQueueFamilies() const;
+
+	uint32_t GetQueueFamily() const { return ComputeQueueFamily; }
+
+	TimelineSemaphore & GetTimeline() { return Timeline; }
+
+private:
+	// Command buffers recorded for one frame in flight
+	struct FrameCommands {
+		VkCommandPool Pool = VK_NULL_HANDLE;
+		std::vector<VkCommandBuffer> Buffers;
+		uint32_t UsedBuffers = 0;
+		// Timeline value of the last submission of this frame
+		uint64_t LastValue = 0;
+	};
+
+private:
+	const vkb::DispatchTable & Vk;
+	VkQueue ComputeQueue;
+	uint32_t ComputeQueueFamily;
+	uint32_t GraphicsQueueFamily;
+
+	TimelineSemaphore Timeline;
+	std::vector<FrameCommands> Frames;
+	uint32_t CurrentFrame = 0;
+
+	// Newest value the next graphics submission has to wait for, and where
+	uint64_t GraphicsWaitValue = 0;
+	VkPipelineStageFlags GraphicsWaitStages = 0;
+};
+
+} // namespace core
@@ -0,0 +1,144 @@
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+
+namespace core {
+
+namespace {
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Same order as GpuStatistic
+const char * const StatisticNames[] = {
+	"InputAssemblyVertices",
+	"VertexShaderInvocations",
+	"ClippingPrimitives",
+	"FragmentShaderInvocations",
+	"ComputeShaderInvocations",
+};
+
+static_assert(std::size(StatisticNames) == static_cast<size_t>(GpuStatistic::Count), "Every statistic needs a name");
+
+////////////////////////////////////////////////////////////////////////////////
+
+const char * GetPresentModeName(VkPresentModeKHR presentMode) {
+	switch (presentMode) {
+	case VK_PRESENT_MODE_IMMEDIATE_KHR:
+		return "Immediate";
+	case VK_PRESENT_MODE_MAILBOX_KHR:
+		return "Mailbox";
+	case VK_PRESENT_MODE_FIFO_KHR:
+		return "Fifo";
+	case VK_PRESENT_MODE_FIFO_RELAXED_KHR:
+		return "FifoRelaxed";
+	default:
+		return "Unknown";
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void WriteFrameTimeStats(std::ofstream & file, const FrameTimeStats & stats) {
+	file << "{\"Frames\":" << stats.Frames
+		<< ",\"AverageMs\":" << stats.AverageMs
+		<< ",\"MinMs\":" << stats.MinMs
+		<< ",\"P50Ms\":" << stats.P50Ms
+		<< ",\"P95Ms\":" << stats.P95Ms
+		<< ",\"P99Ms\":" << stats.P99Ms
+		<< ",\"MaxMs\":" << stats.MaxMs << "}";
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+} // anonymous namespace
+
+////////////////////////////////////////////////////////////////////////////////
+
+FrameTimeStats MakeFrameTimeStats(const RollingStats & stats) {
+	FrameTimeStats frameTimes;
+	if (stats.GetCount() == 0)
+		return frameTimes;
+
+	const std::vector<double> & samples = stats.GetSamples();
+	const auto [min, max] = std::minmax_element(samples.begin(), samples.end());
+
+	frameTimes.Frames = stats.GetCount();
+	frameTimes.AverageMs = stats.GetAverage();
+	frameTimes.MinMs = *min;
+	frameTimes.P50Ms = stats.GetPercentile(0.50);
+	frameTimes.P95Ms = stats.GetPercentile(0.95);
+	frameTimes.P99Ms = stats.GetPercentile(0.99);
+	frameTimes.MaxMs = *max;
+	return frameTimes;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool WriteBenchmarkResults(const std::string & path, const BenchmarkSettings & settings, const BenchmarkResults & results) {
+	std::ofstream file(path);
+	if (!file.is_open())
+		return false;
+
+	// Microsecond resolution is plenty, and keeps the numbers out of exponent notation
+	file << std::fixed << std::setprecision(4);
+
+	file << "{\n\"Device\":{\"Name\":\"" << EscapeJson(results.DeviceName)
+		<< "\",\"DriverVersion\":" << results.DriverVersion << "},\n";
+
+	file << "\"Workload\":{\"WarmUpFrames\":" << settings.WarmUpFrames
+		<< ",\"Frames\":" << settings.Frames
+		<< ",\"DrawCount\":" << settings.DrawCount
+		<< ",\"Overdraw\":" << settings.Overdraw
+		<< ",\"StreamedBytesPerFrame\":" << settings.StreamedBytesPerFrame
+		<< ",\"Width\":" << results.Extent.width
+		<< ",\"Height\":" << results.Extent.height
+		<< ",\"Headless\":" << (results.Headless ? "true" : "false")
+		<< ",\"PresentMode\":\"" << (results.Headless ? "None" : GetPresentModeName(results.PresentMode)) << "\"},\n";
+
+	file << "\"Seconds\":" << results.Seconds << ",\n";
+
+	file << "\"CpuFrame\":";
+	WriteFrameTimeStats(file, results.CpuFrame);
+	file << ",\n\"GpuFrame\":";
+	WriteFrameTimeStats(file, results.GpuFrame);
+	file << ",\n";
+
+	file << "\"CpuPhases\":[";
+	for (size_t i = 0; i < results.CpuPhases.size(); i++) {
+		const CpuPhaseSummary & phase = results.CpuPhases[i];
+		file << (i == 0 ? "\n" : ",\n")
+			<< "{\"Name\":\"" << EscapeJson(phase.Name)
+			<< "\",\"AverageMs\":" << phase.AverageMs
+			<< ",\"P50Ms\":" << phase.P50Ms
+			<< ",\"P95Ms\":" << phase.P95Ms
+			<< ",\"P99Ms\":" << phase.P99Ms << "}";
+	}
+	file << "\n],\n";
+
+	file << "\"GpuScopes\":[";
+	for (size_t i = 0; i < results.GpuScopes.size(); i++) {
+		const GpuScopeSummary & scope = results.GpuScopes[i];
+		file << (i == 0 ? "\n" : ",\n")
+			<< "{\"Name\":\"" << EscapeJson(scope.Name)
+			<< "\",\"AverageMs\":" << scope.AverageMs
+			<< ",\"P50Ms\":" << scope.P50Ms
+			<< ",\"P95Ms\":" << scope.P95Ms
+			<< ",\"P99Ms\":" << scope.P99Ms
+			<< ",\"Statistics\":{";
+		for (size_t statistic = 0; statistic < std::size(StatisticNames); statistic++) {
+			file << (statistic == 0 ? "" : ",")
+				<< "\"" << StatisticNames[statistic] << "\":" << scope.Statistics[statistic];
+		}
+		file << "}}";
+	}
+	file << "\n]\n}\n";
+
+	return static_cast<bool>(file);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+} // namespace core
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "CpuProfiler.h"
+#include "GpuProfiler.h"
+
+#include <string>
+#include <vector>
+
+namespace core {
+
+////////////////////////////////////////////////////////////////////////////////
+// A fixed length run of synthetic workloads, for comparing engine builds.
+// Presentation is uncapped for the run, windowed or headless.
+struct BenchmarkSettings {
+	bool Enabled = false;
+
+	// Frames rendered before measuring, so pipelines, caches and clocks have settled
+	uint32_t WarmUpFrames = 100;
+	// Frames the results are gathered over
+	uint32_t Frames = 1000;
+
+	// Triangles drawn in the main pass every frame, split across the recording jobs
+	uint32_t DrawCount = 1000;
+	// Full screen layers drawn over each other on top of that, to load fill rate
+	uint32_t Overdraw = 0;
+	// Bytes streamed to the GPU on the transfer queue every frame, the path meshes and textures take
+	VkDeviceSize StreamedBytesPerFrame = 0;
+
+	// JSON results, written when the run ends
+	std::string ResultsPath = "./Benchmark.json";
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Distribution of a per-frame timing, in milliseconds
+struct FrameTimeStats {
+	uint32_t Frames = 0;
+	double AverageMs = 0.0;
+	double MinMs = 0.0;
+	double P50Ms = 0.0;
+	double P95Ms = 0.0;
+	double P99Ms = 0.0;
+	double MaxMs = 0.0;
+};
+
+FrameTimeStats MakeFrameTimeStats(const RollingStats & stats);
+
+////////////////////////////////////////////////////////////////////////////////
+// What a benchmark run measured, along with what it ran on
+struct BenchmarkResults {
+	std::string DeviceName;
+	// Vendor specific encoding
+	uint32_t DriverVersion = 0;
+	// Mode the swapchain actually used, immediate unless unsupported. Ignored when headless.
+	VkPresentModeKHR PresentMode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+	bool Headless = false;
+	VkExtent2D Extent = {};
+
+	// Wall clock time of the measured frames
+	double Seconds = 0.0;
+
+	FrameTimeStats CpuFrame;
+	// The "Frame" scope, everything recorded into the main command buffer
+	FrameTimeStats GpuFrame;
+
+	std::vector<CpuPhaseSummary> CpuPhases;
+	std::vector<GpuScopeSummary> GpuScopes;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Write the workload and results as JSON. Returns false if the file couldn't be written.
+bool WriteBenchmarkResults(const std::string & path, const BenchmarkSettings & settings, const BenchmarkResults & results);
+
+} // namespace core
@@ -0,0 +1,290 @@
+#include "BindlessHeap.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace core {
+
+namespace {
+
+////////////////////////////////////////////////////////////////////////////////
+
+VkDescriptorType GetDescriptorType(BindlessType type) {
+	switch (type) {
+	case BindlessType::StorageBuffer:
+		return VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	case BindlessType::SampledImage:
+		return VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	case BindlessType::StorageImage:
+		return VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	}
+	throw std::runtime_error("Unknown bindless descriptor type");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+} // anonymous namespace
+
+////////////////////////////////////////////////////////////////////////////////
+
+BindlessHeap::BindlessHeap(
+	const vkb::DispatchTable & vk
+	, const VkPhysicalDeviceVulkan12Properties & properties12
+	, uint32_t frameCount
+	, uint32_t maxStorageBuffers
+	, uint32_t maxSampledImages
+	, uint32_t maxStorageImages)
+	: Vk(vk)
+	, PendingFrees(frameCount)
+{
+	// The set is visible to every stage, so the per-stage limits apply as well as the per-set ones
+	Slots[0].Capacity = std::min({
+		maxStorageBuffers
+		, properties12.maxDescriptorSetUpdateAfterBindStorageBuffers
+		, properties12.maxPerStageDescriptorUpdateAfterBindStorageBuffers });
+	// Combined image samplers count as both a sampled image and a sampler
+	Slots[1].Capacity = std::min({
+		maxSampledImages
+		, properties12.maxDescriptorSetUpdateAfterBindSampledImages
+		, properties12.maxDescriptorSetUpdateAfterBindSamplers
+		, properties12.maxPerStageDescriptorUpdateAfterBindSampledImages
+		, properties12.maxPerStageDescriptorUpdateAfterBindSamplers });
+	Slots[2].Capacity = std::min({
+		maxStorageImages
+		, properties12.maxDescriptorSetUpdateAfterBindStorageImages
+		, properties12.maxPerStageDescriptorUpdateAfterBindStorageImages });
+
+	if (Slots[0].Capacity + Slots[1].Capacity + Slots[2].Capacity > properties12.maxPerStageUpdateAfterBindResources)
+		throw std::runtime_error("Bindless heap is larger than the GPU supports");
+
+	VkDescriptorSetLayoutBinding bindings[BindlessTypeCount] = {};
+	VkDescriptorBindingFlags bindingFlags[BindlessTypeCount] = {};
+	VkDescriptorPoolSize poolSizes[BindlessTypeCount] = {};
+
+	for (uint32_t i = 0; i < BindlessTypeCount; i++) {
+		const VkDescriptorType descriptorType = GetDescriptorType(static_cast<BindlessType>(i));
+
+		bindings[i].binding = i;
+		bindings[i].descriptorType = descriptorType;
+		bindings[i].descriptorCount = Slots[i].Capacity;
+		bindings[i].stageFlags = VK_SHADER_STAGE_ALL;
+
+		// Unused indices may hold nothing, and indices may be written while other frames are in flight
+		bindingFlags[i] = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT
+			| VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT
+			| VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT;
+
+		poolSizes[i] = { descriptorType, Slots[i].Capacity };
+	}
+
+	VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsInfo = {};
+	bindingFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+	bindingFlagsInfo.pNext = nullptr;
+
+	bindingFlagsInfo.bindingCount = BindlessTypeCount;
+	bindingFlagsInfo.pBindingFlags = bindingFlags;
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.pNext = &bindingFlagsInfo;
+
+	layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+	layoutInfo.bindingCount = BindlessTypeCount;
+	layoutInfo.pBindings = bindings;
+
+	if (Vk.createDescriptorSetLayout(&layoutInfo, nullptr, &SetLayout))
+		throw std::runtime_error("Failed to create bindless descriptor set layout");
+
+	VkDescriptorPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.pNext = nullptr;
+
+	poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+	poolInfo.maxSets = 1;
+	poolInfo.poolSizeCount = BindlessTypeCount;
+	poolInfo.pPoolSizes = poolSizes;
+
+	if (Vk.createDescriptorPool(&poolInfo, nullptr, &Pool))
+		throw std::runtime_error("Failed to create bindless descriptor pool");
+
+	VkDescriptorSetAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.pNext = nullptr;
+
+	allocInfo.descriptorPool = Pool;
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &SetLayout;
+
+	if (Vk.allocateDescriptorSets(&allocInfo, &Set))
+		throw std::runtime_error("Failed to allocate bindless descriptor set");
+
+	// One layout for everything, so binding the heap survives pipeline changes
+	VkPushConstantRange pushConstants = {};
+	pushConstants.stageFlags = VK_SHADER_STAGE_ALL;
+	pushConstants.offset = 0;
+	pushConstants.size = MaxPushConstantSize;
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.pNext = nullptr;
+
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &SetLayout;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstants;
+
+	if (Vk.createPipelineLayout(&pipelineLayoutInfo, nullptr, &PipelineLayout))
+		throw std::runtime_error("Failed to create bindless pipeline layout");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+BindlessHeap::~BindlessHeap() {
+	Vk.destroyPipelineLayout(PipelineLayout, nullptr);
+	// Destroying the pool frees the set
+	Vk.destroyDescriptorPool(Pool, nullptr);
+	Vk.destroyDescriptorSetLayout(SetLayout, nullptr);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void BindlessHeap::BeginFrame(uint32_t frameIndex) {
+	std::lock_guard<std::mutex> lock(Mutex);
+
+	// Everything freed while this frame was last current has finished with its index
+	FrameIndex = frameIndex;
+	for (const BindlessHandle & handle : PendingFrees[FrameIndex])
+		Slots[static_cast<uint32_t>(handle.Type)].FreeIndices.push_back(handle.Index);
+	PendingFrees[FrameIndex].clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+BindlessHandle BindlessHeap::AddStorageBuffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range) {
+	const VkDescriptorBufferInfo bufferInfo = { buffer, offset, range };
+
+	std::lock_guard<std::mutex> lock(Mutex);
+	const BindlessHandle handle = Allocate(BindlessType::StorageBuffer);
+	Write(handle, &bufferInfo, nullptr);
+	return handle;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+BindlessHandle BindlessHeap::AddSampledImage(VkImageView view, VkSampler sampler, VkImageLayout layout) {
+	const VkDescriptorImageInfo imageInfo = { sampler, view, layout };
+
+	std::lock_guard<std::mutex> lock(Mutex);
+	const BindlessHandle handle = Allocate(BindlessType::SampledImage);
+	Write(handle, nullptr, &imageInfo);
+	return handle;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+BindlessHandle BindlessHeap::AddStorageImage(VkImageView view) {
+	const VkDescriptorImageInfo imageInfo = { VK_NULL_HANDLE, view, VK_IMAGE_LAYOUT_GENERAL };
+
+	std::lock_guard<std::mutex> lock(Mutex);
+	const BindlessHandle handle = Allocate(BindlessType::StorageImage);
+	Write(handle, nullptr, &imageInfo);
+	return handle;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void BindlessHeap::UpdateStorageBuffer(BindlessHandle handle, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range) {
+	if (handle.Type != BindlessType::StorageBuffer)
+		throw std::runtime_error("Bindless handle isn't a storage buffer");
+
+	const VkDescriptorBufferInfo bufferInfo = { buffer, offset, range };
+
+	std::lock_guard<std::mutex> lock(Mutex);
+	Write(handle, &bufferInfo, nullptr);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void BindlessHeap::UpdateSampledImage(BindlessHandle handle, VkImageView view, VkSampler sampler, VkImageLayout layout) {
+	if (handle.Type != BindlessType::SampledImage)
+		throw std::runtime_error("Bindless handle isn't a sampled image");
+
+	const VkDescriptorImageInfo imageInfo = { sampler, view, layout };
+
+	std::lock_guard<std::mutex> lock(Mutex);
+	Write(handle, nullptr, &imageInfo);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void BindlessHeap::UpdateStorageImage(BindlessHandle handle, VkImageView view) {
+	if (handle.Type != BindlessType::StorageImage)
+		throw std::runtime_error("Bindless handle isn't a storage image");
+
+	const VkDescriptorImageInfo imageInfo = { VK_NULL_HANDLE, view, VK_IMAGE_LAYOUT_GENERAL };
+
+	std::lock_guard<std::mutex> lock(Mutex);
+	Write(handle, nullptr, &imageInfo);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void BindlessHeap::Free(BindlessHandle handle) {
+	if (!handle.IsValid())
+		return;
+
+	// The frames in flight may still read the descriptor, so the index waits for this frame to come around
+	std::lock_guard<std::mutex> lock(Mutex);
+	PendingFrees[FrameIndex].push_back(handle);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void BindlessHeap::Bind(VkCommandBuffer cmd, VkPipelineBindPoint bindPoint) const {
+	Vk.cmdBindDescriptorSets(cmd, bindPoint, PipelineLayout, 0, 1, &Set, 0, nullptr);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+BindlessHandle BindlessHeap::Allocate(BindlessType type) {
+	TypeSlots & slots = Slots[static_cast<uint32_t>(type)];
+
+	BindlessHandle handle;
+	handle.Type = type;
+
+	if (!slots.FreeIndices.empty()) {
+		handle.Index = slots.FreeIndices.back();
+		slots.FreeIndices.pop_back();
+	} else if (slots.Next < slots.Capacity) {
+		handle.Index = slots.Next++;
+	} else {
+		throw std::runtime_error("Bindless heap is out of descriptors");
+	}
+
+	return handle;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void BindlessHeap::Write(BindlessHandle handle, const VkDescriptorBufferInfo * bufferInfo, const VkDescriptorImageInfo * imageInfo) {
+	if (!handle.IsValid() || handle.Index >= GetCapacity(handle.Type))
+		throw std::runtime_error("Invalid bindless handle");
+
+	VkWriteDescriptorSet write = {};
+	write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	write.pNext = nullptr;
+
+	write.dstSet = Set;
+	write.dstBinding = static_cast<uint32_t>(handle.Type);
+	write.dstArrayElement = handle.Index;
+	write.descriptorCount = 1;
+	write.descriptorType = GetDescriptorType(handle.Type);
+	write.pBufferInfo = bufferInfo;
+	write.pImageInfo = imageInfo;
+
+	Vk.updateDescriptorSets(1, &write, 0, nullptr);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+} // namespace core
@@ -0,0 +1,131 @@
+#pragma once
+
+#include "VkBootStrap/VkBootstrapDispatch.h"
+
+#include <mutex>
+#include <vector>
+
+namespace core {
+
+////////////////////////////////////////////////////////////////////////////////
+// Kind of descriptor, which is also its binding in the heap's set.
+// Has to match Shaders/bindless.glsl.
+enum class BindlessType : uint32_t {
+	StorageBuffer = 0,
+	SampledImage = 1,
+	StorageImage = 2,
+};
+
+constexpr uint32_t BindlessTypeCount = 3;
+
+////////////////////////////////////////////////////////////////////////////////
+// Index of a descriptor in the heap, what shaders use to find the resource
+struct BindlessHandle {
+	uint32_t Index = UINT32_MAX;
+	BindlessType Type = BindlessType::StorageBuffer;
+
+	bool IsValid() const { return Index != UINT32_MAX; }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// One large descriptor set holding every buffer and image shaders access,
+// built on descriptor indexing. Each descriptor type is an array binding that
+// is partially bound and updatable after bind, so resources can be added
+// while frames that use the set are still executing.
+//
+// Shaders address resources by index, usually passed in push constants, so a
+// pass binds the set once with Bind() instead of allocating and binding sets
+// per draw. Every pipeline that uses the heap shares GetPipelineLayout().
+//
+// Indices come from a free list per type. A freed index is only reused once
+// every frame in flight at the time has finished, which BeginFrame() tracks.
+// Adding, updating and freeing descriptors is thread safe.
+class BindlessHeap {
+public:
+	// Capacities are clamped to the limits in properties12. frameCount is the number of frames in flight.
+	BindlessHeap(
+		const vkb::DispatchTable & vk
+		, const VkPhysicalDeviceVulkan12Properties & properties12
+		, uint32_t frameCount
+		, uint32_t maxStorageBuffers
+		, uint32_t maxSampledImages
+		, uint32_t maxStorageImages);
+	// The GPU must be done with every frame that bound the set
+	~BindlessHeap();
+
+	BindlessHeap(const BindlessHeap &) = delete;
+	BindlessHeap & operator=(const BindlessHeap &) = delete;
+
+	// Recycle the indices freed the last time this frame was recorded, the GPU has finished that frame
+	void BeginFrame(uint32_t frameIndex);
+
+	// Offset has to respect minStorageBufferOffsetAlignment
+	BindlessHandle AddStorageBuffer(VkBuffer buffer, VkDeviceSize offset = 0, VkDeviceSize range = VK_WHOLE_SIZE);
+	BindlessHandle AddSampledImage(
+		VkImageView view
+		, VkSampler sampler
+		, VkImageLayout layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	// Storage images are always accessed in the general layout
+	BindlessHandle AddStorageImage(VkImageView view);
+
+	// Point an index at another resource. Frames still executing must not use the index.
+	void UpdateStorageBuffer(BindlessHandle handle, VkBuffer buffer, VkDeviceSize offset = 0, VkDeviceSize range = VK_WHOLE_SIZE);
+	void UpdateSampledImage(
+		BindlessHandle handle
+		, VkImageView view
+		, VkSampler sampler
+		, VkImageLayout layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	void UpdateStorageImage(BindlessHandle handle, VkImageView view);
+
+	// Give an index back once nothing records with it anymore. The resource itself can be
+	// destroyed after the frames in flight are done, like any other resource.
+	void Free(BindlessHandle handle);
+
+	// Bind the heap as set 0 of GetPipelineLayout()
+	void Bind(VkCommandBuffer cmd, VkPipelineBindPoint bindPoint) const;
+
+	// Push constants visible to every stage, at most MaxPushConstantSize bytes
+	template <typename T>
+	void PushConstants(VkCommandBuffer cmd, const T & constants) const {
+		static_assert(sizeof(T) <= MaxPushConstantSize, "Push constants don't fit the bindless pipeline layout");
+		Vk.cmdPushConstants(cmd, PipelineLayout, VK_SHADER_STAGE_ALL, 0, sizeof(T), &constants);
+	}
+
+	VkDescriptorSetLayout GetSetLayout() const { return SetLayout; }
+	VkPipelineLayout GetPipelineLayout() const { return PipelineLayout; }
+
+	uint32_t GetCapacity(BindlessType type) const { return Slots[static_cast<uint32_t>(type)].Capacity; }
+
+	// Guaranteed by every Vulkan implementation
+	static constexpr uint32_t MaxPushConstantSize = 128;
+
+private:
+	struct TypeSlots {
+		uint32_t Capacity = 0;
+		// Indices below this have been handed out at least once
+		uint32_t Next = 0;
+		std::vector<uint32_t> FreeIndices;
+	};
+
+	// Needs the mutex
+	BindlessHandle Allocate(BindlessType type);
+	void Write(BindlessHandle handle, const VkDescriptorBufferInfo * bufferInfo, const VkDescriptorImageInfo * imageInfo);
+
+private:
+	const vkb::DispatchTable & Vk;
+
+	VkDescriptorSetLayout SetLayout = VK_NULL_HANDLE;
+	VkDescriptorPool Pool = VK_NULL_HANDLE;
+	VkDescriptorSet Set = VK_NULL_HANDLE;
+	VkPipelineLayout PipelineLayout = VK_NULL_HANDLE;
+
+	// Guards the free lists and writes to the set
+	std::mutex Mutex;
+	TypeSlots Slots[BindlessTypeCount];
+
+	// Indices freed while each frame in flight was current, reusable once it comes around again
+	std::vector<std::vector<BindlessHandle>> PendingFrees;
+	uint32_t FrameIndex = 0;
+};
+
+} // namespace core
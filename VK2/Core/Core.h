@@ -2,7 +2,7 @@
 
 // Shared includes for all files
 
-#include <vulkan/vulkan.hpp>
+#include <vulkan/vulkan.h>
 
 // Useful for smart pointers in all files
 #include <memory>
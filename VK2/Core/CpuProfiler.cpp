@@ -0,0 +1,161 @@
+#include "CpuProfiler.h"
+
+#include "JobSystem.h"
+
+#include <algorithm>
+
+namespace core {
+
+namespace {
+
+// Frames kept for the frame time percentiles and histogram
+constexpr uint32_t FrameHistoryLength = 1000;
+// Frames kept for the per-phase averages and percentiles
+constexpr uint32_t PhaseHistoryFrames = 240;
+
+} // anonymous namespace
+
+////////////////////////////////////////////////////////////////////////////////
+
+CpuProfiler::CpuProfiler(uint32_t threadCount, bool enabled, uint32_t eventsPerThread)
+	: Enabled(enabled)
+	, EventsPerThread(std::max(1u, eventsPerThread))
+	, Origin(std::chrono::steady_clock::now())
+	, Rings(threadCount)
+	, FrameTimes(FrameHistoryLength)
+	, PhaseHistoryLength(PhaseHistoryFrames)
+{
+	if (!Enabled)
+		return;
+
+	for (ThreadRing & ring : Rings)
+		ring.Events = std::make_unique<Event[]>(EventsPerThread);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+uint64_t CpuProfiler::Now() const {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - Origin).count();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void CpuProfiler::Record(const char * name, uint64_t begin, uint64_t end) {
+	const uint32_t threadIdx = JobSystem::GetThreadIndex();
+	if (!Enabled || threadIdx >= Rings.size())
+		return;
+
+	ThreadRing & ring = Rings[threadIdx];
+	const uint64_t head = ring.Head.load(std::memory_order_relaxed);
+
+	Event & event = ring.Events[head % EventsPerThread];
+	event.Name = name;
+	event.Begin = begin;
+	event.End = end;
+
+	// Publishes the event to whoever reads the ring after an acquire load
+	ring.Head.store(head + 1, std::memory_order_release);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void CpuProfiler::EndFrame() {
+	const uint64_t now = Now();
+	if (!Enabled)
+		return;
+
+	if (LastFrameEnd != 0)
+		FrameTimes.Add((now - LastFrameEnd) / 1e6);
+	LastFrameEnd = now;
+
+	// Sum the owning thread's events per phase. Anything overwritten since the last frame is lost.
+	const ThreadRing & ring = Rings[0];
+	const uint64_t head = ring.Head.load(std::memory_order_acquire);
+	const uint64_t first = std::max(AggregatedHead, head > EventsPerThread ? head - EventsPerThread : 0);
+
+	std::map<const char *, uint64_t> frameTotals;
+	for (uint64_t i = first; i < head; i++) {
+		const Event & event = ring.Events[i % EventsPerThread];
+		frameTotals[event.Name] += event.End - event.Begin;
+	}
+	AggregatedHead = head;
+
+	for (const auto & [name, total] : frameTotals)
+		Phases.try_emplace(name, PhaseHistoryLength).first->second.Add(total / 1e6);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void CpuProfiler::ResetStats(uint32_t historyLength) {
+	FrameTimes = RollingStats(historyLength);
+	Phases.clear();
+	PhaseHistoryLength = historyLength;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+std::vector<CpuPhaseSummary> CpuProfiler::GetSummary() const {
+	std::vector<CpuPhaseSummary> summary;
+
+	for (const auto & [name, stats] : Phases) {
+		CpuPhaseSummary phase;
+		phase.Name = name;
+		phase.AverageMs = stats.GetAverage();
+		phase.P50Ms = stats.GetPercentile(0.50);
+		phase.P95Ms = stats.GetPercentile(0.95);
+		phase.P99Ms = stats.GetPercentile(0.99);
+		summary.push_back(std::move(phase));
+	}
+
+	return summary;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+std::vector<uint32_t> CpuProfiler::GetFrameTimeHistogram(double bucketMs, uint32_t bucketCount) const {
+	std::vector<uint32_t> buckets(bucketCount);
+	if (bucketCount == 0 || bucketMs <= 0.0)
+		return buckets;
+
+	for (double frameMs : FrameTimes.GetSamples()) {
+		const uint32_t bucket = static_cast<uint32_t>(frameMs / bucketMs);
+		buckets[std::min(bucket, bucketCount - 1)]++;
+	}
+
+	return buckets;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool CpuProfiler::WriteTrace(const std::string & path) const {
+	std::vector<TraceEvent> events;
+	std::vector<std::string> trackNames;
+
+	for (uint32_t threadIdx = 0; threadIdx < Rings.size(); threadIdx++) {
+		trackNames.push_back(threadIdx == 0 ? "Main thread" : "Worker " + std::to_string(threadIdx));
+
+		const ThreadRing & ring = Rings[threadIdx];
+		if (!ring.Events)
+			continue;
+
+		const uint64_t head = ring.Head.load(std::memory_order_acquire);
+		const uint64_t first = head > EventsPerThread ? head - EventsPerThread : 0;
+
+		for (uint64_t i = first; i < head; i++) {
+			const Event & event = ring.Events[i % EventsPerThread];
+
+			TraceEvent traceEvent;
+			traceEvent.Name = event.Name;
+			traceEvent.Track = threadIdx;
+			traceEvent.StartMicroseconds = event.Begin / 1e3;
+			traceEvent.DurationMicroseconds = (event.End - event.Begin) / 1e3;
+			events.push_back(std::move(traceEvent));
+		}
+	}
+
+	return WriteChromeTrace(path, events, trackNames);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+} // namespace core
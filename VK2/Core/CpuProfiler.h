@@ -0,0 +1,122 @@
+#pragma once
+
+#include "Profiling.h"
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace core {
+
+////////////////////////////////////////////////////////////////////////////////
+// Rolling timings of one named CPU phase, in milliseconds per frame
+struct CpuPhaseSummary {
+	std::string Name;
+	double AverageMs = 0.0;
+	double P50Ms = 0.0;
+	double P95Ms = 0.0;
+	double P99Ms = 0.0;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Low overhead scoped CPU timers.
+//
+// Every job system thread writes its events into its own fixed size ring,
+// without locks or allocation, overwriting the oldest events once full.
+// EndFrame() sums the owning thread's events of the frame per name, which
+// feeds per-phase percentiles and the frame time histogram. The rings of all
+// threads can be exported as a trace on demand.
+//
+// Names must outlive the profiler, e.g. string literals.
+class CpuProfiler {
+public:
+	// threadCount is the job system thread count, events are filed under JobSystem::GetThreadIndex()
+	explicit CpuProfiler(uint32_t threadCount, bool enabled = true, uint32_t eventsPerThread = 16384);
+
+	CpuProfiler(const CpuProfiler &) = delete;
+	CpuProfiler & operator=(const CpuProfiler &) = delete;
+
+	// Nanoseconds since the profiler was created
+	uint64_t Now() const;
+
+	// Record a finished event on the calling thread. Lock free.
+	void Record(const char * name, uint64_t begin, uint64_t end);
+
+	// Close the current frame. Must be called from the owning thread.
+	void EndFrame();
+
+	std::vector<CpuPhaseSummary> GetSummary() const;
+
+	// Rolling frame times, in milliseconds
+	const RollingStats & GetFrameTimes() const { return FrameTimes; }
+
+	// Drop the frame times and phase timings so far, and keep the last historyLength frames of each from now on.
+	// E.g. to leave the warm-up frames out of a benchmark. Must be called from the owning thread.
+	void ResetStats(uint32_t historyLength);
+
+	// Number of recent frames per bucketMs wide bucket, the last bucket also counts everything slower
+	std::vector<uint32_t> GetFrameTimeHistogram(double bucketMs, uint32_t bucketCount) const;
+
+	// Write every event still in the rings. Other threads must not be recording meanwhile,
+	// e.g. call it between frames. Returns false if fails.
+	bool WriteTrace(const std::string & path) const;
+
+	bool IsEnabled() const { return Enabled; }
+
+private:
+	struct Event {
+		const char * Name = nullptr;
+		uint64_t Begin = 0;
+		uint64_t End = 0;
+	};
+
+	// Only written by its own thread
+	struct ThreadRing {
+		std::unique_ptr<Event[]> Events;
+		// Total events ever written, the next one goes to Head % capacity
+		std::atomic<uint64_t> Head = 0;
+	};
+
+private:
+	bool Enabled;
+	uint32_t EventsPerThread;
+	std::chrono::steady_clock::time_point Origin;
+
+	std::vector<ThreadRing> Rings;
+
+	// Owning thread's events up to here are already part of a frame
+	uint64_t AggregatedHead = 0;
+	uint64_t LastFrameEnd = 0;
+
+	RollingStats FrameTimes;
+	std::map<std::string, RollingStats> Phases;
+	// Capacity of the phases' stats
+	uint32_t PhaseHistoryLength;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Records an event for the lifetime of the object
+class CpuProfileScope {
+public:
+	CpuProfileScope(CpuProfiler & profiler, const char * name)
+		: Profiler(profiler)
+		, Name(name)
+		, Begin(profiler.Now())
+	{
+	}
+
+	~CpuProfileScope() { Profiler.Record(Name, Begin, Profiler.Now()); }
+
+	CpuProfileScope(const CpuProfileScope &) = delete;
+	CpuProfileScope & operator=(const CpuProfileScope &) = delete;
+
+private:
+	CpuProfiler & Profiler;
+	const char * Name;
+	uint64_t Begin;
+};
+
+} // namespace core
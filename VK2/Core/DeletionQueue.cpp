@@ -0,0 +1,79 @@
+#include "DeletionQueue.h"
+
+#include <vector>
+
+namespace core {
+
+////////////////////////////////////////////////////////////////////////////////
+
+DeletionQueue::DeletionQueue(const TimelineSemaphore & timeline)
+	: Timeline(timeline)
+{
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+DeletionQueue::~DeletionQueue() {
+	FlushAll();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void DeletionQueue::Push(uint64_t value, DeleteFn destroy) {
+	std::lock_guard<std::mutex> lock(Mutex);
+	Pending.push_back({ value, std::move(destroy) });
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void DeletionQueue::Push(DeleteFn destroy) {
+	Push(Timeline.GetLastSubmitted() + 1, std::move(destroy));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void DeletionQueue::Flush() {
+	{
+		// Most frames have nothing to delete, don't query the semaphore for them
+		std::lock_guard<std::mutex> lock(Mutex);
+		if (Pending.empty())
+			return;
+	}
+
+	RunUpTo(Timeline.GetCompleted());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void DeletionQueue::FlushAll() {
+	// Deletions may push more, e.g. a parent releasing its children
+	while (GetPendingCount() > 0)
+		RunUpTo(UINT64_MAX);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+size_t DeletionQueue::GetPendingCount() const {
+	std::lock_guard<std::mutex> lock(Mutex);
+	return Pending.size();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void DeletionQueue::RunUpTo(uint64_t value) {
+	std::vector<DeleteFn> ready;
+	{
+		std::lock_guard<std::mutex> lock(Mutex);
+		while (!Pending.empty() && Pending.front().Value <= value) {
+			ready.push_back(std::move(Pending.front().Destroy));
+			Pending.pop_front();
+		}
+	}
+
+	for (DeleteFn & destroy : ready)
+		destroy();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+} // namespace core
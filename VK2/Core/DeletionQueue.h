@@ -0,0 +1,61 @@
+#pragma once
+
+#include "TimelineSemaphore.h"
+
+#include <deque>
+#include <functional>
+#include <mutex>
+
+namespace core {
+
+////////////////////////////////////////////////////////////////////////////////
+// Destroys GPU objects once the GPU is done with them, without idling the
+// device. Every deletion is scheduled against the timeline value of the last
+// submission that may use the object, and runs in Flush() once the timeline
+// has reached it.
+//
+// Deletions run in the order they were pushed, one never runs before those
+// pushed ahead of it. Objects only used on another queue are covered as long
+// as the timeline's submissions wait for that queue's work.
+// Thread safe, deletions run on the thread calling Flush().
+class DeletionQueue {
+public:
+	using DeleteFn = std::function<void()>;
+
+	explicit DeletionQueue(const TimelineSemaphore & timeline);
+	// Runs everything still pending, the device must be idle
+	~DeletionQueue();
+
+	DeletionQueue(const DeletionQueue &) = delete;
+	DeletionQueue & operator=(const DeletionQueue &) = delete;
+
+	// Run destroy once the timeline has reached value
+	void Push(uint64_t value, DeleteFn destroy);
+	// Run destroy once everything submitted so far has finished, as well as the next
+	// submission, which covers objects the commands being recorded still use
+	void Push(DeleteFn destroy);
+
+	// Run every deletion the GPU is done with. Call once per frame.
+	void Flush();
+	// Run every deletion, the device must be idle
+	void FlushAll();
+
+	size_t GetPendingCount() const;
+
+private:
+	struct Deletion {
+		uint64_t Value;
+		DeleteFn Destroy;
+	};
+
+	// Pop the deletions up to value and run them outside the lock, so they may push new ones
+	void RunUpTo(uint64_t value);
+
+private:
+	const TimelineSemaphore & Timeline;
+
+	mutable std::mutex Mutex;
+	std::deque<Deletion> Pending;
+};
+
+} // namespace core
@@ -0,0 +1,136 @@
+#include "DeviceCache.h"
+
+#include "Hash.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+namespace core {
+
+namespace {
+
+constexpr uint32_t CacheMagic = 0x44324B56; // "VK2D"
+constexpr uint32_t CacheVersion = 1;
+
+} // anonymous namespace
+
+////////////////////////////////////////////////////////////////////////////////
+
+DeviceCache::DeviceCache(const std::string & path)
+	: Path(path)
+{
+	if (Path.empty())
+		return;
+
+	std::ifstream file(Path, std::ios::binary);
+	if (!file.is_open())
+		return;
+
+	Record record;
+	file.read(reinterpret_cast<char *>(&record), sizeof(record));
+
+	// Truncated or written by another version, start over
+	if (!file || record.Magic != CacheMagic || record.Version != CacheVersion)
+		return;
+
+	record.DeviceName[VK_MAX_PHYSICAL_DEVICE_NAME_SIZE - 1] = '\0';
+	record.Capabilities.Properties12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES;
+	record.Capabilities.Properties12.pNext = nullptr;
+
+	Cached = record;
+	DeviceName = record.DeviceName;
+	Loaded = true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool DeviceCache::Find(
+	const VkPhysicalDeviceProperties & properties
+	, const std::vector<std::string> & extensions
+	, DeviceCapabilities & outCapabilities) const
+{
+	if (!Loaded)
+		return false;
+
+	// A driver update may change what is supported
+	const Record current = MakeRecord(properties, extensions);
+	if (current.VendorId != Cached.VendorId
+		|| current.DeviceId != Cached.DeviceId
+		|| current.DriverVersion != Cached.DriverVersion
+		|| current.ApiVersion != Cached.ApiVersion
+		|| current.ExtensionsHash != Cached.ExtensionsHash
+		|| strcmp(current.DeviceName, Cached.DeviceName) != 0)
+		return false;
+
+	outCapabilities = Cached.Capabilities;
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool DeviceCache::Store(
+	const VkPhysicalDeviceProperties & properties
+	, const std::vector<std::string> & extensions
+	, const DeviceCapabilities & capabilities)
+{
+	if (Path.empty())
+		return true;
+
+	Record record = MakeRecord(properties, extensions);
+	record.Capabilities = capabilities;
+	record.Capabilities.Properties12.pNext = nullptr;
+
+	// Write next to the old cache and swap it in, so a crash never leaves a partial file
+	const std::string tempPath = Path + ".tmp";
+	{
+		std::ofstream outFile(tempPath, std::ios::binary);
+		if (!outFile.is_open())
+			return false;
+
+		outFile.write(reinterpret_cast<const char *>(&record), sizeof(record));
+		if (!outFile)
+			return false;
+	}
+
+	std::error_code error;
+	std::filesystem::rename(tempPath, Path, error);
+	if (error)
+		return false;
+
+	Cached = record;
+	DeviceName = record.DeviceName;
+	Loaded = true;
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+DeviceCache::Record DeviceCache::MakeRecord(
+	const VkPhysicalDeviceProperties & properties
+	, const std::vector<std::string> & extensions) const
+{
+	Record record;
+	record.Magic = CacheMagic;
+	record.Version = CacheVersion;
+	record.VendorId = properties.vendorID;
+	record.DeviceId = properties.deviceID;
+	record.DriverVersion = properties.driverVersion;
+	record.ApiVersion = properties.apiVersion;
+	memcpy(record.DeviceName, properties.deviceName, sizeof(record.DeviceName));
+
+	// The order extensions were enabled in doesn't matter
+	std::vector<std::string> sorted = extensions;
+	std::sort(sorted.begin(), sorted.end());
+
+	record.ExtensionsHash = HashSeed;
+	for (const std::string & extension : sorted)
+		record.ExtensionsHash = HashString(extension, record.ExtensionsHash);
+
+	return record;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+} // namespace core
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "VkBootStrap/VkBootstrapDispatch.h"
+
+#include <string>
+#include <vector>
+
+namespace core {
+
+////////////////////////////////////////////////////////////////////////////////
+// What startup queries about the chosen GPU on top of device selection.
+// Features are what the GPU supports, not what the settings turn on.
+struct DeviceCapabilities {
+	bool PipelineStatistics = false;
+	bool DynamicRendering = false;
+	bool PresentId = false;
+	bool PresentWait = false;
+
+	// Descriptor indexing limits the bindless heap is sized by. pNext is always null.
+	VkPhysicalDeviceVulkan12Properties Properties12 = {};
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// The GPU chosen on the last launch and its capabilities, persisted between runs.
+//
+// The cached name steers device selection back to the same GPU, so a machine
+// with several keeps using the one it started on. The capabilities are only
+// used if the selected GPU still matches the vendor, device, driver version and
+// enabled extensions they were queried with. Otherwise they are queried again
+// and the cache is rewritten.
+class DeviceCache {
+public:
+	// Loads the file if there is one. An empty path disables the cache.
+	explicit DeviceCache(const std::string & path);
+
+	DeviceCache(const DeviceCache &) = delete;
+	DeviceCache & operator=(const DeviceCache &) = delete;
+
+	// Name of the GPU chosen last time, empty if nothing was cached
+	const std::string & GetDeviceName() const { return DeviceName; }
+
+	// Capabilities of the selected GPU, if they were cached with the same extensions enabled
+	bool Find(
+		const VkPhysicalDeviceProperties & properties
+		, const std::vector<std::string> & extensions
+		, DeviceCapabilities & outCapabilities) const;
+
+	// Remember the selected GPU and write the file. Returns false if fails.
+	bool Store(
+		const VkPhysicalDeviceProperties & properties
+		, const std::vector<std::string> & extensions
+		, const DeviceCapabilities & capabilities);
+
+private:
+	// Written to disk as is, only read back by the same build
+	struct Record {
+		uint32_t Magic = 0;
+		uint32_t Version = 0;
+		uint32_t VendorId = 0;
+		uint32_t DeviceId = 0;
+		uint32_t DriverVersion = 0;
+		uint32_t ApiVersion = 0;
+		uint64_t ExtensionsHash = 0;
+		char DeviceName[VK_MAX_PHYSICAL_DEVICE_NAME_SIZE] = {};
+		DeviceCapabilities Capabilities;
+	};
+
+	Record MakeRecord(const VkPhysicalDeviceProperties & properties, const std::vector<std::string> & extensions) const;
+
+private:
+	std::string Path;
+	bool Loaded = false;
+	Record Cached;
+	std::string DeviceName;
+};
+
+} // namespace core
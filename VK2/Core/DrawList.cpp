@@ -0,0 +1,104 @@
+#include "DrawList.h"
+
+#include "SceneStore.h"
+
+namespace core {
+
+namespace {
+
+////////////////////////////////////////////////////////////////////////////////
+
+uint64_t MakeSortKey(uint32_t material, uint32_t mesh) {
+	return (static_cast<uint64_t>(material) << 32) | mesh;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Stable LSD radix sort on the key, a byte per pass. Instances with equal keys keep
+// their store order, so each batch reads the scene's arrays front to back.
+template <typename Item>
+void RadixSort(std::vector<Item> & items, std::vector<Item> & scratch) {
+	if (items.empty())
+		return;
+
+	scratch.resize(items.size());
+
+	for (uint32_t shift = 0; shift < 64; shift += 8) {
+		uint32_t offsets[256] = {};
+		for (const Item & item : items)
+			offsets[(item.Key >> shift) & 0xFF]++;
+
+		// Ids are usually small, most of the high bytes are the same for every key
+		if (offsets[(items[0].Key >> shift) & 0xFF] == items.size())
+			continue;
+
+		uint32_t offset = 0;
+		for (uint32_t & count : offsets) {
+			const uint32_t digitCount = count;
+			count = offset;
+			offset += digitCount;
+		}
+
+		for (const Item & item : items)
+			scratch[offsets[(item.Key >> shift) & 0xFF]++] = item;
+
+		items.swap(scratch);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+} // anonymous namespace
+
+////////////////////////////////////////////////////////////////////////////////
+
+void DrawListBuilder::Build(const SceneStore & store, DrawList & outList) {
+	const std::vector<uint32_t> & meshes = store.GetMeshes();
+	const std::vector<uint32_t> & materials = store.GetMaterials();
+
+	Items.resize(store.GetCount());
+	for (uint32_t i = 0; i < store.GetCount(); i++)
+		Items[i] = { MakeSortKey(materials[i], meshes[i]), i };
+
+	SortAndMerge(store, outList);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void DrawListBuilder::Build(const SceneStore & store, const uint32_t * indices, uint32_t count, DrawList & outList) {
+	const std::vector<uint32_t> & meshes = store.GetMeshes();
+	const std::vector<uint32_t> & materials = store.GetMaterials();
+
+	Items.resize(count);
+	for (uint32_t i = 0; i < count; i++)
+		Items[i] = { MakeSortKey(materials[indices[i]], meshes[indices[i]]), indices[i] };
+
+	SortAndMerge(store, outList);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void DrawListBuilder::SortAndMerge(const SceneStore & store, DrawList & outList) {
+	RadixSort(Items, Scratch);
+
+	outList.Clear();
+	outList.Instances.reserve(Items.size());
+
+	for (const SortItem & item : Items) {
+		// A new key starts a new batch, equal keys are next to each other after sorting
+		if (outList.Batches.empty() || item.Key != Items[outList.Instances.size() - 1].Key) {
+			DrawBatch batch;
+			batch.Mesh = store.GetMeshes()[item.Instance];
+			batch.Material = store.GetMaterials()[item.Instance];
+			batch.FirstInstance = static_cast<uint32_t>(outList.Instances.size());
+			outList.Batches.push_back(batch);
+		}
+
+		outList.Batches.back().InstanceCount++;
+		outList.Instances.push_back(item.Instance);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+} // namespace core
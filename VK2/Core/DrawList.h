@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace core {
+
+class SceneStore;
+
+////////////////////////////////////////////////////////////////////////////////
+// Instances sharing a mesh and material, drawn with a single instanced draw
+struct DrawBatch {
+	uint32_t Mesh = 0;
+	uint32_t Material = 0;
+	// Range of DrawList::Instances, what the draw's firstInstance and instanceCount cover
+	uint32_t FirstInstance = 0;
+	uint32_t InstanceCount = 0;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Batches ordered by material, then mesh. Instances holds scene store indices,
+// every batch's instances next to each other, ready to upload as the buffer
+// the vertex shader looks gl_InstanceIndex up in.
+struct DrawList {
+	std::vector<DrawBatch> Batches;
+	std::vector<uint32_t> Instances;
+
+	void Clear() {
+		Batches.clear();
+		Instances.clear();
+	}
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Turns the entities of a scene store into as few instanced draws as possible,
+// by sorting them on a key of their material and mesh and merging every run of
+// equal keys into one batch. Material is the most significant part of the key,
+// since switching materials costs more than switching meshes.
+//
+// The scratch memory is kept between builds, so rebuilding every frame doesn't
+// allocate once it has grown to the scene's size.
+class DrawListBuilder {
+public:
+	// Batch every entity of the store
+	void Build(const SceneStore & store, DrawList & outList);
+	// Batch the given store indices only, for instance the ones that passed culling
+	void Build(const SceneStore & store, const uint32_t * indices, uint32_t count, DrawList & outList);
+
+private:
+	// Sort Items and turn runs of equal keys into batches
+	void SortAndMerge(const SceneStore & store, DrawList & outList);
+
+private:
+	struct SortItem {
+		uint64_t Key;
+		uint32_t Instance;
+	};
+
+	std::vector<SortItem> Items;
+	std::vector<SortItem> Scratch;
+};
+
+} // namespace core
@@ -1,24 +1,82 @@
 #include "Engine.h"
 
+#include "AsyncCompute.h"
+#include "BindlessHeap.h"
+#include "CpuProfiler.h"
+#include "DeletionQueue.h"
+#include "DeviceCache.h"
+#include "FramePacer.h"
+#include "GpuAllocator.h"
+#include "GpuProfiler.h"
+#include "GpuScene.h"
+#include "JobSystem.h"
+#include "Math.h"
+#include "PipelineCache.h"
+#include "SceneStore.h"
+#include "ShaderWatcher.h"
+#include "SimdKernels.h"
+#include "StreamingUploader.h"
+#include "TimelineSemaphore.h"
+#include "UploadRing.h"
 #include "VkBootStrap/VkBootstrap.h"
 
 
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_vulkan.h>
-#include <vulkan/vulkan.hpp>
-#include <shaderc/shaderc.hpp>
+#include <vulkan/vulkan.h>
 
-#include <fstream>
+#include <algorithm>
+#include <cmath>
+#include <exception>
 #include <iostream>
 #include <stdexcept>
+#include <string>
 #include <vector>
-#include <filesystem>
-#include <Windows.h>
 
 namespace core {
 
 namespace {
 
+// Timeline semaphores are core in 1.2. Shaders are compiled for the same version.
+constexpr uint32_t VulkanApiVersion = VK_API_VERSION_1_2;
+
+// Number of draws each recording job writes into its secondary command buffer
+constexpr uint32_t DrawsPerRecordJob = 512;
+
+// What vk-bootstrap's default swapchain format selection prefers, so headless frames match windowed ones
+constexpr VkFormat HeadlessFormat = VK_FORMAT_B8G8R8A8_SRGB;
+constexpr uint32_t HeadlessBytesPerPixel = 4;
+
+// Triangle corners, uploaded every frame
+constexpr float TrianglePositions[3][3] = {
+	{ 1.f, 1.f, 0.f },
+	{ -1.f, 1.f, 0.f },
+	{ 0.f, -1.f, 0.f },
+};
+
+// A single triangle covering the whole viewport, for the benchmark's overdraw layers
+constexpr float FullscreenPositions[3][3] = {
+	{ -1.f, -1.f, 0.f },
+	{ 3.f, -1.f, 0.f },
+	{ -1.f, 3.f, 0.f },
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Modes to try for a presentation policy, best match first. FIFO is always supported.
+std::vector<VkPresentModeKHR> GetPresentModeFallbacks(VkPresentModeKHR presentMode) {
+	switch (presentMode) {
+	case VK_PRESENT_MODE_MAILBOX_KHR:
+		return { VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_FIFO_KHR };
+	case VK_PRESENT_MODE_IMMEDIATE_KHR:
+		return { VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_FIFO_KHR };
+	case VK_PRESENT_MODE_FIFO_RELAXED_KHR:
+		return { VK_PRESENT_MODE_FIFO_RELAXED_KHR, VK_PRESENT_MODE_FIFO_KHR };
+	default:
+		return { VK_PRESENT_MODE_FIFO_KHR };
+	}
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 // Create a command pool for commands submitted to the graphics queue
@@ -56,14 +114,115 @@ VkCommandBufferAllocateInfo CommandBufferAllocateInfo(
 
 ////////////////////////////////////////////////////////////////////////////////
 
+// Get an unused secondary command buffer from a thread's pool, allocating one if needed
+VkCommandBuffer AcquireSecondaryCommandBuffer(const vkb::DispatchTable & vk, ThreadCommandPool & threadPool) {
+	if (threadPool.UsedSecondaryBuffers == threadPool.SecondaryBuffers.size()) {
+		VkCommandBufferAllocateInfo allocInfo = CommandBufferAllocateInfo(
+			threadPool.Pool
+			, 1
+			, VK_COMMAND_BUFFER_LEVEL_SECONDARY
+		);
+
+		VkCommandBuffer buffer;
+		if (vk.allocateCommandBuffers(&allocInfo, &buffer))
+			throw std::runtime_error("Failed to allocate a secondary command buffer.");
+
+		threadPool.SecondaryBuffers.push_back(buffer);
+	}
+
+	return threadPool.SecondaryBuffers[threadPool.UsedSecondaryBuffers++];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Instance functions aren't in the device dispatch table, and there are no prototypes without the static loader
+template <typename Fn>
+Fn LoadInstanceFunction(const vkb::Instance & instance, const char * name) {
+	return reinterpret_cast<Fn>(instance.fp_vkGetInstanceProcAddr(instance.instance, name));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Selector for the GPUs the engine can run on with these settings. Without a surface any GPU will do,
+// it doesn't have to be able to present.
+vkb::PhysicalDeviceSelector MakeDeviceSelector(const vkb::Instance & instance, const EngineSettings & settings, VkSurfaceKHR surface) {
+	VkPhysicalDeviceVulkan12Features features12 = {};
+	features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+	features12.timelineSemaphore = VK_TRUE;
+	// The GPU-driven scene writes its own draws, with the instance index as first instance
+	features12.drawIndirectCount = settings.GpuDrivenRendering ? VK_TRUE : VK_FALSE;
+	// The bindless heap is one partially bound set, written while frames using it are in flight
+	features12.descriptorIndexing = VK_TRUE;
+	features12.runtimeDescriptorArray = VK_TRUE;
+	features12.descriptorBindingPartiallyBound = VK_TRUE;
+	features12.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+	features12.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+	features12.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+	features12.descriptorBindingStorageImageUpdateAfterBind = VK_TRUE;
+
+	VkPhysicalDeviceFeatures requiredFeatures = {};
+	requiredFeatures.multiDrawIndirect = settings.GpuDrivenRendering ? VK_TRUE : VK_FALSE;
+	requiredFeatures.drawIndirectFirstInstance = settings.GpuDrivenRendering ? VK_TRUE : VK_FALSE;
+
+	// The selector keeps copies of the feature structs
+	vkb::PhysicalDeviceSelector selector(instance);
+	selector.set_minimum_version(1, 2)
+		.set_required_features(requiredFeatures)
+		.set_required_features_12(features12)
+		.add_desired_extension(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME);
+
+	if (surface != VK_NULL_HANDLE) {
+		// Lets the frame pacer wait for frames to reach the screen
+		selector.add_desired_extension(VK_KHR_PRESENT_ID_EXTENSION_NAME)
+			.add_desired_extension(VK_KHR_PRESENT_WAIT_EXTENSION_NAME)
+			.set_surface(surface);
+	}
+
+	return selector;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Startup work running on the job system while the calling thread gets on with something else.
+// Finish() waits for it and rethrows what it threw. Destruction waits as well, so a stage
+// never outlives the state it initializes if the calling thread throws first.
+class StartupStage {
+public:
+	StartupStage(JobSystem & jobs, std::function<void()> fn)
+		: Jobs(jobs)
+	{
+		Jobs.Schedule(std::move(fn), &Done);
+	}
+
+	~StartupStage() {
+		// Only still running if the calling thread threw first, its exception is the one to report
+		try {
+			Jobs.Wait(Done);
+		} catch (...) {
+		}
+	}
+
+	StartupStage(const StartupStage &) = delete;
+	StartupStage & operator=(const StartupStage &) = delete;
+
+	void Finish() { Jobs.Wait(Done); }
+
+private:
+	JobSystem & Jobs;
+	JobCounter Done;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
 } // anonymous namespace
 
 ////////////////////////////////////////////////////////////////////////////////
 
-Engine::Engine(const std::string & appName) 
+Engine::Engine(const std::string & appName, const EngineSettings & settings) 
 	: AppName(appName)
+	, Settings(settings)
 {
-
+	if (Settings.FramesInFlight == 0)
+		Settings.FramesInFlight = 1;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -82,7 +241,14 @@ int Engine::Exec() {
 		return 1;
 	}
 
-	Run();
+	// Still clean up if something goes wrong mid-run, e.g. a shader failing to compile
+	int result = 0;
+	try {
+		Run();
+	} catch (const std::exception & e) {
+		std::cout << e.what() << std::endl;
+		result = 1;
+	}
 
 	try {
 		Cleanup();
@@ -91,17 +257,167 @@ int Engine::Exec() {
 		return 1;
 	}
 
-	return 0;
+	return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+std::vector<std::string> Engine::GetSuitableDevices(const EngineSettings & settings) {
+	// Only for looking, every engine creates its own instance
+	vkb::InstanceBuilder builder;
+	vkb::Result<vkb::Instance> instance = builder.set_app_name("GPU enumeration")
+		.require_api_version(VulkanApiVersion)
+		.set_headless(settings.Headless)
+		.build();
+	if (!instance)
+		throw std::runtime_error("Failed to create a Vulkan instance");
+
+	// Without a surface presentation isn't checked, a windowed engine may not be able to use all of them
+	vkb::Result<std::vector<std::string>> names = MakeDeviceSelector(instance.value(), settings, VK_NULL_HANDLE)
+		.select_device_names(vkb::DeviceSelectionMode::only_fully_suitable);
+	vkb::destroy_instance(instance.value());
+
+	if (!names)
+		return {};
+	return names.value();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+JobSystem & Engine::GetJobSystem() {
+	return *Jobs;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+StreamingUploader & Engine::GetStreamingUploader() {
+	return *Streaming;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+AsyncCompute & Engine::GetAsyncCompute() {
+	return *Compute;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+TimelineSemaphore & Engine::GetGraphicsTimeline() {
+	return *GraphicsTimeline;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+DeletionQueue & Engine::GetDeletionQueue() {
+	return *Deletions;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+GpuProfiler & Engine::GetGpuProfiler() {
+	return *GpuTimings;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+CpuProfiler & Engine::GetCpuProfiler() {
+	return *CpuTimings;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+BindlessHeap & Engine::GetBindlessHeap() {
+	return *Bindless;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void Engine::SetPresentMode(VkPresentModeKHR presentMode) {
+	Settings.PresentMode = presentMode;
+	// Nothing to recreate when headless
+	SwapchainDirty = !Settings.Headless;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void Engine::SetMaxQueuedFrames(uint32_t maxQueuedFrames) {
+	Settings.MaxQueuedFrames = maxQueuedFrames;
+
+	// Without present wait the pacer waits for frames to finish rendering, and the wait
+	// for the frame in flight already keeps FramesInFlight or more from being queued.
+	// Only stricter limits are left to the pacer.
+	if (!Pacer->UsesPresentWait() && maxQueuedFrames >= Settings.FramesInFlight)
+		maxQueuedFrames = 0;
+
+	Pacer->SetMaxQueuedFrames(maxQueuedFrames);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
 void Engine::Initialize() {
+	// Benchmarks measure the engine, not the display, and need the timings of every frame
+	if (Settings.Benchmark.Enabled) {
+		Settings.PresentMode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+		Settings.MaxQueuedFrames = 0;
+		Settings.CpuProfiling = true;
+		Settings.GpuProfiling = true;
+	}
+
+	// Independent startup stages run side by side on the job system
+	Jobs = std::make_unique<JobSystem>(Settings.WorkerThreadCount);
+	CpuTimings = std::make_unique<CpuProfiler>(Jobs->GetThreadCount(), Settings.CpuProfiling);
+
+	// The instance doesn't need the window, so it is built on a worker while SDL opens one.
+	// SDL stays on the main thread, some platforms only allow windows to be created there.
+	{
+		StartupStage instanceStage(*Jobs, [this]() { InitInstance(); });
+		InitWindow();
+		instanceStage.Finish();
+	}
+
+	InitVulkan();
+
+	// Only the render pass, graphs and pipelines depend on the backbuffer format. Shaders start
+	// compiling, the pipeline cache is read and the per-frame objects are created meanwhile.
+	{
+		StartupStage backbufferStage(*Jobs, [this]() {
+			if (Settings.Headless)
+				InitOffscreenTargets();
+			else
+				InitSwapchain();
+		});
+		InitShaders();
+		InitCommands();
+		InitSyncStructures();
+		backbufferStage.Finish();
+	}
+
+	InitDefaultRenderpass();
+	InitRenderGraphs();
+	InitPipelines();
+	InitScene();
+	if (Settings.Benchmark.Enabled)
+		InitBenchmark();
+
+	// Every permutation is registered at this point, build them while the first frames are recorded
+	if (Settings.WarmUpPipelines)
+		Pipelines->WarmUp();
+
+	IsInitialized = true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void Engine::InitWindow() {
+	// Headless runs don't touch SDL at all, there may be no display to open one on
+	if (Settings.Headless)
+		return;
+
 	if (SDL_Init(SDL_INIT_VIDEO) != 0)
 		throw std::runtime_error("Could not initialize SDL.");
 
 	// Cast to silence compiler warning
-	SDL_WindowFlags windowFlags = (SDL_WindowFlags) SDL_WINDOW_VULKAN;
+	SDL_WindowFlags windowFlags = (SDL_WindowFlags) (SDL_WINDOW_VULKAN | SDL_WINDOW_RESIZABLE);
 
 	Window = SDL_CreateWindow(
 		AppName.c_str()
@@ -114,57 +430,229 @@ void Engine::Initialize() {
 
 	if (!Window)
 		throw std::runtime_error("Failed to create SDL Window");
-
-	InitVulkan();
-	InitSwapchain();
-	InitCommands();
-	InitDefaultRenderpass();
-	InitFramebuffers();
-	InitSyncStructures();
-	InitPipelines();
-
-	IsInitialized = true;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
-void Engine::InitVulkan() {
+void Engine::InitInstance() {
 	// Built the Vulkan Instance with basic debug features if building in Debug config
 	vkb::InstanceBuilder builder;
 	auto instRet = builder.set_app_name(AppName.c_str())
 #if defined(_DEBUG)
 		.request_validation_layers(true)
 #endif
-		.require_api_version(1, 1, 0)
+		.require_api_version(VulkanApiVersion)
+		// Skips the surface extensions, and with them the selector's present requirement
+		.set_headless(Settings.Headless)
 		.use_default_debug_messenger()
 		.build();
 
-	vkb::Instance vkbInst = instRet.value();
+	Instance = instRet.value();
+}
 
-	Instance = vkbInst.instance;
-	DebugMessenger = vkbInst.debug_messenger;
+////////////////////////////////////////////////////////////////////////////////
 
+void Engine::InitVulkan() {
 	// Get the surface of the window opened with SDL
-	SDL_Vulkan_CreateSurface(Window, Instance, &Surface);
+	if (!Settings.Headless)
+		SDL_Vulkan_CreateSurface(Window, Instance, &Surface);
 
 	// use VkBootstrap to select a GPU
-	vkb::PhysicalDeviceSelector selector(vkbInst);
-	vkb::PhysicalDevice physicalDevice = selector.set_minimum_version(1, 1)
-		.set_surface(Surface)
-		.select()
-		.value();
+	vkb::PhysicalDeviceSelector selector = MakeDeviceSelector(Instance, Settings, Surface);
+	DeviceCache deviceCache(Settings.DeviceCachePath);
+
+	vkb::PhysicalDevice physicalDevice;
+	if (Settings.DeviceIndex != UINT32_MAX) {
+		// Identical GPUs share a name, so a specific one is found by its place in the enumeration order
+		vkb::Result<std::vector<vkb::PhysicalDevice>> devices = selector.select_devices(vkb::DeviceSelectionMode::only_fully_suitable);
+		if (!devices || Settings.DeviceIndex >= devices.value().size())
+			throw std::runtime_error("No suitable GPU at index " + std::to_string(Settings.DeviceIndex));
+
+		physicalDevice = devices.value()[Settings.DeviceIndex];
+	} else {
+		// Go back to the GPU picked last time, if it is still there and suitable
+		if (!deviceCache.GetDeviceName().empty())
+			selector.set_name(deviceCache.GetDeviceName());
+
+		vkb::Result<vkb::PhysicalDevice> selected = selector.select();
+		if (!selected && !deviceCache.GetDeviceName().empty())
+			selected = selector.set_name("").select();
+		if (!selected)
+			throw std::runtime_error("No suitable GPU found");
+
+		physicalDevice = selected.value();
+	}
 
 	ChosenGPU = physicalDevice.physical_device;
+	GPUProperties = physicalDevice.properties;
+
+	// Optional extensions are useless without their features, which are only queried if the extensions were enabled
+	const std::vector<std::string> extensions = physicalDevice.get_extensions();
+	auto hasExtension = [&](const char * name) {
+		return std::find(extensions.begin(), extensions.end(), name) != extensions.end();
+	};
+
+	// Whatever the last launch found out about this GPU and driver doesn't have to be queried again
+	DeviceCapabilities capabilities;
+	if (!deviceCache.Find(GPUProperties, extensions, capabilities)) {
+		VkPhysicalDeviceFeatures supportedFeatures;
+		LoadInstanceFunction<PFN_vkGetPhysicalDeviceFeatures>(Instance, "vkGetPhysicalDeviceFeatures")(ChosenGPU, &supportedFeatures);
+		capabilities.PipelineStatistics = supportedFeatures.pipelineStatisticsQuery;
+
+		VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamicRenderingFeatures = {};
+		dynamicRenderingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR;
+
+		VkPhysicalDevicePresentWaitFeaturesKHR presentWaitFeatures = {};
+		presentWaitFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR;
+
+		VkPhysicalDevicePresentIdFeaturesKHR presentIdFeatures = {};
+		presentIdFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR;
+
+		VkPhysicalDeviceFeatures2 features2 = {};
+		features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+
+		if (hasExtension(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME)) {
+			dynamicRenderingFeatures.pNext = features2.pNext;
+			features2.pNext = &dynamicRenderingFeatures;
+		}
+		if (hasExtension(VK_KHR_PRESENT_ID_EXTENSION_NAME) && hasExtension(VK_KHR_PRESENT_WAIT_EXTENSION_NAME)) {
+			presentWaitFeatures.pNext = features2.pNext;
+			presentIdFeatures.pNext = &presentWaitFeatures;
+			features2.pNext = &presentIdFeatures;
+		}
+		if (features2.pNext)
+			LoadInstanceFunction<PFN_vkGetPhysicalDeviceFeatures2>(Instance, "vkGetPhysicalDeviceFeatures2")(ChosenGPU, &features2);
+
+		capabilities.DynamicRendering = dynamicRenderingFeatures.dynamicRendering;
+		capabilities.PresentId = presentIdFeatures.presentId;
+		capabilities.PresentWait = presentWaitFeatures.presentWait;
+
+		// The bindless heap is sized by the descriptor indexing limits
+		capabilities.Properties12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES;
+		capabilities.Properties12.pNext = nullptr;
+
+		VkPhysicalDeviceProperties2 properties2 = {};
+		properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+		properties2.pNext = &capabilities.Properties12;
+
+		LoadInstanceFunction<PFN_vkGetPhysicalDeviceProperties2>(Instance, "vkGetPhysicalDeviceProperties2")(ChosenGPU, &properties2);
+
+		if (!deviceCache.Store(GPUProperties, extensions, capabilities))
+			std::cout << "Failed to save the device cache" << std::endl;
+	}
+
+	// Pipeline statistics are optional, only turn them on where the GPU has them
+	const bool pipelineStatistics = Settings.GpuProfiling && capabilities.PipelineStatistics;
+	physicalDevice.features.pipelineStatisticsQuery = pipelineStatistics ? VK_TRUE : VK_FALSE;
+
+	DynamicRendering = Settings.DynamicRendering && capabilities.DynamicRendering;
+	const bool presentWait = capabilities.PresentId && capabilities.PresentWait;
+
+	// Use VkBootstrap to build the driver from the physical GPU, with the optional features that are used
+	VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamicRenderingFeatures = {};
+	dynamicRenderingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR;
+	dynamicRenderingFeatures.pNext = nullptr;
+
+	dynamicRenderingFeatures.dynamicRendering = VK_TRUE;
+
+	VkPhysicalDevicePresentIdFeaturesKHR presentIdFeatures = {};
+	presentIdFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR;
+	presentIdFeatures.pNext = nullptr;
+
+	presentIdFeatures.presentId = VK_TRUE;
+
+	VkPhysicalDevicePresentWaitFeaturesKHR presentWaitFeatures = {};
+	presentWaitFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR;
+	presentWaitFeatures.pNext = nullptr;
+
+	presentWaitFeatures.presentWait = VK_TRUE;
 
-	// Use VkBootstrap to build the driver from the physical GPU
 	vkb::DeviceBuilder deviceBuilder(physicalDevice);
+	if (DynamicRendering)
+		deviceBuilder.add_pNext(&dynamicRenderingFeatures);
+	if (presentWait)
+		deviceBuilder.add_pNext(&presentIdFeatures).add_pNext(&presentWaitFeatures);
 	vkb::Device vkbDevice = deviceBuilder.build().value();
 
-	Device = vkbDevice.device;
+	Device = vkbDevice;
+	// Every device level call goes through here, straight to the driver instead of through the loader's trampolines
+	Vk = vkbDevice.make_table();
+
+	GraphicsTimeline = std::make_unique<TimelineSemaphore>(Vk);
+	Deletions = std::make_unique<DeletionQueue>(*GraphicsTimeline);
+
+	Pacer = std::make_unique<FramePacer>(Vk, *GraphicsTimeline, presentWait, 0);
+	SetMaxQueuedFrames(Settings.MaxQueuedFrames);
 
 	// Use VkBootstrap to get a Graphics queue
 	GraphicsQueue = vkbDevice.get_queue(vkb::QueueType::graphics).value();
 	GraphicsQueueFamily = vkbDevice.get_queue_index(vkb::QueueType::graphics).value();
+
+	// Prefer a transfer-only family (usually the DMA engines), then any non-graphics family.
+	// Without either, streaming shares the graphics queue and skips ownership transfers.
+	if (auto dedicated = vkbDevice.get_dedicated_queue(vkb::QueueType::transfer)) {
+		TransferQueue = dedicated.value();
+		TransferQueueFamily = vkbDevice.get_dedicated_queue_index(vkb::QueueType::transfer).value();
+	} else if (auto separate = vkbDevice.get_queue(vkb::QueueType::transfer)) {
+		TransferQueue = separate.value();
+		TransferQueueFamily = vkbDevice.get_queue_index(vkb::QueueType::transfer).value();
+	} else {
+		TransferQueue = GraphicsQueue;
+		TransferQueueFamily = GraphicsQueueFamily;
+	}
+
+	// Same fallback chain for compute. A separate queue isn't required, without one
+	// compute work is just serialized with graphics on the same queue.
+	if (auto dedicated = vkbDevice.get_dedicated_queue(vkb::QueueType::compute)) {
+		ComputeQueue = dedicated.value();
+		ComputeQueueFamily = vkbDevice.get_dedicated_queue_index(vkb::QueueType::compute).value();
+	} else if (auto separate = vkbDevice.get_queue(vkb::QueueType::compute)) {
+		ComputeQueue = separate.value();
+		ComputeQueueFamily = vkbDevice.get_queue_index(vkb::QueueType::compute).value();
+	} else {
+		ComputeQueue = GraphicsQueue;
+		ComputeQueueFamily = GraphicsQueueFamily;
+	}
+
+	Compute = std::make_unique<AsyncCompute>(
+		Vk
+		, ComputeQueue
+		, ComputeQueueFamily
+		, GraphicsQueueFamily
+		, Settings.FramesInFlight
+	);
+
+	// All buffer and image memory is sub-allocated from here
+	Allocator = std::make_unique<GpuAllocator>(Vk, GPUProperties, physicalDevice.memory_properties);
+	// Per-frame data is read on the compute queue too, e.g. by GPU culling
+	Uploads = std::make_unique<UploadRing>(*Allocator, Settings.FramesInFlight, Settings.UploadBytesPerFrame, Compute->GetQueueFamilies());
+	Streaming = std::make_unique<StreamingUploader>(
+		Vk
+		, *Allocator
+		, TransferQueue
+		, TransferQueueFamily
+		, GraphicsQueueFamily
+		, Settings.StreamingStagingBytes
+	);
+
+	Bindless = std::make_unique<BindlessHeap>(
+		Vk
+		, capabilities.Properties12
+		, Settings.FramesInFlight
+		, Settings.BindlessStorageBuffers
+		, Settings.BindlessSampledImages
+		, Settings.BindlessStorageImages
+	);
+
+	// A profiler without timestamp bits ignores every scope
+	const uint32_t timestampBits = physicalDevice.get_queue_families()[GraphicsQueueFamily].timestampValidBits;
+	GpuTimings = std::make_unique<GpuProfiler>(
+		Vk
+		, GPUProperties
+		, Settings.GpuProfiling ? timestampBits : 0
+		, pipelineStatistics
+		, Settings.FramesInFlight
+	);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -172,18 +660,145 @@ void Engine::InitVulkan() {
 void Engine::InitSwapchain() {
 	vkb::SwapchainBuilder swapchainBuilder(ChosenGPU, Device, Surface);
 
-	vkb::Swapchain vkbSwapchain = swapchainBuilder.use_default_format_selection()
-		// This is where to swap V-Sync setting
-		.set_desired_present_mode(VK_PRESENT_MODE_FIFO_KHR)
-		.set_desired_extent(WindowExtents.width, WindowExtents.height)
-		.build()
-		.value();
+	// Lets the driver hand the old swapchain's resources over, and keep presenting its images meanwhile
+	if (Swapchain != VK_NULL_HANDLE)
+		swapchainBuilder.set_old_swapchain(Swapchain);
+
+	const std::vector<VkPresentModeKHR> presentModes = GetPresentModeFallbacks(Settings.PresentMode);
+
+	swapchainBuilder.use_default_format_selection()
+		.set_desired_present_mode(presentModes[0])
+		.set_desired_extent(WindowExtents.width, WindowExtents.height);
+
+	for (size_t i = 1; i < presentModes.size(); i++)
+		swapchainBuilder.add_fallback_present_mode(presentModes[i]);
+
+	// Mailbox needs a spare image to render into while one is queued and one is on screen
+	if (Settings.PresentMode == VK_PRESENT_MODE_MAILBOX_KHR)
+		swapchainBuilder.set_desired_min_image_count(vkb::SwapchainBuilder::TRIPLE_BUFFERING);
+
+	vkb::Swapchain vkbSwapchain = swapchainBuilder.build().value();
 
 	// Store swapchain & images in engine
 	Swapchain = vkbSwapchain.swapchain;
 	SwapchainImages = vkbSwapchain.get_images().value();
 	SwapchainImageViews = vkbSwapchain.get_image_views().value();
 	SwapchainFormat = vkbSwapchain.image_format;
+
+	VkSemaphoreCreateInfo semaphoreCreateInfo = {};
+	semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	semaphoreCreateInfo.pNext = nullptr;
+	semaphoreCreateInfo.flags = 0;
+
+	RenderSemaphores.resize(SwapchainImages.size());
+	for (VkSemaphore & semaphore : RenderSemaphores) {
+		if (Vk.createSemaphore(&semaphoreCreateInfo, nullptr, &semaphore))
+			throw std::runtime_error("Failed to create render semaphore");
+	}
+
+	PresentMode = vkbSwapchain.present_mode;
+	// May differ from the window size the surface asked for
+	WindowExtents = vkbSwapchain.extent;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void Engine::InitOffscreenTargets() {
+	SwapchainFormat = HeadlessFormat;
+	WindowExtents = Settings.HeadlessExtent;
+	// Nothing is presented, frames go as fast as the GPU renders them
+	PresentMode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+
+	const bool readback = static_cast<bool>(Settings.OnHeadlessFrame);
+
+	VkImageCreateInfo imageInfo = {};
+	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageInfo.pNext = nullptr;
+
+	imageInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageInfo.format = SwapchainFormat;
+	imageInfo.extent = { WindowExtents.width, WindowExtents.height, 1 };
+	imageInfo.mipLevels = 1;
+	imageInfo.arrayLayers = 1;
+	imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | (readback ? VK_IMAGE_USAGE_TRANSFER_SRC_BIT : 0);
+	imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+	const VkDeviceSize readbackSize = VkDeviceSize(WindowExtents.width) * WindowExtents.height * HeadlessBytesPerPixel;
+
+	// One target per frame in flight, like swapchain images they are only reused once their frame is done
+	OffscreenTargets.resize(Settings.FramesInFlight);
+	for (OffscreenTarget & target : OffscreenTargets) {
+		target.Color = Allocator->CreateImage(imageInfo, MemoryUsage::GpuOnly);
+
+		VkImageViewCreateInfo viewInfo = {};
+		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		viewInfo.pNext = nullptr;
+
+		viewInfo.image = target.Color.Handle;
+		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewInfo.format = SwapchainFormat;
+		viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		viewInfo.subresourceRange.levelCount = 1;
+		viewInfo.subresourceRange.layerCount = 1;
+
+		if (Vk.createImageView(&viewInfo, nullptr, &target.View))
+			throw std::runtime_error("Failed to create offscreen view");
+
+		// Persistently mapped, the callback reads the copy in place
+		if (readback)
+			target.Readback = Allocator->CreateBuffer(readbackSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT, MemoryUsage::GpuToCpu);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool Engine::RecreateSwapchain() {
+	int width = 0;
+	int height = 0;
+	SDL_Vulkan_GetDrawableSize(Window, &width, &height);
+
+	// Minimized, wait until the window is restored
+	if (width == 0 || height == 0)
+		return false;
+
+	WindowExtents.width = static_cast<uint32_t>(width);
+	WindowExtents.height = static_cast<uint32_t>(height);
+
+	const VkSwapchainKHR oldSwapchain = Swapchain;
+	const std::vector<VkImageView> oldViews = std::move(SwapchainImageViews);
+	const std::vector<VkSemaphore> oldSemaphores = std::move(RenderSemaphores);
+
+	InitSwapchain();
+
+	// The graphics timeline says nothing about the presentation engine, it may still be showing
+	// or waiting on old images. With present wait, wait for the last present to the old swapchain,
+	// presents are processed in order. Otherwise, or if it never completes, e.g. it was out of date,
+	// fall back to the queue going idle.
+	const uint64_t lastPresentId = Pacer->UsesPresentWait() ? Pacer->GetLastPresentId(oldSwapchain) : 0;
+	if (lastPresentId == 0 || Vk.waitForPresentKHR(oldSwapchain, lastPresentId, 1000000000) != VK_SUCCESS)
+		Vk.queueWaitIdle(GraphicsQueue);
+
+	// Framebuffers of frames that haven't come around yet still reference the old views
+	Deletions->Push(GraphicsTimeline->GetLastSubmitted(), [this, oldSwapchain, oldViews, oldSemaphores]() {
+		for (VkImageView view : oldViews)
+			Vk.destroyImageView(view, nullptr);
+		for (VkSemaphore semaphore : oldSemaphores)
+			Vk.destroySemaphore(semaphore, nullptr);
+		Vk.destroySwapchainKHR(oldSwapchain, nullptr);
+	});
+
+	// Each graph drops its framebuffers the next time its frame comes around, when the GPU is done with them
+	for (FrameData & frame : Frames)
+		frame.StaleFramebuffers = true;
+
+	// Queued frames belonged to the old swapchain
+	Pacer->Reset();
+	SwapchainDirty = false;
+
+	return true;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -193,19 +808,44 @@ void Engine::InitCommands() {
 		GraphicsQueueFamily
 		, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT
 	);
-	
-	if (vkCreateCommandPool(Device, &commandPoolInfo, nullptr, &CommandPool))
-		throw std::runtime_error("Failed to create command pool.");
 
-	VkCommandBufferAllocateInfo cmdAllocInfo = CommandBufferAllocateInfo(CommandPool);
+	Frames.resize(Settings.FramesInFlight);
+
+	// Pools for secondary buffers are reset as a whole every frame
+	auto threadPoolInfo = CommandPoolCreateInfo(
+		GraphicsQueueFamily
+		, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT
+	);
+
+	// Each frame in flight gets its own pool, so resetting one frame's
+	// commands never touches buffers the GPU may still be executing
+	for (FrameData & frame : Frames) {
+		if (Vk.createCommandPool(&commandPoolInfo, nullptr, &frame.CommandPool))
+			throw std::runtime_error("Failed to create command pool.");
+
+		VkCommandBufferAllocateInfo cmdAllocInfo = CommandBufferAllocateInfo(frame.CommandPool);
 
-	if (vkAllocateCommandBuffers(Device, &cmdAllocInfo, &MainCommandBuffer))
-		throw std::runtime_error("Failed to allocate a command buffer.");
+		if (Vk.allocateCommandBuffers(&cmdAllocInfo, &frame.MainCommandBuffer))
+			throw std::runtime_error("Failed to allocate a command buffer.");
+
+		// Command pools are externally synchronized, so every recording thread needs its own
+		frame.ThreadPools.resize(Jobs->GetThreadCount());
+		for (ThreadCommandPool & threadPool : frame.ThreadPools) {
+			if (Vk.createCommandPool(&threadPoolInfo, nullptr, &threadPool.Pool))
+				throw std::runtime_error("Failed to create thread command pool.");
+		}
+	}
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
 void Engine::InitDefaultRenderpass() {
+	// Pipelines and render graphs don't need a render pass to be compatible with
+	if (DynamicRendering) {
+		RenderPass = VK_NULL_HANDLE;
+		return;
+	}
+
 	// The renderpass will use this color attachment. 
 	// This is a description of the image we will write into with render commands.
 	VkAttachmentDescription colorAttachment = {};
@@ -245,66 +885,156 @@ void Engine::InitDefaultRenderpass() {
 	renderPassInfo.subpassCount = 1;
 	renderPassInfo.pSubpasses = &subpass;
 
-	if (vkCreateRenderPass(Device, &renderPassInfo, nullptr, &RenderPass))
+	if (Vk.createRenderPass(&renderPassInfo, nullptr, &RenderPass))
 		throw std::runtime_error("Failed to create render pass");
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
-void Engine::InitFramebuffers() {
-	// Create the framebuffers for the swapchain images.
-	// This connects the renderpass to the images for rendering.
-	VkFramebufferCreateInfo fbInfo = {};
-	fbInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-	fbInfo.pNext = nullptr;
-
-	fbInfo.renderPass = RenderPass;
-	fbInfo.attachmentCount = 1;
-	fbInfo.width = WindowExtents.width;
-	fbInfo.height = WindowExtents.height;
-	fbInfo.layers = 1;
-
-	// Grab the number of images in the swapchain
-	const size_t swapchainSize = SwapchainImages.size();
-	Framebuffers.resize(swapchainSize);
-
-	for (size_t i = 0; i < swapchainSize; i++) {
-		fbInfo.pAttachments = &SwapchainImageViews[i];
-		if (vkCreateFramebuffer(Device, &fbInfo, nullptr, &Framebuffers[i]))
-			throw std::runtime_error("Failed to create a framebuffer");
-	}
+void Engine::InitRenderGraphs() {
+	// Framebuffers are created and cached by each frame's graph
+	for (FrameData & frame : Frames)
+		frame.Graph = std::make_unique<RenderGraph>(Vk, *Allocator, GpuTimings.get(), DynamicRendering);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
 void Engine::InitSyncStructures() {
-	VkFenceCreateInfo fenceCreateInfo = {};
-	fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-	fenceCreateInfo.pNext = nullptr;
-	// Use signaled flag so we can wait on this fence before using it on a GPU command
-	fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-
-	if (vkCreateFence(Device, &fenceCreateInfo, nullptr, &RenderFence))
-		throw std::runtime_error("Failed to create fence");
-
+	// Frames wait on the graphics timeline instead of fences, only the swapchain needs binary semaphores.
+	// The ones presents wait on belong to the swapchain images.
 	VkSemaphoreCreateInfo semaphoreCreateInfo = {};
 	semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 	semaphoreCreateInfo.pNext = nullptr;
 	semaphoreCreateInfo.flags = 0;
 
-	if (vkCreateSemaphore(Device, &semaphoreCreateInfo, nullptr, &PresentSemaphore))
-		throw std::runtime_error("Failed to create present semaphore");
+	for (FrameData & frame : Frames) {
+		if (Vk.createSemaphore(&semaphoreCreateInfo, nullptr, &frame.PresentSemaphore))
+			throw std::runtime_error("Failed to create present semaphore");
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void Engine::InitShaders() {
+	Shaders = std::make_unique<ShaderLibrary>(
+		Vk
+		, *Jobs
+		, Settings.ShaderCacheDirectory
+		, Settings.ShaderArchivePath
+		, VulkanApiVersion
+	);
+
+	// Shaders compile on the job system, nothing blocks until a module is actually needed
+	TriangleVertShader = Shaders->LoadAsync("./Shaders/triangle.vert");
+	TriangleFragShader = Shaders->LoadAsync("./Shaders/triangle.frag");
+
+	// Shaders loaded later are watched as well, the watcher goes over every loaded module
+	if (Settings.HotReloadShaders)
+		Watcher = std::make_unique<ShaderWatcher>(*Shaders, std::chrono::milliseconds(Settings.ShaderReloadIntervalMs));
 
-	if (vkCreateSemaphore(Device, &semaphoreCreateInfo, nullptr, &RenderSemaphore))
-		throw std::runtime_error("Failed to create render semaphore");
+	DiskPipelineCache = std::make_unique<PipelineCache>(Vk, GPUProperties, Settings.PipelineCachePath);
+	Pipelines = std::make_unique<PipelineLibrary>(Vk, *Jobs, *Shaders, *DiskPipelineCache);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
 void Engine::InitPipelines() {
-	VkShaderModule triangleVertShader, triangleFragShader;
-	LoadShaderModule("./Shaders/triangle.vert", triangleVertShader);
-	LoadShaderModule("./Shaders/triangle.frag", triangleFragShader);
+	// The triangle doesn't use any descriptors or push constants
+	VkPipelineLayoutCreateInfo layoutInfo = {};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	layoutInfo.pNext = nullptr;
+
+	if (Vk.createPipelineLayout(&layoutInfo, nullptr, &TrianglePipelineLayout))
+		throw std::runtime_error("Failed to create triangle pipeline layout");
+
+	GraphicsPipelineDesc triangleDesc;
+	triangleDesc.VertexShader = TriangleVertShader;
+	triangleDesc.FragmentShader = TriangleFragShader;
+	triangleDesc.Layout = TrianglePipelineLayout;
+	// Dynamic rendering pipelines only need to know the attachment formats
+	if (DynamicRendering)
+		triangleDesc.ColorFormats = { SwapchainFormat };
+	else
+		triangleDesc.RenderPass = RenderPass;
+	triangleDesc.VertexBindings = { { 0, sizeof(TrianglePositions[0]), VK_VERTEX_INPUT_RATE_VERTEX } };
+	triangleDesc.VertexAttributes = { { 0, 0, VK_FORMAT_R32G32B32_SFLOAT, 0 } };
+	TrianglePipeline = Pipelines->Register(triangleDesc);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void Engine::InitScene() {
+	Scene = std::make_unique<GpuScene>(
+		Vk
+		, *Allocator
+		, *Compute
+		, *GraphicsTimeline
+		, *Streaming
+		, *Uploads
+		, *Bindless
+		, *Shaders
+		, *Pipelines
+		, *DiskPipelineCache
+		, *Deletions
+		, Settings.FramesInFlight
+		, SwapchainFormat
+		, DynamicRendering
+		, Settings.GpuDrivenRendering
+	);
+	SceneData = std::make_unique<SceneStore>();
+
+	const std::vector<Vec3> cubePositions = {
+		{ -1.f, -1.f, -1.f }, { 1.f, -1.f, -1.f }, { 1.f, 1.f, -1.f }, { -1.f, 1.f, -1.f }
+		, { -1.f, -1.f, 1.f }, { 1.f, -1.f, 1.f }, { 1.f, 1.f, 1.f }, { -1.f, 1.f, 1.f }
+	};
+	const std::vector<uint32_t> cubeIndices = {
+		0, 2, 1, 0, 3, 2
+		, 4, 5, 6, 4, 6, 7
+		, 0, 1, 5, 0, 5, 4
+		, 3, 6, 2, 3, 7, 6
+		, 0, 4, 7, 0, 7, 3
+		, 1, 2, 6, 1, 6, 5
+	};
+	const MeshHandle cube = Scene->AddMesh(cubePositions, cubeIndices);
+	const Vec4 cubeBounds = Scene->GetMeshBounds(cube);
+
+	// Grid of cubes on the ground plane, centered on the origin, with varying heights.
+	// Materials alternate in a checkerboard, so batching ends up with one draw per material.
+	const uint32_t gridSize = std::max(1u, Settings.DemoGridSize);
+	const float spacing = 3.f;
+	const float halfExtent = (gridSize - 1) * spacing * 0.5f;
+
+	for (uint32_t z = 0; z < gridSize; z++) {
+		for (uint32_t x = 0; x < gridSize; x++) {
+			const float height = 1.f + static_cast<float>((x * 7 + z * 13) % 5);
+			const Vec3 position = { x * spacing - halfExtent, height, z * spacing - halfExtent };
+			const uint32_t material = (x + z) % 2;
+			SceneData->Add(cube.Index, material, Translation(position) * Scale({ 1.f, height, 1.f }), cubeBounds);
+		}
+	}
+
+	// Streams in on the transfer queue, the scene is drawn once it has landed
+	Scene->Commit(*SceneData);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void Engine::InitBenchmark() {
+	const VkDeviceSize streamedBytes = Settings.Benchmark.StreamedBytesPerFrame;
+	if (streamedBytes == 0)
+		return;
+
+	// Any pattern will do, it only has to be copied
+	StreamedData.resize(streamedBytes);
+	for (size_t i = 0; i < StreamedData.size(); i++)
+		StreamedData[i] = static_cast<uint8_t>(i);
+
+	StreamedBuffer = Allocator->CreateBuffer(
+		streamedBytes
+		, VK_BUFFER_USAGE_TRANSFER_DST_BIT
+		, MemoryUsage::GpuOnly
+		, Streaming->GetQueueFamilies()
+	);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -312,42 +1042,223 @@ void Engine::InitPipelines() {
 void Engine::Cleanup() {
 	if (!IsInitialized)
 		return;
+
+	// Frames may still be executing on the GPU
+	Vk.deviceWaitIdle();
+
+	// Headless frames still in flight have finished now, hand them over oldest first
+	if (!OffscreenTargets.empty()) {
+		for (uint64_t i = FrameNumber - std::min<uint64_t>(FrameNumber, OffscreenTargets.size()); i < FrameNumber; i++)
+			DeliverReadback(OffscreenTargets[i % OffscreenTargets.size()]);
+	}
+
+	// Nothing is in flight anymore, so whatever is still queued can go before the systems it belongs to
+	Deletions->FlushAll();
+
+	if (Settings.GpuProfiling) {
+		for (const GpuScopeSummary & scope : GpuTimings->GetSummary()) {
+			std::cout << "GPU " << scope.Name
+				<< ": avg " << scope.AverageMs
+				<< " ms, p50 " << scope.P50Ms
+				<< " ms, p95 " << scope.P95Ms
+				<< " ms, p99 " << scope.P99Ms << " ms" << std::endl;
+		}
+	}
+
+	if (!Settings.GpuTracePath.empty() && !GpuTimings->WriteTrace(Settings.GpuTracePath))
+		std::cout << "Failed to write the GPU trace" << std::endl;
+
+	if (Settings.CpuProfiling) {
+		const RollingStats & frameTimes = CpuTimings->GetFrameTimes();
+		std::cout << "CPU frame: p50 " << frameTimes.GetPercentile(0.50)
+			<< " ms, p95 " << frameTimes.GetPercentile(0.95)
+			<< " ms, p99 " << frameTimes.GetPercentile(0.99) << " ms" << std::endl;
+		std::cout << "CPU kernels: " << GetSimdLevelName(GetSimdLevel()) << std::endl;
+
+		for (const CpuPhaseSummary & phase : CpuTimings->GetSummary()) {
+			std::cout << "CPU " << phase.Name
+				<< ": avg " << phase.AverageMs
+				<< " ms, p50 " << phase.P50Ms
+				<< " ms, p95 " << phase.P95Ms
+				<< " ms, p99 " << phase.P99Ms << " ms" << std::endl;
+		}
+	}
 	
+	// Stop recompiling before anything the reloads would be swapped into goes away
+	Watcher.reset();
+
 	// Vulkan objects need to be destroyed in reverse order of creation
 
-	// Destroying command pool will destroy all command buffers that have been allocated from it
-	vkDestroyCommandPool(Device, CommandPool, nullptr);
+	for (FrameData & frame : Frames) {
+		frame.Graph.reset();
 
-	vkDestroySwapchainKHR(Device, Swapchain, nullptr);
+		Vk.destroySemaphore(frame.PresentSemaphore, nullptr);
 
-	vkDestroyRenderPass(Device, RenderPass, nullptr);
-	
-	for (size_t i = 0; i < SwapchainImageViews.size(); i++) {
-		vkDestroyFramebuffer(Device, Framebuffers[i], nullptr);
-		vkDestroyImageView(Device, SwapchainImageViews[i], nullptr);
+		for (ThreadCommandPool & threadPool : frame.ThreadPools)
+			Vk.destroyCommandPool(threadPool.Pool, nullptr);
+
+		// Destroying command pool will destroy all command buffers that have been allocated from it
+		Vk.destroyCommandPool(frame.CommandPool, nullptr);
 	}
 
-	vkDestroyDevice(Device, nullptr);
-	vkDestroySurfaceKHR(Instance, Surface, nullptr);
-	vkb::destroy_debug_utils_messenger(Instance, DebugMessenger);
-	vkDestroyInstance(Instance, nullptr);
+	// The swapchain functions aren't loaded when headless
+	if (Swapchain != VK_NULL_HANDLE)
+		Vk.destroySwapchainKHR(Swapchain, nullptr);
 
-	SDL_DestroyWindow(Window);
+	Vk.destroyRenderPass(RenderPass, nullptr);
+	
+	for (VkImageView view : SwapchainImageViews)
+		Vk.destroyImageView(view, nullptr);
+	for (VkSemaphore semaphore : RenderSemaphores)
+		Vk.destroySemaphore(semaphore, nullptr);
+
+	for (OffscreenTarget & target : OffscreenTargets) {
+		Vk.destroyImageView(target.View, nullptr);
+		Allocator->DestroyImage(target.Color);
+		Allocator->DestroyBuffer(target.Readback);
+	}
+	OffscreenTargets.clear();
+
+	if (Settings.PackShaderCache && !Shaders->PackCache())
+		std::cout << "Failed to pack the shader cache" << std::endl;
+
+	Scene.reset();
+	SceneData.reset();
+	Allocator->DestroyBuffer(StreamedBuffer);
+
+	// Waits for any pipeline still being created
+	Pipelines.reset();
+	Vk.destroyPipelineLayout(TrianglePipelineLayout, nullptr);
+
+	if (!DiskPipelineCache->Save())
+		std::cout << "Failed to save the pipeline cache" << std::endl;
+	DiskPipelineCache.reset();
+
+	// Waits for any shader still compiling
+	Shaders.reset();
+
+	// Deletions may free bindless indices
+	Deletions.reset();
+	Bindless.reset();
+	Compute.reset();
+	GpuTimings.reset();
+	Pacer.reset();
+	GraphicsTimeline.reset();
+
+	// Every buffer and image has to be destroyed by now
+	Streaming.reset();
+	Uploads.reset();
+	Allocator.reset();
+
+	vkb::destroy_device(Device);
+	if (Surface != VK_NULL_HANDLE)
+		vkb::destroy_surface(Instance, Surface);
+	// Also destroys the debug messenger
+	vkb::destroy_instance(Instance);
+
+	if (Window)
+		SDL_DestroyWindow(Window);
+
+	CpuTimings.reset();
+	Jobs.reset();
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
 void Engine::Draw() {
-	// Wait until GPU has finished rendering the previous frame, timeout after 1 second
-	vkWaitForFences(Device, 1, &RenderFence, true, 1000000000);
-	vkResetFences(Device, 1, &RenderFence);
+	if (SwapchainDirty && !RecreateSwapchain())
+		return;
+
+	FrameData & frame = GetCurrentFrame();
+	VkCommandBuffer cmd = frame.MainCommandBuffer;
+
+	// Keep latency down by not running further ahead of the display than allowed
+	{
+		CpuProfileScope scope(*CpuTimings, "Pace");
+		Pacer->Wait();
+	}
+
+	// Wait until GPU has finished rendering the last frame that used these resources.
+	// With several frames in flight this lets recording overlap GPU execution of the previous frames.
+	// Timeout after 1 second
+	{
+		CpuProfileScope scope(*CpuTimings, "Frame wait");
+		if (!GraphicsTimeline->Wait(frame.RenderValue, 1000000000))
+			throw std::runtime_error("Timed out waiting for a frame in flight");
+	}
+
+	const uint32_t frameIdx = static_cast<uint32_t>(FrameNumber % Frames.size());
+
+	// The frame this target was last rendered to has finished, so its pixels have arrived
+	if (Settings.Headless)
+		DeliverReadback(OffscreenTargets[frameIdx]);
+
+	// This frame's last use of any replaced swapchain views has finished
+	if (frame.StaleFramebuffers) {
+		frame.Graph->InvalidateFramebuffers();
+		frame.StaleFramebuffers = false;
+	}
+
+	// Whatever was last used by this frame or an earlier one can go now
+	Deletions->Flush();
+
+	// Nothing is being recorded between frames, so reloaded shaders and rebuilt pipelines can be swapped in
+	if (Watcher) {
+		CpuProfileScope scope(*CpuTimings, "Shader reload");
+
+		std::vector<VkShaderModule> replacedModules;
+		const std::vector<ShaderHandle> reloaded = Shaders->ApplyReloads(replacedModules);
+		if (!reloaded.empty()) {
+			Pipelines->Rebuild(reloaded, std::move(replacedModules));
+			if (Scene)
+				Scene->OnShadersReloaded(reloaded);
+		}
+
+		Pipelines->ApplyRebuilds(*Deletions);
+	}
+
+	// Request image from swapchain, timeout after 1 second.
+	// Headless frames always have their target to themselves.
+	uint32_t swapchainImageIdx = 0;
+	if (!Settings.Headless) {
+		VkResult acquireResult;
+		{
+			CpuProfileScope scope(*CpuTimings, "Acquire");
+			acquireResult = Vk.acquireNextImageKHR(Swapchain, 1000000000, frame.PresentSemaphore, nullptr, &swapchainImageIdx);
+		}
+
+		// Nothing was acquired, so the present semaphore is unsignaled and the frame is skipped.
+		// Suboptimal images can still be presented, the swapchain is replaced afterwards.
+		if (acquireResult == VK_ERROR_OUT_OF_DATE_KHR) {
+			SwapchainDirty = true;
+			return;
+		}
+		if (acquireResult == VK_SUBOPTIMAL_KHR)
+			SwapchainDirty = true;
+		else if (acquireResult != VK_SUCCESS)
+			throw std::runtime_error("Failed to acquire swapchain image");
+	}
 
-	// Request image from swapchain, timeout after 1 second
-	uint32_t swapchainImageIdx;
-	vkAcquireNextImageKHR(Device, Swapchain, 1000000000, PresentSemaphore, nullptr, &swapchainImageIdx);
+	const uint64_t recordBegin = CpuTimings->Now();
 
-	// Empty command buffer, since we know that all commands have been executed (fence is cleared)
-	vkResetCommandBuffer(MainCommandBuffer, 0);
+	// The GPU is done reading this frame's region of the upload ring, so it can be written again
+	Uploads->BeginFrame(frameIdx);
+	TriangleVertices = Uploads->Push(TrianglePositions, 3);
+	if (Settings.Benchmark.Overdraw > 0)
+		OverdrawVertices = Uploads->Push(FullscreenPositions, 3);
+
+	// Indices freed while this frame was last recorded aren't used by any frame in flight anymore
+	Bindless->BeginFrame(frameIdx);
+
+	// Compute command buffers are recycled the same way
+	Compute->BeginFrame(frameIdx);
+
+	// Empty command buffers, since we know that all commands have been executed (the timeline has passed the frame)
+	Vk.resetCommandBuffer(cmd, 0);
+	for (ThreadCommandPool & threadPool : frame.ThreadPools) {
+		Vk.resetCommandPool(threadPool.Pool, 0);
+		threadPool.UsedSecondaryBuffers = 0;
+	}
 	VkCommandBufferBeginInfo cmdBeginInfo = {};
 	cmdBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 	cmdBeginInfo.pNext = nullptr;
@@ -355,51 +1266,92 @@ void Engine::Draw() {
 	cmdBeginInfo.pInheritanceInfo = nullptr;
 	cmdBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 
-	vkBeginCommandBuffer(MainCommandBuffer, &cmdBeginInfo);
+	Vk.beginCommandBuffer(cmd, &cmdBeginInfo);
 
-	// Compute a clear color from the frame number
-	VkClearValue clearValue;
-	float flash = abs(sin(FrameNumber / 120.0f));
-	clearValue.color = { 0.f, 0.f, flash, 1.f };
+	// This frame's queries were last used FramesInFlight frames ago, their results are in by now
+	GpuTimings->BeginFrame(frameIdx, cmd);
+	// Timestamps only, so the passes inside get the statistics queries
+	const uint32_t frameScope = GpuTimings->BeginScope(cmd, "Frame", false);
+
+	// Every frame overwrites the same buffer. It is shared concurrently, so no ownership transfers,
+	// and the uploader orders the copies and keeps reusing its staging memory.
+	if (!StreamedData.empty())
+		Streaming->UploadBuffer(StreamedBuffer.Handle, 0, StreamedData.data(), StreamedData.size(), true);
 
-	// Start the main renderpass
-	VkRenderPassBeginInfo rpInfo = {};
-	rpInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-	rpInfo.pNext = nullptr;
+	// Kick off whatever was queued for streaming since last frame, and take ownership
+	// of everything that has finished. Unfinished uploads never hold up this frame.
+	Streaming->Submit();
 
-	rpInfo.renderPass = RenderPass;
-	rpInfo.renderArea.offset = { 0, 0 };
-	rpInfo.renderArea.extent = WindowExtents;
-	rpInfo.framebuffer = Framebuffers[swapchainImageIdx];
+	SemaphoreWaits waits;
+	if (!Settings.Headless)
+		waits.Add(frame.PresentSemaphore, 0, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+	Streaming->AcquireCompleted(cmd, waits);
 
-	rpInfo.clearValueCount = 1;
-	rpInfo.pClearValues = &clearValue;
+	// The graph culls, transitions and aliases, then records every pass into cmd
+	if (Settings.Headless)
+		BuildRenderGraph(frame, OffscreenTargets[frameIdx].Color.Handle, OffscreenTargets[frameIdx].View);
+	else
+		BuildRenderGraph(frame, SwapchainImages[swapchainImageIdx], SwapchainImageViews[swapchainImageIdx]);
+	// Building the graph submits the frame's compute work, e.g. the scene's culling
+	Compute->AddGraphicsWaits(waits);
+	frame.Graph->Compile();
+	frame.Graph->Execute(cmd);
 
-	vkCmdBeginRenderPass(MainCommandBuffer, &rpInfo, VK_SUBPASS_CONTENTS_INLINE);
-	vkCmdEndRenderPass(MainCommandBuffer);
-	vkEndCommandBuffer(MainCommandBuffer);
+	if (Settings.Headless && Settings.OnHeadlessFrame)
+		RecordReadback(OffscreenTargets[frameIdx], cmd);
+
+	GpuTimings->EndScope(cmd, frameScope);
+	Vk.endCommandBuffer(cmd);
+
+	CpuTimings->Record("Record", recordBegin, CpuTimings->Now());
 
 	// Prepare submission to the queue
 
+	// The frame's value on the graphics timeline, next to the binary semaphore presentation waits on.
+	// Headless frames aren't presented, so they only signal the timeline.
+	frame.RenderValue = GraphicsTimeline->Advance();
+
+	VkSemaphore signalSemaphores[] = { GraphicsTimeline->Get(), Settings.Headless ? VK_NULL_HANDLE : RenderSemaphores[swapchainImageIdx] };
+	const uint64_t signalValues[] = { frame.RenderValue, 0 };
+	const uint32_t signalCount = Settings.Headless ? 1 : 2;
+
+	// Timeline values for the waits and signals, binary semaphores ignore theirs
+	VkTimelineSemaphoreSubmitInfo timelineInfo = {};
+	timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+	timelineInfo.pNext = nullptr;
+
+	timelineInfo.waitSemaphoreValueCount = static_cast<uint32_t>(waits.Values.size());
+	timelineInfo.pWaitSemaphoreValues = waits.Values.data();
+	timelineInfo.signalSemaphoreValueCount = signalCount;
+	timelineInfo.pSignalSemaphoreValues = signalValues;
+
 	VkSubmitInfo submit = {};
 	submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submit.pNext = nullptr;
+	submit.pNext = &timelineInfo;
 
-	VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	submit.pWaitDstStageMask = waits.Stages.data();
 
-	submit.pWaitDstStageMask = &waitStage;
+	submit.waitSemaphoreCount = static_cast<uint32_t>(waits.Semaphores.size());
+	submit.pWaitSemaphores = waits.Semaphores.data();
 
-	submit.waitSemaphoreCount = 1;
-	submit.pWaitSemaphores = &PresentSemaphore;
-
-	submit.signalSemaphoreCount = 1;
-	submit.pSignalSemaphores = &RenderSemaphore;
+	submit.signalSemaphoreCount = signalCount;
+	submit.pSignalSemaphores = signalSemaphores;
 
 	submit.commandBufferCount = 1;
-	submit.pCommandBuffers = &MainCommandBuffer;
+	submit.pCommandBuffers = &cmd;
+
+	// RenderValue will block the next use of this frame's resources until its commands have executed
+	{
+		CpuProfileScope scope(*CpuTimings, "Submit");
+		if (Vk.queueSubmit(GraphicsQueue, 1, &submit, VK_NULL_HANDLE))
+			throw std::runtime_error("Failed to submit to the graphics queue");
+	}
 
-	// RenderFence will block draw until the graphics queue is cleared of all commands
-	vkQueueSubmit(GraphicsQueue, 1, &submit, RenderFence);
+	if (Settings.Headless) {
+		FrameNumber++;
+		SceneFrameNumber = FrameNumber;
+		return;
+	}
 
 	VkPresentInfoKHR presentInfo = {};
 	presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -409,128 +1361,445 @@ void Engine::Draw() {
 	presentInfo.pSwapchains = &Swapchain;
 
 	presentInfo.waitSemaphoreCount = 1;
-	presentInfo.pWaitSemaphores = &RenderSemaphore;
+	presentInfo.pWaitSemaphores = &RenderSemaphores[swapchainImageIdx];
 
 	presentInfo.pImageIndices = &swapchainImageIdx;
 
-	vkQueuePresentKHR(GraphicsQueue, &presentInfo);
+	// Tag the present so the pacer can wait for it to reach the screen
+	const uint64_t presentId = Pacer->GetNextPresentId();
+
+	VkPresentIdKHR presentIdInfo = {};
+	presentIdInfo.sType = VK_STRUCTURE_TYPE_PRESENT_ID_KHR;
+	presentIdInfo.pNext = nullptr;
+
+	presentIdInfo.swapchainCount = 1;
+	presentIdInfo.pPresentIds = &presentId;
+
+	if (Pacer->UsesPresentWait())
+		presentInfo.pNext = &presentIdInfo;
+
+	VkResult presentResult;
+	{
+		CpuProfileScope scope(*CpuTimings, "Present");
+		presentResult = Vk.queuePresentKHR(GraphicsQueue, &presentInfo);
+	}
+
+	if (presentResult == VK_ERROR_OUT_OF_DATE_KHR || presentResult == VK_SUBOPTIMAL_KHR)
+		SwapchainDirty = true;
+	else if (presentResult != VK_SUCCESS)
+		throw std::runtime_error("Failed to present swapchain image");
+	Pacer->OnPresent(Swapchain, frame.RenderValue);
 
 	FrameNumber++;
+	SceneFrameNumber = FrameNumber;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
 void Engine::Run() {
+	if (Settings.Benchmark.Enabled) {
+		RunBenchmark();
+		return;
+	}
+
+	if (Settings.Headless) {
+		RunHeadless();
+		return;
+	}
+
+	while (PollEvents()) {
+		// Nothing to present to, don't spin
+		if (SDL_GetWindowFlags(Window) & SDL_WINDOW_MINIMIZED) {
+			SDL_Delay(16);
+			continue;
+		}
+
+		Draw();
+		CpuTimings->EndFrame();
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool Engine::PollEvents() {
+	CpuProfileScope scope(*CpuTimings, "Events");
+
 	bool stillRunning = true;
 
-	while (stillRunning) {
+	SDL_Event e;
+	while (SDL_PollEvent(&e)) {
+
+		switch (e.type) {
+		case SDL_QUIT:
+			stillRunning = false;
+			break;
+
+		case SDL_WINDOWEVENT:
+			// Some platforms never report the swapchain out of date, so don't rely on it
+			if (e.window.event == SDL_WINDOWEVENT_SIZE_CHANGED)
+				SwapchainDirty = true;
+			break;
+
+		case SDL_KEYDOWN:
+			// Borderless fullscreen, the resize event recreates the swapchain
+			if (e.key.keysym.sym == SDLK_F11) {
+				const bool fullscreen = SDL_GetWindowFlags(Window) & SDL_WINDOW_FULLSCREEN_DESKTOP;
+				SDL_SetWindowFullscreen(Window, fullscreen ? 0 : SDL_WINDOW_FULLSCREEN_DESKTOP);
+			}
 
-		SDL_Event e;
-		while (SDL_PollEvent(&e)) {
+			// Workers are idle between frames, so the rings can be read safely here
+			if (e.key.keysym.sym == SDLK_F12 && Settings.CpuProfiling && !CpuTimings->WriteTrace(Settings.CpuTracePath))
+				std::cout << "Failed to write the CPU trace" << std::endl;
+			break;
 
-			switch (e.type) {
-			case SDL_QUIT:
-				stillRunning = false;
-				break;
+		default:
+			break;
+		}
+	}
 
-			default:
+	return stillRunning;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void Engine::RunHeadless() {
+	// No events to pump and no display to pace against, frames are rendered back to back
+	for (uint32_t i = 0; ; i++) {
+		// Frames are either handed out by a scheduler shared with other engines, or counted here
+		if (Settings.AcquireHeadlessFrame) {
+			if (!Settings.AcquireHeadlessFrame(SceneFrameNumber))
 				break;
-			}
+		} else if (Settings.HeadlessFrameCount != 0 && i >= Settings.HeadlessFrameCount) {
+			break;
 		}
 
 		Draw();
+		CpuTimings->EndFrame();
 	}
+
+	// There is no F12 to press
+	if (Settings.CpuProfiling && !Settings.CpuTracePath.empty() && !CpuTimings->WriteTrace(Settings.CpuTracePath))
+		std::cout << "Failed to write the CPU trace" << std::endl;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
-void Engine::LoadShaderModule(const std::string & glslPath, VkShaderModule & outShaderModule) {
-	const std::string spvPath = glslPath + ".spv";
-	
-	// Check if we have compiled this glsl into spir-v already.
-	// Rerun compilation if the glsl has been dirtied since the previous compilation
-	if (!std::filesystem::exists(spvPath) || 
-		std::filesystem::last_write_time(glslPath) > std::filesystem::last_write_time(spvPath)) {
-		if (!CompileGlslToSpv(glslPath, spvPath))
-			throw std::runtime_error("Failed to compile " + glslPath + " to spv");
-	}
+void Engine::RunBenchmark() {
+	const BenchmarkSettings & benchmark = Settings.Benchmark;
+	const uint32_t measureBegin = benchmark.WarmUpFrames;
+	const uint32_t measureEnd = benchmark.WarmUpFrames + benchmark.Frames;
+
+	// GPU timings are read back when their frame in flight comes around again, so the GPU side
+	// is measured FramesInFlight frames later than the CPU side, and the run goes on for as many
+	// frames to read back the last measured ones
+	const uint32_t gpuLag = Settings.FramesInFlight;
+
+	BenchmarkResults results;
+	uint64_t beginNs = 0;
+
+	for (uint32_t i = 0; i < measureEnd + gpuLag; i++) {
+		if (!Settings.Headless && !PollEvents()) {
+			std::cout << "Benchmark aborted, no results written" << std::endl;
+			return;
+		}
 
-	// Open the spv file here
-	std::ifstream file(spvPath, std::ios::ate | std::ios::binary);
-	if (!file.is_open())
-		throw std::runtime_error("Failed to open shader file!");
+		if (i == measureBegin) {
+			CpuTimings->ResetStats(benchmark.Frames);
+			beginNs = CpuTimings->Now();
+		}
+		if (i == measureBegin + gpuLag)
+			GpuTimings->ResetStats(benchmark.Frames);
 
-	// Allocate buffer to size of file (in bytes)
-	size_t fileSize = (size_t)file.tellg();
-	std::vector<char> buffer(fileSize);
+		Draw();
+		CpuTimings->EndFrame();
 
-	// Reset the cursor of the file to the top
-	file.seekg(0);
-	// Read spv into buffer
-	file.read(buffer.data(), fileSize);
-	file.close();
+		if (i + 1 == measureEnd) {
+			results.Seconds = (CpuTimings->Now() - beginNs) / 1e9;
+			results.CpuFrame = MakeFrameTimeStats(CpuTimings->GetFrameTimes());
+			results.CpuPhases = CpuTimings->GetSummary();
+		}
+	}
 
-	VkShaderModuleCreateInfo createInfo = {};
-	createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-	createInfo.pNext = nullptr;
+	if (const RollingStats * gpuFrame = GpuTimings->GetScopeTimes("Frame"))
+		results.GpuFrame = MakeFrameTimeStats(*gpuFrame);
+	results.GpuScopes = GpuTimings->GetSummary();
 
-	createInfo.codeSize = buffer.size();
-	createInfo.pCode = reinterpret_cast<const uint32_t *>(buffer.data());
+	results.DeviceName = GPUProperties.deviceName;
+	results.DriverVersion = GPUProperties.driverVersion;
+	results.PresentMode = PresentMode;
+	results.Headless = Settings.Headless;
+	results.Extent = WindowExtents;
 
-	VkShaderModule shaderModule;
-	if (vkCreateShaderModule(Device, &createInfo, nullptr, &shaderModule)) {
-		throw std::runtime_error("Failed to create shader module from " + spvPath);
+	if (!WriteBenchmarkResults(benchmark.ResultsPath, benchmark, results)) {
+		std::cout << "Failed to write the benchmark results" << std::endl;
+		return;
 	}
 
-	outShaderModule = shaderModule;
+	std::cout << "Benchmark: CPU frame avg " << results.CpuFrame.AverageMs
+		<< " ms, GPU frame avg " << results.GpuFrame.AverageMs
+		<< " ms, written to " << benchmark.ResultsPath << std::endl;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
-bool Engine::CompileGlslToSpv(const std::string & glslPath, std::optional<std::string> inOutSpvPath) {
-	if (!inOutSpvPath.has_value())
-		inOutSpvPath = glslPath + ".spv";
+FrameData & Engine::GetCurrentFrame() {
+	return Frames[FrameNumber % Frames.size()];
+}
 
-	if (!std::filesystem::exists(glslPath))
-		return false;
+////////////////////////////////////////////////////////////////////////////////
 
-	std::ifstream file(glslPath, std::ios::ate | std::ios::binary);
-	if (!file.is_open())
-		return false;
-	
-	size_t fileSize = (size_t)file.tellg();
-	std::vector<char> buffer(fileSize);
-	file.seekg(0);
-	file.read(buffer.data(), fileSize);
-	file.close();
-
-	// Ensure null terminated
-	buffer.push_back(0);
-
-	// Create shader compiler
-	shaderc::Compiler compiler;
-	auto result = compiler.CompileGlslToSpv(
-		buffer.data()
-		, shaderc_shader_kind::shaderc_glsl_infer_from_source
-		, glslPath.c_str()
+void Engine::BuildRenderGraph(FrameData & frame, VkImage backbufferImage, VkImageView backbufferView) {
+	RenderGraph & graph = *frame.Graph;
+	graph.Reset();
+
+	TextureDesc backbufferDesc;
+	backbufferDesc.Format = SwapchainFormat;
+	backbufferDesc.Extent = WindowExtents;
+
+	// Headless frames are copied out instead of presented, or left as they are without a readback
+	VkImageLayout finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	if (Settings.Headless)
+		finalLayout = Settings.OnHeadlessFrame ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED;
+
+	// Acquire and submit wait on the color attachment output stage, so the first transition has to as well
+	RenderGraphResource backbuffer = graph.ImportImage(
+		"Backbuffer"
+		, backbufferImage
+		, backbufferView
+		, backbufferDesc
+		, VK_IMAGE_LAYOUT_UNDEFINED
+		, finalLayout
+		, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
 	);
 
-	if (result.GetNumErrors() > 0) {
-		auto errorString = result.GetErrorMessage();
-		OutputDebugString(std::wstring(errorString.begin(), errorString.end()).c_str());
-		OutputDebugString(L"\n");
-		return false;
+	// Compute a clear color from the frame number
+	VkClearColorValue clearColor;
+	float flash = abs(sin(SceneFrameNumber / 120.0f));
+	clearColor = { { 0.f, 0.f, flash, 1.f } };
+
+	graph.AddRasterPass(
+		"Main"
+		, [&](RenderPassBuilder & builder) {
+			builder.WriteColor(backbuffer, VK_ATTACHMENT_LOAD_OP_CLEAR, clearColor);
+			builder.UseSecondaryCommandBuffers();
+		}
+		, [this, &frame](const RasterPassContext & context) {
+			// The renderpass contents are recorded in parallel into secondary command buffers
+			RecordSecondaryCommands(frame, context);
+
+			Vk.cmdExecuteCommands(
+				context.Cmd
+				, static_cast<uint32_t>(frame.SecondaryCommandBuffers.size())
+				, frame.SecondaryCommandBuffers.data()
+			);
+		}
+	);
+	if (Scene) {
+		// Camera orbiting the grid
+		const float angle = SceneFrameNumber / 600.0f;
+		const float radius = std::max(20.f, Settings.DemoGridSize * 1.5f);
+		const Vec3 eye = { radius * std::cos(angle), radius * 0.4f, radius * std::sin(angle) };
+		const float aspect = static_cast<float>(WindowExtents.width) / static_cast<float>(WindowExtents.height);
+		const Mat4 viewProj = Perspective(1.0472f, aspect, 0.1f, radius * 4.f) * LookAt(eye, { 0.f, 0.f, 0.f }, { 0.f, 1.f, 0.f });
+
+		const uint32_t frameIdx = static_cast<uint32_t>(FrameNumber % Frames.size());
+		CpuProfileScope scope(*CpuTimings, "Scene");
+		Scene->AddPasses(graph, frameIdx, backbuffer, WindowExtents, viewProj);
 	}
+}
 
-	std::ofstream outFile(*inOutSpvPath, std::ios::binary);
-	if (!outFile.is_open())
-		return false;
+////////////////////////////////////////////////////////////////////////////////
 
-	// Write compiled spir-v to file
-	outFile.write((char *)result.cbegin(), (result.cend() - result.cbegin()) * sizeof(uint32_t));
-	outFile.close();
+void Engine::RecordReadback(OffscreenTarget & target, VkCommandBuffer cmd) {
+	// The graph's final transition waits for the passes, chain the copy onto it
+	VkImageMemoryBarrier copyBarrier = {};
+	copyBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	copyBarrier.pNext = nullptr;
+
+	copyBarrier.srcAccessMask = 0;
+	copyBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+	copyBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	copyBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	copyBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	copyBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	copyBarrier.image = target.Color.Handle;
+	copyBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+
+	Vk.cmdPipelineBarrier(
+		cmd
+		, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT
+		, VK_PIPELINE_STAGE_TRANSFER_BIT
+		, 0
+		, 0, nullptr
+		, 0, nullptr
+		, 1, &copyBarrier
+	);
 
-	return true;
+	// Rows tightly packed
+	VkBufferImageCopy region = {};
+	region.bufferOffset = 0;
+	region.bufferRowLength = 0;
+	region.bufferImageHeight = 0;
+	region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+	region.imageOffset = { 0, 0, 0 };
+	region.imageExtent = { WindowExtents.width, WindowExtents.height, 1 };
+
+	Vk.cmdCopyImageToBuffer(cmd, target.Color.Handle, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, target.Readback.Handle, 1, &region);
+
+	// Waiting on the timeline alone doesn't make device writes visible to the host
+	VkBufferMemoryBarrier hostBarrier = {};
+	hostBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	hostBarrier.pNext = nullptr;
+
+	hostBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+	hostBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	hostBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	hostBarrier.buffer = target.Readback.Handle;
+	hostBarrier.offset = 0;
+	hostBarrier.size = VK_WHOLE_SIZE;
+
+	Vk.cmdPipelineBarrier(
+		cmd
+		, VK_PIPELINE_STAGE_TRANSFER_BIT
+		, VK_PIPELINE_STAGE_HOST_BIT
+		, 0
+		, 0, nullptr
+		, 1, &hostBarrier
+		, 0, nullptr
+	);
+
+	target.ReadbackPending = true;
+	target.ReadbackFrameNumber = SceneFrameNumber;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void Engine::DeliverReadback(OffscreenTarget & target) {
+	if (!target.ReadbackPending)
+		return;
+
+	target.ReadbackPending = false;
+
+	HeadlessFrame frame;
+	frame.FrameNumber = target.ReadbackFrameNumber;
+	frame.Extent = WindowExtents;
+	frame.Format = SwapchainFormat;
+	// Host coherent memory, nothing to invalidate
+	frame.Pixels = static_cast<const uint8_t *>(target.Readback.Memory.Mapped);
+	frame.Size = size_t(WindowExtents.width) * WindowExtents.height * HeadlessBytesPerPixel;
+
+	Settings.OnHeadlessFrame(frame);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void Engine::RecordSecondaryCommands(FrameData & frame, const RasterPassContext & context) {
+	const uint32_t drawCount = GetDrawCount();
+
+	// Always record at least one buffer, vkCmdExecuteCommands needs something to execute
+	const uint32_t jobCount = std::max(1u, (drawCount + DrawsPerRecordJob - 1) / DrawsPerRecordJob);
+	frame.SecondaryCommandBuffers.resize(jobCount);
+
+	// With dynamic rendering there is no render pass to inherit, only the attachment formats
+	VkCommandBufferInheritanceRenderingInfoKHR renderingInfo = {};
+	renderingInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO_KHR;
+	renderingInfo.pNext = nullptr;
+
+	renderingInfo.colorAttachmentCount = static_cast<uint32_t>(context.ColorFormats.size());
+	renderingInfo.pColorAttachmentFormats = context.ColorFormats.data();
+	renderingInfo.depthAttachmentFormat = context.DepthFormat;
+	renderingInfo.rasterizationSamples = context.Samples;
+
+	// Secondary buffers inherit the renderpass state from the primary buffer
+	VkCommandBufferInheritanceInfo inheritanceInfo = {};
+	inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	inheritanceInfo.pNext = context.RenderPass == VK_NULL_HANDLE ? &renderingInfo : nullptr;
+
+	inheritanceInfo.renderPass = context.RenderPass;
+	inheritanceInfo.subpass = 0;
+	inheritanceInfo.framebuffer = context.Framebuffer;
+	// The pass' statistics query is active while they execute
+	inheritanceInfo.pipelineStatistics = GpuTimings->GetStatisticFlags();
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.pNext = nullptr;
+
+	beginInfo.pInheritanceInfo = &inheritanceInfo;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
+		| VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+
+	Jobs->ParallelFor(jobCount, [&](uint32_t jobIdx, uint32_t threadIdx) {
+		CpuProfileScope scope(*CpuTimings, "Record draws");
+		VkCommandBuffer secondary = AcquireSecondaryCommandBuffer(Vk, frame.ThreadPools[threadIdx]);
+
+		if (Vk.beginCommandBuffer(secondary, &beginInfo))
+			throw std::runtime_error("Failed to begin a secondary command buffer.");
+
+		const uint32_t firstDraw = jobIdx * DrawsPerRecordJob;
+		RecordDraws(secondary, firstDraw, std::min(DrawsPerRecordJob, drawCount - firstDraw));
+
+		if (Vk.endCommandBuffer(secondary))
+			throw std::runtime_error("Failed to record a secondary command buffer.");
+
+		// Keep submission order independent of which thread recorded the job
+		frame.SecondaryCommandBuffers[jobIdx] = secondary;
+	});
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+uint32_t Engine::GetDrawCount() const {
+	// Triangles first, then the overdraw layers
+	if (Settings.Benchmark.Enabled)
+		return Settings.Benchmark.DrawCount + Settings.Benchmark.Overdraw;
+
+	// Just the triangle for now
+	return 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void Engine::RecordDraws(VkCommandBuffer cmd, uint32_t firstDraw, uint32_t drawCount) {
+	if (drawCount == 0)
+		return;
+
+	// Waits here if the pipeline is still being warmed up
+	Vk.cmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, Pipelines->Get(TrianglePipeline));
+
+	// Dynamic state isn't inherited, every secondary buffer sets its own
+	VkViewport viewport = {};
+	viewport.x = 0.f;
+	viewport.y = 0.f;
+	viewport.width = static_cast<float>(WindowExtents.width);
+	viewport.height = static_cast<float>(WindowExtents.height);
+	viewport.minDepth = 0.f;
+	viewport.maxDepth = 1.f;
+
+	VkRect2D scissor = {};
+	scissor.offset = { 0, 0 };
+	scissor.extent = WindowExtents;
+
+	Vk.cmdSetViewport(cmd, 0, 1, &viewport);
+	Vk.cmdSetScissor(cmd, 0, 1, &scissor);
+
+	// Draws past the triangles are the benchmark's overdraw layers
+	const uint32_t triangleCount = Settings.Benchmark.Enabled ? Settings.Benchmark.DrawCount : GetDrawCount();
+	const uint32_t lastDraw = firstDraw + drawCount;
+	const uint32_t overdrawBegin = std::clamp(triangleCount, firstDraw, lastDraw);
+
+	if (overdrawBegin > firstDraw) {
+		Vk.cmdBindVertexBuffers(cmd, 0, 1, &TriangleVertices.Buffer, &TriangleVertices.Offset);
+		for (uint32_t i = firstDraw; i < overdrawBegin; i++)
+			Vk.cmdDraw(cmd, 3, 1, 0, 0);
+	}
+
+	if (lastDraw > overdrawBegin) {
+		Vk.cmdBindVertexBuffers(cmd, 0, 1, &OverdrawVertices.Buffer, &OverdrawVertices.Offset);
+		for (uint32_t i = overdrawBegin; i < lastDraw; i++)
+			Vk.cmdDraw(cmd, 3, 1, 0, 0);
+	}
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -1,7 +1,13 @@
 #pragma once
 
-#include <vulkan/vulkan.h>
+#include "Benchmark.h"
+#include "PipelineLibrary.h"
+#include "RenderGraph.h"
+#include "ShaderLibrary.h"
+#include "UploadRing.h"
+#include "VkBootStrap/VkBootstrap.h"
 
+#include <functional>
 #include <string>
 #include <vector>
 
@@ -9,38 +15,262 @@ struct SDL_Window;
 
 namespace core {
 
+class AsyncCompute;
+class BindlessHeap;
+class CpuProfiler;
+class DeletionQueue;
+class FramePacer;
+class GpuAllocator;
+class GpuProfiler;
+class GpuScene;
+class JobSystem;
+class PipelineCache;
+class SceneStore;
+class ShaderWatcher;
+class StreamingUploader;
+class TimelineSemaphore;
+class UploadRing;
+
+////////////////////////////////////////////////////////////////////////////////
+// A frame rendered in headless mode, read back into host memory
+struct HeadlessFrame {
+	uint64_t FrameNumber = 0;
+	VkExtent2D Extent = {};
+	VkFormat Format = VK_FORMAT_UNDEFINED;
+	// Tightly packed rows, straight out of the mapped readback buffer
+	const uint8_t * Pixels = nullptr;
+	size_t Size = 0;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Settings used to configure the engine on construction.
+struct EngineSettings {
+	// Number of frames the CPU is allowed to record ahead of the GPU
+	uint32_t FramesInFlight = 2;
+
+	// Number of job system worker threads, 0 uses one per hardware thread
+	uint32_t WorkerThreadCount = 0;
+
+	// GPU chosen on the last launch and what was queried about it, reused while the driver
+	// stays the same. Empty to disable.
+	std::string DeviceCachePath = "./DeviceCache.bin";
+	// Run on the GPU at this index among the suitable ones, in enumeration order, instead of
+	// the cached or best one. How MultiGpuRunner puts an engine on every GPU. UINT32_MAX to pick as usual.
+	uint32_t DeviceIndex = UINT32_MAX;
+
+	// Directory compiled spir-v is cached in
+	std::string ShaderCacheDirectory = "./ShaderCache";
+	// Packed spir-v cache, memory mapped at startup if it exists. Empty to disable.
+	std::string ShaderArchivePath = "./ShaderCache.pack";
+	// Pack every cached module into ShaderArchivePath on cleanup, for shipping a prebuilt cache
+	bool PackShaderCache = false;
+	// Recompile shaders whose glsl changed on disk in the background, and swap the rebuilt
+	// pipelines in between frames. Sources are checked every ShaderReloadIntervalMs.
+	bool HotReloadShaders = false;
+	uint32_t ShaderReloadIntervalMs = 250;
+
+	// VkPipelineCache contents are loaded from and saved to this file
+	std::string PipelineCachePath = "./PipelineCache.bin";
+	// Create every known pipeline in the background during startup, instead of on first use
+	bool WarmUpPipelines = true;
+
+	// Preferred presentation policy: FIFO (V-Sync), FIFO_RELAXED, MAILBOX for low latency,
+	// or IMMEDIATE for benchmarking. Falls back to the closest supported mode.
+	VkPresentModeKHR PresentMode = VK_PRESENT_MODE_FIFO_KHR;
+	// Presented frames allowed to queue up ahead of the display, 0 to only limit by FramesInFlight
+	uint32_t MaxQueuedFrames = 0;
+
+	// Render without VkRenderPass and VkFramebuffer objects where VK_KHR_dynamic_rendering is supported
+	bool DynamicRendering = true;
+
+	// Draw the demo scene with GPU culling and indirect draws. Needs drawIndirectCount,
+	// multiDrawIndirect and drawIndirectFirstInstance. Otherwise the CPU batches the
+	// scene into one instanced draw per mesh and material.
+	bool GpuDrivenRendering = true;
+	// Cubes per side of the demo scene's grid
+	uint32_t DemoGridSize = 100;
+
+	// Descriptors of each type in the bindless heap, clamped to what the GPU supports
+	uint32_t BindlessStorageBuffers = 8192;
+	uint32_t BindlessSampledImages = 8192;
+	uint32_t BindlessStorageImages = 1024;
+
+	// Size of each frame's region in the upload ring
+	VkDeviceSize UploadBytesPerFrame = 4 * 1024 * 1024;
+
+	// Staging memory the streaming uploader keeps around and reuses.
+	// Uploads that don't fit while it is taken get a staging buffer of their own.
+	VkDeviceSize StreamingStagingBytes = 64 * 1024 * 1024;
+
+	// Time every render graph pass on the GPU, printed on cleanup
+	bool GpuProfiling = true;
+	// Chrome trace of the last GPU timings, written on cleanup. Empty to disable.
+	std::string GpuTracePath = "";
+
+	// Time the phases of every frame on the CPU, printed on cleanup
+	bool CpuProfiling = true;
+	// Chrome trace of the recent CPU events, written whenever F12 is pressed or when a headless run ends
+	std::string CpuTracePath = "./CpuTrace.json";
+
+	// Render offscreen without a window, surface or swapchain, e.g. on machines without a display.
+	// Frames are rendered back to back at HeadlessExtent, the run ends after HeadlessFrameCount
+	// frames, or never with 0.
+	bool Headless = false;
+	VkExtent2D HeadlessExtent = { 1280, 720 };
+	uint32_t HeadlessFrameCount = 1000;
+	// Called on the main thread with every headless frame once the GPU has finished it.
+	// The pixels are only valid during the call. Without it nothing is read back.
+	std::function<void(const HeadlessFrame &)> OnHeadlessFrame;
+	// Hands out the number of every headless frame before it's rendered, in place of counting to
+	// HeadlessFrameCount, so several engines can split one run. Returns false once no frames are left.
+	// Called on the main thread. The scene is animated by the frame number it's given.
+	std::function<bool(uint64_t & outFrameNumber)> AcquireHeadlessFrame;
+
+	// Render a fixed number of frames of synthetic workloads and write the CPU and GPU frame times
+	// as JSON, instead of running interactively. Turns on both profilers and uncapped presentation.
+	// Also runs headless, in place of HeadlessFrameCount.
+	BenchmarkSettings Benchmark;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Command pool owned by a single recording thread for one frame in flight.
+// Only the owning thread allocates from or records into it.
+struct ThreadCommandPool {
+	VkCommandPool Pool = VK_NULL_HANDLE;
+
+	// Secondary buffers allocated from Pool, reused every time the frame comes around
+	std::vector<VkCommandBuffer> SecondaryBuffers;
+	uint32_t UsedSecondaryBuffers = 0;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// What a frame in flight renders to in headless mode, in place of a swapchain image
+struct OffscreenTarget {
+	Image Color;
+	VkImageView View = VK_NULL_HANDLE;
+
+	// Host visible copy of Color, only with a readback callback
+	Buffer Readback;
+	// Readback holds this frame, and it hasn't been handed to the callback yet
+	bool ReadbackPending = false;
+	uint64_t ReadbackFrameNumber = 0;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Resources owned by a single frame in flight.
+// Each frame gets its own command buffer and synchronization constructs so
+// the CPU can record frame N+1 while the GPU is still executing frame N.
+struct FrameData {
+	VkCommandPool CommandPool = VK_NULL_HANDLE;
+	VkCommandBuffer MainCommandBuffer = VK_NULL_HANDLE;
+
+	// Signaled when the swapchain image is ready to be rendered to
+	VkSemaphore PresentSemaphore = VK_NULL_HANDLE;
+	// Graphics timeline value signaled once the GPU has finished executing this frame's commands
+	uint64_t RenderValue = 0;
+
+	// One pool per job system thread, indexed by JobSystem::GetThreadIndex()
+	std::vector<ThreadCommandPool> ThreadPools;
+	// Secondary buffers recorded for the main renderpass this frame, in draw order
+	std::vector<VkCommandBuffer> SecondaryCommandBuffers;
+
+	// Passes of this frame, rebuilt every time the frame is recorded
+	std::unique_ptr<RenderGraph> Graph;
+	// The graph's cached framebuffers reference swapchain views that were replaced
+	bool StaleFramebuffers = false;
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 // Class to run the application. 
 class Engine {
 public:
-	explicit Engine(const std::string & appName);
+	explicit Engine(const std::string & appName, const EngineSettings & settings = {});
 	~Engine();
 
 	int Exec();
+
+	// Names of the GPUs the engine can run on with these settings, in the order DeviceIndex refers to.
+	// Creates a Vulkan instance of its own to look.
+	static std::vector<std::string> GetSuitableDevices(const EngineSettings & settings);
+
+	// Job scheduler shared by all engine systems. Only valid while the engine is initialized.
+	JobSystem & GetJobSystem();
+
+	// Background uploads of meshes and textures. Only valid while the engine is initialized.
+	StreamingUploader & GetStreamingUploader();
+
+	// Compute work overlapping the graphics queue. Only valid while the engine is initialized.
+	AsyncCompute & GetAsyncCompute();
+
+	// Signaled by every graphics submission, for other queues to wait on. Only valid while the engine is initialized.
+	TimelineSemaphore & GetGraphicsTimeline();
+
+	// Destroys GPU objects once the graphics timeline has passed their last use. Only valid while the engine is initialized.
+	DeletionQueue & GetDeletionQueue();
+
+	// Descriptors of every buffer and image shaders access. Only valid while the engine is initialized.
+	BindlessHeap & GetBindlessHeap();
+
+	// GPU timings per pass. Only valid while the engine is initialized.
+	GpuProfiler & GetGpuProfiler();
+
+	// CPU timings per frame phase. Only valid while the engine is initialized.
+	CpuProfiler & GetCpuProfiler();
+
+	// Switch presentation policy, the swapchain is recreated before the next frame
+	void SetPresentMode(VkPresentModeKHR presentMode);
+	// Mode the swapchain actually uses
+	VkPresentModeKHR GetPresentMode() const { return PresentMode; }
+
+	void SetMaxQueuedFrames(uint32_t maxQueuedFrames);
 private:
-	// Initialize the SDL window
+	// Initialize the engine, running independent stages in parallel
 	void Initialize();
 
-	// Initialize Vulkan constructs
+	// Initialize the SDL window, unless headless
+	void InitWindow();
+
+	// Initialize the Vulkan instance. Doesn't need the window.
+	void InitInstance();
+
+	// Initialize the surface, device and the systems built on it
 	void InitVulkan();
 
 	// Initialize swapchain
 	void InitSwapchain();
 
+	// Initialize the images headless frames render to, instead of a swapchain
+	void InitOffscreenTargets();
+
+	// Replace the swapchain after a resize or a settings change, without waiting for the device.
+	// Returns false if the window is minimized and there is nothing to present to.
+	bool RecreateSwapchain();
+
 	// Initialize Vulkan Commands
 	void InitCommands();
 
 	// Initialize renderpass
 	void InitDefaultRenderpass();
 
-	// Initialize framebuffers
-	void InitFramebuffers();
+	// Initialize the per-frame render graphs
+	void InitRenderGraphs();
 
 	// Initialize synchrnoization constructs
 	void InitSyncStructures();
 
+	// Initialize the shader and pipeline libraries. Shaders start compiling in the background.
+	// Doesn't depend on the backbuffer format.
+	void InitShaders();
+
+	// Initialize graphics pipelines
 	void InitPipelines();
 
+	// Fill the scene with the demo grid
+	void InitScene();
+
+	// Initialize what the benchmark workloads stream to
+	void InitBenchmark();
+
 	// Destroy the SDL window and Vulkan constructs
 	void Cleanup();
 
@@ -50,11 +280,36 @@ private:
 	// Run the main event loop
 	void Run();
 
-	// Throws if fails
-	void LoadShaderModule(const std::string & glslPath, VkShaderModule & outShaderModule);
-	// Compile a glsl shader to spv, and cache it to inOutSpvPath.
-	// If it is not provided, glslPath.spv will be used as a default.
-	bool CompileGlslToSpv(const std::string & glslPath, std::optional<std::string> inOutSpvPath);
+	// Handle pending window events. Returns false once the window is closed.
+	bool PollEvents();
+
+	// Render Settings.HeadlessFrameCount frames without a window
+	void RunHeadless();
+
+	// Render the benchmark's frames and write its results
+	void RunBenchmark();
+
+	// Get the resources of the frame currently being recorded
+	FrameData & GetCurrentFrame();
+
+	// Declare this frame's passes, rendering into the given swapchain or offscreen image
+	void BuildRenderGraph(FrameData & frame, VkImage backbufferImage, VkImageView backbufferView);
+
+	// Copy a headless frame into its target's readback buffer, after the render graph
+	void RecordReadback(OffscreenTarget & target, VkCommandBuffer cmd);
+	// Hand the target's pending readback to Settings.OnHeadlessFrame, its frame has to be done on the GPU
+	void DeliverReadback(OffscreenTarget & target);
+
+	// Record the contents of the main renderpass into frame.SecondaryCommandBuffers,
+	// split across the job system threads
+	void RecordSecondaryCommands(FrameData & frame, const RasterPassContext & context);
+
+	// Number of draws recorded into the main renderpass this frame
+	uint32_t GetDrawCount() const;
+
+	// Record draws [firstDraw, firstDraw + drawCount) into a secondary command buffer.
+	// Called from multiple threads at once.
+	void RecordDraws(VkCommandBuffer cmd, uint32_t firstDraw, uint32_t drawCount);
 
 private:
 	// Window members
@@ -64,35 +319,107 @@ private:
 	// State members
 	bool IsInitialized = false;
 	std::string AppName;
+	EngineSettings Settings;
 	uint64_t FrameNumber = 0;
+	// What the scene is animated for and headless frames are numbered by. Follows FrameNumber,
+	// unless Settings.AcquireHeadlessFrame hands out the frames.
+	uint64_t SceneFrameNumber = 0;
+
+	// Threading members
+	std::unique_ptr<JobSystem> Jobs;
 
 	// Vulkan members
-	VkInstance Instance;
-	VkDebugUtilsMessengerEXT DebugMessenger;
+	vkb::Instance Instance;
 	VkPhysicalDevice ChosenGPU;
-	VkDevice Device;
-	VkSurfaceKHR Surface;
+	VkPhysicalDeviceProperties GPUProperties;
+	vkb::Device Device;
+	// Device functions loaded from the driver, every system is handed this to make its calls with
+	vkb::DispatchTable Vk;
+	// VK_KHR_dynamic_rendering is enabled and used by the render graphs
+	bool DynamicRendering = false;
+	// Null when headless
+	VkSurfaceKHR Surface = VK_NULL_HANDLE;
+
+	// Memory members
+	std::unique_ptr<GpuAllocator> Allocator;
+	// Per-frame dynamic data, one region per frame in flight
+	std::unique_ptr<UploadRing> Uploads;
+	// Long-lived resource data, copied on the transfer queue
+	std::unique_ptr<StreamingUploader> Streaming;
+
+	// Descriptor members
+	std::unique_ptr<BindlessHeap> Bindless;
 
 	// Swapchain members
-	VkSwapchainKHR Swapchain;
+	VkSwapchainKHR Swapchain = VK_NULL_HANDLE;
 	VkFormat SwapchainFormat;
 	std::vector<VkImage> SwapchainImages;
 	std::vector<VkImageView> SwapchainImageViews;
+	// Signaled when rendering into the image with the same index is finished and it can be presented.
+	// Per image rather than per frame, an earlier present of another image may still be waiting on a frame's.
+	std::vector<VkSemaphore> RenderSemaphores;
+	VkPresentModeKHR PresentMode;
+	// Set when the swapchain has to be recreated before the next frame
+	bool SwapchainDirty = false;
+	// Replace the swapchain when headless, one per frame in flight. SwapchainFormat is their format.
+	std::vector<OffscreenTarget> OffscreenTargets;
+
+	// Frame pacing members
+	std::unique_ptr<FramePacer> Pacer;
 
 	// Commands members
 	VkQueue GraphicsQueue;
 	uint32_t GraphicsQueueFamily;
-	VkCommandPool CommandPool;
-	VkCommandBuffer MainCommandBuffer;
+	// One value per frame, what frames in flight, pacing and deferred destruction wait on
+	std::unique_ptr<TimelineSemaphore> GraphicsTimeline;
+	// Flushed every frame, after waiting for the frame in flight
+	std::unique_ptr<DeletionQueue> Deletions;
+	// Same as the graphics queue if the GPU has no separate transfer family
+	VkQueue TransferQueue;
+	uint32_t TransferQueueFamily;
+	// Same as the graphics queue if the GPU has no separate compute family
+	VkQueue ComputeQueue;
+	uint32_t ComputeQueueFamily;
+	std::unique_ptr<AsyncCompute> Compute;
+
+	// Profiling members
+	std::unique_ptr<GpuProfiler> GpuTimings;
+	std::unique_ptr<CpuProfiler> CpuTimings;
+
+	// Shader members
+	std::unique_ptr<ShaderLibrary> Shaders;
+	// Only with Settings.HotReloadShaders
+	std::unique_ptr<ShaderWatcher> Watcher;
+	ShaderHandle TriangleVertShader;
+	ShaderHandle TriangleFragShader;
+
+	// Pipeline members
+	std::unique_ptr<PipelineCache> DiskPipelineCache;
+	std::unique_ptr<PipelineLibrary> Pipelines;
+	VkPipelineLayout TrianglePipelineLayout;
+	PipelineHandle TrianglePipeline;
+	// Triangle positions for the frame being recorded, lives in the upload ring
+	UploadAllocation TriangleVertices;
+	// Full screen triangle of the benchmark's overdraw layers, in the upload ring as well
+	UploadAllocation OverdrawVertices;
+
+	// Benchmark members.
+	// Settings.Benchmark.StreamedBytesPerFrame of data, streamed into StreamedBuffer every frame.
+	// The buffer is shared concurrently with the transfer queue, so it is never handed back and forth.
+	std::vector<uint8_t> StreamedData;
+	Buffer StreamedBuffer;
+
+	// Scene members
+	std::unique_ptr<GpuScene> Scene;
+	// Entities of the scene, has to outlive it
+	std::unique_ptr<SceneStore> SceneData;
 
-	// Renderpass members
+	// Renderpass members.
+	// Pipelines are built against this one, the render graph creates compatible ones for its passes.
 	VkRenderPass RenderPass;
-	std::vector<VkFramebuffer> Framebuffers;
 
-	// Synchronization members
-	VkSemaphore PresentSemaphore;
-	VkSemaphore RenderSemaphore;
-	VkFence RenderFence;
+	// Frame members, indexed by FrameNumber % FramesInFlight
+	std::vector<FrameData> Frames;
 };
 
 } // namespace core
@@ -0,0 +1,73 @@
+#include "FramePacer.h"
+
+namespace core {
+
+namespace {
+
+// Don't hang forever if the presentation engine never gets to a frame, e.g. a minimized window
+constexpr uint64_t PaceTimeout = 100000000;
+
+} // anonymous namespace
+
+////////////////////////////////////////////////////////////////////////////////
+
+FramePacer::FramePacer(const vkb::DispatchTable & vk, const TimelineSemaphore & graphicsTimeline, bool presentWait, uint32_t maxQueuedFrames)
+	: Vk(vk)
+	, GraphicsTimeline(graphicsTimeline)
+	, PresentWait(presentWait)
+	, MaxQueuedFrames(maxQueuedFrames)
+{
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void FramePacer::SetMaxQueuedFrames(uint32_t maxQueuedFrames) {
+	MaxQueuedFrames = maxQueuedFrames;
+
+	while (Queued.size() > MaxQueuedFrames)
+		Queued.pop_front();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void FramePacer::Wait() {
+	if (MaxQueuedFrames == 0 || Queued.size() < MaxQueuedFrames)
+		return;
+
+	const QueuedFrame & frame = Queued.front();
+
+	// Errors like out of date swapchains just mean there is nothing left to wait for
+	if (PresentWait)
+		Vk.waitForPresentKHR(frame.Swapchain, frame.PresentId, PaceTimeout);
+	else
+		GraphicsTimeline.Wait(frame.RenderValue, PaceTimeout);
+
+	Queued.pop_front();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void FramePacer::OnPresent(VkSwapchainKHR swapchain, uint64_t renderValue) {
+	QueuedFrame frame;
+	frame.Swapchain = swapchain;
+	frame.PresentId = NextPresentId++;
+	frame.RenderValue = renderValue;
+	LastSwapchain = swapchain;
+
+	if (MaxQueuedFrames == 0)
+		return;
+
+	Queued.push_back(frame);
+	while (Queued.size() > MaxQueuedFrames)
+		Queued.pop_front();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void FramePacer::Reset() {
+	Queued.clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+} // namespace core
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "TimelineSemaphore.h"
+#include "VkBootStrap/VkBootstrapDispatch.h"
+
+#include <deque>
+
+namespace core {
+
+////////////////////////////////////////////////////////////////////////////////
+// Limits how many presented frames may be queued up ahead of the display.
+// Every queued frame is another frame of input latency, so interactive
+// workloads want as few as the GPU can keep busy with.
+//
+// With VK_KHR_present_wait the pacer waits until an earlier frame has
+// actually reached the screen. Without it, it falls back to waiting until
+// that frame has finished rendering, using its value on the graphics timeline.
+// Not thread safe, only the presenting thread may use it.
+class FramePacer {
+public:
+	// presentWait only if VK_KHR_present_wait is enabled. graphicsTimeline is signaled by every frame's submission.
+	FramePacer(const vkb::DispatchTable & vk, const TimelineSemaphore & graphicsTimeline, bool presentWait, uint32_t maxQueuedFrames);
+
+	// 0 disables pacing, frames are then only limited by frames in flight
+	void SetMaxQueuedFrames(uint32_t maxQueuedFrames);
+	uint32_t GetMaxQueuedFrames() const { return MaxQueuedFrames; }
+
+	bool UsesPresentWait() const { return PresentWait; }
+
+	// Block until at most MaxQueuedFrames - 1 earlier frames are still on their way to the screen.
+	// Call before recording a frame, so the input it samples is as fresh as possible.
+	void Wait();
+
+	// Present id to pass in VkPresentIdKHR for the frame being presented
+	uint64_t GetNextPresentId() const { return NextPresentId; }
+
+	// Present id of the latest present, if it was to swapchain. 0 otherwise, e.g. nothing was presented to it yet
+	uint64_t GetLastPresentId(VkSwapchainKHR swapchain) const { return swapchain == LastSwapchain ? NextPresentId - 1 : 0; }
+
+	// Call after presenting, with the graphics timeline value the frame's submission signals
+	void OnPresent(VkSwapchainKHR swapchain, uint64_t renderValue);
+
+	// Forget every queued frame, e.g. after the swapchain was recreated
+	void Reset();
+
+private:
+	struct QueuedFrame {
+		VkSwapchainKHR Swapchain = VK_NULL_HANDLE;
+		uint64_t PresentId = 0;
+		uint64_t RenderValue = 0;
+	};
+
+private:
+	const vkb::DispatchTable & Vk;
+	const TimelineSemaphore & GraphicsTimeline;
+	bool PresentWait;
+	uint32_t MaxQueuedFrames;
+
+	// Present ids must increase for each present to a swapchain
+	uint64_t NextPresentId = 1;
+	VkSwapchainKHR LastSwapchain = VK_NULL_HANDLE;
+	// Most recent frames, oldest first
+	std::deque<QueuedFrame> Queued;
+};
+
+} // namespace core
@@ -0,0 +1,425 @@
+#include "GpuAllocator.h"
+
+#include <algorithm>
+#include <bit>
+#include <climits>
+#include <stdexcept>
+
+namespace core {
+
+namespace {
+
+// Upper bound for a block, smaller heaps get proportionally smaller blocks
+constexpr VkDeviceSize MaxBlockSize = 256ull * 1024 * 1024;
+
+// Anything bigger than this fraction of a block gets its own VkDeviceMemory
+constexpr VkDeviceSize DedicatedAllocationDivisor = 2;
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Flags a memory type must have, should have, and should preferably not have for a usage
+struct MemoryFlags {
+	VkMemoryPropertyFlags Required;
+	VkMemoryPropertyFlags Preferred;
+	VkMemoryPropertyFlags Avoided;
+};
+
+MemoryFlags GetMemoryFlags(MemoryUsage usage) {
+	switch (usage) {
+	case MemoryUsage::CpuToGpu:
+		// Staging data shouldn't eat into small host visible device local heaps
+		return {
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+			, 0
+			, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+		};
+
+	case MemoryUsage::GpuToCpu:
+		// Cached memory makes CPU reads fast
+		return {
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+			, VK_MEMORY_PROPERTY_HOST_CACHED_BIT
+			, 0
+		};
+
+	case MemoryUsage::GpuOnly:
+	default:
+		// Integrated GPUs may not have a type that is device local only
+		return {
+			0
+			, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+			, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+		};
+	}
+}
+
+} // anonymous namespace
+
+////////////////////////////////////////////////////////////////////////////////
+
+GpuAllocator::GpuAllocator(
+	const vkb::DispatchTable & vk
+	, const VkPhysicalDeviceProperties & gpuProperties
+	, const VkPhysicalDeviceMemoryProperties & memoryProperties)
+	: Vk(vk)
+	, MemoryProperties(memoryProperties)
+	, Limits(gpuProperties.limits)
+{
+	Pools.resize(MemoryProperties.memoryTypeCount * 2);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+GpuAllocator::~GpuAllocator() {
+	for (BlockPool & pool : Pools) {
+		for (std::unique_ptr<MemoryBlock> & block : pool.Blocks)
+			FreeDeviceMemory(block->Memory, block->Mapped != nullptr);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+Allocation GpuAllocator::Allocate(const VkMemoryRequirements & requirements, MemoryUsage usage, bool linear) {
+	const uint32_t memoryType = FindMemoryType(requirements.memoryTypeBits, usage);
+	const VkDeviceSize blockSize = GetBlockSize(memoryType);
+
+	Allocation allocation;
+	allocation.Size = requirements.size;
+	allocation.MemoryType = memoryType;
+
+	// Large resources would waste most of a block, give them their own memory
+	if (requirements.size > blockSize / DedicatedAllocationDivisor) {
+		std::lock_guard<std::mutex> lock(Mutex);
+		allocation.Memory = AllocateDeviceMemory(requirements.size, memoryType, &allocation.Mapped);
+		return allocation;
+	}
+
+	std::lock_guard<std::mutex> lock(Mutex);
+	BlockPool & pool = Pools[memoryType * 2 + (linear ? 1 : 0)];
+
+	MemoryBlock * block = nullptr;
+	VkDeviceSize offset = 0;
+	for (std::unique_ptr<MemoryBlock> & candidate : pool.Blocks) {
+		if (candidate->Ranges.Allocate(requirements.size, requirements.alignment, offset)) {
+			block = candidate.get();
+			break;
+		}
+	}
+
+	// Every block is full, grow the pool
+	if (!block) {
+		auto newBlock = std::make_unique<MemoryBlock>();
+		void * mapped = nullptr;
+		newBlock->Memory = AllocateDeviceMemory(blockSize, memoryType, &mapped);
+		newBlock->MemoryType = memoryType;
+		newBlock->Mapped = static_cast<uint8_t *>(mapped);
+		newBlock->Ranges.Reset(blockSize);
+
+		block = newBlock.get();
+		pool.Blocks.push_back(std::move(newBlock));
+
+		if (!block->Ranges.Allocate(requirements.size, requirements.alignment, offset))
+			throw std::runtime_error("Allocation does not fit in a memory block");
+	}
+
+	allocation.Memory = block->Memory;
+	allocation.Offset = offset;
+	allocation.Mapped = block->Mapped ? block->Mapped + offset : nullptr;
+	allocation.Block = block;
+	return allocation;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void GpuAllocator::Free(Allocation & allocation) {
+	if (!allocation.IsValid())
+		return;
+
+	std::lock_guard<std::mutex> lock(Mutex);
+
+	if (!allocation.Block) {
+		FreeDeviceMemory(allocation.Memory, allocation.Mapped != nullptr);
+		allocation = {};
+		return;
+	}
+
+	MemoryBlock * block = allocation.Block;
+	block->Ranges.Free(allocation.Offset, allocation.Size);
+	allocation = {};
+
+	// Keep one empty block around per pool, so a resource being recreated doesn't thrash vkAllocateMemory
+	if (!block->Ranges.IsEmpty())
+		return;
+
+	for (BlockPool & pool : Pools) {
+		auto it = std::find_if(pool.Blocks.begin(), pool.Blocks.end(),
+			[block](const std::unique_ptr<MemoryBlock> & candidate) { return candidate.get() == block; });
+
+		if (it == pool.Blocks.end())
+			continue;
+
+		if (pool.Blocks.size() > 1) {
+			FreeDeviceMemory(block->Memory, block->Mapped != nullptr);
+			pool.Blocks.erase(it);
+		}
+		return;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+Buffer GpuAllocator::CreateBuffer(
+	VkDeviceSize size
+	, VkBufferUsageFlags bufferUsage
+	, MemoryUsage memoryUsage
+	, const std::vector<uint32_t> & queueFamilies)
+{
+	VkBufferCreateInfo bufferInfo = {};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.pNext = nullptr;
+
+	bufferInfo.size = size;
+	bufferInfo.usage = bufferUsage;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	if (queueFamilies.size() > 1) {
+		bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+		bufferInfo.queueFamilyIndexCount = static_cast<uint32_t>(queueFamilies.size());
+		bufferInfo.pQueueFamilyIndices = queueFamilies.data();
+	}
+
+	Buffer buffer;
+	if (Vk.createBuffer(&bufferInfo, nullptr, &buffer.Handle))
+		throw std::runtime_error("Failed to create buffer");
+
+	VkMemoryRequirements requirements;
+	Vk.getBufferMemoryRequirements(buffer.Handle, &requirements);
+
+	try {
+		buffer.Memory = Allocate(requirements, memoryUsage, true);
+	} catch (...) {
+		Vk.destroyBuffer(buffer.Handle, nullptr);
+		throw;
+	}
+
+	if (Vk.bindBufferMemory(buffer.Handle, buffer.Memory.Memory, buffer.Memory.Offset)) {
+		DestroyBuffer(buffer);
+		throw std::runtime_error("Failed to bind buffer memory");
+	}
+
+	return buffer;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void GpuAllocator::DestroyBuffer(Buffer & buffer) {
+	if (buffer.Handle != VK_NULL_HANDLE)
+		Vk.destroyBuffer(buffer.Handle, nullptr);
+
+	Free(buffer.Memory);
+	buffer = {};
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+Image GpuAllocator::CreateImage(const VkImageCreateInfo & imageInfo, MemoryUsage memoryUsage) {
+	Image image;
+	if (Vk.createImage(&imageInfo, nullptr, &image.Handle))
+		throw std::runtime_error("Failed to create image");
+
+	VkMemoryRequirements requirements;
+	Vk.getImageMemoryRequirements(image.Handle, &requirements);
+
+	try {
+		image.Memory = Allocate(requirements, memoryUsage, imageInfo.tiling == VK_IMAGE_TILING_LINEAR);
+	} catch (...) {
+		Vk.destroyImage(image.Handle, nullptr);
+		throw;
+	}
+
+	if (Vk.bindImageMemory(image.Handle, image.Memory.Memory, image.Memory.Offset)) {
+		DestroyImage(image);
+		throw std::runtime_error("Failed to bind image memory");
+	}
+
+	return image;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void GpuAllocator::DestroyImage(Image & image) {
+	if (image.Handle != VK_NULL_HANDLE)
+		Vk.destroyImage(image.Handle, nullptr);
+
+	Free(image.Memory);
+	image = {};
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+uint32_t GpuAllocator::FindMemoryType(uint32_t memoryTypeBits, MemoryUsage usage) const {
+	const MemoryFlags flags = GetMemoryFlags(usage);
+
+	uint32_t bestType = UINT32_MAX;
+	int bestScore = INT_MIN;
+
+	for (uint32_t i = 0; i < MemoryProperties.memoryTypeCount; i++) {
+		if (!(memoryTypeBits & (1u << i)))
+			continue;
+
+		const VkMemoryPropertyFlags typeFlags = MemoryProperties.memoryTypes[i].propertyFlags;
+		if ((typeFlags & flags.Required) != flags.Required)
+			continue;
+
+		// One point per preferred flag, lose one per avoided flag. Ties go to the lower index.
+		const int score = std::popcount(typeFlags & flags.Preferred)
+			- std::popcount(typeFlags & flags.Avoided);
+
+		if (score > bestScore) {
+			bestScore = score;
+			bestType = i;
+		}
+	}
+
+	if (bestType == UINT32_MAX)
+		throw std::runtime_error("No compatible memory type");
+
+	return bestType;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+VkDeviceMemory GpuAllocator::AllocateDeviceMemory(VkDeviceSize size, uint32_t memoryType, void ** outMapped) {
+	if (DeviceAllocationCount >= Limits.maxMemoryAllocationCount)
+		throw std::runtime_error("Exceeded maxMemoryAllocationCount");
+
+	VkMemoryAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.pNext = nullptr;
+
+	allocInfo.allocationSize = size;
+	allocInfo.memoryTypeIndex = memoryType;
+
+	VkDeviceMemory memory;
+	if (Vk.allocateMemory(&allocInfo, nullptr, &memory))
+		throw std::runtime_error("Failed to allocate device memory");
+
+	DeviceAllocationCount++;
+
+	// Host visible memory stays mapped for its whole lifetime
+	*outMapped = nullptr;
+	const VkMemoryPropertyFlags typeFlags = MemoryProperties.memoryTypes[memoryType].propertyFlags;
+	if (typeFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+		if (Vk.mapMemory(memory, 0, VK_WHOLE_SIZE, 0, outMapped)) {
+			FreeDeviceMemory(memory, false);
+			throw std::runtime_error("Failed to map device memory");
+		}
+	}
+
+	return memory;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void GpuAllocator::FreeDeviceMemory(VkDeviceMemory memory, bool mapped) {
+	if (mapped)
+		Vk.unmapMemory(memory);
+
+	Vk.freeMemory(memory, nullptr);
+	DeviceAllocationCount--;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+VkDeviceSize GpuAllocator::GetBlockSize(uint32_t memoryType) const {
+	const uint32_t heapIndex = MemoryProperties.memoryTypes[memoryType].heapIndex;
+	const VkDeviceSize heapSize = MemoryProperties.memoryHeaps[heapIndex].size;
+
+	// Don't let a single block take a big bite out of small heaps
+	return std::min(MaxBlockSize, heapSize / 8);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+LinearArena::LinearArena(const Allocation & allocation)
+	: Memory(allocation)
+{
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool LinearArena::Allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize & outOffset) {
+	// Align relative to the memory object, that is what Vulkan's alignment rules refer to
+	const VkDeviceSize offset = AlignUp(Memory.Offset + Head, alignment) - Memory.Offset;
+	if (offset + size > Memory.Size)
+		return false;
+
+	Head = offset + size;
+	outOffset = offset;
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+PoolAllocator::PoolAllocator(
+	GpuAllocator & allocator
+	, const VkMemoryRequirements & slotRequirements
+	, MemoryUsage usage
+	, bool linear
+	, uint32_t slotsPerChunk)
+	: Allocator(allocator)
+	, Usage(usage)
+	, Linear(linear)
+	, SlotStride(AlignUp(slotRequirements.size, slotRequirements.alignment))
+	, SlotsPerChunk(std::max(1u, slotsPerChunk))
+{
+	ChunkRequirements = slotRequirements;
+	ChunkRequirements.size = SlotStride * SlotsPerChunk;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+PoolAllocator::~PoolAllocator() {
+	for (Allocation & chunk : Chunks)
+		Allocator.Free(chunk);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+Allocation PoolAllocator::Allocate() {
+	std::lock_guard<std::mutex> lock(Mutex);
+
+	if (FreeSlots.empty()) {
+		Allocation chunk = Allocator.Allocate(ChunkRequirements, Usage, Linear);
+		Chunks.push_back(chunk);
+
+		// Push in reverse so slots are handed out front to back
+		for (uint32_t i = SlotsPerChunk; i-- > 0;) {
+			Allocation slot = chunk;
+			slot.Offset = chunk.Offset + i * SlotStride;
+			slot.Size = SlotStride;
+			slot.Mapped = chunk.Mapped ? static_cast<uint8_t *>(chunk.Mapped) + i * SlotStride : nullptr;
+			FreeSlots.push_back(slot);
+		}
+	}
+
+	Allocation slot = FreeSlots.back();
+	FreeSlots.pop_back();
+	return slot;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void PoolAllocator::Free(Allocation & allocation) {
+	if (!allocation.IsValid())
+		return;
+
+	std::lock_guard<std::mutex> lock(Mutex);
+	FreeSlots.push_back(allocation);
+	allocation = {};
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+} // namespace core
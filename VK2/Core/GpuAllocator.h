@@ -0,0 +1,194 @@
+#pragma once
+
+#include "RangeAllocator.h"
+#include "VkBootStrap/VkBootstrapDispatch.h"
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace core {
+
+////////////////////////////////////////////////////////////////////////////////
+// How a resource's memory is going to be accessed
+enum class MemoryUsage {
+	// Only touched by the GPU, e.g. render targets and static meshes
+	GpuOnly,
+	// Written by the CPU and read by the GPU, e.g. staging and per-frame data.
+	// Persistently mapped.
+	CpuToGpu,
+	// Written by the GPU and read back by the CPU. Persistently mapped.
+	GpuToCpu
+};
+
+struct MemoryBlock;
+
+////////////////////////////////////////////////////////////////////////////////
+// A sub-range of a VkDeviceMemory block
+struct Allocation {
+	VkDeviceMemory Memory = VK_NULL_HANDLE;
+	VkDeviceSize Offset = 0;
+	VkDeviceSize Size = 0;
+	// Start of the allocation in host memory, null unless the memory is host visible
+	void * Mapped = nullptr;
+	uint32_t MemoryType = 0;
+
+	// Block the allocation came from, null for dedicated allocations
+	MemoryBlock * Block = nullptr;
+
+	bool IsValid() const { return Memory != VK_NULL_HANDLE; }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+struct Buffer {
+	VkBuffer Handle = VK_NULL_HANDLE;
+	Allocation Memory;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+struct Image {
+	VkImage Handle = VK_NULL_HANDLE;
+	Allocation Memory;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// One VkDeviceMemory that allocations are carved out of
+struct MemoryBlock {
+	VkDeviceMemory Memory = VK_NULL_HANDLE;
+	uint32_t MemoryType = 0;
+	// Whole block is mapped once for its lifetime if the memory is host visible
+	uint8_t * Mapped = nullptr;
+	RangeAllocator Ranges;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Sub-allocates buffer and image memory out of large VkDeviceMemory blocks,
+// so the engine stays far below maxMemoryAllocationCount and rarely calls
+// vkAllocateMemory. Memory types are picked from the GPU's memory properties.
+// Thread safe.
+class GpuAllocator {
+public:
+	// Properties of the GPU the device was created on, queried by VkBootstrap when selecting it
+	GpuAllocator(
+		const vkb::DispatchTable & vk
+		, const VkPhysicalDeviceProperties & gpuProperties
+		, const VkPhysicalDeviceMemoryProperties & memoryProperties);
+	// Frees every block, all resources must have been destroyed
+	~GpuAllocator();
+
+	GpuAllocator(const GpuAllocator &) = delete;
+	GpuAllocator & operator=(const GpuAllocator &) = delete;
+
+	// Allocate memory for a resource. Linear resources are buffers and linearly tiled images.
+	// Throws if out of memory.
+	Allocation Allocate(const VkMemoryRequirements & requirements, MemoryUsage usage, bool linear);
+	void Free(Allocation & allocation);
+
+	// Create a buffer and bind memory to it. Throws if fails.
+	// With more than one queue family the buffer is shared between them concurrently, otherwise it is exclusive.
+	Buffer CreateBuffer(
+		VkDeviceSize size
+		, VkBufferUsageFlags bufferUsage
+		, MemoryUsage memoryUsage
+		, const std::vector<uint32_t> & queueFamilies = {});
+	void DestroyBuffer(Buffer & buffer);
+
+	// Create an image and bind memory to it. Throws if fails.
+	Image CreateImage(const VkImageCreateInfo & imageInfo, MemoryUsage memoryUsage);
+	void DestroyImage(Image & image);
+
+	// Pick a memory type for the given usage. Throws if none is compatible.
+	uint32_t FindMemoryType(uint32_t memoryTypeBits, MemoryUsage usage) const;
+
+	VkDevice GetDevice() const { return Vk.device; }
+	const VkPhysicalDeviceMemoryProperties & GetMemoryProperties() const { return MemoryProperties; }
+	const VkPhysicalDeviceLimits & GetLimits() const { return Limits; }
+
+private:
+	// Blocks for one memory type. Linear and optimally tiled resources live in
+	// separate blocks, so bufferImageGranularity never has to be considered.
+	struct BlockPool {
+		std::vector<std::unique_ptr<MemoryBlock>> Blocks;
+	};
+
+	// Allocate a whole VkDeviceMemory. Throws if fails.
+	VkDeviceMemory AllocateDeviceMemory(VkDeviceSize size, uint32_t memoryType, void ** outMapped);
+	void FreeDeviceMemory(VkDeviceMemory memory, bool mapped);
+
+	VkDeviceSize GetBlockSize(uint32_t memoryType) const;
+
+private:
+	const vkb::DispatchTable & Vk;
+	VkPhysicalDeviceMemoryProperties MemoryProperties;
+	VkPhysicalDeviceLimits Limits;
+
+	std::mutex Mutex;
+	// Indexed by memory type * 2 + linear
+	std::vector<BlockPool> Pools;
+	uint32_t DeviceAllocationCount = 0;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Bump allocator over a single allocation, for transient data that is
+// thrown away all at once, e.g. everything written in one frame.
+// Not thread safe.
+class LinearArena {
+public:
+	LinearArena() = default;
+	// The arena doesn't own the allocation
+	explicit LinearArena(const Allocation & allocation);
+
+	// Returns false if the arena is full. outOffset is relative to the arena's allocation.
+	bool Allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize & outOffset);
+
+	// Throw away everything allocated so far
+	void Reset() { Head = 0; }
+
+	const Allocation & GetAllocation() const { return Memory; }
+	VkDeviceSize GetUsedSize() const { return Head; }
+
+private:
+	Allocation Memory;
+	VkDeviceSize Head = 0;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Pool of equally sized slots for resources that all have the same memory
+// requirements, e.g. fixed size textures or per-object buffers.
+// Allocating and freeing a slot never touches the block free lists.
+// Thread safe.
+class PoolAllocator {
+public:
+	PoolAllocator(
+		GpuAllocator & allocator
+		, const VkMemoryRequirements & slotRequirements
+		, MemoryUsage usage
+		, bool linear
+		, uint32_t slotsPerChunk = 64);
+	// Returns every chunk to the allocator, all slots must have been freed
+	~PoolAllocator();
+
+	PoolAllocator(const PoolAllocator &) = delete;
+	PoolAllocator & operator=(const PoolAllocator &) = delete;
+
+	// Throws if out of memory
+	Allocation Allocate();
+	void Free(Allocation & allocation);
+
+private:
+	GpuAllocator & Allocator;
+	VkMemoryRequirements ChunkRequirements;
+	MemoryUsage Usage;
+	bool Linear;
+	VkDeviceSize SlotStride;
+	uint32_t SlotsPerChunk;
+
+	std::mutex Mutex;
+	std::vector<Allocation> Chunks;
+	std::vector<Allocation> FreeSlots;
+};
+
+} // namespace core
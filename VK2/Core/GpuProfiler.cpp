@@ -0,0 +1,266 @@
+#include "GpuProfiler.h"
+
+#include <stdexcept>
+
+namespace core {
+
+namespace {
+
+// Trace events kept for WriteTrace, a few seconds worth at typical scope counts
+constexpr size_t MaxTraceEvents = 8192;
+
+// Results kept per scope for the averages and percentiles
+constexpr uint32_t ScopeHistoryLength = 240;
+
+constexpr uint32_t StatisticCount = static_cast<uint32_t>(GpuStatistic::Count);
+
+// Must match the order of GpuStatistic, results are written in bit order
+constexpr VkQueryPipelineStatisticFlags StatisticFlags =
+	VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT
+	| VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT
+	| VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT
+	| VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT
+	| VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT;
+
+} // anonymous namespace
+
+////////////////////////////////////////////////////////////////////////////////
+
+GpuProfiler::GpuProfiler(
+	const vkb::DispatchTable & vk
+	, const VkPhysicalDeviceProperties & properties
+	, uint32_t timestampValidBits
+	, bool pipelineStatistics
+	, uint32_t frameCount
+	, uint32_t maxScopesPerFrame)
+	: Vk(vk)
+	, TimestampPeriod(properties.limits.timestampPeriod)
+	, TimestampMask(timestampValidBits >= 64 ? UINT64_MAX : (1ull << timestampValidBits) - 1)
+	, PipelineStatistics(pipelineStatistics)
+	, MaxScopes(maxScopesPerFrame)
+	, Frames(frameCount)
+	, HistoryLength(ScopeHistoryLength)
+{
+	if (!IsEnabled())
+		return;
+
+	VkQueryPoolCreateInfo timestampInfo = {};
+	timestampInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	timestampInfo.pNext = nullptr;
+
+	timestampInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	timestampInfo.queryCount = MaxScopes * 2;
+
+	VkQueryPoolCreateInfo statisticsInfo = {};
+	statisticsInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	statisticsInfo.pNext = nullptr;
+
+	statisticsInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+	statisticsInfo.queryCount = MaxScopes;
+	statisticsInfo.pipelineStatistics = StatisticFlags;
+
+	for (FrameQueries & frame : Frames) {
+		if (Vk.createQueryPool(&timestampInfo, nullptr, &frame.Timestamps))
+			throw std::runtime_error("Failed to create timestamp query pool");
+
+		if (PipelineStatistics && Vk.createQueryPool(&statisticsInfo, nullptr, &frame.Statistics))
+			throw std::runtime_error("Failed to create pipeline statistics query pool");
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+GpuProfiler::~GpuProfiler() {
+	for (FrameQueries & frame : Frames) {
+		Vk.destroyQueryPool(frame.Statistics, nullptr);
+		Vk.destroyQueryPool(frame.Timestamps, nullptr);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void GpuProfiler::BeginFrame(uint32_t frameIndex, VkCommandBuffer cmd) {
+	CurrentFrame = frameIndex;
+	StatisticsActive = false;
+
+	if (!IsEnabled())
+		return;
+
+	FrameQueries & frame = Frames[CurrentFrame];
+	ReadResults(frame);
+
+	frame.Scopes.clear();
+	frame.StatisticsCount = 0;
+
+	// Queries have to be reset before every use, including the first
+	Vk.cmdResetQueryPool(cmd, frame.Timestamps, 0, MaxScopes * 2);
+	if (PipelineStatistics)
+		Vk.cmdResetQueryPool(cmd, frame.Statistics, 0, MaxScopes);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+uint32_t GpuProfiler::BeginScope(VkCommandBuffer cmd, const char * name, bool statistics) {
+	FrameQueries & frame = Frames[CurrentFrame];
+	if (!IsEnabled() || frame.Scopes.size() == MaxScopes)
+		return UINT32_MAX;
+
+	Scope scope;
+	scope.Name = name;
+	scope.Query = static_cast<uint32_t>(frame.Scopes.size() * 2);
+
+	Vk.cmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, frame.Timestamps, scope.Query);
+
+	// Only one statistics query can be active at a time, so nested scopes go without
+	if (PipelineStatistics && statistics && !StatisticsActive) {
+		scope.StatisticsQuery = frame.StatisticsCount++;
+		Vk.cmdBeginQuery(cmd, frame.Statistics, scope.StatisticsQuery, 0);
+		StatisticsActive = true;
+	}
+
+	frame.Scopes.push_back(std::move(scope));
+	return static_cast<uint32_t>(frame.Scopes.size() - 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void GpuProfiler::EndScope(VkCommandBuffer cmd, uint32_t scopeId) {
+	if (scopeId == UINT32_MAX)
+		return;
+
+	FrameQueries & frame = Frames[CurrentFrame];
+	const Scope & scope = frame.Scopes[scopeId];
+
+	if (scope.StatisticsQuery != UINT32_MAX) {
+		Vk.cmdEndQuery(cmd, frame.Statistics, scope.StatisticsQuery);
+		StatisticsActive = false;
+	}
+
+	Vk.cmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, frame.Timestamps, scope.Query + 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+VkQueryPipelineStatisticFlags GpuProfiler::GetStatisticFlags() const {
+	return PipelineStatistics ? StatisticFlags : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+std::vector<GpuScopeSummary> GpuProfiler::GetSummary() const {
+	std::vector<GpuScopeSummary> summary;
+
+	for (const auto & [name, history] : History) {
+		GpuScopeSummary scope;
+		scope.Name = name;
+		scope.AverageMs = history.Milliseconds.GetAverage();
+		scope.P50Ms = history.Milliseconds.GetPercentile(0.50);
+		scope.P95Ms = history.Milliseconds.GetPercentile(0.95);
+		scope.P99Ms = history.Milliseconds.GetPercentile(0.99);
+
+		for (uint32_t i = 0; i < StatisticCount; i++)
+			scope.Statistics[i] = history.Statistics[i].GetAverage();
+
+		summary.push_back(std::move(scope));
+	}
+
+	return summary;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+const RollingStats * GpuProfiler::GetScopeTimes(const std::string & name) const {
+	auto it = History.find(name);
+	return it != History.end() ? &it->second.Milliseconds : nullptr;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void GpuProfiler::ResetStats(uint32_t historyLength) {
+	History.clear();
+	HistoryLength = historyLength;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool GpuProfiler::WriteTrace(const std::string & path) const {
+	std::vector<TraceEvent> events(RecentEvents.begin(), RecentEvents.end());
+	return WriteChromeTrace(path, events, { "GPU" });
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+GpuProfiler::ScopeHistory::ScopeHistory(uint32_t length)
+	: Milliseconds(length)
+{
+	for (RollingStats & statistic : Statistics)
+		statistic = RollingStats(length);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void GpuProfiler::ReadResults(FrameQueries & frame) {
+	if (frame.Scopes.empty())
+		return;
+
+	// The GPU has finished the frame, so this doesn't wait. Skip the frame if the results still aren't there.
+	std::vector<uint64_t> timestamps(frame.Scopes.size() * 2);
+	VkResult result = Vk.getQueryPoolResults(
+		frame.Timestamps
+		, 0
+		, static_cast<uint32_t>(timestamps.size())
+		, timestamps.size() * sizeof(uint64_t)
+		, timestamps.data()
+		, sizeof(uint64_t)
+		, VK_QUERY_RESULT_64_BIT
+	);
+	if (result != VK_SUCCESS)
+		return;
+
+	std::vector<uint64_t> statistics(frame.StatisticsCount * StatisticCount);
+	if (frame.StatisticsCount > 0) {
+		result = Vk.getQueryPoolResults(
+			frame.Statistics
+			, 0
+			, frame.StatisticsCount
+			, statistics.size() * sizeof(uint64_t)
+			, statistics.data()
+			, StatisticCount * sizeof(uint64_t)
+			, VK_QUERY_RESULT_64_BIT
+		);
+		if (result != VK_SUCCESS)
+			statistics.clear();
+	}
+
+	if (TraceOrigin == 0)
+		TraceOrigin = timestamps[0] & TimestampMask;
+
+	for (const Scope & scope : frame.Scopes) {
+		const uint64_t begin = timestamps[scope.Query] & TimestampMask;
+		const uint64_t end = timestamps[scope.Query + 1] & TimestampMask;
+
+		// Masking the difference handles the counter wrapping around
+		const double durationNs = static_cast<double>((end - begin) & TimestampMask) * TimestampPeriod;
+
+		ScopeHistory & history = History.try_emplace(scope.Name, HistoryLength).first->second;
+		history.Milliseconds.Add(durationNs / 1e6);
+
+		if (scope.StatisticsQuery != UINT32_MAX && !statistics.empty()) {
+			for (uint32_t i = 0; i < StatisticCount; i++)
+				history.Statistics[i].Add(static_cast<double>(statistics[scope.StatisticsQuery * StatisticCount + i]));
+		}
+
+		TraceEvent event;
+		event.Name = scope.Name;
+		event.StartMicroseconds = static_cast<double>((begin - TraceOrigin) & TimestampMask) * TimestampPeriod / 1e3;
+		event.DurationMicroseconds = durationNs / 1e3;
+		RecentEvents.push_back(std::move(event));
+	}
+
+	while (RecentEvents.size() > MaxTraceEvents)
+		RecentEvents.pop_front();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+} // namespace core
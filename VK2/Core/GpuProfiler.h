@@ -0,0 +1,160 @@
+#pragma once
+
+#include "Profiling.h"
+#include "VkBootStrap/VkBootstrapDispatch.h"
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace core {
+
+////////////////////////////////////////////////////////////////////////////////
+// Pipeline statistics gathered for each top level scope, in this order
+enum class GpuStatistic : uint32_t {
+	InputAssemblyVertices,
+	VertexShaderInvocations,
+	ClippingPrimitives,
+	FragmentShaderInvocations,
+	ComputeShaderInvocations,
+	Count
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Rolling timings of one named scope, in milliseconds
+struct GpuScopeSummary {
+	std::string Name;
+	double AverageMs = 0.0;
+	double P50Ms = 0.0;
+	double P95Ms = 0.0;
+	double P99Ms = 0.0;
+	// Averages, all zero if pipeline statistics are unavailable or the scope was nested
+	double Statistics[static_cast<uint32_t>(GpuStatistic::Count)] = {};
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Measures GPU time of named scopes with timestamp queries, plus pipeline
+// statistics for scopes that aren't nested in another one.
+//
+// Every frame in flight has its own query pools. Results are read when the
+// frame comes around again, after the GPU has finished it, so reading never
+// waits on the GPU. Scopes with the same name are aggregated into rolling
+// averages and percentiles. Not thread safe, scopes can only be recorded
+// into the primary command buffer.
+class GpuProfiler {
+public:
+	GpuProfiler(
+		const vkb::DispatchTable & vk
+		, const VkPhysicalDeviceProperties & properties
+		, uint32_t timestampValidBits
+		, bool pipelineStatistics
+		, uint32_t frameCount
+		, uint32_t maxScopesPerFrame = 128);
+	~GpuProfiler();
+
+	GpuProfiler(const GpuProfiler &) = delete;
+	GpuProfiler & operator=(const GpuProfiler &) = delete;
+
+	// Collect the results of the frame's last use and reset its queries.
+	// cmd must be recording and outside a render pass.
+	void BeginFrame(uint32_t frameIndex, VkCommandBuffer cmd);
+
+	// Returns an id for EndScope. Scopes must be ended in reverse order
+	// and outside render passes if they started outside one.
+	// Only one statistics query can be active at a time, so scopes nested in one that has it
+	// are timed only. Scopes wrapping others, like a whole frame, should pass statistics = false
+	// so the scopes inside them get the statistics.
+	uint32_t BeginScope(VkCommandBuffer cmd, const char * name, bool statistics = true);
+	void EndScope(VkCommandBuffer cmd, uint32_t scope);
+
+	// False if the graphics queue doesn't support timestamps. Scopes are ignored then.
+	bool IsEnabled() const { return TimestampMask != 0; }
+
+	// Statistics that secondary command buffers executed inside a scope have to inherit,
+	// through VkCommandBufferInheritanceInfo::pipelineStatistics. 0 without statistics.
+	VkQueryPipelineStatisticFlags GetStatisticFlags() const;
+
+	std::vector<GpuScopeSummary> GetSummary() const;
+
+	// Rolling timings of the scopes with this name, in milliseconds. Null if there were none yet.
+	const RollingStats * GetScopeTimes(const std::string & name) const;
+
+	// Drop the scope timings so far, and keep the last historyLength results of each scope from now on.
+	// Results arrive frameCount frames late, the next ones read still belong to frames recorded before the call.
+	void ResetStats(uint32_t historyLength);
+
+	// Write the timings of the last frames that were read back. Returns false if fails.
+	bool WriteTrace(const std::string & path) const;
+
+private:
+	struct Scope {
+		// Copied, results are only read frames later
+		std::string Name;
+		// Index of the begin timestamp, end is the next one
+		uint32_t Query = 0;
+		// UINT32_MAX if the scope has no statistics query
+		uint32_t StatisticsQuery = UINT32_MAX;
+	};
+
+	struct FrameQueries {
+		VkQueryPool Timestamps = VK_NULL_HANDLE;
+		VkQueryPool Statistics = VK_NULL_HANDLE;
+		std::vector<Scope> Scopes;
+		uint32_t StatisticsCount = 0;
+	};
+
+	struct ScopeHistory {
+		explicit ScopeHistory(uint32_t length);
+
+		RollingStats Milliseconds;
+		RollingStats Statistics[static_cast<uint32_t>(GpuStatistic::Count)];
+	};
+
+	void ReadResults(FrameQueries & frame);
+
+private:
+	const vkb::DispatchTable & Vk;
+	// Nanoseconds per timestamp tick
+	double TimestampPeriod;
+	uint64_t TimestampMask;
+	bool PipelineStatistics;
+	uint32_t MaxScopes;
+
+	std::vector<FrameQueries> Frames;
+	uint32_t CurrentFrame = 0;
+	// A scope with a statistics query is open
+	bool StatisticsActive = false;
+
+	std::map<std::string, ScopeHistory> History;
+	// Capacity of each scope's stats
+	uint32_t HistoryLength;
+	// Events of the most recent frames, oldest first
+	std::deque<TraceEvent> RecentEvents;
+	// First timestamp read, trace times are relative to it
+	uint64_t TraceOrigin = 0;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Times everything recorded into cmd while the object is alive
+class GpuProfileScope {
+public:
+	GpuProfileScope(GpuProfiler & profiler, VkCommandBuffer cmd, const char * name)
+		: Profiler(profiler)
+		, Cmd(cmd)
+		, Scope(profiler.BeginScope(cmd, name))
+	{
+	}
+
+	~GpuProfileScope() { Profiler.EndScope(Cmd, Scope); }
+
+	GpuProfileScope(const GpuProfileScope &) = delete;
+	GpuProfileScope & operator=(const GpuProfileScope &) = delete;
+
+private:
+	GpuProfiler & Profiler;
+	VkCommandBuffer Cmd;
+	uint32_t Scope;
+};
+
+} // namespace core
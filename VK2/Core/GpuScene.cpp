@@ -0,0 +1,1076 @@
+#include "GpuScene.h"
+
+#include "AsyncCompute.h"
+#include "PipelineCache.h"
+#include "SceneStore.h"
+#include "ShaderLibrary.h"
+#include "SimdKernels.h"
+#include "UploadRing.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+namespace core {
+
+namespace {
+
+// Mips the Hi-Z pyramid can have, enough for a 32k depth buffer
+constexpr uint32_t MaxHiZMips = 16;
+
+constexpr uint32_t CullGroupSize = 64;
+constexpr uint32_t HiZGroupSize = 8;
+
+////////////////////////////////////////////////////////////////////////////////
+// GPU layouts, have to match cull.comp, hiz.comp and mesh.vert
+
+struct GpuMeshInfo {
+	uint32_t IndexCount;
+	uint32_t FirstIndex;
+	int32_t VertexOffset;
+	uint32_t Pad;
+};
+static_assert(sizeof(GpuMeshInfo) == 16, "GpuMeshInfo has to match the std430 layout");
+
+struct CullData {
+	Mat4 ViewProj;
+	Vec4 FrustumPlanes[6];
+	float HiZSize[2];
+	uint32_t HiZMipCount;
+	uint32_t InstanceCount;
+	uint32_t OcclusionCulling;
+	uint32_t Pad[3];
+};
+static_assert(sizeof(CullData) == 192, "CullData has to match the std430 layout");
+
+////////////////////////////////////////////////////////////////////////////////
+// Push constants, heap indices where the shaders take them
+
+struct CullConstants {
+	uint32_t CullData;
+	uint32_t Meshes;
+	uint32_t Bounds;
+	uint32_t MeshIds;
+	uint32_t DrawCommands;
+	uint32_t DrawCount;
+	uint32_t Visible;
+	uint32_t HiZ;
+};
+
+struct HiZConstants {
+	int32_t DstSize[2];
+	uint32_t FromDepth;
+	uint32_t Depth;
+	uint32_t Src;
+	uint32_t Dst;
+};
+
+struct DrawConstants {
+	Mat4 ViewProj;
+	uint32_t Transforms;
+	// Store index of each drawn instance, looked up with gl_InstanceIndex
+	uint32_t InstanceIds;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Largest power of two no larger than value
+uint32_t FloorPowerOfTwo(uint32_t value) {
+	uint32_t result = 1;
+	while (result * 2 <= value)
+		result *= 2;
+	return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Every family of both lists once, what a resource used on all of their queues is shared between
+std::vector<uint32_t> MergeQueueFamilies(std::vector<uint32_t> families, const std::vector<uint32_t> & more) {
+	for (uint32_t family : more) {
+		if (std::find(families.begin(), families.end(), family) == families.end())
+			families.push_back(family);
+	}
+	return families;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void ComputeBarrier(const vkb::DispatchTable & vk, VkCommandBuffer cmd, VkPipelineStageFlags srcStages, VkAccessFlags srcAccess, VkAccessFlags dstAccess) {
+	VkMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.pNext = nullptr;
+
+	barrier.srcAccessMask = srcAccess;
+	barrier.dstAccessMask = dstAccess;
+
+	vk.cmdPipelineBarrier(
+		cmd
+		, srcStages
+		, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
+		, 0
+		, 1, &barrier
+		, 0, nullptr
+		, 0, nullptr
+	);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+} // anonymous namespace
+
+////////////////////////////////////////////////////////////////////////////////
+
+GpuScene::GpuScene(
+	const vkb::DispatchTable & vk
+	, GpuAllocator & allocator
+	, AsyncCompute & compute
+	, TimelineSemaphore & graphicsTimeline
+	, StreamingUploader & streaming
+	, UploadRing & uploads
+	, BindlessHeap & heap
+	, ShaderLibrary & shaders
+	, PipelineLibrary & pipelines
+	, PipelineCache & cache
+	, DeletionQueue & deletions
+	, uint32_t maxFramesInFlight
+	, VkFormat colorFormat
+	, bool dynamicRendering
+	, bool gpuCulling)
+	: Vk(vk)
+	, Allocator(allocator)
+	, Compute(compute)
+	, GraphicsTimeline(graphicsTimeline)
+	, Streaming(streaming)
+	, Uploads(uploads)
+	, Heap(heap)
+	, Shaders(shaders)
+	, Pipelines(pipelines)
+	, Cache(cache)
+	, Deletions(deletions)
+	, GpuCulling(gpuCulling)
+	, AsyncCulling(gpuCulling && compute.IsAsync())
+{
+	if (GpuCulling) {
+		CullShader = Shaders.LoadAsync("./Shaders/cull.comp");
+		HiZShader = Shaders.LoadAsync("./Shaders/hiz.comp");
+	}
+	DrawVertShader = Shaders.LoadAsync("./Shaders/mesh.vert");
+	DrawFragShader = Shaders.LoadAsync("./Shaders/mesh.frag");
+
+	Frames.resize(maxFramesInFlight);
+
+	// texelFetch ignores filtering, the sampler only has to allow every mip
+	VkSamplerCreateInfo samplerInfo = {};
+	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerInfo.pNext = nullptr;
+
+	samplerInfo.magFilter = VK_FILTER_NEAREST;
+	samplerInfo.minFilter = VK_FILTER_NEAREST;
+	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.minLod = 0.f;
+	samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+
+	if (Vk.createSampler(&samplerInfo, nullptr, &HiZSampler))
+		throw std::runtime_error("Failed to create Hi-Z sampler");
+
+	GraphicsPipelineDesc drawDesc;
+	drawDesc.VertexShader = DrawVertShader;
+	drawDesc.FragmentShader = DrawFragShader;
+	drawDesc.Layout = Heap.GetPipelineLayout();
+	if (dynamicRendering) {
+		drawDesc.ColorFormats = { colorFormat };
+		drawDesc.DepthFormat = DepthFormat;
+	} else {
+		CreateCompatibleRenderPass(colorFormat);
+		drawDesc.RenderPass = CompatibleRenderPass;
+	}
+	drawDesc.VertexBindings = { { 0, sizeof(Vec3), VK_VERTEX_INPUT_RATE_VERTEX } };
+	drawDesc.VertexAttributes = { { 0, 0, VK_FORMAT_R32G32B32_SFLOAT, 0 } };
+	drawDesc.DepthTest = true;
+	drawDesc.DepthWrite = true;
+	DrawPipeline = Pipelines.Register(drawDesc);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+GpuScene::~GpuScene() {
+	// Replaced pyramids are still queued for deletion, and reference the scene
+	Deletions.FlushAll();
+	DestroyHiZ(HiZ);
+	DestroyDepthTarget(SharedDepth);
+
+	for (const FrameBindings & frame : Frames) {
+		Heap.Free(frame.CullData);
+		Heap.Free(frame.Depth);
+		Heap.Free(frame.InstanceIds);
+	}
+	Heap.Free(MeshIndex);
+	Heap.Free(TransformIndex);
+	Heap.Free(BoundsIndex);
+	Heap.Free(MeshIdIndex);
+	Heap.Free(DrawCommandIndex);
+	Heap.Free(DrawCountIndex);
+	Heap.Free(VisibleIndex);
+
+	Allocator.DestroyBuffer(VertexBuffer);
+	Allocator.DestroyBuffer(IndexBuffer);
+	Allocator.DestroyBuffer(MeshBuffer);
+	Allocator.DestroyBuffer(TransformBuffer);
+	Allocator.DestroyBuffer(BoundsBuffer);
+	Allocator.DestroyBuffer(MeshIdBuffer);
+	Allocator.DestroyBuffer(DrawCommandBuffer);
+	Allocator.DestroyBuffer(DrawCountBuffer);
+	Allocator.DestroyBuffer(VisibleBuffer);
+
+	Vk.destroyPipeline(CullPipeline, nullptr);
+	Vk.destroyPipeline(HiZPipeline, nullptr);
+	Vk.destroyRenderPass(CompatibleRenderPass, nullptr);
+	Vk.destroySampler(HiZSampler, nullptr);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+MeshHandle GpuScene::AddMesh(const std::vector<Vec3> & positions, const std::vector<uint32_t> & indices) {
+	if (Committed)
+		throw std::runtime_error("Meshes can't be added to a committed scene");
+	if (positions.empty() || indices.empty())
+		throw std::runtime_error("Empty meshes can't be added to the scene");
+
+	Mesh mesh;
+	mesh.FirstVertex = static_cast<uint32_t>(Positions.size());
+	mesh.FirstIndex = static_cast<uint32_t>(Indices.size());
+	mesh.IndexCount = static_cast<uint32_t>(indices.size());
+
+	const Vec4 bounds = ComputeBoundingSphere(positions.data(), positions.size());
+	mesh.Center = { bounds.X, bounds.Y, bounds.Z };
+	mesh.Radius = bounds.W;
+
+	Positions.insert(Positions.end(), positions.begin(), positions.end());
+	Indices.insert(Indices.end(), indices.begin(), indices.end());
+
+	Meshes.push_back(mesh);
+	return { static_cast<uint32_t>(Meshes.size() - 1) };
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+MeshHandle GpuScene::AddMesh(std::span<const Vec3> positions, std::span<const uint32_t> indices, const Vec4 & bounds) {
+	if (Committed)
+		throw std::runtime_error("Meshes can't be added to a committed scene");
+	if (positions.empty() || indices.empty())
+		throw std::runtime_error("Empty meshes can't be added to the scene");
+
+	// First vertex and index are assigned on Commit
+	Mesh mesh;
+	mesh.IndexCount = static_cast<uint32_t>(indices.size());
+	mesh.Center = { bounds.X, bounds.Y, bounds.Z };
+	mesh.Radius = bounds.W;
+	mesh.ExternalPositions = positions;
+	mesh.ExternalIndices = indices;
+
+	Meshes.push_back(mesh);
+	return { static_cast<uint32_t>(Meshes.size() - 1) };
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+Vec4 GpuScene::GetMeshBounds(MeshHandle mesh) const {
+	if (!mesh.IsValid() || mesh.Index >= Meshes.size())
+		throw std::runtime_error("Invalid mesh handle");
+
+	const Mesh & info = Meshes[mesh.Index];
+	return { info.Center.X, info.Center.Y, info.Center.Z, info.Radius };
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void GpuScene::Commit(const SceneStore & store) {
+	if (Committed)
+		throw std::runtime_error("The scene has already been committed");
+	if (store.GetCount() == 0)
+		throw std::runtime_error("Can't commit a scene without instances");
+
+	for (uint32_t mesh : store.GetMeshes()) {
+		if (mesh >= Meshes.size())
+			throw std::runtime_error("Scene store references an unknown mesh");
+	}
+
+	// Meshes added in place go after the copied ones
+	uint32_t vertexCount = static_cast<uint32_t>(Positions.size());
+	uint32_t indexCount = static_cast<uint32_t>(Indices.size());
+	for (Mesh & mesh : Meshes) {
+		if (mesh.ExternalPositions.empty())
+			continue;
+
+		mesh.FirstVertex = vertexCount;
+		mesh.FirstIndex = indexCount;
+		vertexCount += static_cast<uint32_t>(mesh.ExternalPositions.size());
+		indexCount += static_cast<uint32_t>(mesh.ExternalIndices.size());
+	}
+
+	std::vector<GpuMeshInfo> meshInfos;
+	meshInfos.reserve(Meshes.size());
+	for (const Mesh & mesh : Meshes) {
+		GpuMeshInfo info = {};
+		info.IndexCount = mesh.IndexCount;
+		info.FirstIndex = mesh.FirstIndex;
+		info.VertexOffset = static_cast<int32_t>(mesh.FirstVertex);
+		meshInfos.push_back(info);
+	}
+
+	Store = &store;
+	InstanceCount = store.GetCount();
+
+	const VkDeviceSize vertexSize = vertexCount * sizeof(Vec3);
+	const VkDeviceSize indexSize = indexCount * sizeof(uint32_t);
+	const VkDeviceSize meshSize = meshInfos.size() * sizeof(GpuMeshInfo);
+	const VkDeviceSize transformSize = InstanceCount * sizeof(Mat4);
+	const VkDeviceSize boundsSize = InstanceCount * sizeof(Vec4);
+	const VkDeviceSize meshIdSize = InstanceCount * sizeof(uint32_t);
+
+	auto createStatic = [&](VkDeviceSize size, VkBufferUsageFlags usage, const std::vector<uint32_t> & queueFamilies) {
+		return Allocator.CreateBuffer(size, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT, MemoryUsage::GpuOnly, queueFamilies);
+	};
+
+	// Culling on the compute queue reads what cull.comp takes from the scene too,
+	// so those are shared with it and the transfer queue instead of being handed over
+	std::vector<uint32_t> cullFamilies;
+	if (AsyncCulling)
+		cullFamilies = MergeQueueFamilies(Streaming.GetQueueFamilies(), Compute.GetQueueFamilies());
+
+	VertexBuffer = createStatic(vertexSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, {});
+	IndexBuffer = createStatic(indexSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, {});
+	MeshBuffer = createStatic(meshSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, cullFamilies);
+	TransformBuffer = createStatic(transformSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, {});
+	BoundsBuffer = createStatic(boundsSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, cullFamilies);
+	MeshIdBuffer = createStatic(meshIdSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, cullFamilies);
+
+	// The copied meshes and the store's arrays are tightly packed, so each one is a single copy.
+	// Meshes added in place are copied from where they are straight into staging memory.
+	if (!Positions.empty()) {
+		Streaming.UploadBuffer(VertexBuffer.Handle, 0, Positions.data(), Positions.size() * sizeof(Vec3));
+		Streaming.UploadBuffer(IndexBuffer.Handle, 0, Indices.data(), Indices.size() * sizeof(uint32_t));
+	}
+	for (Mesh & mesh : Meshes) {
+		if (mesh.ExternalPositions.empty())
+			continue;
+
+		Streaming.UploadBuffer(VertexBuffer.Handle, mesh.FirstVertex * sizeof(Vec3), mesh.ExternalPositions.data(), mesh.ExternalPositions.size_bytes());
+		Streaming.UploadBuffer(IndexBuffer.Handle, mesh.FirstIndex * sizeof(uint32_t), mesh.ExternalIndices.data(), mesh.ExternalIndices.size_bytes());
+		// Uploads copy the data right away, nothing points into it from here on
+		mesh.ExternalPositions = {};
+		mesh.ExternalIndices = {};
+	}
+	Streaming.UploadBuffer(MeshBuffer.Handle, 0, meshInfos.data(), meshSize, AsyncCulling);
+	Streaming.UploadBuffer(TransformBuffer.Handle, 0, store.GetTransforms().data(), transformSize);
+	Streaming.UploadBuffer(BoundsBuffer.Handle, 0, store.GetBounds().data(), boundsSize, AsyncCulling);
+	// Uploads are submitted together, so the last ticket covers all of them
+	Uploaded = Streaming.UploadBuffer(MeshIdBuffer.Handle, 0, store.GetMeshes().data(), meshIdSize, AsyncCulling);
+
+	// The scene's buffers never move, unlike the per-frame data
+	MeshIndex = Heap.AddStorageBuffer(MeshBuffer.Handle);
+	TransformIndex = Heap.AddStorageBuffer(TransformBuffer.Handle);
+	BoundsIndex = Heap.AddStorageBuffer(BoundsBuffer.Handle);
+	MeshIdIndex = Heap.AddStorageBuffer(MeshIdBuffer.Handle);
+
+	if (GpuCulling) {
+		// Written on the compute queue and read on the graphics queue, when culling asynchronously
+		std::vector<uint32_t> drawFamilies;
+		if (AsyncCulling)
+			drawFamilies = Compute.GetQueueFamilies();
+
+		// Room for every instance to be visible
+		DrawCommandBuffer = Allocator.CreateBuffer(
+			InstanceCount * sizeof(VkDrawIndexedIndirectCommand)
+			, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT
+			, MemoryUsage::GpuOnly
+			, drawFamilies);
+		// Cleared with vkCmdFillBuffer before every cull
+		DrawCountBuffer = Allocator.CreateBuffer(
+			sizeof(uint32_t)
+			, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT
+			, MemoryUsage::GpuOnly
+			, drawFamilies);
+		// Store index of each draw, draws are single instances starting at their own slot
+		VisibleBuffer = Allocator.CreateBuffer(
+			meshIdSize
+			, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+			, MemoryUsage::GpuOnly
+			, drawFamilies);
+
+		DrawCommandIndex = Heap.AddStorageBuffer(DrawCommandBuffer.Handle);
+		DrawCountIndex = Heap.AddStorageBuffer(DrawCountBuffer.Handle);
+		VisibleIndex = Heap.AddStorageBuffer(VisibleBuffer.Handle);
+	}
+
+	// The GPU has its own copy now
+	Positions = {};
+	Indices = {};
+	Committed = true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool GpuScene::IsReady() {
+	if (!Committed || !Streaming.IsComplete(Uploaded))
+		return false;
+	if (GpuCulling && !(Shaders.IsReady(CullShader) && Shaders.IsReady(HiZShader)))
+		return false;
+
+	return Shaders.IsReady(DrawVertShader) && Shaders.IsReady(DrawFragShader);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void GpuScene::OnShadersReloaded(const std::vector<ShaderHandle> & reloaded) {
+	if (CullPipeline == VK_NULL_HANDLE)
+		return;
+
+	const bool affected = std::any_of(reloaded.begin(), reloaded.end(), [this](ShaderHandle shader) {
+		return shader.Index == CullShader.Index || shader.Index == HiZShader.Index;
+	});
+	if (!affected)
+		return;
+
+	// Frames in flight may still be culling with the old ones. The next frame creates
+	// new pipelines, which is quick since the modules have already been compiled.
+	Deletions.Push([&vk = Vk, cull = CullPipeline, hiZ = HiZPipeline]() {
+		vk.destroyPipeline(cull, nullptr);
+		vk.destroyPipeline(hiZ, nullptr);
+	});
+	CullPipeline = VK_NULL_HANDLE;
+	HiZPipeline = VK_NULL_HANDLE;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void GpuScene::AddPasses(
+	RenderGraph & graph
+	, uint32_t frameIndex
+	, RenderGraphResource color
+	, VkExtent2D extent
+	, const Mat4 & viewProj)
+{
+	if (!IsReady())
+		return;
+
+	// The frame's previous submission is done, so its indices can be pointed at this frame's data
+	FrameBindings & bindings = Frames[frameIndex];
+
+	if (GpuCulling)
+		AddGpuCulledPasses(graph, bindings, color, extent, viewProj);
+	else
+		AddBatchedPass(graph, bindings, color, extent, viewProj);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void GpuScene::AddGpuCulledPasses(
+	RenderGraph & graph
+	, FrameBindings & bindings
+	, RenderGraphResource color
+	, VkExtent2D extent
+	, const Mat4 & viewProj)
+{
+	if (CullPipeline == VK_NULL_HANDLE)
+		CreateComputePipelines();
+
+	UpdateHiZ(extent);
+	if (AsyncCulling) {
+		UpdateDepthTarget(extent);
+		// The pyramid is built right before culling, from whatever depth the last frame left
+		HiZValid = DepthValid;
+	}
+
+	CullData cullData = {};
+	cullData.ViewProj = viewProj;
+	ExtractFrustumPlanes(viewProj, cullData.FrustumPlanes);
+	cullData.HiZSize[0] = static_cast<float>(HiZ.Extent.width);
+	cullData.HiZSize[1] = static_cast<float>(HiZ.Extent.height);
+	cullData.HiZMipCount = static_cast<uint32_t>(HiZ.MipViews.size());
+	cullData.InstanceCount = InstanceCount;
+	// A new pyramid holds garbage until this frame has built it
+	cullData.OcclusionCulling = HiZValid ? 1 : 0;
+
+	const UploadAllocation cullDataAllocation = Uploads.Push(&cullData, 1, Uploads.GetUniformAlignment());
+	if (bindings.CullData.IsValid())
+		Heap.UpdateStorageBuffer(bindings.CullData, cullDataAllocation.Buffer, cullDataAllocation.Offset, cullDataAllocation.Size);
+	else
+		bindings.CullData = Heap.AddStorageBuffer(cullDataAllocation.Buffer, cullDataAllocation.Offset, cullDataAllocation.Size);
+
+	// Last frame drew from the command buffers. Culling on the compute queue writes them
+	// before the semaphore the graphics queue waits on, which makes the writes visible.
+	RenderGraphResource drawCommands = graph.ImportBuffer(
+		"Draw commands"
+		, DrawCommandBuffer.Handle
+		, InstanceCount * sizeof(VkDrawIndexedIndirectCommand)
+		, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT
+	);
+	RenderGraphResource drawCount = graph.ImportBuffer(
+		"Draw count"
+		, DrawCountBuffer.Handle
+		, sizeof(uint32_t)
+		, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT
+	);
+	RenderGraphResource visible = graph.ImportBuffer(
+		"Visible instances"
+		, VisibleBuffer.Handle
+		, InstanceCount * sizeof(uint32_t)
+		, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT
+	);
+
+	TextureDesc depthDesc;
+	depthDesc.Format = DepthFormat;
+	depthDesc.Extent = extent;
+
+	RenderGraphResource hiZ;
+	RenderGraphResource depth;
+	if (AsyncCulling) {
+		// Submitted right away, the graphics submission picks up the wait through AsyncCompute
+		SubmitCull(bindings);
+
+		// The compute queue reads it as the next frame begins. Graphics waits for this frame's
+		// culling at early fragment tests, the first transition is chained onto that wait.
+		depth = graph.ImportImage(
+			"Depth"
+			, SharedDepth.Depth.Handle
+			, SharedDepth.View
+			, depthDesc
+			, VK_IMAGE_LAYOUT_UNDEFINED
+			, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+			, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT
+		);
+	} else {
+		TextureDesc hiZDesc;
+		hiZDesc.Format = VK_FORMAT_R32_SFLOAT;
+		hiZDesc.Extent = HiZ.Extent;
+
+		// Last frame built the pyramid in its final pass
+		hiZ = graph.ImportImage(
+			"Hi-Z"
+			, HiZ.Pyramid.Handle
+			, HiZ.SampledView
+			, hiZDesc
+			, HiZValid ? VK_IMAGE_LAYOUT_GENERAL : VK_IMAGE_LAYOUT_UNDEFINED
+			, VK_IMAGE_LAYOUT_GENERAL
+			, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
+			, HiZValid ? VK_ACCESS_SHADER_WRITE_BIT : 0
+		);
+
+		graph.AddComputePass(
+			"Cull"
+			, [&](RenderPassBuilder & builder) {
+				builder.ReadStorageImage(hiZ);
+				builder.WriteBuffer(drawCommands, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+				builder.WriteBuffer(visible, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+				builder.WriteBuffer(
+					drawCount
+					, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
+					, VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+			}
+			, [this, &bindings](VkCommandBuffer cmd) {
+				RecordCull(cmd, bindings);
+			}
+		);
+	}
+
+	graph.AddRasterPass(
+		"Scene"
+		, [&](RenderPassBuilder & builder) {
+			if (!AsyncCulling)
+				depth = builder.CreateTexture("Depth", depthDesc);
+
+			builder.WriteColor(color, VK_ATTACHMENT_LOAD_OP_LOAD);
+			builder.WriteDepth(depth, VK_ATTACHMENT_LOAD_OP_CLEAR);
+			builder.ReadBuffer(drawCommands, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT);
+			builder.ReadBuffer(drawCount, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT);
+			builder.ReadBuffer(visible, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+		}
+		, [this, viewProj](const RasterPassContext & context) {
+			RecordDraw(context, viewProj);
+		}
+	);
+
+	// Next frame culls against this frame's depth
+	if (AsyncCulling) {
+		DepthValid = true;
+		return;
+	}
+
+	graph.AddComputePass(
+		"Hi-Z"
+		, [&](RenderPassBuilder & builder) {
+			builder.ReadTexture(depth, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+			builder.WriteStorageImage(hiZ);
+		}
+		, [this, &graph, &bindings, depth](VkCommandBuffer cmd) {
+			// The depth view only exists once the graph has been compiled
+			const VkImageView depthView = graph.GetImageView(depth);
+			if (bindings.Depth.IsValid())
+				Heap.UpdateSampledImage(bindings.Depth, depthView, HiZSampler);
+			else
+				bindings.Depth = Heap.AddSampledImage(depthView, HiZSampler);
+
+			RecordHiZ(cmd, bindings.Depth);
+		}
+	);
+
+	HiZValid = true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void GpuScene::AddBatchedPass(
+	RenderGraph & graph
+	, FrameBindings & bindings
+	, RenderGraphResource color
+	, VkExtent2D extent
+	, const Mat4 & viewProj)
+{
+	// Frustum cull the store's bounds with SIMD, then one instanced draw per mesh and material
+	Vec4 planes[6];
+	ExtractFrustumPlanes(viewProj, planes);
+
+	VisibleInstances.resize(InstanceCount);
+	const uint32_t visibleCount = CullSpheres(planes, Store->GetBounds().data(), InstanceCount, VisibleInstances.data());
+	if (visibleCount == 0)
+		return;
+
+	Batcher.Build(*Store, VisibleInstances.data(), visibleCount, Draws);
+
+	const UploadAllocation instanceIds = Uploads.Push(
+		Draws.Instances.data()
+		, Draws.Instances.size()
+		, Uploads.GetUniformAlignment());
+	if (bindings.InstanceIds.IsValid())
+		Heap.UpdateStorageBuffer(bindings.InstanceIds, instanceIds.Buffer, instanceIds.Offset, instanceIds.Size);
+	else
+		bindings.InstanceIds = Heap.AddStorageBuffer(instanceIds.Buffer, instanceIds.Offset, instanceIds.Size);
+
+	graph.AddRasterPass(
+		"Scene"
+		, [&](RenderPassBuilder & builder) {
+			TextureDesc depthDesc;
+			depthDesc.Format = DepthFormat;
+			depthDesc.Extent = extent;
+
+			builder.WriteColor(color, VK_ATTACHMENT_LOAD_OP_LOAD);
+			builder.WriteDepth(builder.CreateTexture("Depth", depthDesc), VK_ATTACHMENT_LOAD_OP_CLEAR);
+		}
+		, [this, viewProj, ids = bindings.InstanceIds](const RasterPassContext & context) {
+			RecordBatches(context, viewProj, ids);
+		}
+	);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void GpuScene::CreateComputePipelines() {
+	CullPipeline = CreateComputePipeline(Shaders.Get(CullShader));
+	HiZPipeline = CreateComputePipeline(Shaders.Get(HiZShader));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+VkPipeline GpuScene::CreateComputePipeline(VkShaderModule module) {
+	VkComputePipelineCreateInfo pipelineInfo = {};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.pNext = nullptr;
+
+	pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipelineInfo.stage.module = module;
+	pipelineInfo.stage.pName = "main";
+	pipelineInfo.layout = Heap.GetPipelineLayout();
+
+	VkPipeline pipeline;
+	if (Vk.createComputePipelines(Cache.Get(), 1, &pipelineInfo, nullptr, &pipeline))
+		throw std::runtime_error("Failed to create compute pipeline");
+
+	return pipeline;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void GpuScene::CreateCompatibleRenderPass(VkFormat colorFormat) {
+	// Only formats and sample counts matter for compatibility
+	VkAttachmentDescription attachments[2] = {};
+	attachments[0].format = colorFormat;
+	attachments[0].samples = VK_SAMPLE_COUNT_1_BIT;
+	attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+	attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	attachments[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	attachments[0].initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	attachments[0].finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+	attachments[1].format = DepthFormat;
+	attachments[1].samples = VK_SAMPLE_COUNT_1_BIT;
+	attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	attachments[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	attachments[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	attachments[1].initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	attachments[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+	VkAttachmentReference colorRef = { 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+	VkAttachmentReference depthRef = { 1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
+
+	VkSubpassDescription subpass = {};
+	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	subpass.colorAttachmentCount = 1;
+	subpass.pColorAttachments = &colorRef;
+	subpass.pDepthStencilAttachment = &depthRef;
+
+	VkRenderPassCreateInfo renderPassInfo = {};
+	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+	renderPassInfo.attachmentCount = 2;
+	renderPassInfo.pAttachments = attachments;
+	renderPassInfo.subpassCount = 1;
+	renderPassInfo.pSubpasses = &subpass;
+
+	if (Vk.createRenderPass(&renderPassInfo, nullptr, &CompatibleRenderPass))
+		throw std::runtime_error("Failed to create GPU scene render pass");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void GpuScene::UpdateHiZ(VkExtent2D depthExtent) {
+	// Power of two mips halve exactly, so every texel's footprint is a clean 2x2 of the mip above
+	const VkExtent2D extent = { FloorPowerOfTwo(depthExtent.width), FloorPowerOfTwo(depthExtent.height) };
+
+	if (HiZ.Pyramid.Handle != VK_NULL_HANDLE && HiZ.Extent.width == extent.width && HiZ.Extent.height == extent.height)
+		return;
+
+	// The frames in flight may still cull against the old pyramid, and so may the one being recorded
+	if (HiZ.Pyramid.Handle != VK_NULL_HANDLE) {
+		Deletions.Push([this, retired = std::move(HiZ)]() mutable { DestroyHiZ(retired); });
+		HiZ = {};
+	}
+
+	uint32_t mipCount = 1;
+	while ((std::max(extent.width, extent.height) >> mipCount) > 0 && mipCount < MaxHiZMips)
+		mipCount++;
+
+	VkImageCreateInfo imageInfo = {};
+	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageInfo.pNext = nullptr;
+
+	imageInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageInfo.format = VK_FORMAT_R32_SFLOAT;
+	imageInfo.extent = { extent.width, extent.height, 1 };
+	imageInfo.mipLevels = mipCount;
+	imageInfo.arrayLayers = 1;
+	imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageInfo.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+	HiZ.Pyramid = Allocator.CreateImage(imageInfo, MemoryUsage::GpuOnly);
+	HiZ.Extent = extent;
+
+	VkImageViewCreateInfo viewInfo = {};
+	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	viewInfo.pNext = nullptr;
+
+	viewInfo.image = HiZ.Pyramid.Handle;
+	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	viewInfo.format = VK_FORMAT_R32_SFLOAT;
+	viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	viewInfo.subresourceRange.levelCount = mipCount;
+	viewInfo.subresourceRange.layerCount = 1;
+
+	if (Vk.createImageView(&viewInfo, nullptr, &HiZ.SampledView))
+		throw std::runtime_error("Failed to create Hi-Z view");
+
+	viewInfo.subresourceRange.levelCount = 1;
+	for (uint32_t mip = 0; mip < mipCount; mip++) {
+		viewInfo.subresourceRange.baseMipLevel = mip;
+
+		VkImageView view;
+		if (Vk.createImageView(&viewInfo, nullptr, &view))
+			throw std::runtime_error("Failed to create Hi-Z mip view");
+		HiZ.MipViews.push_back(view);
+		HiZ.MipIndices.push_back(Heap.AddStorageImage(view));
+	}
+
+	HiZ.SampledIndex = Heap.AddSampledImage(HiZ.SampledView, HiZSampler, VK_IMAGE_LAYOUT_GENERAL);
+
+	HiZValid = false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void GpuScene::DestroyHiZ(HiZPyramid & hiZ) {
+	for (BindlessHandle index : hiZ.MipIndices)
+		Heap.Free(index);
+	Heap.Free(hiZ.SampledIndex);
+
+	for (VkImageView view : hiZ.MipViews)
+		Vk.destroyImageView(view, nullptr);
+	Vk.destroyImageView(hiZ.SampledView, nullptr);
+	Allocator.DestroyImage(hiZ.Pyramid);
+	hiZ = {};
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void GpuScene::UpdateDepthTarget(VkExtent2D extent) {
+	if (SharedDepth.Depth.Handle != VK_NULL_HANDLE && SharedDepth.Extent.width == extent.width && SharedDepth.Extent.height == extent.height)
+		return;
+
+	// The frames in flight may still draw into the old one, or build a pyramid from it
+	if (SharedDepth.Depth.Handle != VK_NULL_HANDLE) {
+		Deletions.Push([this, retired = std::move(SharedDepth)]() mutable { DestroyDepthTarget(retired); });
+		SharedDepth = {};
+	}
+
+	const std::vector<uint32_t> queueFamilies = Compute.GetQueueFamilies();
+
+	VkImageCreateInfo imageInfo = {};
+	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageInfo.pNext = nullptr;
+
+	imageInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageInfo.format = DepthFormat;
+	imageInfo.extent = { extent.width, extent.height, 1 };
+	imageInfo.mipLevels = 1;
+	imageInfo.arrayLayers = 1;
+	imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	// Drawn on the graphics queue, read on the compute queue
+	imageInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+	imageInfo.queueFamilyIndexCount = static_cast<uint32_t>(queueFamilies.size());
+	imageInfo.pQueueFamilyIndices = queueFamilies.data();
+	imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+	SharedDepth.Depth = Allocator.CreateImage(imageInfo, MemoryUsage::GpuOnly);
+	SharedDepth.Extent = extent;
+
+	VkImageViewCreateInfo viewInfo = {};
+	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	viewInfo.pNext = nullptr;
+
+	viewInfo.image = SharedDepth.Depth.Handle;
+	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	viewInfo.format = DepthFormat;
+	viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+	viewInfo.subresourceRange.levelCount = 1;
+	viewInfo.subresourceRange.layerCount = 1;
+
+	if (Vk.createImageView(&viewInfo, nullptr, &SharedDepth.View))
+		throw std::runtime_error("Failed to create shared depth view");
+
+	SharedDepth.SampledIndex = Heap.AddSampledImage(SharedDepth.View, HiZSampler);
+
+	DepthValid = false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void GpuScene::DestroyDepthTarget(DepthTarget & target) {
+	Heap.Free(target.SampledIndex);
+	Vk.destroyImageView(target.View, nullptr);
+	Allocator.DestroyImage(target.Depth);
+	target = {};
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void GpuScene::SubmitCull(const FrameBindings & bindings) {
+	VkCommandBuffer cmd = Compute.BeginCommands();
+
+	// The pyramid is rebuilt from scratch. Last frame's cull on this queue has to be done reading it.
+	VkImageMemoryBarrier pyramidBarrier = {};
+	pyramidBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	pyramidBarrier.pNext = nullptr;
+
+	pyramidBarrier.srcAccessMask = 0;
+	pyramidBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	pyramidBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	pyramidBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+	pyramidBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	pyramidBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	pyramidBarrier.image = HiZ.Pyramid.Handle;
+	pyramidBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, VK_REMAINING_MIP_LEVELS, 0, 1 };
+
+	Vk.cmdPipelineBarrier(
+		cmd
+		, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
+		, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
+		, 0
+		, 0, nullptr
+		, 0, nullptr
+		, 1, &pyramidBarrier
+	);
+
+	// Last frame left its depth in the read only layout
+	if (HiZValid) {
+		RecordHiZ(cmd, SharedDepth.SampledIndex);
+		ComputeBarrier(Vk, cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+	}
+
+	RecordCull(cmd, bindings);
+
+	SemaphoreWaits waits;
+	// Last frame has to be done drawing the depth and reading the draw buffers about to be overwritten
+	waits.Add(GraphicsTimeline.Get(), GraphicsTimeline.GetLastSubmitted(), VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+	// Only the graphics queue waits for the uploads otherwise, and this frame's wait may be its first
+	waits.Add(Streaming.GetTimeline().Get(), Uploaded, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+	// The scene pass is the first to need the results, everything recorded before it overlaps the culling
+	Compute.Submit(
+		cmd
+		, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT
+		, &waits);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void GpuScene::RecordCull(VkCommandBuffer cmd, const FrameBindings & bindings) {
+	// Visible instances append to the draw list
+	Vk.cmdFillBuffer(cmd, DrawCountBuffer.Handle, 0, sizeof(uint32_t), 0);
+	ComputeBarrier(
+		Vk
+		, cmd
+		, VK_PIPELINE_STAGE_TRANSFER_BIT
+		, VK_ACCESS_TRANSFER_WRITE_BIT
+		, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+	CullConstants constants = {};
+	constants.CullData = bindings.CullData.Index;
+	constants.Meshes = MeshIndex.Index;
+	constants.Bounds = BoundsIndex.Index;
+	constants.MeshIds = MeshIdIndex.Index;
+	constants.DrawCommands = DrawCommandIndex.Index;
+	constants.DrawCount = DrawCountIndex.Index;
+	constants.Visible = VisibleIndex.Index;
+	constants.HiZ = HiZ.SampledIndex.Index;
+
+	Vk.cmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, CullPipeline);
+	Heap.Bind(cmd, VK_PIPELINE_BIND_POINT_COMPUTE);
+	Heap.PushConstants(cmd, constants);
+	Vk.cmdDispatch(cmd, (InstanceCount + CullGroupSize - 1) / CullGroupSize, 1, 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void GpuScene::SetViewport(VkCommandBuffer cmd, VkExtent2D extent) {
+	VkViewport viewport = {};
+	viewport.x = 0.f;
+	viewport.y = 0.f;
+	viewport.width = static_cast<float>(extent.width);
+	viewport.height = static_cast<float>(extent.height);
+	viewport.minDepth = 0.f;
+	viewport.maxDepth = 1.f;
+
+	VkRect2D scissor = {};
+	scissor.offset = { 0, 0 };
+	scissor.extent = extent;
+
+	Vk.cmdSetViewport(cmd, 0, 1, &viewport);
+	Vk.cmdSetScissor(cmd, 0, 1, &scissor);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void GpuScene::RecordDraw(const RasterPassContext & context, const Mat4 & viewProj) {
+	VkCommandBuffer cmd = context.Cmd;
+	SetViewport(cmd, context.Extent);
+
+	DrawConstants constants = {};
+	constants.ViewProj = viewProj;
+	constants.Transforms = TransformIndex.Index;
+	constants.InstanceIds = VisibleIndex.Index;
+
+	Vk.cmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, Pipelines.Get(DrawPipeline));
+	Heap.Bind(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS);
+	Heap.PushConstants(cmd, constants);
+
+	const VkDeviceSize vertexOffset = 0;
+	Vk.cmdBindVertexBuffers(cmd, 0, 1, &VertexBuffer.Handle, &vertexOffset);
+	Vk.cmdBindIndexBuffer(cmd, IndexBuffer.Handle, 0, VK_INDEX_TYPE_UINT32);
+
+	// However many draws the cull pass wrote, without the CPU ever knowing
+	Vk.cmdDrawIndexedIndirectCount(
+		cmd
+		, DrawCommandBuffer.Handle
+		, 0
+		, DrawCountBuffer.Handle
+		, 0
+		, InstanceCount
+		, sizeof(VkDrawIndexedIndirectCommand)
+	);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void GpuScene::RecordBatches(const RasterPassContext & context, const Mat4 & viewProj, BindlessHandle instanceIds) {
+	VkCommandBuffer cmd = context.Cmd;
+	SetViewport(cmd, context.Extent);
+
+	DrawConstants constants = {};
+	constants.ViewProj = viewProj;
+	constants.Transforms = TransformIndex.Index;
+	constants.InstanceIds = instanceIds.Index;
+
+	Vk.cmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, Pipelines.Get(DrawPipeline));
+	Heap.Bind(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS);
+	Heap.PushConstants(cmd, constants);
+
+	const VkDeviceSize vertexOffset = 0;
+	Vk.cmdBindVertexBuffers(cmd, 0, 1, &VertexBuffer.Handle, &vertexOffset);
+	Vk.cmdBindIndexBuffer(cmd, IndexBuffer.Handle, 0, VK_INDEX_TYPE_UINT32);
+
+	// There are no materials to bind yet, batches of the same mesh only differ by their instances
+	for (const DrawBatch & batch : Draws.Batches) {
+		const Mesh & mesh = Meshes[batch.Mesh];
+		Vk.cmdDrawIndexed(
+			cmd
+			, mesh.IndexCount
+			, batch.InstanceCount
+			, mesh.FirstIndex
+			, static_cast<int32_t>(mesh.FirstVertex)
+			, batch.FirstInstance
+		);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void GpuScene::RecordHiZ(VkCommandBuffer cmd, BindlessHandle depth) {
+	Vk.cmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, HiZPipeline);
+	Heap.Bind(cmd, VK_PIPELINE_BIND_POINT_COMPUTE);
+
+	const uint32_t mipCount = static_cast<uint32_t>(HiZ.MipViews.size());
+	for (uint32_t mip = 0; mip < mipCount; mip++) {
+		// Each mip reduces the one written right before it
+		if (mip > 0)
+			ComputeBarrier(Vk, cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+
+		HiZConstants constants = {};
+		constants.DstSize[0] = static_cast<int32_t>(std::max(1u, HiZ.Extent.width >> mip));
+		constants.DstSize[1] = static_cast<int32_t>(std::max(1u, HiZ.Extent.height >> mip));
+		constants.FromDepth = mip == 0 ? 1 : 0;
+		constants.Depth = depth.Index;
+		// Mip 0 reads the depth buffer instead, src only has to be a valid index
+		constants.Src = HiZ.MipIndices[mip == 0 ? 0 : mip - 1].Index;
+		constants.Dst = HiZ.MipIndices[mip].Index;
+
+		Heap.PushConstants(cmd, constants);
+		Vk.cmdDispatch(
+			cmd
+			, (constants.DstSize[0] + HiZGroupSize - 1) / HiZGroupSize
+			, (constants.DstSize[1] + HiZGroupSize - 1) / HiZGroupSize
+			, 1);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+} // namespace core
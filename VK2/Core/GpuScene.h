@@ -0,0 +1,269 @@
+#pragma once
+
+#include "BindlessHeap.h"
+#include "DeletionQueue.h"
+#include "DrawList.h"
+#include "GpuAllocator.h"
+#include "Math.h"
+#include "PipelineLibrary.h"
+#include "RenderGraph.h"
+#include "StreamingUploader.h"
+#include "VkBootStrap/VkBootstrapDispatch.h"
+
+#include <span>
+#include <vector>
+
+namespace core {
+
+class AsyncCompute;
+class PipelineCache;
+class SceneStore;
+class ShaderLibrary;
+class TimelineSemaphore;
+class UploadRing;
+
+////////////////////////////////////////////////////////////////////////////////
+// Handle to a mesh owned by a GpuScene
+struct MeshHandle {
+	uint32_t Index = UINT32_MAX;
+
+	bool IsValid() const { return Index != UINT32_MAX; }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Renderer for large numbers of instances.
+//
+// Meshes share one vertex and index buffer. The instances are the entities of
+// a SceneStore, whose transform, bounds and mesh arrays are copied as is into
+// storage buffers.
+//
+// With GPU culling, each frame a compute pass culls the instances against the
+// frustum and against a Hi-Z pyramid of the previous frame's depth, and
+// appends a VkDrawIndexedIndirectCommand for everything visible. The raster
+// pass then draws them all with a single vkCmdDrawIndexedIndirectCount, so
+// the CPU cost doesn't depend on the instance count. Finally the pyramid is
+// rebuilt from this frame's depth.
+//
+// With a separate compute queue, the pyramid is instead built from the last
+// frame's depth on that queue right before culling, and only the scene pass
+// waits for the results, so the passes recorded before it overlap both.
+// Everything both queues touch is shared concurrently.
+//
+// Without it, the CPU culls the store's bounds against the frustum with the
+// SIMD kernels, and a DrawListBuilder merges the visible instances sharing
+// a mesh and material into one instanced draw each.
+//
+// Every pass finds its buffers and images through the bindless heap, with the
+// indices in push constants.
+//
+// Meshes and instances are static once committed. Not thread safe.
+class GpuScene {
+public:
+	// maxFramesInFlight is how many frames may be recorded before the first one has
+	// finished on the GPU. Pipelines are built for colorFormat and DepthFormat.
+	// GPU culling needs drawIndirectCount, multiDrawIndirect and drawIndirectFirstInstance.
+	// graphicsTimeline is what frames on the graphics queue signal, the compute queue waits on it.
+	GpuScene(
+		const vkb::DispatchTable & vk
+		, GpuAllocator & allocator
+		, AsyncCompute & compute
+		, TimelineSemaphore & graphicsTimeline
+		, StreamingUploader & streaming
+		, UploadRing & uploads
+		, BindlessHeap & heap
+		, ShaderLibrary & shaders
+		, PipelineLibrary & pipelines
+		, PipelineCache & cache
+		, DeletionQueue & deletions
+		, uint32_t maxFramesInFlight
+		, VkFormat colorFormat
+		, bool dynamicRendering
+		, bool gpuCulling);
+	// The GPU must be done with every frame the scene was drawn in
+	~GpuScene();
+
+	GpuScene(const GpuScene &) = delete;
+	GpuScene & operator=(const GpuScene &) = delete;
+
+	// Indices are relative to the mesh's first vertex
+	MeshHandle AddMesh(const std::vector<Vec3> & positions, const std::vector<uint32_t> & indices);
+	// Same without copying, for geometry that is already in memory, like a mapped AssetPackage.
+	// It's uploaded straight from there on Commit, so it has to stay valid until then.
+	MeshHandle AddMesh(std::span<const Vec3> positions, std::span<const uint32_t> indices, const Vec4 & bounds);
+
+	// Bounding sphere of the mesh in object space, what its entities are added to the store with
+	Vec4 GetMeshBounds(MeshHandle mesh) const;
+
+	// Upload every mesh, and the store's entities as instances, with MeshHandle::Index as mesh id.
+	// Nothing can be added afterwards. The store has to outlive the scene and stay unchanged.
+	void Commit(const SceneStore & store);
+
+	// True once the uploads have landed and the shaders have compiled
+	bool IsReady();
+
+	// Cull, draw into color and rebuild the Hi-Z pyramid, or draw the batches without
+	// GPU culling. Does nothing until the scene is ready.
+	// Culling on the compute queue is submitted right away, the graphics submission has
+	// to add AsyncCompute's waits once the graph is built.
+	// Call once per recorded frame, frameIndex is the frame's slot among the frames in flight.
+	void AddPasses(
+		RenderGraph & graph
+		, uint32_t frameIndex
+		, RenderGraphResource color
+		, VkExtent2D extent
+		, const Mat4 & viewProj);
+
+	// Recreate the compute pipelines if their shaders were among the reloaded ones.
+	// The draw pipeline belongs to the PipelineLibrary, which rebuilds it by itself.
+	void OnShadersReloaded(const std::vector<ShaderHandle> & reloaded);
+
+	uint32_t GetInstanceCount() const { return InstanceCount; }
+
+	static constexpr VkFormat DepthFormat = VK_FORMAT_D32_SFLOAT;
+
+private:
+	struct Mesh {
+		uint32_t FirstVertex = 0;
+		uint32_t FirstIndex = 0;
+		uint32_t IndexCount = 0;
+		// Bounding sphere in object space
+		Vec3 Center;
+		float Radius = 0.f;
+		// Data of meshes added without a copy, placed after the copied ones on Commit
+		std::span<const Vec3> ExternalPositions;
+		std::span<const uint32_t> ExternalIndices;
+	};
+
+	// Farthest depth pyramid, one view for sampling every mip and one storage view per mip
+	struct HiZPyramid {
+		Image Pyramid;
+		VkImageView SampledView = VK_NULL_HANDLE;
+		std::vector<VkImageView> MipViews;
+		BindlessHandle SampledIndex;
+		std::vector<BindlessHandle> MipIndices;
+		VkExtent2D Extent = {};
+	};
+
+	// Depth buffer kept from one frame to the next, for the compute queue to build the pyramid from
+	struct DepthTarget {
+		Image Depth;
+		VkImageView View = VK_NULL_HANDLE;
+		BindlessHandle SampledIndex;
+		VkExtent2D Extent = {};
+	};
+
+	// Heap indices of one frame in flight, pointed at this frame's data every time the frame is recorded
+	struct FrameBindings {
+		BindlessHandle CullData;
+		BindlessHandle Depth;
+		// The batches' instances, without GPU culling
+		BindlessHandle InstanceIds;
+	};
+
+	void AddGpuCulledPasses(
+		RenderGraph & graph
+		, FrameBindings & bindings
+		, RenderGraphResource color
+		, VkExtent2D extent
+		, const Mat4 & viewProj);
+	void AddBatchedPass(
+		RenderGraph & graph
+		, FrameBindings & bindings
+		, RenderGraphResource color
+		, VkExtent2D extent
+		, const Mat4 & viewProj);
+
+	void CreateComputePipelines();
+	VkPipeline CreateComputePipeline(VkShaderModule module);
+	// Render pass the draw pipeline has to be compatible with, when not rendering dynamically
+	void CreateCompatibleRenderPass(VkFormat colorFormat);
+
+	// Replace the pyramid if the depth buffer it's built from was resized
+	void UpdateHiZ(VkExtent2D depthExtent);
+	void DestroyHiZ(HiZPyramid & hiZ);
+	// Same for the depth buffer of the compute queue path
+	void UpdateDepthTarget(VkExtent2D extent);
+	void DestroyDepthTarget(DepthTarget & target);
+
+	// Build the pyramid from last frame's depth if there is one, then cull, on the compute queue
+	void SubmitCull(const FrameBindings & bindings);
+
+	void RecordCull(VkCommandBuffer cmd, const FrameBindings & bindings);
+	void SetViewport(VkCommandBuffer cmd, VkExtent2D extent);
+	void RecordDraw(const RasterPassContext & context, const Mat4 & viewProj);
+	void RecordBatches(const RasterPassContext & context, const Mat4 & viewProj, BindlessHandle instanceIds);
+	void RecordHiZ(VkCommandBuffer cmd, BindlessHandle depth);
+
+private:
+	const vkb::DispatchTable & Vk;
+	GpuAllocator & Allocator;
+	AsyncCompute & Compute;
+	TimelineSemaphore & GraphicsTimeline;
+	StreamingUploader & Streaming;
+	UploadRing & Uploads;
+	BindlessHeap & Heap;
+	ShaderLibrary & Shaders;
+	PipelineLibrary & Pipelines;
+	PipelineCache & Cache;
+	DeletionQueue & Deletions;
+
+	// CPU copies until committed, of the meshes that weren't added in place
+	std::vector<Vec3> Positions;
+	std::vector<uint32_t> Indices;
+	std::vector<Mesh> Meshes;
+
+	bool GpuCulling;
+	// Hi-Z and culling run on the compute queue
+	bool AsyncCulling;
+	bool Committed = false;
+	const SceneStore * Store = nullptr;
+	UploadTicket Uploaded = 0;
+	uint32_t InstanceCount = 0;
+
+	Buffer VertexBuffer;
+	Buffer IndexBuffer;
+	Buffer MeshBuffer;
+	// Copies of the store's arrays
+	Buffer TransformBuffer;
+	Buffer BoundsBuffer;
+	Buffer MeshIdBuffer;
+	// Written by the cull pass, read by vkCmdDrawIndexedIndirectCount and the vertex shader
+	Buffer DrawCommandBuffer;
+	Buffer DrawCountBuffer;
+	Buffer VisibleBuffer;
+	BindlessHandle MeshIndex;
+	BindlessHandle TransformIndex;
+	BindlessHandle BoundsIndex;
+	BindlessHandle MeshIdIndex;
+	BindlessHandle DrawCommandIndex;
+	BindlessHandle DrawCountIndex;
+	BindlessHandle VisibleIndex;
+
+	// Rebuilt every frame without GPU culling
+	std::vector<uint32_t> VisibleInstances;
+	DrawListBuilder Batcher;
+	DrawList Draws;
+
+	ShaderHandle CullShader;
+	ShaderHandle HiZShader;
+	ShaderHandle DrawVertShader;
+	ShaderHandle DrawFragShader;
+
+	std::vector<FrameBindings> Frames;
+
+	VkPipeline CullPipeline = VK_NULL_HANDLE;
+	VkPipeline HiZPipeline = VK_NULL_HANDLE;
+	PipelineHandle DrawPipeline;
+	VkRenderPass CompatibleRenderPass = VK_NULL_HANDLE;
+
+	VkSampler HiZSampler = VK_NULL_HANDLE;
+	HiZPyramid HiZ;
+	// The pyramid holds last frame's depth, so occlusion culling can use it
+	bool HiZValid = false;
+
+	DepthTarget SharedDepth;
+	// SharedDepth holds last frame's depth, so the pyramid can be built from it
+	bool DepthValid = false;
+};
+
+} // namespace core
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace core {
+
+// 64 bit FNV-1a, used for content addressed caches.
+// Stable across runs and platforms, so hashes can be written to disk.
+constexpr uint64_t HashSeed = 14695981039346656037ull;
+
+////////////////////////////////////////////////////////////////////////////////
+
+inline uint64_t HashBytes(const void * data, size_t size, uint64_t hash = HashSeed) {
+	const uint8_t * bytes = static_cast<const uint8_t *>(data);
+	for (size_t i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+inline uint64_t HashString(std::string_view str, uint64_t hash = HashSeed) {
+	// Include the length so consecutive strings can't run into each other
+	const uint64_t length = str.size();
+	hash = HashBytes(&length, sizeof(length), hash);
+	return HashBytes(str.data(), str.size(), hash);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+template <typename T>
+uint64_t HashValue(const T & value, uint64_t hash = HashSeed) {
+	return HashBytes(&value, sizeof(T), hash);
+}
+
+} // namespace core
@@ -0,0 +1,275 @@
+#include "JobSystem.h"
+
+#include <algorithm>
+#include <exception>
+#include <utility>
+
+namespace core {
+
+namespace {
+
+// Index of the current thread within the job system that spawned it
+thread_local uint32_t CurrentThreadIndex = 0;
+
+} // anonymous namespace
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool JobCounter::IsDone() const {
+	return Pending.load(std::memory_order_acquire) == 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+JobSystem::JobSystem(uint32_t workerCount) {
+	if (workerCount == 0) {
+		const uint32_t hardwareThreads = std::thread::hardware_concurrency();
+		workerCount = hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+	}
+
+	// One deque for the owning thread plus one per worker.
+	// Queues must all exist before any worker starts stealing.
+	for (uint32_t i = 0; i < workerCount + 1; i++)
+		Queues.push_back(std::make_unique<WorkerQueue>());
+
+	Workers.reserve(workerCount);
+	for (uint32_t i = 0; i < workerCount; i++)
+		Workers.emplace_back(&JobSystem::WorkerLoop, this, i + 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+JobSystem::~JobSystem() {
+	// Jobs still sitting in a deque are dropped
+	{
+		std::lock_guard<std::mutex> lock(SleepMutex);
+		Stopping = true;
+	}
+	SleepCondition.notify_all();
+
+	for (std::thread & worker : Workers)
+		worker.join();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+uint32_t JobSystem::GetThreadCount() const {
+	return static_cast<uint32_t>(Queues.size());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+uint32_t JobSystem::GetThreadIndex() {
+	return CurrentThreadIndex;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void JobSystem::Schedule(Job job, JobCounter * counter) {
+	if (counter)
+		counter->Pending.fetch_add(1, std::memory_order_relaxed);
+
+	Push({ std::move(job), counter });
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void JobSystem::ScheduleAfter(JobCounter & dependency, Job job, JobCounter * counter) {
+	if (counter)
+		counter->Pending.fetch_add(1, std::memory_order_relaxed);
+
+	{
+		std::lock_guard<std::mutex> lock(dependency.Mutex);
+		if (!dependency.IsDone()) {
+			dependency.Continuations.push_back({ std::move(job), counter });
+			return;
+		}
+	}
+
+	// The dependency already finished, the job can run right away
+	Push({ std::move(job), counter });
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void JobSystem::Wait(JobCounter & counter) {
+	const uint32_t threadIdx = GetThreadIndex();
+
+	while (!counter.IsDone()) {
+		if (!RunOneJob(threadIdx))
+			std::this_thread::yield();
+	}
+
+	// The last job may still be inside Finish(), make sure it let go of the counter
+	std::exception_ptr error;
+	{
+		std::lock_guard<std::mutex> lock(counter.Mutex);
+		std::swap(error, counter.Error);
+	}
+
+	if (error)
+		std::rethrow_exception(error);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void JobSystem::ParallelFor(uint32_t count, const std::function<void(uint32_t index, uint32_t threadIdx)> & fn) {
+	if (count == 0)
+		return;
+
+	// Indices are handed out from a shared counter, so threads that finish early pick up more of the work
+	std::atomic<uint32_t> nextIndex = 0;
+
+	// The first exception thrown by fn is rethrown on the calling thread
+	std::mutex errorMutex;
+	std::exception_ptr error;
+
+	auto work = [&]() {
+		const uint32_t threadIdx = GetThreadIndex();
+		try {
+			for (uint32_t i = nextIndex++; i < count; i = nextIndex++)
+				fn(i, threadIdx);
+		} catch (...) {
+			// Skip the indices nobody has started on yet
+			nextIndex = count;
+
+			std::lock_guard<std::mutex> lock(errorMutex);
+			if (!error)
+				error = std::current_exception();
+		}
+	};
+
+	// One job per helping thread, the calling thread takes a share as well.
+	// The jobs reference this stack frame, so we can't return until all of them have run.
+	JobCounter helpers;
+	const uint32_t helperCount = std::min(count, GetThreadCount()) - 1;
+	for (uint32_t i = 0; i < helperCount; i++)
+		Schedule(work, &helpers);
+
+	work();
+	Wait(helpers);
+
+	if (error)
+		std::rethrow_exception(error);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void JobSystem::WorkerLoop(uint32_t threadIdx) {
+	CurrentThreadIndex = threadIdx;
+
+	while (!Stopping) {
+		if (RunOneJob(threadIdx))
+			continue;
+
+		std::unique_lock<std::mutex> lock(SleepMutex);
+		SleepCondition.wait(lock, [this]() { return Stopping || QueuedTasks > 0; });
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void JobSystem::Push(Task task) {
+	// Threads outside the job system share the owning thread's deque
+	const uint32_t threadIdx = std::min(GetThreadIndex(), GetThreadCount() - 1);
+
+	WorkerQueue & queue = *Queues[threadIdx];
+	{
+		std::lock_guard<std::mutex> lock(queue.Mutex);
+		queue.Tasks.push_back(std::move(task));
+	}
+
+	// Take the sleep lock so a worker can't miss the wake up between checking for work and sleeping
+	{
+		std::lock_guard<std::mutex> lock(SleepMutex);
+		QueuedTasks++;
+	}
+	SleepCondition.notify_one();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool JobSystem::TryGetTask(uint32_t threadIdx, Task & outTask) {
+	const uint32_t threadCount = GetThreadCount();
+	threadIdx = std::min(threadIdx, threadCount - 1);
+
+	// Newest job from our own deque first, it is the most likely to be warm in cache
+	{
+		WorkerQueue & queue = *Queues[threadIdx];
+		std::lock_guard<std::mutex> lock(queue.Mutex);
+		if (!queue.Tasks.empty()) {
+			outTask = std::move(queue.Tasks.back());
+			queue.Tasks.pop_back();
+			QueuedTasks--;
+			return true;
+		}
+	}
+
+	// Otherwise steal the oldest job from someone else
+	for (uint32_t i = 1; i < threadCount; i++) {
+		WorkerQueue & victim = *Queues[(threadIdx + i) % threadCount];
+		std::lock_guard<std::mutex> lock(victim.Mutex);
+		if (!victim.Tasks.empty()) {
+			outTask = std::move(victim.Tasks.front());
+			victim.Tasks.pop_front();
+			QueuedTasks--;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool JobSystem::RunOneJob(uint32_t threadIdx) {
+	Task task;
+	if (!TryGetTask(threadIdx, task))
+		return false;
+
+	Execute(task);
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void JobSystem::Execute(Task & task) {
+	// Jobs without a counter must not throw, see Schedule(). If one does, terminate right here
+	// instead of unwinding through the worker.
+	if (!task.Counter) {
+		const Job & fn = task.Fn;
+		[&]() noexcept { fn(); }();
+		return;
+	}
+
+	// An exception escaping a worker would terminate, and leave the counter waited on forever
+	try {
+		task.Fn();
+	} catch (...) {
+		std::lock_guard<std::mutex> lock(task.Counter->Mutex);
+		if (!task.Counter->Error)
+			task.Counter->Error = std::current_exception();
+	}
+
+	Finish(*task.Counter);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void JobSystem::Finish(JobCounter & counter) {
+	std::vector<JobCounter::Continuation> continuations;
+	{
+		std::lock_guard<std::mutex> lock(counter.Mutex);
+		if (counter.Pending.fetch_sub(1, std::memory_order_acq_rel) != 1)
+			return;
+
+		continuations.swap(counter.Continuations);
+	}
+
+	for (JobCounter::Continuation & continuation : continuations)
+		Push({ std::move(continuation.Fn), continuation.Counter });
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+} // namespace core
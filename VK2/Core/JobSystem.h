@@ -0,0 +1,128 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace core {
+
+using Job = std::function<void()>;
+
+////////////////////////////////////////////////////////////////////////////////
+// Counts the outstanding jobs scheduled against it.
+// Jobs can be chained onto a counter and will be scheduled once it reaches zero.
+// The first exception thrown by one of its jobs is kept, and rethrown by JobSystem::Wait().
+// Always JobSystem::Wait() on a counter before destroying it.
+class JobCounter {
+public:
+	JobCounter() = default;
+
+	JobCounter(const JobCounter &) = delete;
+	JobCounter & operator=(const JobCounter &) = delete;
+
+	// True once every job scheduled against this counter has finished
+	bool IsDone() const;
+
+private:
+	friend class JobSystem;
+
+	std::atomic<uint32_t> Pending = 0;
+
+	// Guards Continuations, Error and the transition of Pending to zero
+	std::mutex Mutex;
+	std::exception_ptr Error;
+	struct Continuation {
+		Job Fn;
+		JobCounter * Counter;
+	};
+	std::vector<Continuation> Continuations;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Work-stealing job scheduler shared by all engine systems.
+// Every thread owns a deque of jobs. Threads push and pop jobs at the back of
+// their own deque, and steal from the front of other threads' deques when
+// they run dry. Threads waiting on a counter keep executing jobs instead of
+// blocking.
+//
+// The thread that owns the job system counts as thread 0, workers are
+// numbered 1..N. The thread index is stable for the lifetime of the job
+// system, so it can be used to index per-thread resources such as command pools.
+class JobSystem {
+public:
+	// A worker count of 0 uses one worker per hardware thread besides the calling thread
+	explicit JobSystem(uint32_t workerCount = 0);
+	~JobSystem();
+
+	JobSystem(const JobSystem &) = delete;
+	JobSystem & operator=(const JobSystem &) = delete;
+
+	// Number of threads that can execute jobs, including the owning thread
+	uint32_t GetThreadCount() const;
+
+	// Index of the calling thread, 0 for the owning thread (and any thread not owned by the job system)
+	static uint32_t GetThreadIndex();
+
+	// Queue a job on the calling thread's deque.
+	// If a counter is given, it is incremented now and decremented when the job finishes,
+	// whether it returns or throws. A job without a counter has nobody to report to and must not throw.
+	void Schedule(Job job, JobCounter * counter = nullptr);
+
+	// Queue a job once every job scheduled against dependency has finished, even if one of them threw.
+	// counter is incremented immediately, so waiting on it also covers the deferred job.
+	void ScheduleAfter(JobCounter & dependency, Job job, JobCounter * counter = nullptr);
+
+	// Execute jobs on the calling thread until the counter reaches zero.
+	// Rethrows the first exception thrown by the counter's jobs, once.
+	void Wait(JobCounter & counter);
+
+	// Run fn(index, threadIdx) for every index in [0, count) across all threads.
+	// Blocks until every index has been processed, rethrowing the first exception thrown by fn.
+	void ParallelFor(uint32_t count, const std::function<void(uint32_t index, uint32_t threadIdx)> & fn);
+
+private:
+	struct Task {
+		Job Fn;
+		JobCounter * Counter = nullptr;
+	};
+
+	// Deque of jobs owned by one thread
+	struct WorkerQueue {
+		std::mutex Mutex;
+		std::deque<Task> Tasks;
+	};
+
+	void WorkerLoop(uint32_t threadIdx);
+
+	void Push(Task task);
+
+	// Pop a job from our own deque, or steal one from another thread
+	bool TryGetTask(uint32_t threadIdx, Task & outTask);
+
+	// Find and run one job. Returns false if there was nothing to do.
+	bool RunOneJob(uint32_t threadIdx);
+
+	void Execute(Task & task);
+
+	// Decrement a counter, scheduling its continuations if it reached zero
+	void Finish(JobCounter & counter);
+
+private:
+	std::vector<std::unique_ptr<WorkerQueue>> Queues;
+	std::vector<std::thread> Workers;
+
+	// Number of tasks sitting in any queue, used to put idle workers to sleep
+	std::atomic<uint32_t> QueuedTasks = 0;
+	std::mutex SleepMutex;
+	std::condition_variable SleepCondition;
+	std::atomic<bool> Stopping = false;
+};
+
+} // namespace core
@@ -0,0 +1,78 @@
+#include "MappedFile.h"
+
+#include <filesystem>
+#include <Windows.h>
+
+namespace core {
+
+////////////////////////////////////////////////////////////////////////////////
+
+MappedFile::~MappedFile() {
+	Close();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool MappedFile::Open(const std::string & path) {
+	Close();
+
+	const std::wstring widePath = std::filesystem::path(path).wstring();
+	HANDLE file = CreateFileW(
+		widePath.c_str()
+		, GENERIC_READ
+		, FILE_SHARE_READ
+		, nullptr
+		, OPEN_EXISTING
+		, FILE_ATTRIBUTE_NORMAL
+		, nullptr
+	);
+
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER fileSize;
+	// Empty files can't be mapped
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mapping) {
+		CloseHandle(file);
+		return false;
+	}
+
+	void * view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!view) {
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+
+	FileHandle = file;
+	MappingHandle = mapping;
+	Data = static_cast<const uint8_t *>(view);
+	Size = static_cast<size_t>(fileSize.QuadPart);
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void MappedFile::Close() {
+	if (Data)
+		UnmapViewOfFile(Data);
+	if (MappingHandle)
+		CloseHandle(MappingHandle);
+	if (FileHandle)
+		CloseHandle(FileHandle);
+
+	FileHandle = nullptr;
+	MappingHandle = nullptr;
+	Data = nullptr;
+	Size = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+} // namespace core
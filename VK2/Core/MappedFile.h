@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace core {
+
+////////////////////////////////////////////////////////////////////////////////
+// Read-only memory mapping of a whole file.
+// Pages are loaded by the OS on first access, so nothing is copied up front.
+class MappedFile {
+public:
+	MappedFile() = default;
+	~MappedFile();
+
+	MappedFile(const MappedFile &) = delete;
+	MappedFile & operator=(const MappedFile &) = delete;
+
+	// Returns false if the file does not exist or can't be mapped
+	bool Open(const std::string & path);
+	void Close();
+
+	bool IsOpen() const { return Data != nullptr; }
+	const uint8_t * GetData() const { return Data; }
+	size_t GetSize() const { return Size; }
+
+private:
+	// Native handles, kept opaque so the header doesn't pull in Windows.h
+	void * FileHandle = nullptr;
+	void * MappingHandle = nullptr;
+
+	const uint8_t * Data = nullptr;
+	size_t Size = 0;
+};
+
+} // namespace core
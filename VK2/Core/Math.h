@@ -0,0 +1,207 @@
+#pragma once
+
+#include <cfloat>
+#include <cmath>
+#include <cstddef>
+
+namespace core {
+
+////////////////////////////////////////////////////////////////////////////////
+
+struct Vec3 {
+	float X = 0.f;
+	float Y = 0.f;
+	float Z = 0.f;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Same layout as a glsl vec4
+struct Vec4 {
+	float X = 0.f;
+	float Y = 0.f;
+	float Z = 0.f;
+	float W = 0.f;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Column major like glsl, M[column * 4 + row], so it can be copied to the GPU as is
+struct Mat4 {
+	float M[16] = {
+		1.f, 0.f, 0.f, 0.f,
+		0.f, 1.f, 0.f, 0.f,
+		0.f, 0.f, 1.f, 0.f,
+		0.f, 0.f, 0.f, 1.f
+	};
+
+	float & operator()(int row, int column) { return M[column * 4 + row]; }
+	float operator()(int row, int column) const { return M[column * 4 + row]; }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+inline Vec3 operator+(const Vec3 & a, const Vec3 & b) { return { a.X + b.X, a.Y + b.Y, a.Z + b.Z }; }
+inline Vec3 operator-(const Vec3 & a, const Vec3 & b) { return { a.X - b.X, a.Y - b.Y, a.Z - b.Z }; }
+inline Vec3 operator*(const Vec3 & v, float s) { return { v.X * s, v.Y * s, v.Z * s }; }
+
+inline float Dot(const Vec3 & a, const Vec3 & b) { return a.X * b.X + a.Y * b.Y + a.Z * b.Z; }
+inline float Length(const Vec3 & v) { return std::sqrt(Dot(v, v)); }
+inline Vec3 Normalize(const Vec3 & v) { return v * (1.f / Length(v)); }
+
+inline Vec3 Cross(const Vec3 & a, const Vec3 & b) {
+	return { a.Y * b.Z - a.Z * b.Y, a.Z * b.X - a.X * b.Z, a.X * b.Y - a.Y * b.X };
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+inline Mat4 operator*(const Mat4 & a, const Mat4 & b) {
+	Mat4 result;
+	for (int column = 0; column < 4; column++) {
+		for (int row = 0; row < 4; row++) {
+			float sum = 0.f;
+			for (int k = 0; k < 4; k++)
+				sum += a(row, k) * b(k, column);
+			result(row, column) = sum;
+		}
+	}
+	return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+inline Vec3 TransformPoint(const Mat4 & m, const Vec3 & p) {
+	return {
+		m(0, 0) * p.X + m(0, 1) * p.Y + m(0, 2) * p.Z + m(0, 3)
+		, m(1, 0) * p.X + m(1, 1) * p.Y + m(1, 2) * p.Z + m(1, 3)
+		, m(2, 0) * p.X + m(2, 1) * p.Y + m(2, 2) * p.Z + m(2, 3)
+	};
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+inline Mat4 Translation(const Vec3 & offset) {
+	Mat4 result;
+	result(0, 3) = offset.X;
+	result(1, 3) = offset.Y;
+	result(2, 3) = offset.Z;
+	return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+inline Mat4 Scale(const Vec3 & scale) {
+	Mat4 result;
+	result(0, 0) = scale.X;
+	result(1, 1) = scale.Y;
+	result(2, 2) = scale.Z;
+	return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Largest scale along any axis, what a bounding sphere's radius has to grow by
+inline float GetMaxScale(const Mat4 & m) {
+	const float x = Length({ m(0, 0), m(1, 0), m(2, 0) });
+	const float y = Length({ m(0, 1), m(1, 1), m(2, 1) });
+	const float z = Length({ m(0, 2), m(1, 2), m(2, 2) });
+	return std::fmax(x, std::fmax(y, z));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Bounding sphere (xyz center, w radius) of a transformed sphere
+inline Vec4 TransformSphere(const Mat4 & m, const Vec4 & sphere) {
+	const Vec3 center = TransformPoint(m, { sphere.X, sphere.Y, sphere.Z });
+	return { center.X, center.Y, center.Z, sphere.W * GetMaxScale(m) };
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Sphere around the bounding box of the points, cheap and good enough to cull with
+inline Vec4 ComputeBoundingSphere(const Vec3 * points, size_t count) {
+	Vec3 min = { FLT_MAX, FLT_MAX, FLT_MAX };
+	Vec3 max = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	for (size_t i = 0; i < count; i++) {
+		min = { std::fmin(min.X, points[i].X), std::fmin(min.Y, points[i].Y), std::fmin(min.Z, points[i].Z) };
+		max = { std::fmax(max.X, points[i].X), std::fmax(max.Y, points[i].Y), std::fmax(max.Z, points[i].Z) };
+	}
+
+	const Vec3 center = (min + max) * 0.5f;
+	float radius = 0.f;
+	for (size_t i = 0; i < count; i++)
+		radius = std::fmax(radius, Length(points[i] - center));
+
+	return { center.X, center.Y, center.Z, radius };
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Right handed view matrix looking down -Z
+inline Mat4 LookAt(const Vec3 & eye, const Vec3 & target, const Vec3 & up) {
+	const Vec3 forward = Normalize(target - eye);
+	const Vec3 side = Normalize(Cross(forward, up));
+	const Vec3 newUp = Cross(side, forward);
+
+	Mat4 result;
+	result(0, 0) = side.X;
+	result(0, 1) = side.Y;
+	result(0, 2) = side.Z;
+	result(0, 3) = -Dot(side, eye);
+
+	result(1, 0) = newUp.X;
+	result(1, 1) = newUp.Y;
+	result(1, 2) = newUp.Z;
+	result(1, 3) = -Dot(newUp, eye);
+
+	result(2, 0) = -forward.X;
+	result(2, 1) = -forward.Y;
+	result(2, 2) = -forward.Z;
+	result(2, 3) = Dot(forward, eye);
+	return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Vulkan clip space: Y points down and depth goes from 0 at the near plane to 1 at the far plane
+inline Mat4 Perspective(float fovY, float aspect, float nearPlane, float farPlane) {
+	const float focal = 1.f / std::tan(fovY * 0.5f);
+
+	Mat4 result;
+	result(0, 0) = focal / aspect;
+	result(1, 1) = -focal;
+	result(2, 2) = farPlane / (nearPlane - farPlane);
+	result(2, 3) = nearPlane * farPlane / (nearPlane - farPlane);
+	result(3, 2) = -1.f;
+	result(3, 3) = 0.f;
+	return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Planes of the view frustum as (normal, distance), normals pointing inwards and normalized,
+// in the order left, right, bottom, top, near, far. A point p is inside a plane if dot(n, p) + d >= 0.
+inline void ExtractFrustumPlanes(const Mat4 & viewProj, Vec4 outPlanes[6]) {
+	auto row = [&](int r) { return Vec4{ viewProj(r, 0), viewProj(r, 1), viewProj(r, 2), viewProj(r, 3) }; };
+	auto add = [](const Vec4 & a, const Vec4 & b) { return Vec4{ a.X + b.X, a.Y + b.Y, a.Z + b.Z, a.W + b.W }; };
+	auto sub = [](const Vec4 & a, const Vec4 & b) { return Vec4{ a.X - b.X, a.Y - b.Y, a.Z - b.Z, a.W - b.W }; };
+
+	const Vec4 x = row(0);
+	const Vec4 y = row(1);
+	const Vec4 z = row(2);
+	const Vec4 w = row(3);
+
+	outPlanes[0] = add(w, x);
+	outPlanes[1] = sub(w, x);
+	outPlanes[2] = add(w, y);
+	outPlanes[3] = sub(w, y);
+	// Depth is already 0 at the near plane
+	outPlanes[4] = z;
+	outPlanes[5] = sub(w, z);
+
+	for (int i = 0; i < 6; i++) {
+		Vec4 & plane = outPlanes[i];
+		const float length = Length({ plane.X, plane.Y, plane.Z });
+		plane = { plane.X / length, plane.Y / length, plane.Z / length, plane.W / length };
+	}
+}
+
+} // namespace core
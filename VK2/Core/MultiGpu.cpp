@@ -0,0 +1,139 @@
+#include "MultiGpu.h"
+
+#include "SpirvCache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace core {
+
+namespace {
+
+////////////////////////////////////////////////////////////////////////////////
+
+// "./PipelineCache.bin" becomes "./PipelineCache.1.bin". Empty paths stay disabled.
+std::string AppendDeviceIndex(const std::string & path, uint32_t index) {
+	if (path.empty())
+		return path;
+
+	std::filesystem::path result = path;
+	result.replace_extension(std::to_string(index) + result.extension().string());
+	return result.string();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+} // anonymous namespace
+
+////////////////////////////////////////////////////////////////////////////////
+
+MultiGpuRunner::MultiGpuRunner(const std::string & appName, const EngineSettings & settings)
+	: AppName(appName)
+	, Settings(settings)
+{
+	Settings.Headless = true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+int MultiGpuRunner::Exec() {
+	if (Settings.Benchmark.Enabled) {
+		std::cout << "Benchmarks measure a single GPU and can't be split" << std::endl;
+		return 1;
+	}
+
+	std::vector<std::string> devices;
+	try {
+		devices = Engine::GetSuitableDevices(Settings);
+	} catch (const std::exception & e) {
+		std::cout << e.what() << std::endl;
+		return 1;
+	}
+
+	if (devices.empty()) {
+		std::cout << "No suitable GPU found" << std::endl;
+		return 1;
+	}
+
+	const uint32_t deviceCount = static_cast<uint32_t>(devices.size());
+	const uint64_t frameCount = Settings.HeadlessFrameCount;
+
+	// Whichever engine is ready first takes the next frame
+	std::atomic<uint64_t> nextFrame = 0;
+	std::vector<uint64_t> framesTaken(deviceCount, 0);
+	std::vector<int> results(deviceCount, 0);
+
+	// The caller's callback doesn't have to be thread safe
+	std::mutex deliverMutex;
+
+	std::vector<std::thread> threads;
+	threads.reserve(deviceCount);
+
+	for (uint32_t i = 0; i < deviceCount; i++) {
+		EngineSettings settings = Settings;
+		settings.DeviceIndex = i;
+
+		// Pipeline caches and device capabilities differ between GPUs, and every engine writes its own on cleanup
+		settings.DeviceCachePath = AppendDeviceIndex(Settings.DeviceCachePath, i);
+		settings.PipelineCachePath = AppendDeviceIndex(Settings.PipelineCachePath, i);
+		settings.CpuTracePath = AppendDeviceIndex(Settings.CpuTracePath, i);
+		settings.GpuTracePath = AppendDeviceIndex(Settings.GpuTracePath, i);
+		// Every engine maps the shared archive, so none of them can replace it. It's packed below once they're all done.
+		settings.PackShaderCache = false;
+
+		// Share the CPU between the engines' job systems
+		if (settings.WorkerThreadCount == 0)
+			settings.WorkerThreadCount = std::max(1u, std::thread::hardware_concurrency() / deviceCount);
+
+		settings.AcquireHeadlessFrame = [&, i](uint64_t & outFrameNumber) {
+			outFrameNumber = nextFrame.fetch_add(1);
+			if (frameCount != 0 && outFrameNumber >= frameCount)
+				return false;
+
+			framesTaken[i]++;
+			return true;
+		};
+
+		if (Settings.OnHeadlessFrame) {
+			settings.OnHeadlessFrame = [&](const HeadlessFrame & frame) {
+				std::lock_guard<std::mutex> lock(deliverMutex);
+				Settings.OnHeadlessFrame(frame);
+			};
+		}
+
+		threads.emplace_back([this, &results, i, settings = std::move(settings)]() {
+			std::unique_ptr<Engine> engine = std::make_unique<Engine>(AppName, settings);
+			results[i] = engine->Exec();
+		});
+	}
+
+	for (std::thread & thread : threads)
+		thread.join();
+
+	// Compiled spir-v is the same for every GPU
+	if (Settings.PackShaderCache) {
+		SpirvCache cache(Settings.ShaderCacheDirectory, Settings.ShaderArchivePath);
+		if (!cache.WriteArchive())
+			std::cout << "Failed to pack the shader cache" << std::endl;
+	}
+
+	int result = 0;
+	for (uint32_t i = 0; i < deviceCount; i++) {
+		std::cout << "GPU " << i << " (" << devices[i] << "): " << framesTaken[i] << " frames" << std::endl;
+		if (results[i] != 0)
+			result = 1;
+	}
+
+	return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+} // namespace core
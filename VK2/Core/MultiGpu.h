@@ -0,0 +1,40 @@
+#pragma once
+
+#include "Engine.h"
+
+#include <string>
+
+namespace core {
+
+////////////////////////////////////////////////////////////////////////////////
+// Splits one headless run across every suitable GPU in the machine.
+//
+// Each GPU gets an Engine of its own, running on its own thread with its own
+// instance, device and job system, so nothing is shared between them on the
+// CPU or GPU side. Frame numbers are handed out from one counter as each
+// engine becomes ready for another frame, so faster GPUs take on more of the
+// run and throughput grows with the number of GPUs.
+//
+// Per GPU files, the pipeline and device caches and the traces, get the GPU's
+// index appended to their names. The shader cache is shared, and packed once
+// every engine has shut down.
+class MultiGpuRunner {
+public:
+	// settings is what every engine is configured with. The run is always headless.
+	MultiGpuRunner(const std::string & appName, const EngineSettings & settings);
+
+	MultiGpuRunner(const MultiGpuRunner &) = delete;
+	MultiGpuRunner & operator=(const MultiGpuRunner &) = delete;
+
+	// Render settings.HeadlessFrameCount frames between the GPUs, or never stop with 0.
+	// settings.OnHeadlessFrame is called for one frame at a time, in the order they finish,
+	// from the thread of the engine that rendered it. Returns 0 if every engine succeeded.
+	// A GPU failing doesn't stop the others, the frames it had taken on are lost.
+	int Exec();
+
+private:
+	std::string AppName;
+	EngineSettings Settings;
+};
+
+} // namespace core
@@ -0,0 +1,108 @@
+#include "PipelineCache.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+namespace core {
+
+namespace {
+
+// Header every driver writes at the start of the cache data (VK_PIPELINE_CACHE_HEADER_VERSION_ONE)
+struct CacheHeader {
+	uint32_t HeaderSize;
+	uint32_t HeaderVersion;
+	uint32_t VendorId;
+	uint32_t DeviceId;
+	uint8_t CacheUuid[VK_UUID_SIZE];
+};
+
+} // anonymous namespace
+
+////////////////////////////////////////////////////////////////////////////////
+
+PipelineCache::PipelineCache(const vkb::DispatchTable & vk, const VkPhysicalDeviceProperties & gpuProperties, const std::string & path)
+	: Vk(vk)
+	, GPUProperties(gpuProperties)
+	, Path(path)
+{
+	std::string data;
+
+	std::ifstream file(Path, std::ios::ate | std::ios::binary);
+	if (file.is_open()) {
+		size_t fileSize = (size_t)file.tellg();
+		data.resize(fileSize);
+		file.seekg(0);
+		file.read(data.data(), fileSize);
+
+		// Stale data from another GPU or driver would just be rejected, start from scratch instead
+		if (!file || !IsCompatible(data))
+			data.clear();
+	}
+
+	VkPipelineCacheCreateInfo createInfo = {};
+	createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	createInfo.pNext = nullptr;
+
+	createInfo.initialDataSize = data.size();
+	createInfo.pInitialData = data.empty() ? nullptr : data.data();
+
+	if (Vk.createPipelineCache(&createInfo, nullptr, &Cache))
+		throw std::runtime_error("Failed to create pipeline cache");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+PipelineCache::~PipelineCache() {
+	Vk.destroyPipelineCache(Cache, nullptr);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool PipelineCache::Save() const {
+	size_t dataSize = 0;
+	if (Vk.getPipelineCacheData(Cache, &dataSize, nullptr))
+		return false;
+
+	std::vector<char> data(dataSize);
+	if (Vk.getPipelineCacheData(Cache, &dataSize, data.data()))
+		return false;
+
+	// Write next to the old cache and swap it in, so a crash never leaves a partial file
+	const std::string tempPath = Path + ".tmp";
+	{
+		std::ofstream outFile(tempPath, std::ios::binary);
+		if (!outFile.is_open())
+			return false;
+
+		outFile.write(data.data(), dataSize);
+		if (!outFile)
+			return false;
+	}
+
+	std::error_code error;
+	std::filesystem::rename(tempPath, Path, error);
+	return !error;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool PipelineCache::IsCompatible(const std::string & data) const {
+	if (data.size() < sizeof(CacheHeader))
+		return false;
+
+	CacheHeader header;
+	memcpy(&header, data.data(), sizeof(header));
+
+	return header.HeaderSize >= sizeof(CacheHeader)
+		&& header.HeaderVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+		&& header.VendorId == GPUProperties.vendorID
+		&& header.DeviceId == GPUProperties.deviceID
+		&& memcmp(header.CacheUuid, GPUProperties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+} // namespace core
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "VkBootStrap/VkBootstrapDispatch.h"
+
+#include <string>
+
+namespace core {
+
+////////////////////////////////////////////////////////////////////////////////
+// VkPipelineCache that persists between runs.
+// The file is only used if its header matches the vendor, device and cache
+// UUID of the current GPU, otherwise the cache starts out empty.
+class PipelineCache {
+public:
+	PipelineCache(const vkb::DispatchTable & vk, const VkPhysicalDeviceProperties & gpuProperties, const std::string & path);
+	~PipelineCache();
+
+	PipelineCache(const PipelineCache &) = delete;
+	PipelineCache & operator=(const PipelineCache &) = delete;
+
+	VkPipelineCache Get() const { return Cache; }
+
+	// Write the cache contents back to disk
+	bool Save() const;
+
+private:
+	// Check that the data was produced by this driver on this GPU
+	bool IsCompatible(const std::string & data) const;
+
+private:
+	const vkb::DispatchTable & Vk;
+	VkPhysicalDeviceProperties GPUProperties;
+	std::string Path;
+
+	VkPipelineCache Cache = VK_NULL_HANDLE;
+};
+
+} // namespace core
@@ -0,0 +1,427 @@
+#include "PipelineLibrary.h"
+
+#include "DeletionQueue.h"
+#include "Hash.h"
+#include "PipelineCache.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace core {
+
+namespace {
+
+////////////////////////////////////////////////////////////////////////////////
+
+uint64_t HashConstants(const SpecializationConstants & constants, uint64_t hash) {
+	for (const VkSpecializationMapEntry & entry : constants.Entries) {
+		hash = HashValue(entry.constantID, hash);
+		hash = HashBytes(constants.Data.data() + entry.offset, entry.size, hash);
+	}
+	return hash;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Null without constants, info has to outlive the pipeline creation
+const VkSpecializationInfo * MakeSpecializationInfo(const SpecializationConstants & constants, VkSpecializationInfo & info) {
+	if (constants.IsEmpty())
+		return nullptr;
+
+	info.mapEntryCount = static_cast<uint32_t>(constants.Entries.size());
+	info.pMapEntries = constants.Entries.data();
+	info.dataSize = constants.Data.size();
+	info.pData = constants.Data.data();
+	return &info;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+} // anonymous namespace
+
+////////////////////////////////////////////////////////////////////////////////
+
+uint64_t GraphicsPipelineDesc::Hash() const {
+	uint64_t hash = HashValue(VertexShader.Index);
+	hash = HashValue(FragmentShader.Index, hash);
+	hash = HashConstants(VertexConstants, hash);
+	hash = HashConstants(FragmentConstants, hash);
+	hash = HashValue(Layout, hash);
+	hash = HashValue(RenderPass, hash);
+	hash = HashValue(Subpass, hash);
+
+	for (VkFormat format : ColorFormats)
+		hash = HashValue(format, hash);
+	hash = HashValue(DepthFormat, hash);
+
+	for (const VkVertexInputBindingDescription & binding : VertexBindings) {
+		hash = HashValue(binding.binding, hash);
+		hash = HashValue(binding.stride, hash);
+		hash = HashValue(binding.inputRate, hash);
+	}
+	for (const VkVertexInputAttributeDescription & attribute : VertexAttributes) {
+		hash = HashValue(attribute.location, hash);
+		hash = HashValue(attribute.binding, hash);
+		hash = HashValue(attribute.format, hash);
+		hash = HashValue(attribute.offset, hash);
+	}
+
+	hash = HashValue(Topology, hash);
+	hash = HashValue(PolygonMode, hash);
+	hash = HashValue(CullMode, hash);
+	hash = HashValue(FrontFace, hash);
+	hash = HashValue(DepthTest, hash);
+	hash = HashValue(DepthWrite, hash);
+	hash = HashValue(DepthCompareOp, hash);
+	return hash;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+PipelineLibrary::PipelineLibrary(const vkb::DispatchTable & vk, JobSystem & jobs, ShaderLibrary & shaders, PipelineCache & cache)
+	: Vk(vk)
+	, Jobs(jobs)
+	, Shaders(shaders)
+	, Cache(cache)
+{
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+PipelineLibrary::~PipelineLibrary() {
+	WaitAll();
+
+	for (Entry & entry : Entries) {
+		if (entry.Pipeline != VK_NULL_HANDLE)
+			Vk.destroyPipeline(entry.Pipeline, nullptr);
+		if (entry.RebuiltPipeline != VK_NULL_HANDLE)
+			Vk.destroyPipeline(entry.RebuiltPipeline, nullptr);
+	}
+
+	for (ReplacedModules & replaced : Replaced) {
+		for (VkShaderModule module : replaced.Modules)
+			Vk.destroyShaderModule(module, nullptr);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+PipelineHandle PipelineLibrary::Register(const GraphicsPipelineDesc & desc) {
+	const uint64_t hash = desc.Hash();
+
+	std::lock_guard<std::mutex> lock(EntriesMutex);
+
+	auto it = EntryIndices.find(hash);
+	if (it != EntryIndices.end())
+		return { it->second };
+
+	PipelineHandle handle;
+	handle.Index = static_cast<uint32_t>(Entries.size());
+	Entries.emplace_back().Desc = desc;
+	EntryIndices.emplace(hash, handle.Index);
+	return handle;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void PipelineLibrary::WarmUp() {
+	std::unique_lock<std::mutex> lock(EntriesMutex);
+
+	for (size_t i = 0; i < Entries.size(); i++) {
+		Entry & entry = Entries[i];
+		lock.unlock();
+		StartCreation(entry);
+		lock.lock();
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool PipelineLibrary::IsReady(PipelineHandle handle) {
+	Entry & entry = GetEntry(handle);
+	return entry.Started && entry.Created.IsDone();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+VkPipeline PipelineLibrary::Get(PipelineHandle handle) {
+	Entry & entry = GetEntry(handle);
+
+	// Without a warm up this is where the creation hitch happens
+	StartCreation(entry);
+	Jobs.Wait(entry.Created);
+
+	if (entry.Error)
+		std::rethrow_exception(entry.Error);
+
+	return entry.Pipeline;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void PipelineLibrary::WaitAll() {
+	std::unique_lock<std::mutex> lock(EntriesMutex);
+
+	for (size_t i = 0; i < Entries.size(); i++) {
+		Entry & entry = Entries[i];
+		lock.unlock();
+		if (entry.Started)
+			Jobs.Wait(entry.Created);
+		if (entry.Rebuilding)
+			Jobs.Wait(entry.Rebuilt);
+		lock.lock();
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void PipelineLibrary::Rebuild(const std::vector<ShaderHandle> & shaders, std::vector<VkShaderModule> replacedModules) {
+	std::lock_guard<std::mutex> lock(EntriesMutex);
+
+	ReplacedModules replaced;
+	replaced.Modules = std::move(replacedModules);
+
+	for (Entry & entry : Entries) {
+		const bool affected = std::any_of(shaders.begin(), shaders.end(), [&entry](ShaderHandle shader) {
+			return shader.Index == entry.Desc.VertexShader.Index
+				|| shader.Index == entry.Desc.FragmentShader.Index;
+		});
+		if (!affected)
+			continue;
+
+		// The new modules are in place, so only jobs that are already running can have taken the old ones
+		if (!entry.Created.IsDone())
+			replaced.Builds.push_back(&entry.Created);
+		if (entry.Rebuilding && !entry.Rebuilt.IsDone())
+			replaced.Builds.push_back(&entry.Rebuilt);
+
+		// Pipelines that haven't started creation will get the new modules anyway
+		if (!entry.Started || entry.RebuildRequested)
+			continue;
+
+		// A rebuild that is already running may have picked up the old modules, so it gets redone after
+		entry.RebuildRequested = true;
+		if (!entry.Rebuilding)
+			PendingRebuilds++;
+	}
+
+	if (!replaced.Modules.empty())
+		Replaced.push_back(std::move(replaced));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void PipelineLibrary::ApplyRebuilds(DeletionQueue & deletions) {
+	if (PendingRebuilds == 0 && Replaced.empty())
+		return;
+
+	std::lock_guard<std::mutex> lock(EntriesMutex);
+
+	// Pipelines don't reference their modules once created, so modules are free to go as soon as the jobs are done
+	std::erase_if(Replaced, [this](ReplacedModules & replaced) {
+		const bool done = std::all_of(replaced.Builds.begin(), replaced.Builds.end(), [](JobCounter * build) {
+			return build->IsDone();
+		});
+		if (done) {
+			for (VkShaderModule module : replaced.Modules)
+				Vk.destroyShaderModule(module, nullptr);
+		}
+		return done;
+	});
+
+	for (Entry & entry : Entries) {
+		if (entry.Rebuilding && entry.Rebuilt.IsDone()) {
+			entry.Rebuilding = false;
+
+			// On failure keep drawing with the old pipeline, the shader error has been reported when compiling
+			if (entry.RebuildError) {
+				entry.RebuildError = nullptr;
+			} else {
+				// A first build that failed, e.g. on a shader typo, is fixed now and Get() stops throwing
+				entry.Error = nullptr;
+
+				// Frames in flight may still be using the old pipeline
+				deletions.Push([&vk = Vk, pipeline = entry.Pipeline]() {
+					vk.destroyPipeline(pipeline, nullptr);
+				});
+
+				entry.Pipeline = entry.RebuiltPipeline;
+				entry.RebuiltPipeline = VK_NULL_HANDLE;
+			}
+
+			if (!entry.RebuildRequested)
+				PendingRebuilds--;
+		}
+
+		// Wait for the first creation to finish, the rebuild replaces what it created
+		if (!entry.RebuildRequested || entry.Rebuilding || !entry.Created.IsDone())
+			continue;
+
+		entry.RebuildRequested = false;
+		entry.Rebuilding = true;
+
+		Jobs.Schedule([this, &entry]() {
+			try {
+				entry.RebuiltPipeline = CreateGraphicsPipeline(entry.Desc);
+			} catch (...) {
+				entry.RebuildError = std::current_exception();
+			}
+		}, &entry.Rebuilt);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+PipelineLibrary::Entry & PipelineLibrary::GetEntry(PipelineHandle handle) {
+	std::lock_guard<std::mutex> lock(EntriesMutex);
+
+	if (handle.Index >= Entries.size())
+		throw std::runtime_error("Invalid pipeline handle");
+
+	return Entries[handle.Index];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void PipelineLibrary::StartCreation(Entry & entry) {
+	if (entry.Started.exchange(true))
+		return;
+
+	Jobs.Schedule([this, &entry]() {
+		try {
+			entry.Pipeline = CreateGraphicsPipeline(entry.Desc);
+		} catch (...) {
+			entry.Error = std::current_exception();
+		}
+	}, &entry.Created);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+VkPipeline PipelineLibrary::CreateGraphicsPipeline(const GraphicsPipelineDesc & desc) {
+	VkSpecializationInfo vertexSpecialization = {};
+	VkSpecializationInfo fragmentSpecialization = {};
+
+	// Blocks until the shaders have compiled
+	VkPipelineShaderStageCreateInfo stages[2] = {};
+	stages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+	stages[0].module = Shaders.Get(desc.VertexShader);
+	stages[0].pName = "main";
+	stages[0].pSpecializationInfo = MakeSpecializationInfo(desc.VertexConstants, vertexSpecialization);
+
+	stages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+	stages[1].module = Shaders.Get(desc.FragmentShader);
+	stages[1].pName = "main";
+	stages[1].pSpecializationInfo = MakeSpecializationInfo(desc.FragmentConstants, fragmentSpecialization);
+
+	VkPipelineVertexInputStateCreateInfo vertexInput = {};
+	vertexInput.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+	vertexInput.vertexBindingDescriptionCount = static_cast<uint32_t>(desc.VertexBindings.size());
+	vertexInput.pVertexBindingDescriptions = desc.VertexBindings.data();
+	vertexInput.vertexAttributeDescriptionCount = static_cast<uint32_t>(desc.VertexAttributes.size());
+	vertexInput.pVertexAttributeDescriptions = desc.VertexAttributes.data();
+
+	VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
+	inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+	inputAssembly.topology = desc.Topology;
+	inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+	// Viewport and scissor are set when recording
+	VkPipelineViewportStateCreateInfo viewportState = {};
+	viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+	viewportState.viewportCount = 1;
+	viewportState.scissorCount = 1;
+
+	VkPipelineRasterizationStateCreateInfo rasterizer = {};
+	rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+	rasterizer.depthClampEnable = VK_FALSE;
+	rasterizer.rasterizerDiscardEnable = VK_FALSE;
+	rasterizer.polygonMode = desc.PolygonMode;
+	rasterizer.lineWidth = 1.f;
+	rasterizer.cullMode = desc.CullMode;
+	rasterizer.frontFace = desc.FrontFace;
+	rasterizer.depthBiasEnable = VK_FALSE;
+
+	// Change this if implementing MSAA
+	VkPipelineMultisampleStateCreateInfo multisampling = {};
+	multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+	multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+	multisampling.minSampleShading = 1.f;
+
+	// Ignored if the pass has no depth attachment
+	VkPipelineDepthStencilStateCreateInfo depthStencil = {};
+	depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+	depthStencil.depthTestEnable = desc.DepthTest ? VK_TRUE : VK_FALSE;
+	depthStencil.depthWriteEnable = desc.DepthWrite ? VK_TRUE : VK_FALSE;
+	depthStencil.depthCompareOp = desc.DepthTest ? desc.DepthCompareOp : VK_COMPARE_OP_ALWAYS;
+	depthStencil.depthBoundsTestEnable = VK_FALSE;
+	depthStencil.stencilTestEnable = VK_FALSE;
+	depthStencil.minDepthBounds = 0.f;
+	depthStencil.maxDepthBounds = 1.f;
+
+	// Write all channels, no blending
+	VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
+	colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT
+		| VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+	colorBlendAttachment.blendEnable = VK_FALSE;
+
+	VkPipelineColorBlendStateCreateInfo colorBlending = {};
+	colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+	colorBlending.logicOpEnable = VK_FALSE;
+	colorBlending.logicOp = VK_LOGIC_OP_COPY;
+	colorBlending.attachmentCount = 1;
+	colorBlending.pAttachments = &colorBlendAttachment;
+
+	const VkDynamicState dynamicStates[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+	VkPipelineDynamicStateCreateInfo dynamicState = {};
+	dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+	dynamicState.dynamicStateCount = 2;
+	dynamicState.pDynamicStates = dynamicStates;
+
+	// Without a render pass, dynamic rendering needs the attachment formats up front
+	VkPipelineRenderingCreateInfoKHR renderingInfo = {};
+	renderingInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR;
+	renderingInfo.pNext = nullptr;
+
+	renderingInfo.colorAttachmentCount = static_cast<uint32_t>(desc.ColorFormats.size());
+	renderingInfo.pColorAttachmentFormats = desc.ColorFormats.data();
+	renderingInfo.depthAttachmentFormat = desc.DepthFormat;
+	renderingInfo.stencilAttachmentFormat = desc.DepthFormat == VK_FORMAT_D16_UNORM_S8_UINT
+		|| desc.DepthFormat == VK_FORMAT_D24_UNORM_S8_UINT
+		|| desc.DepthFormat == VK_FORMAT_D32_SFLOAT_S8_UINT
+		? desc.DepthFormat
+		: VK_FORMAT_UNDEFINED;
+
+	VkGraphicsPipelineCreateInfo pipelineInfo = {};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+	pipelineInfo.pNext = desc.RenderPass == VK_NULL_HANDLE ? &renderingInfo : nullptr;
+
+	pipelineInfo.stageCount = 2;
+	pipelineInfo.pStages = stages;
+	pipelineInfo.pVertexInputState = &vertexInput;
+	pipelineInfo.pInputAssemblyState = &inputAssembly;
+	pipelineInfo.pViewportState = &viewportState;
+	pipelineInfo.pRasterizationState = &rasterizer;
+	pipelineInfo.pMultisampleState = &multisampling;
+	pipelineInfo.pDepthStencilState = &depthStencil;
+	pipelineInfo.pColorBlendState = &colorBlending;
+	pipelineInfo.pDynamicState = &dynamicState;
+	pipelineInfo.layout = desc.Layout;
+	pipelineInfo.renderPass = desc.RenderPass;
+	pipelineInfo.subpass = desc.Subpass;
+	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+
+	// The pipeline cache is internally synchronized, so jobs can create pipelines concurrently
+	VkPipeline pipeline;
+	if (Vk.createGraphicsPipelines(Cache.Get(), 1, &pipelineInfo, nullptr, &pipeline))
+		throw std::runtime_error("Failed to create graphics pipeline");
+
+	return pipeline;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+} // namespace core
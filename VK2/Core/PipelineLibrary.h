@@ -0,0 +1,192 @@
+#pragma once
+
+#include "JobSystem.h"
+#include "ShaderLibrary.h"
+#include "VkBootStrap/VkBootstrapDispatch.h"
+
+#include <atomic>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+namespace core {
+
+class DeletionQueue;
+class PipelineCache;
+
+////////////////////////////////////////////////////////////////////////////////
+// Values of a shader stage's specialization constants, layout (constant_id = N) in glsl.
+// They are baked in when the pipeline is created, so the driver folds the branches that
+// depend on them away, without a module per value like a define would need.
+struct SpecializationConstants {
+	std::vector<VkSpecializationMapEntry> Entries;
+	std::vector<uint8_t> Data;
+
+	// Set or replace the value of a scalar constant
+	template <typename T>
+	void Set(uint32_t constantId, const T & value) {
+		static_assert(std::is_trivially_copyable_v<T>, "Specialization constants are plain scalars");
+
+		for (const VkSpecializationMapEntry & entry : Entries) {
+			if (entry.constantID == constantId && entry.size == sizeof(T)) {
+				std::memcpy(Data.data() + entry.offset, &value, sizeof(T));
+				return;
+			}
+		}
+
+		VkSpecializationMapEntry entry;
+		entry.constantID = constantId;
+		entry.offset = static_cast<uint32_t>(Data.size());
+		entry.size = sizeof(T);
+		Entries.push_back(entry);
+
+		Data.resize(Data.size() + sizeof(T));
+		std::memcpy(Data.data() + entry.offset, &value, sizeof(T));
+	}
+
+	// A glsl bool constant is a 32-bit VkBool32
+	void Set(uint32_t constantId, bool value) {
+		Set<VkBool32>(constantId, value ? VK_TRUE : VK_FALSE);
+	}
+
+	bool IsEmpty() const { return Entries.empty(); }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Everything needed to build a graphics pipeline.
+// Viewport and scissor are always dynamic, so pipelines survive swapchain resizes.
+struct GraphicsPipelineDesc {
+	ShaderHandle VertexShader;
+	ShaderHandle FragmentShader;
+	SpecializationConstants VertexConstants;
+	SpecializationConstants FragmentConstants;
+
+	VkPipelineLayout Layout = VK_NULL_HANDLE;
+	VkRenderPass RenderPass = VK_NULL_HANDLE;
+	uint32_t Subpass = 0;
+	// Attachment formats for dynamic rendering, only used without a RenderPass
+	std::vector<VkFormat> ColorFormats;
+	VkFormat DepthFormat = VK_FORMAT_UNDEFINED;
+
+	std::vector<VkVertexInputBindingDescription> VertexBindings;
+	std::vector<VkVertexInputAttributeDescription> VertexAttributes;
+
+	VkPrimitiveTopology Topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+	VkPolygonMode PolygonMode = VK_POLYGON_MODE_FILL;
+	VkCullModeFlags CullMode = VK_CULL_MODE_NONE;
+	VkFrontFace FrontFace = VK_FRONT_FACE_CLOCKWISE;
+
+	bool DepthTest = false;
+	bool DepthWrite = false;
+	VkCompareOp DepthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+
+	// Hash of every field, identifies the permutation
+	uint64_t Hash() const;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Handle to a pipeline owned by a PipelineLibrary
+struct PipelineHandle {
+	uint32_t Index = UINT32_MAX;
+
+	bool IsValid() const { return Index != UINT32_MAX; }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Registry of every known pipeline permutation.
+// Pipelines are created on first use, or ahead of time on the job system by
+// WarmUp() so nothing has to be compiled in the middle of a frame.
+// All creation goes through the shared VkPipelineCache.
+//
+// When shaders are hot reloaded, Rebuild() recreates the pipelines using them in
+// the background, and ApplyRebuilds() swaps the new ones in at a frame boundary.
+class PipelineLibrary {
+public:
+	PipelineLibrary(const vkb::DispatchTable & vk, JobSystem & jobs, ShaderLibrary & shaders, PipelineCache & cache);
+	// Waits for outstanding creation and destroys every pipeline
+	~PipelineLibrary();
+
+	PipelineLibrary(const PipelineLibrary &) = delete;
+	PipelineLibrary & operator=(const PipelineLibrary &) = delete;
+
+	// Make a permutation known to the library. Registering the same description twice returns the same handle.
+	PipelineHandle Register(const GraphicsPipelineDesc & desc);
+
+	// Start creating every registered pipeline that hasn't been created yet, in the background
+	void WarmUp();
+
+	// True once the pipeline has been created (or failed to)
+	bool IsReady(PipelineHandle handle);
+
+	// Get the pipeline, creating it now if needed. Throws if creation failed.
+	// Safe to call from multiple threads.
+	VkPipeline Get(PipelineHandle handle);
+
+	// Wait for every pipeline that has started creation or a rebuild
+	void WaitAll();
+
+	// Rebuild every pipeline already created from one of the shaders, usually the ones
+	// ShaderLibrary::ApplyReloads() returned. The old pipelines stay in use until the
+	// rebuilds are swapped in. Call at a frame boundary.
+	// replacedModules are the modules the shaders had before, which creation and rebuild
+	// jobs already running may still be using. They're destroyed once those jobs are done.
+	void Rebuild(const std::vector<ShaderHandle> & shaders, std::vector<VkShaderModule> replacedModules);
+
+	// Start requested rebuilds and swap in the finished ones, destroying the replaced
+	// pipelines through deletions. A pipeline that fails to rebuild keeps the old one.
+	// Also destroys the replaced shader modules no job can be using anymore.
+	// Call at a frame boundary, before recording, since Get() returns the new pipelines afterwards.
+	void ApplyRebuilds(DeletionQueue & deletions);
+
+private:
+	struct Entry {
+		GraphicsPipelineDesc Desc;
+		std::atomic<bool> Started = false;
+		JobCounter Created;
+		VkPipeline Pipeline = VK_NULL_HANDLE;
+		std::exception_ptr Error;
+
+		// Only touched at frame boundaries, besides the rebuild job writing its results
+		bool RebuildRequested = false;
+		bool Rebuilding = false;
+		JobCounter Rebuilt;
+		VkPipeline RebuiltPipeline = VK_NULL_HANDLE;
+		std::exception_ptr RebuildError;
+	};
+
+	// Shader modules replaced by a hot reload, and the jobs that may have picked them up
+	struct ReplacedModules {
+		std::vector<VkShaderModule> Modules;
+		std::vector<JobCounter *> Builds;
+	};
+
+	Entry & GetEntry(PipelineHandle handle);
+
+	// Schedule creation of the pipeline unless that has already happened
+	void StartCreation(Entry & entry);
+
+	// Throws if fails
+	VkPipeline CreateGraphicsPipeline(const GraphicsPipelineDesc & desc);
+
+private:
+	const vkb::DispatchTable & Vk;
+	JobSystem & Jobs;
+	ShaderLibrary & Shaders;
+	PipelineCache & Cache;
+
+	// Guards Entries and EntryIndices. Entries never move once created.
+	std::mutex EntriesMutex;
+	std::deque<Entry> Entries;
+	std::unordered_map<uint64_t, uint32_t> EntryIndices;
+
+	// Entries requesting or running a rebuild, so ApplyRebuilds() is free most frames
+	uint32_t PendingRebuilds = 0;
+	// Guarded by EntriesMutex
+	std::vector<ReplacedModules> Replaced;
+};
+
+} // namespace core
@@ -0,0 +1,108 @@
+#include "Profiling.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+
+namespace core {
+
+////////////////////////////////////////////////////////////////////////////////
+
+std::string EscapeJson(const std::string & str) {
+	std::string escaped;
+	escaped.reserve(str.size());
+
+	for (char c : str) {
+		if (c == '"' || c == '\\')
+			escaped += '\\';
+
+		if (static_cast<unsigned char>(c) >= 0x20)
+			escaped += c;
+	}
+	return escaped;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+RollingStats::RollingStats(uint32_t capacity)
+	: Capacity(std::max(1u, capacity))
+{
+	Samples.reserve(Capacity);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void RollingStats::Add(double sample) {
+	if (Samples.size() < Capacity) {
+		Samples.push_back(sample);
+		return;
+	}
+
+	Samples[Next] = sample;
+	Next = (Next + 1) % Capacity;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+double RollingStats::GetAverage() const {
+	if (Samples.empty())
+		return 0.0;
+
+	double sum = 0.0;
+	for (double sample : Samples)
+		sum += sample;
+	return sum / Samples.size();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+double RollingStats::GetPercentile(double percentile) const {
+	if (Samples.empty())
+		return 0.0;
+
+	// Nearest rank on a copy, the ring itself stays in arrival order
+	std::vector<double> sorted = Samples;
+	const size_t rank = static_cast<size_t>(std::clamp(percentile, 0.0, 1.0) * (sorted.size() - 1) + 0.5);
+	std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+	return sorted[rank];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool WriteChromeTrace(
+	const std::string & path
+	, const std::vector<TraceEvent> & events
+	, const std::vector<std::string> & trackNames)
+{
+	std::ofstream file(path);
+	if (!file.is_open())
+		return false;
+
+	// Default stream precision would turn long timestamps into exponents
+	file << std::fixed << std::setprecision(3);
+	file << "{\"traceEvents\":[\n";
+
+	bool first = true;
+	for (size_t track = 0; track < trackNames.size(); track++) {
+		file << (first ? "" : ",\n")
+			<< "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << track
+			<< ",\"args\":{\"name\":\"" << EscapeJson(trackNames[track]) << "\"}}";
+		first = false;
+	}
+
+	// Complete events, timestamps in microseconds
+	for (const TraceEvent & event : events) {
+		file << (first ? "" : ",\n")
+			<< "{\"name\":\"" << EscapeJson(event.Name) << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << event.Track
+			<< ",\"ts\":" << event.StartMicroseconds
+			<< ",\"dur\":" << event.DurationMicroseconds << "}";
+		first = false;
+	}
+
+	file << "\n]}\n";
+	return static_cast<bool>(file);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+} // namespace core
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace core {
+
+////////////////////////////////////////////////////////////////////////////////
+// Keeps the last N samples of a measurement, for averages and percentiles
+// that follow what is happening now instead of the whole run.
+// Not thread safe.
+class RollingStats {
+public:
+	explicit RollingStats(uint32_t capacity = 240);
+
+	void Add(double sample);
+
+	double GetAverage() const;
+	// percentile in [0, 1], e.g. 0.99 for p99. 0 if there are no samples.
+	double GetPercentile(double percentile) const;
+
+	uint32_t GetCount() const { return static_cast<uint32_t>(Samples.size()); }
+	// In no particular order
+	const std::vector<double> & GetSamples() const { return Samples; }
+
+private:
+	uint32_t Capacity;
+	// Ring of samples, Next is the slot the next one replaces once full
+	std::vector<double> Samples;
+	uint32_t Next = 0;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Timed event in a trace, as shown by chrome://tracing, Perfetto or Tracy's importer
+struct TraceEvent {
+	std::string Name;
+	// Row the event is shown in, e.g. a thread or a queue
+	uint32_t Track = 0;
+	double StartMicroseconds = 0.0;
+	double DurationMicroseconds = 0.0;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Names end up in JSON strings, escape what would break them
+std::string EscapeJson(const std::string & str);
+
+////////////////////////////////////////////////////////////////////////////////
+// Write events in the Chrome trace event JSON format. trackNames names the tracks by index.
+// Returns false if the file couldn't be written.
+bool WriteChromeTrace(
+	const std::string & path
+	, const std::vector<TraceEvent> & events
+	, const std::vector<std::string> & trackNames);
+
+} // namespace core
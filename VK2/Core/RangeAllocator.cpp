@@ -0,0 +1,86 @@
+#include "RangeAllocator.h"
+
+#include <iterator>
+
+namespace core {
+
+////////////////////////////////////////////////////////////////////////////////
+
+RangeAllocator::RangeAllocator(uint64_t size) {
+	Reset(size);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void RangeAllocator::Reset(uint64_t size) {
+	Size = size;
+	FreeSize = size;
+
+	FreeRanges.clear();
+	if (size > 0)
+		FreeRanges.emplace(0, size);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool RangeAllocator::Allocate(uint64_t size, uint64_t alignment, uint64_t & outOffset) {
+	if (size == 0 || size > FreeSize)
+		return false;
+
+	// First fit, lower offsets are preferred which keeps the end of the space free for large requests
+	for (auto it = FreeRanges.begin(); it != FreeRanges.end(); ++it) {
+		const uint64_t rangeOffset = it->first;
+		const uint64_t rangeEnd = it->first + it->second;
+
+		const uint64_t offset = AlignUp(rangeOffset, alignment);
+		if (offset + size > rangeEnd)
+			continue;
+
+		FreeRanges.erase(it);
+
+		// Give back the padding in front of the allocation and whatever is left after it
+		if (offset > rangeOffset)
+			FreeRanges.emplace(rangeOffset, offset - rangeOffset);
+		if (offset + size < rangeEnd)
+			FreeRanges.emplace(offset + size, rangeEnd - (offset + size));
+
+		FreeSize -= size;
+		outOffset = offset;
+		return true;
+	}
+
+	return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void RangeAllocator::Free(uint64_t offset, uint64_t size) {
+	if (size == 0)
+		return;
+
+	FreeSize += size;
+
+	auto next = FreeRanges.lower_bound(offset);
+
+	// Merge with the range immediately before
+	if (next != FreeRanges.begin()) {
+		auto prev = std::prev(next);
+		if (prev->first + prev->second == offset) {
+			offset = prev->first;
+			size += prev->second;
+			FreeRanges.erase(prev);
+		}
+	}
+
+	// Merge with the range immediately after
+	if (next != FreeRanges.end() && offset + size == next->first) {
+		size += next->second;
+		FreeRanges.erase(next);
+	}
+
+	FreeRanges.emplace(offset, size);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+} // namespace core
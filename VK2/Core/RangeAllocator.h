@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+
+namespace core {
+
+////////////////////////////////////////////////////////////////////////////////
+// Hands out aligned sub-ranges of a fixed size space, e.g. offsets into a
+// VkDeviceMemory block. Freed ranges are merged with their neighbours.
+// Not thread safe.
+class RangeAllocator {
+public:
+	explicit RangeAllocator(uint64_t size = 0);
+
+	// Forget every allocation and start over with a space of the given size
+	void Reset(uint64_t size);
+
+	// Returns false if no free range is large enough
+	bool Allocate(uint64_t size, uint64_t alignment, uint64_t & outOffset);
+
+	// Return a range previously handed out by Allocate
+	void Free(uint64_t offset, uint64_t size);
+
+	uint64_t GetSize() const { return Size; }
+	uint64_t GetFreeSize() const { return FreeSize; }
+	bool IsEmpty() const { return FreeSize == Size; }
+
+private:
+	uint64_t Size = 0;
+	uint64_t FreeSize = 0;
+
+	// Free ranges, offset to size
+	std::map<uint64_t, uint64_t> FreeRanges;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+inline uint64_t AlignUp(uint64_t value, uint64_t alignment) {
+	return alignment > 1 ? (value + alignment - 1) / alignment * alignment : value;
+}
+
+} // namespace core
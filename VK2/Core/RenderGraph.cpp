@@ -0,0 +1,1015 @@
+#include "RenderGraph.h"
+
+#include "GpuProfiler.h"
+#include "Hash.h"
+#include "RangeAllocator.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace core {
+
+namespace {
+
+// Cached framebuffers not used for this many executions are destroyed
+constexpr uint64_t FramebufferRetireExecutions = 16;
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool IsDepthFormat(VkFormat format) {
+	switch (format) {
+	case VK_FORMAT_D16_UNORM:
+	case VK_FORMAT_X8_D24_UNORM_PACK32:
+	case VK_FORMAT_D32_SFLOAT:
+	case VK_FORMAT_D16_UNORM_S8_UINT:
+	case VK_FORMAT_D24_UNORM_S8_UINT:
+	case VK_FORMAT_D32_SFLOAT_S8_UINT:
+		return true;
+	default:
+		return false;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool HasStencil(VkFormat format) {
+	return format == VK_FORMAT_D16_UNORM_S8_UINT
+		|| format == VK_FORMAT_D24_UNORM_S8_UINT
+		|| format == VK_FORMAT_D32_SFLOAT_S8_UINT;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Aspects a barrier on the whole image has to cover
+VkImageAspectFlags GetBarrierAspects(VkFormat format) {
+	if (!IsDepthFormat(format))
+		return VK_IMAGE_ASPECT_COLOR_BIT;
+
+	return HasStencil(format)
+		? VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT
+		: VK_IMAGE_ASPECT_DEPTH_BIT;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool RangesOverlap(VkDeviceSize offsetA, VkDeviceSize sizeA, VkDeviceSize offsetB, VkDeviceSize sizeB) {
+	return offsetA < offsetB + sizeB && offsetB < offsetA + sizeA;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+} // anonymous namespace
+
+////////////////////////////////////////////////////////////////////////////////
+
+RenderPassBuilder::RenderPassBuilder(RenderGraph & graph, uint32_t passIndex)
+	: Graph(graph)
+	, PassIndex(passIndex)
+{
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+RenderGraphResource RenderPassBuilder::CreateTexture(const std::string & name, const TextureDesc & desc) {
+	RenderGraph::Resource resource;
+	resource.Name = name;
+	resource.IsImage = true;
+	resource.Desc = desc;
+
+	Graph.Resources.push_back(std::move(resource));
+	return { static_cast<uint32_t>(Graph.Resources.size() - 1) };
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void RenderPassBuilder::WriteColor(RenderGraphResource resource, VkAttachmentLoadOp loadOp, VkClearColorValue clear) {
+	RenderGraph::Pass & pass = Graph.Passes[PassIndex];
+	if (!pass.Raster)
+		throw std::runtime_error("Color attachments are only allowed in raster passes: " + pass.Name);
+
+	const bool load = loadOp == VK_ATTACHMENT_LOAD_OP_LOAD;
+
+	RenderGraph::ResourceUse use;
+	use.Resource = resource.Index;
+	use.Stages = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	use.Access = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | (load ? VK_ACCESS_COLOR_ATTACHMENT_READ_BIT : 0);
+	use.Layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	use.Usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+	use.Read = load;
+	use.Write = true;
+	Graph.AddUse(PassIndex, use);
+
+	RenderGraph::AttachmentUse attachment;
+	attachment.Resource = resource.Index;
+	attachment.LoadOp = loadOp;
+	attachment.Clear.color = clear;
+	attachment.Layout = use.Layout;
+	pass.ColorAttachments.push_back(attachment);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void RenderPassBuilder::WriteDepth(RenderGraphResource resource, VkAttachmentLoadOp loadOp, VkClearDepthStencilValue clear) {
+	RenderGraph::Pass & pass = Graph.Passes[PassIndex];
+	if (!pass.Raster)
+		throw std::runtime_error("Depth attachments are only allowed in raster passes: " + pass.Name);
+
+	const bool load = loadOp == VK_ATTACHMENT_LOAD_OP_LOAD;
+
+	RenderGraph::ResourceUse use;
+	use.Resource = resource.Index;
+	use.Stages = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	// Depth testing reads the attachment even when it was just cleared
+	use.Access = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	use.Layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	use.Usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+	use.Read = load;
+	use.Write = true;
+	Graph.AddUse(PassIndex, use);
+
+	pass.DepthAttachment.Resource = resource.Index;
+	pass.DepthAttachment.LoadOp = loadOp;
+	pass.DepthAttachment.Clear.depthStencil = clear;
+	pass.DepthAttachment.Layout = use.Layout;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void RenderPassBuilder::ReadDepth(RenderGraphResource resource) {
+	RenderGraph::Pass & pass = Graph.Passes[PassIndex];
+	if (!pass.Raster)
+		throw std::runtime_error("Depth attachments are only allowed in raster passes: " + pass.Name);
+
+	RenderGraph::ResourceUse use;
+	use.Resource = resource.Index;
+	use.Stages = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	use.Access = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
+	use.Layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+	use.Usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+	use.Read = true;
+	Graph.AddUse(PassIndex, use);
+
+	pass.DepthAttachment.Resource = resource.Index;
+	pass.DepthAttachment.LoadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+	pass.DepthAttachment.Layout = use.Layout;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void RenderPassBuilder::ReadTexture(RenderGraphResource resource, VkPipelineStageFlags stages) {
+	RenderGraph::ResourceUse use;
+	use.Resource = resource.Index;
+	use.Stages = stages;
+	use.Access = VK_ACCESS_SHADER_READ_BIT;
+	use.Layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	use.Usage = VK_IMAGE_USAGE_SAMPLED_BIT;
+	use.Read = true;
+	Graph.AddUse(PassIndex, use);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void RenderPassBuilder::ReadStorageImage(RenderGraphResource resource, VkPipelineStageFlags stages) {
+	RenderGraph::ResourceUse use;
+	use.Resource = resource.Index;
+	use.Stages = stages;
+	use.Access = VK_ACCESS_SHADER_READ_BIT;
+	use.Layout = VK_IMAGE_LAYOUT_GENERAL;
+	use.Usage = VK_IMAGE_USAGE_STORAGE_BIT;
+	use.Read = true;
+	Graph.AddUse(PassIndex, use);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void RenderPassBuilder::WriteStorageImage(RenderGraphResource resource, VkPipelineStageFlags stages) {
+	RenderGraph::ResourceUse use;
+	use.Resource = resource.Index;
+	use.Stages = stages;
+	use.Access = VK_ACCESS_SHADER_WRITE_BIT;
+	use.Layout = VK_IMAGE_LAYOUT_GENERAL;
+	use.Usage = VK_IMAGE_USAGE_STORAGE_BIT;
+	use.Write = true;
+	Graph.AddUse(PassIndex, use);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void RenderPassBuilder::ReadBuffer(RenderGraphResource resource, VkPipelineStageFlags stages, VkAccessFlags access) {
+	RenderGraph::ResourceUse use;
+	use.Resource = resource.Index;
+	use.Stages = stages;
+	use.Access = access;
+	use.Read = true;
+	Graph.AddUse(PassIndex, use);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void RenderPassBuilder::WriteBuffer(RenderGraphResource resource, VkPipelineStageFlags stages, VkAccessFlags access) {
+	RenderGraph::ResourceUse use;
+	use.Resource = resource.Index;
+	use.Stages = stages;
+	use.Access = access;
+	use.Write = true;
+	Graph.AddUse(PassIndex, use);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void RenderPassBuilder::SetSideEffects() {
+	Graph.Passes[PassIndex].SideEffects = true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void RenderPassBuilder::UseSecondaryCommandBuffers() {
+	Graph.Passes[PassIndex].SecondaryCommandBuffers = true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+RenderGraph::RenderGraph(const vkb::DispatchTable & vk, GpuAllocator & allocator, GpuProfiler * profiler, bool dynamicRendering)
+	: Vk(vk)
+	, Allocator(allocator)
+	, Profiler(profiler)
+	, DynamicRendering(dynamicRendering)
+{
+	if (!DynamicRendering)
+		return;
+
+	// The dispatch table only loads extension commands the device has enabled
+	if (!Vk.fp_vkCmdBeginRenderingKHR || !Vk.fp_vkCmdEndRenderingKHR)
+		throw std::runtime_error("VK_KHR_dynamic_rendering is not enabled");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+RenderGraph::~RenderGraph() {
+	DestroyTransients();
+
+	for (auto & [key, renderPass] : RenderPasses)
+		Vk.destroyRenderPass(renderPass, nullptr);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void RenderGraph::Reset() {
+	Passes.clear();
+	Resources.clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+RenderGraphResource RenderGraph::ImportImage(
+	const std::string & name
+	, VkImage image
+	, VkImageView view
+	, const TextureDesc & desc
+	, VkImageLayout initialLayout
+	, VkImageLayout finalLayout
+	, VkPipelineStageFlags initialStages
+	, VkAccessFlags initialWrites)
+{
+	Resource resource;
+	resource.Name = name;
+	resource.IsImage = true;
+	resource.Imported = true;
+	resource.Desc = desc;
+	resource.Image = image;
+	resource.View = view;
+	resource.InitialState.Layout = initialLayout;
+	resource.InitialState.Stages = initialStages;
+	resource.InitialState.Access = initialWrites;
+	resource.InitialState.Written = initialWrites != 0;
+	resource.FinalLayout = finalLayout;
+
+	Resources.push_back(std::move(resource));
+	return { static_cast<uint32_t>(Resources.size() - 1) };
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+RenderGraphResource RenderGraph::ImportBuffer(
+	const std::string & name
+	, VkBuffer buffer
+	, VkDeviceSize size
+	, VkPipelineStageFlags initialStages
+	, VkAccessFlags initialWrites)
+{
+	Resource resource;
+	resource.Name = name;
+	resource.Imported = true;
+	resource.Buffer = buffer;
+	resource.Size = size;
+	resource.InitialState.Stages = initialStages;
+	resource.InitialState.Access = initialWrites;
+	resource.InitialState.Written = initialWrites != 0;
+
+	Resources.push_back(std::move(resource));
+	return { static_cast<uint32_t>(Resources.size() - 1) };
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void RenderGraph::AddRasterPass(const std::string & name, const SetupFn & setup, RasterExecuteFn execute) {
+	const uint32_t passIndex = AddPass(name, true, setup);
+	Passes[passIndex].ExecuteRaster = std::move(execute);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void RenderGraph::AddComputePass(const std::string & name, const SetupFn & setup, ComputeExecuteFn execute) {
+	const uint32_t passIndex = AddPass(name, false, setup);
+	Passes[passIndex].ExecuteCompute = std::move(execute);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void RenderGraph::Compile() {
+	CullPasses();
+	ComputeLifetimes();
+	AllocateTransients();
+
+	for (Pass & pass : Passes) {
+		if (pass.Culled || !pass.Raster)
+			continue;
+
+		if (pass.ColorAttachments.empty() && pass.DepthAttachment.Resource == UINT32_MAX)
+			throw std::runtime_error("Raster pass without attachments: " + pass.Name);
+
+		// Rendering straight into the views, nothing to create
+		if (DynamicRendering)
+			continue;
+
+		pass.RenderPass = GetRenderPass(pass);
+		pass.Framebuffer = GetFramebuffer(pass);
+	}
+
+	// Framebuffers of imported views that went away, e.g. swapchain images not acquired lately
+	for (auto it = Framebuffers.begin(); it != Framebuffers.end();) {
+		if (ExecuteCount - it->second.LastUsed > FramebufferRetireExecutions) {
+			Vk.destroyFramebuffer(it->second.Framebuffer, nullptr);
+			it = Framebuffers.erase(it);
+		} else {
+			++it;
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void RenderGraph::Execute(VkCommandBuffer cmd) {
+	for (Resource & resource : Resources) {
+		resource.State = resource.InitialState;
+		resource.Touched = false;
+	}
+
+	for (Pass & pass : Passes) {
+		if (pass.Culled)
+			continue;
+
+		// Includes the pass' barriers, so waiting on earlier passes shows up too
+		const uint32_t scope = Profiler ? Profiler->BeginScope(cmd, pass.Name.c_str()) : UINT32_MAX;
+		ExecutePass(cmd, pass);
+		if (Profiler)
+			Profiler->EndScope(cmd, scope);
+	}
+
+	// Leave imported images the way their owner expects them
+	std::vector<VkImageMemoryBarrier> imageBarriers;
+	std::vector<VkBufferMemoryBarrier> bufferBarriers;
+	VkPipelineStageFlags srcStages = 0;
+	VkPipelineStageFlags dstStages = 0;
+
+	for (Resource & resource : Resources) {
+		if (!resource.Imported || !resource.IsImage || resource.FinalLayout == VK_IMAGE_LAYOUT_UNDEFINED)
+			continue;
+
+		ResourceState finalState;
+		finalState.Layout = resource.FinalLayout;
+		finalState.Stages = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+		TransitionResource(resource, finalState, imageBarriers, bufferBarriers, srcStages, dstStages);
+	}
+
+	if (!imageBarriers.empty()) {
+		Vk.cmdPipelineBarrier(
+			cmd
+			, srcStages
+			, dstStages
+			, 0
+			, 0, nullptr
+			, 0, nullptr
+			, static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data()
+		);
+	}
+
+	ExecuteCount++;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void RenderGraph::InvalidateFramebuffers() {
+	for (auto & [key, entry] : Framebuffers)
+		Vk.destroyFramebuffer(entry.Framebuffer, nullptr);
+
+	Framebuffers.clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+VkImage RenderGraph::GetImage(RenderGraphResource resource) const {
+	return Resources[resource.Index].Image;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+VkImageView RenderGraph::GetImageView(RenderGraphResource resource) const {
+	return Resources[resource.Index].View;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+VkBuffer RenderGraph::GetBuffer(RenderGraphResource resource) const {
+	return Resources[resource.Index].Buffer;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+uint32_t RenderGraph::AddPass(const std::string & name, bool raster, const SetupFn & setup) {
+	Pass pass;
+	pass.Name = name;
+	pass.Raster = raster;
+	Passes.push_back(std::move(pass));
+
+	const uint32_t passIndex = static_cast<uint32_t>(Passes.size() - 1);
+	RenderPassBuilder builder(*this, passIndex);
+	setup(builder);
+
+	return passIndex;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void RenderGraph::AddUse(uint32_t passIndex, const ResourceUse & use) {
+	if (use.Resource >= Resources.size())
+		throw std::runtime_error("Invalid render graph resource used in pass " + Passes[passIndex].Name);
+
+	Pass & pass = Passes[passIndex];
+	for (ResourceUse & existing : pass.Uses) {
+		if (existing.Resource != use.Resource)
+			continue;
+
+		// An image can only be in one layout for the whole pass
+		if (existing.Layout != use.Layout)
+			throw std::runtime_error("Conflicting uses of " + Resources[use.Resource].Name + " in pass " + pass.Name);
+
+		existing.Stages |= use.Stages;
+		existing.Access |= use.Access;
+		existing.Usage |= use.Usage;
+		existing.Read |= use.Read;
+		existing.Write |= use.Write;
+		return;
+	}
+
+	pass.Uses.push_back(use);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void RenderGraph::CullPasses() {
+	// Imported resources are what the frame is for, anything they don't depend on can go.
+	// Passes are in declaration order, so walking backwards visits consumers before producers.
+	std::vector<bool> needed(Resources.size());
+	for (size_t i = 0; i < Resources.size(); i++)
+		needed[i] = Resources[i].Imported;
+
+	for (auto pass = Passes.rbegin(); pass != Passes.rend(); ++pass) {
+		bool keep = pass->SideEffects;
+		for (const ResourceUse & use : pass->Uses)
+			keep = keep || (use.Write && needed[use.Resource]);
+
+		pass->Culled = !keep;
+		if (!keep)
+			continue;
+
+		for (const ResourceUse & use : pass->Uses) {
+			if (use.Read)
+				needed[use.Resource] = true;
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void RenderGraph::ComputeLifetimes() {
+	for (uint32_t passIndex = 0; passIndex < Passes.size(); passIndex++) {
+		const Pass & pass = Passes[passIndex];
+		if (pass.Culled)
+			continue;
+
+		for (const ResourceUse & use : pass.Uses) {
+			Resource & resource = Resources[use.Resource];
+			resource.FirstPass = std::min(resource.FirstPass, passIndex);
+			resource.LastPass = std::max(resource.LastPass, passIndex);
+			resource.Usage |= use.Usage;
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+uint64_t RenderGraph::HashTransients() const {
+	uint64_t hash = HashSeed;
+	for (const Resource & resource : Resources) {
+		if (resource.Imported || resource.FirstPass == UINT32_MAX)
+			continue;
+
+		hash = HashValue(resource.Desc.Format, hash);
+		hash = HashValue(resource.Desc.Extent.width, hash);
+		hash = HashValue(resource.Desc.Extent.height, hash);
+		hash = HashValue(resource.Desc.Samples, hash);
+		hash = HashValue(resource.Usage, hash);
+		hash = HashValue(resource.FirstPass, hash);
+		hash = HashValue(resource.LastPass, hash);
+	}
+	return hash;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void RenderGraph::AllocateTransients() {
+	const uint64_t hash = HashTransients();
+	const bool rebuild = hash != TransientHash;
+
+	if (rebuild) {
+		// This graph's last frame has finished on the GPU, nothing uses the old images anymore
+		DestroyTransients();
+		TransientHash = hash;
+	}
+
+	// Transients are numbered in declaration order, which matches last frame if the hash does
+	uint32_t transientCount = 0;
+	for (uint32_t i = 0; i < Resources.size(); i++) {
+		Resource & resource = Resources[i];
+		if (resource.Imported || resource.FirstPass == UINT32_MAX)
+			continue;
+
+		resource.Transient = transientCount++;
+		if (rebuild) {
+			VkImageCreateInfo imageInfo = {};
+			imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+			imageInfo.pNext = nullptr;
+
+			imageInfo.imageType = VK_IMAGE_TYPE_2D;
+			imageInfo.format = resource.Desc.Format;
+			imageInfo.extent = { resource.Desc.Extent.width, resource.Desc.Extent.height, 1 };
+			imageInfo.mipLevels = 1;
+			imageInfo.arrayLayers = 1;
+			imageInfo.samples = resource.Desc.Samples;
+			imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+			imageInfo.usage = resource.Usage;
+			imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+			imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+			TransientImage transient;
+			if (Vk.createImage(&imageInfo, nullptr, &transient.Image))
+				throw std::runtime_error("Failed to create transient image " + resource.Name);
+
+			Vk.getImageMemoryRequirements(transient.Image, &transient.Requirements);
+			TransientImages.push_back(std::move(transient));
+		}
+
+		TransientImages[resource.Transient].Resource = i;
+	}
+
+	if (rebuild && !TransientImages.empty())
+		PlaceTransients();
+
+	for (Resource & resource : Resources) {
+		if (resource.Transient == UINT32_MAX)
+			continue;
+
+		const TransientImage & transient = TransientImages[resource.Transient];
+		resource.Image = transient.Image;
+		resource.View = transient.View;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void RenderGraph::PlaceTransients() {
+	// Place images in pass order, returning each image's range once its last pass is done,
+	// so later images reuse the memory of earlier ones
+	VkDeviceSize spaceSize = 0;
+	VkDeviceSize alignment = 1;
+	uint32_t memoryTypeBits = UINT32_MAX;
+	for (const TransientImage & transient : TransientImages) {
+		spaceSize += AlignUp(transient.Requirements.size, transient.Requirements.alignment);
+		alignment = std::max(alignment, transient.Requirements.alignment);
+		memoryTypeBits &= transient.Requirements.memoryTypeBits;
+	}
+
+	if (memoryTypeBits == 0)
+		throw std::runtime_error("Transient images have no memory type in common");
+
+	RangeAllocator space(spaceSize + alignment);
+	std::vector<bool> placed(TransientImages.size());
+	std::vector<bool> released(TransientImages.size());
+	VkDeviceSize heapSize = 0;
+
+	for (uint32_t passIndex = 0; passIndex < Passes.size(); passIndex++) {
+		for (uint32_t t = 0; t < TransientImages.size(); t++) {
+			TransientImage & transient = TransientImages[t];
+			const Resource & resource = Resources[transient.Resource];
+			if (placed[t] && !released[t] && resource.LastPass < passIndex) {
+				space.Free(transient.Offset, transient.Requirements.size);
+				released[t] = true;
+			}
+		}
+
+		for (uint32_t t = 0; t < TransientImages.size(); t++) {
+			TransientImage & transient = TransientImages[t];
+			if (Resources[transient.Resource].FirstPass != passIndex)
+				continue;
+
+			if (!space.Allocate(transient.Requirements.size, transient.Requirements.alignment, transient.Offset))
+				throw std::runtime_error("Failed to place transient image " + Resources[transient.Resource].Name);
+			placed[t] = true;
+			heapSize = std::max(heapSize, transient.Offset + transient.Requirements.size);
+
+			for (uint32_t other = 0; other < TransientImages.size(); other++) {
+				const TransientImage & previous = TransientImages[other];
+				if (released[other] && RangesOverlap(previous.Offset, previous.Requirements.size, transient.Offset, transient.Requirements.size))
+					transient.Aliases.push_back(other);
+			}
+		}
+	}
+
+	VkMemoryRequirements heapRequirements = {};
+	heapRequirements.size = heapSize;
+	heapRequirements.alignment = alignment;
+	heapRequirements.memoryTypeBits = memoryTypeBits;
+	TransientMemory = Allocator.Allocate(heapRequirements, MemoryUsage::GpuOnly, false);
+
+	for (uint32_t t = 0; t < TransientImages.size(); t++) {
+		TransientImage & transient = TransientImages[t];
+		const Resource & resource = Resources[transient.Resource];
+
+		if (Vk.bindImageMemory(transient.Image, TransientMemory.Memory, TransientMemory.Offset + transient.Offset))
+			throw std::runtime_error("Failed to bind transient image memory");
+
+		VkImageViewCreateInfo viewInfo = {};
+		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		viewInfo.pNext = nullptr;
+
+		viewInfo.image = transient.Image;
+		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewInfo.format = resource.Desc.Format;
+		// Sampling a depth image only allows the depth aspect
+		viewInfo.subresourceRange.aspectMask = IsDepthFormat(resource.Desc.Format)
+			? VK_IMAGE_ASPECT_DEPTH_BIT
+			: VK_IMAGE_ASPECT_COLOR_BIT;
+		viewInfo.subresourceRange.levelCount = 1;
+		viewInfo.subresourceRange.layerCount = 1;
+
+		if (Vk.createImageView(&viewInfo, nullptr, &transient.View))
+			throw std::runtime_error("Failed to create transient image view " + resource.Name);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void RenderGraph::DestroyTransients() {
+	if (TransientImages.empty())
+		return;
+
+	// Framebuffers may reference the views
+	InvalidateFramebuffers();
+
+	for (TransientImage & transient : TransientImages) {
+		Vk.destroyImageView(transient.View, nullptr);
+		Vk.destroyImage(transient.Image, nullptr);
+	}
+	TransientImages.clear();
+
+	if (TransientMemory.IsValid())
+		Allocator.Free(TransientMemory);
+	TransientMemory = {};
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+VkAttachmentStoreOp RenderGraph::GetStoreOp(const Pass & pass, const AttachmentUse & use) const {
+	const Resource & resource = Resources[use.Resource];
+
+	return !resource.Imported && resource.LastPass == static_cast<uint32_t>(&pass - Passes.data())
+		? VK_ATTACHMENT_STORE_OP_DONT_CARE
+		: VK_ATTACHMENT_STORE_OP_STORE;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+VkRenderPass RenderGraph::GetRenderPass(const Pass & pass) {
+	std::vector<VkAttachmentDescription> attachments;
+	std::vector<VkAttachmentReference> colorRefs;
+	VkAttachmentReference depthRef = {};
+
+	auto addAttachment = [&](const AttachmentUse & use) {
+		const Resource & resource = Resources[use.Resource];
+
+		VkAttachmentDescription attachment = {};
+		attachment.format = resource.Desc.Format;
+		attachment.samples = resource.Desc.Samples;
+		attachment.loadOp = use.LoadOp;
+		attachment.storeOp = GetStoreOp(pass, use);
+		attachment.stencilLoadOp = HasStencil(resource.Desc.Format) ? use.LoadOp : VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		attachment.stencilStoreOp = HasStencil(resource.Desc.Format) ? attachment.storeOp : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		// The graph transitions layouts with its own barriers, the render pass never changes them
+		attachment.initialLayout = use.Layout;
+		attachment.finalLayout = use.Layout;
+		attachments.push_back(attachment);
+
+		VkAttachmentReference ref = {};
+		ref.attachment = static_cast<uint32_t>(attachments.size() - 1);
+		ref.layout = use.Layout;
+		return ref;
+	};
+
+	for (const AttachmentUse & use : pass.ColorAttachments)
+		colorRefs.push_back(addAttachment(use));
+
+	const bool hasDepth = pass.DepthAttachment.Resource != UINT32_MAX;
+	if (hasDepth)
+		depthRef = addAttachment(pass.DepthAttachment);
+
+	uint64_t key = HashSeed;
+	for (const VkAttachmentDescription & attachment : attachments)
+		key = HashValue(attachment, key);
+	key = HashValue(hasDepth, key);
+
+	auto cached = RenderPasses.find(key);
+	if (cached != RenderPasses.end())
+		return cached->second;
+
+	VkSubpassDescription subpass = {};
+	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	subpass.colorAttachmentCount = static_cast<uint32_t>(colorRefs.size());
+	subpass.pColorAttachments = colorRefs.data();
+	subpass.pDepthStencilAttachment = hasDepth ? &depthRef : nullptr;
+
+	VkRenderPassCreateInfo renderPassInfo = {};
+	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+	renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+	renderPassInfo.pAttachments = attachments.data();
+	renderPassInfo.subpassCount = 1;
+	renderPassInfo.pSubpasses = &subpass;
+
+	VkRenderPass renderPass;
+	if (Vk.createRenderPass(&renderPassInfo, nullptr, &renderPass))
+		throw std::runtime_error("Failed to create render pass for " + pass.Name);
+
+	RenderPasses.emplace(key, renderPass);
+	return renderPass;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+VkFramebuffer RenderGraph::GetFramebuffer(const Pass & pass) {
+	std::vector<VkImageView> views;
+	for (const AttachmentUse & use : pass.ColorAttachments)
+		views.push_back(Resources[use.Resource].View);
+	if (pass.DepthAttachment.Resource != UINT32_MAX)
+		views.push_back(Resources[pass.DepthAttachment.Resource].View);
+
+	const uint32_t first = pass.ColorAttachments.empty() ? pass.DepthAttachment.Resource : pass.ColorAttachments[0].Resource;
+	const VkExtent2D extent = Resources[first].Desc.Extent;
+
+	uint64_t key = HashValue(pass.RenderPass);
+	key = HashBytes(views.data(), views.size() * sizeof(VkImageView), key);
+	key = HashValue(extent.width, key);
+	key = HashValue(extent.height, key);
+
+	FramebufferEntry & entry = Framebuffers[key];
+	entry.LastUsed = ExecuteCount;
+	if (entry.Framebuffer != VK_NULL_HANDLE)
+		return entry.Framebuffer;
+
+	VkFramebufferCreateInfo fbInfo = {};
+	fbInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+	fbInfo.pNext = nullptr;
+
+	fbInfo.renderPass = pass.RenderPass;
+	fbInfo.attachmentCount = static_cast<uint32_t>(views.size());
+	fbInfo.pAttachments = views.data();
+	fbInfo.width = extent.width;
+	fbInfo.height = extent.height;
+	fbInfo.layers = 1;
+
+	if (Vk.createFramebuffer(&fbInfo, nullptr, &entry.Framebuffer)) {
+		Framebuffers.erase(key);
+		throw std::runtime_error("Failed to create framebuffer for " + pass.Name);
+	}
+
+	return entry.Framebuffer;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void RenderGraph::TransitionResource(
+	Resource & resource
+	, const ResourceState & newState
+	, std::vector<VkImageMemoryBarrier> & imageBarriers
+	, std::vector<VkBufferMemoryBarrier> & bufferBarriers
+	, VkPipelineStageFlags & srcStages
+	, VkPipelineStageFlags & dstStages)
+{
+	ResourceState & state = resource.State;
+
+	// First use this frame of an image sharing memory with earlier ones: wait until they are done with it
+	if (!resource.Touched && resource.Transient != UINT32_MAX) {
+		for (uint32_t alias : TransientImages[resource.Transient].Aliases) {
+			const ResourceState & aliasState = Resources[TransientImages[alias].Resource].State;
+			state.Stages |= aliasState.Stages;
+			state.Access |= aliasState.Written ? aliasState.Access : 0;
+			state.Written = state.Written || aliasState.Written;
+		}
+	}
+	resource.Touched = true;
+
+	const bool layoutChange = resource.IsImage && state.Layout != newState.Layout;
+	const bool hazard = state.Written || newState.Written;
+
+	// Reads after reads in the same layout can run in any order, just remember who has to be waited for
+	if (!layoutChange && !hazard) {
+		state.Stages |= newState.Stages;
+		state.Access |= newState.Access;
+		return;
+	}
+
+	srcStages |= state.Stages ? state.Stages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+	dstStages |= newState.Stages;
+
+	// Write after read only needs an execution dependency, which the stages already provide
+	const VkAccessFlags srcAccess = state.Written ? state.Access : 0;
+
+	if (resource.IsImage) {
+		VkImageMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.pNext = nullptr;
+
+		barrier.srcAccessMask = srcAccess;
+		barrier.dstAccessMask = newState.Access;
+		barrier.oldLayout = state.Layout;
+		barrier.newLayout = newState.Layout;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = resource.Image;
+		barrier.subresourceRange.aspectMask = GetBarrierAspects(resource.Desc.Format);
+		barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+		barrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+		imageBarriers.push_back(barrier);
+	} else if (srcAccess != 0 || newState.Access != 0) {
+		VkBufferMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		barrier.pNext = nullptr;
+
+		barrier.srcAccessMask = srcAccess;
+		barrier.dstAccessMask = newState.Access;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.buffer = resource.Buffer;
+		barrier.offset = 0;
+		barrier.size = VK_WHOLE_SIZE;
+		bufferBarriers.push_back(barrier);
+	}
+
+	state = newState;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void RenderGraph::ExecutePass(VkCommandBuffer cmd, Pass & pass) {
+	std::vector<VkImageMemoryBarrier> imageBarriers;
+	std::vector<VkBufferMemoryBarrier> bufferBarriers;
+	VkPipelineStageFlags srcStages = 0;
+	VkPipelineStageFlags dstStages = 0;
+
+	for (const ResourceUse & use : pass.Uses) {
+		ResourceState newState;
+		newState.Layout = use.Layout;
+		newState.Stages = use.Stages;
+		newState.Access = use.Access;
+		newState.Written = use.Write;
+		TransitionResource(Resources[use.Resource], newState, imageBarriers, bufferBarriers, srcStages, dstStages);
+	}
+
+	// One barrier per pass, covering every resource it touches
+	if (srcStages != 0) {
+		Vk.cmdPipelineBarrier(
+			cmd
+			, srcStages
+			, dstStages
+			, 0
+			, 0, nullptr
+			, static_cast<uint32_t>(bufferBarriers.size()), bufferBarriers.data()
+			, static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data()
+		);
+	}
+
+	if (!pass.Raster) {
+		pass.ExecuteCompute(cmd);
+		return;
+	}
+
+	const bool hasDepth = pass.DepthAttachment.Resource != UINT32_MAX;
+	const uint32_t first = pass.ColorAttachments.empty() ? pass.DepthAttachment.Resource : pass.ColorAttachments[0].Resource;
+
+	RasterPassContext context;
+	context.Cmd = cmd;
+	context.RenderPass = pass.RenderPass;
+	context.Framebuffer = pass.Framebuffer;
+	context.Extent = Resources[first].Desc.Extent;
+	for (const AttachmentUse & use : pass.ColorAttachments)
+		context.ColorFormats.push_back(Resources[use.Resource].Desc.Format);
+	context.DepthFormat = hasDepth ? Resources[pass.DepthAttachment.Resource].Desc.Format : VK_FORMAT_UNDEFINED;
+	context.Samples = Resources[first].Desc.Samples;
+
+	if (DynamicRendering) {
+		BeginRendering(cmd, pass, context);
+		pass.ExecuteRaster(context);
+		Vk.cmdEndRenderingKHR(cmd);
+		return;
+	}
+
+	std::vector<VkClearValue> clearValues;
+	for (const AttachmentUse & use : pass.ColorAttachments)
+		clearValues.push_back(use.Clear);
+	if (hasDepth)
+		clearValues.push_back(pass.DepthAttachment.Clear);
+
+	VkRenderPassBeginInfo rpInfo = {};
+	rpInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	rpInfo.pNext = nullptr;
+
+	rpInfo.renderPass = pass.RenderPass;
+	rpInfo.renderArea.offset = { 0, 0 };
+	rpInfo.renderArea.extent = context.Extent;
+	rpInfo.framebuffer = pass.Framebuffer;
+
+	rpInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
+	rpInfo.pClearValues = clearValues.data();
+
+	Vk.cmdBeginRenderPass(
+		cmd
+		, &rpInfo
+		, pass.SecondaryCommandBuffers ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE
+	);
+	pass.ExecuteRaster(context);
+	Vk.cmdEndRenderPass(cmd);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void RenderGraph::BeginRendering(VkCommandBuffer cmd, const Pass & pass, const RasterPassContext & context) {
+	auto makeAttachment = [&](const AttachmentUse & use) {
+		VkRenderingAttachmentInfoKHR attachment = {};
+		attachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR;
+		attachment.pNext = nullptr;
+
+		attachment.imageView = Resources[use.Resource].View;
+		attachment.imageLayout = use.Layout;
+		attachment.resolveMode = VK_RESOLVE_MODE_NONE;
+		attachment.loadOp = use.LoadOp;
+		attachment.storeOp = GetStoreOp(pass, use);
+		attachment.clearValue = use.Clear;
+		return attachment;
+	};
+
+	std::vector<VkRenderingAttachmentInfoKHR> colorAttachments;
+	for (const AttachmentUse & use : pass.ColorAttachments)
+		colorAttachments.push_back(makeAttachment(use));
+
+	const bool hasDepth = pass.DepthAttachment.Resource != UINT32_MAX;
+	const VkRenderingAttachmentInfoKHR depthAttachment = hasDepth ? makeAttachment(pass.DepthAttachment) : VkRenderingAttachmentInfoKHR{};
+
+	VkRenderingInfoKHR renderingInfo = {};
+	renderingInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INFO_KHR;
+	renderingInfo.pNext = nullptr;
+
+	renderingInfo.flags = pass.SecondaryCommandBuffers ? VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT_KHR : 0;
+	renderingInfo.renderArea.offset = { 0, 0 };
+	renderingInfo.renderArea.extent = context.Extent;
+	renderingInfo.layerCount = 1;
+
+	renderingInfo.colorAttachmentCount = static_cast<uint32_t>(colorAttachments.size());
+	renderingInfo.pColorAttachments = colorAttachments.data();
+	renderingInfo.pDepthAttachment = hasDepth ? &depthAttachment : nullptr;
+	renderingInfo.pStencilAttachment = hasDepth && HasStencil(context.DepthFormat) ? &depthAttachment : nullptr;
+
+	Vk.cmdBeginRenderingKHR(cmd, &renderingInfo);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+} // namespace core
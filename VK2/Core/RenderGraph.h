@@ -0,0 +1,330 @@
+#pragma once
+
+#include "GpuAllocator.h"
+#include "VkBootStrap/VkBootstrapDispatch.h"
+
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace core {
+
+////////////////////////////////////////////////////////////////////////////////
+// Handle to an image or buffer used by a RenderGraph, valid until the graph is reset
+struct RenderGraphResource {
+	uint32_t Index = UINT32_MAX;
+
+	bool IsValid() const { return Index != UINT32_MAX; }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Description of a 2D image with a single mip and layer
+struct TextureDesc {
+	VkFormat Format = VK_FORMAT_UNDEFINED;
+	VkExtent2D Extent = {};
+	VkSampleCountFlagBits Samples = VK_SAMPLE_COUNT_1_BIT;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// What a raster pass' execute callback records into, inside the pass' render pass
+struct RasterPassContext {
+	VkCommandBuffer Cmd = VK_NULL_HANDLE;
+	// Compatible with any render pass with the same attachment formats and sample counts.
+	// Both are null with dynamic rendering.
+	VkRenderPass RenderPass = VK_NULL_HANDLE;
+	VkFramebuffer Framebuffer = VK_NULL_HANDLE;
+	VkExtent2D Extent = {};
+
+	// Attachment formats, what secondary command buffers inherit with dynamic rendering
+	std::vector<VkFormat> ColorFormats;
+	VkFormat DepthFormat = VK_FORMAT_UNDEFINED;
+	VkSampleCountFlagBits Samples = VK_SAMPLE_COUNT_1_BIT;
+};
+
+class GpuProfiler;
+class RenderGraph;
+
+////////////////////////////////////////////////////////////////////////////////
+// Declares what a single pass reads and writes. Only used inside a pass' setup callback.
+// The stage flags tell the graph where the pass first and last touches a resource,
+// so barriers wait for exactly that and nothing more.
+class RenderPassBuilder {
+public:
+	// Image owned by the graph, only alive for the passes using it.
+	// Its memory is shared with transient images whose lifetimes don't overlap.
+	RenderGraphResource CreateTexture(const std::string & name, const TextureDesc & desc);
+
+	// Render into the image as the next color attachment. LOAD also reads the previous contents.
+	void WriteColor(
+		RenderGraphResource resource
+		, VkAttachmentLoadOp loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE
+		, VkClearColorValue clear = {});
+
+	// Depth test against and write the image
+	void WriteDepth(
+		RenderGraphResource resource
+		, VkAttachmentLoadOp loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE
+		, VkClearDepthStencilValue clear = { 1.f, 0 });
+
+	// Depth test against the image without writing it
+	void ReadDepth(RenderGraphResource resource);
+
+	// Sample the image
+	void ReadTexture(RenderGraphResource resource, VkPipelineStageFlags stages = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+
+	// Load or store through a storage image binding
+	void ReadStorageImage(RenderGraphResource resource, VkPipelineStageFlags stages = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+	void WriteStorageImage(RenderGraphResource resource, VkPipelineStageFlags stages = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+	void ReadBuffer(
+		RenderGraphResource resource
+		, VkPipelineStageFlags stages
+		, VkAccessFlags access = VK_ACCESS_SHADER_READ_BIT);
+	void WriteBuffer(
+		RenderGraphResource resource
+		, VkPipelineStageFlags stages
+		, VkAccessFlags access = VK_ACCESS_SHADER_WRITE_BIT);
+
+	// Keep the pass even if nothing reads what it writes, e.g. GPU readbacks
+	void SetSideEffects();
+
+	// The render pass is begun with VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS
+	void UseSecondaryCommandBuffers();
+
+private:
+	friend class RenderGraph;
+
+	RenderPassBuilder(RenderGraph & graph, uint32_t passIndex);
+
+	RenderGraph & Graph;
+	uint32_t PassIndex;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Frame graph: the frame is described as passes that declare the resources
+// they read and write, instead of hand written render passes and barriers.
+//
+// Compile() culls passes whose results are never used, places transient
+// images with non-overlapping lifetimes in the same memory, and caches the
+// VkRenderPass and VkFramebuffer objects raster passes need. Execute() then
+// records the passes in declaration order, with one combined barrier in
+// front of each pass that only waits for the accesses that actually conflict.
+// Transient images are kept alive between frames as long as the graph's
+// shape doesn't change.
+//
+// With dynamic rendering (VK_KHR_dynamic_rendering) raster passes render
+// straight into the image views, no render pass or framebuffer is created.
+//
+// The graph is rebuilt every frame: Reset(), declare passes, Compile(), Execute().
+// Not thread safe. Use one graph per frame in flight, so resetting it never
+// touches objects the GPU may still be using.
+class RenderGraph {
+public:
+	using RasterExecuteFn = std::function<void(const RasterPassContext & context)>;
+	using ComputeExecuteFn = std::function<void(VkCommandBuffer cmd)>;
+	using SetupFn = std::function<void(RenderPassBuilder & builder)>;
+
+	// Every pass is timed as a scope of the profiler, if there is one.
+	// dynamicRendering needs the dynamicRendering feature of VK_KHR_dynamic_rendering enabled.
+	RenderGraph(const vkb::DispatchTable & vk, GpuAllocator & allocator, GpuProfiler * profiler = nullptr, bool dynamicRendering = false);
+	// The GPU must be done with everything the graph has recorded
+	~RenderGraph();
+
+	RenderGraph(const RenderGraph &) = delete;
+	RenderGraph & operator=(const RenderGraph &) = delete;
+
+	// Forget all passes and resources of the last frame
+	void Reset();
+
+	// Use an image owned by someone else, e.g. a swapchain image. It starts out in
+	// initialLayout, last accessed at initialStages, and is left in finalLayout.
+	// initialWrites are writes of earlier submissions the first use has to see.
+	RenderGraphResource ImportImage(
+		const std::string & name
+		, VkImage image
+		, VkImageView view
+		, const TextureDesc & desc
+		, VkImageLayout initialLayout
+		, VkImageLayout finalLayout
+		, VkPipelineStageFlags initialStages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT
+		, VkAccessFlags initialWrites = 0);
+
+	// Use a buffer owned by someone else, last accessed at initialStages
+	RenderGraphResource ImportBuffer(
+		const std::string & name
+		, VkBuffer buffer
+		, VkDeviceSize size
+		, VkPipelineStageFlags initialStages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT
+		, VkAccessFlags initialWrites = 0);
+
+	// Passes are executed in the order they are added. setup is called right away.
+	void AddRasterPass(const std::string & name, const SetupFn & setup, RasterExecuteFn execute);
+	void AddComputePass(const std::string & name, const SetupFn & setup, ComputeExecuteFn execute);
+
+	// Cull, allocate transient images and create render passes. Throws if fails.
+	void Compile();
+
+	// Record every pass that survived culling
+	void Execute(VkCommandBuffer cmd);
+
+	// Destroy every cached framebuffer. Call when imported image views are destroyed,
+	// once the GPU is done with the graph.
+	void InvalidateFramebuffers();
+
+	bool UsesDynamicRendering() const { return DynamicRendering; }
+
+	// Only valid after Compile()
+	VkImage GetImage(RenderGraphResource resource) const;
+	VkImageView GetImageView(RenderGraphResource resource) const;
+	VkBuffer GetBuffer(RenderGraphResource resource) const;
+
+	// Memory shared by all transient images
+	VkDeviceSize GetTransientMemorySize() const { return TransientMemory.Size; }
+
+private:
+	friend class RenderPassBuilder;
+
+	// Where and how a resource is accessed
+	struct ResourceState {
+		VkImageLayout Layout = VK_IMAGE_LAYOUT_UNDEFINED;
+		VkPipelineStageFlags Stages = 0;
+		VkAccessFlags Access = 0;
+		// Access contains writes that later accesses have to wait for
+		bool Written = false;
+	};
+
+	// A single pass' access to a resource
+	struct ResourceUse {
+		uint32_t Resource = UINT32_MAX;
+		VkPipelineStageFlags Stages = 0;
+		VkAccessFlags Access = 0;
+		VkImageLayout Layout = VK_IMAGE_LAYOUT_UNDEFINED;
+		VkImageUsageFlags Usage = 0;
+		bool Read = false;
+		bool Write = false;
+	};
+
+	struct AttachmentUse {
+		uint32_t Resource = UINT32_MAX;
+		VkAttachmentLoadOp LoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		VkClearValue Clear = {};
+		VkImageLayout Layout = VK_IMAGE_LAYOUT_UNDEFINED;
+	};
+
+	struct Pass {
+		std::string Name;
+		bool Raster = false;
+		bool SideEffects = false;
+		bool SecondaryCommandBuffers = false;
+		bool Culled = false;
+
+		std::vector<ResourceUse> Uses;
+		std::vector<AttachmentUse> ColorAttachments;
+		AttachmentUse DepthAttachment;
+
+		RasterExecuteFn ExecuteRaster;
+		ComputeExecuteFn ExecuteCompute;
+
+		// Filled in by Compile()
+		VkRenderPass RenderPass = VK_NULL_HANDLE;
+		VkFramebuffer Framebuffer = VK_NULL_HANDLE;
+	};
+
+	struct Resource {
+		std::string Name;
+		bool IsImage = false;
+		bool Imported = false;
+
+		TextureDesc Desc;
+		VkImageUsageFlags Usage = 0;
+		VkImage Image = VK_NULL_HANDLE;
+		VkImageView View = VK_NULL_HANDLE;
+		VkBuffer Buffer = VK_NULL_HANDLE;
+		VkDeviceSize Size = 0;
+
+		ResourceState InitialState;
+		VkImageLayout FinalLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+		// First and last pass that survived culling and uses the resource
+		uint32_t FirstPass = UINT32_MAX;
+		uint32_t LastPass = 0;
+		// Index into TransientImages, UINT32_MAX for imported or unused resources
+		uint32_t Transient = UINT32_MAX;
+
+		// Tracked while executing
+		ResourceState State;
+		bool Touched = false;
+	};
+
+	// Physical image backing a transient resource
+	struct TransientImage {
+		VkImage Image = VK_NULL_HANDLE;
+		VkImageView View = VK_NULL_HANDLE;
+		VkMemoryRequirements Requirements = {};
+		VkDeviceSize Offset = 0;
+		// Transient images whose memory this one reuses. Its first use has to wait for their last.
+		std::vector<uint32_t> Aliases;
+		// Resource backed by the image this frame
+		uint32_t Resource = UINT32_MAX;
+	};
+
+	struct FramebufferEntry {
+		VkFramebuffer Framebuffer = VK_NULL_HANDLE;
+		uint64_t LastUsed = 0;
+	};
+
+	uint32_t AddPass(const std::string & name, bool raster, const SetupFn & setup);
+
+	// Merge an access into the pass' uses, one use per resource and pass
+	void AddUse(uint32_t passIndex, const ResourceUse & use);
+
+	void CullPasses();
+	void ComputeLifetimes();
+
+	// Recreate the transient images if the graph's shape changed since the last frame
+	void AllocateTransients();
+	// Bind the transient images to shared memory, aliasing images whose lifetimes don't overlap
+	void PlaceTransients();
+	void DestroyTransients();
+	uint64_t HashTransients() const;
+
+	// Transients nobody reads after this pass don't have to be written back to memory
+	VkAttachmentStoreOp GetStoreOp(const Pass & pass, const AttachmentUse & use) const;
+
+	VkRenderPass GetRenderPass(const Pass & pass);
+	VkFramebuffer GetFramebuffer(const Pass & pass);
+
+	// Add the barrier needed before use to the pass' barrier batch
+	void TransitionResource(
+		Resource & resource
+		, const ResourceState & newState
+		, std::vector<VkImageMemoryBarrier> & imageBarriers
+		, std::vector<VkBufferMemoryBarrier> & bufferBarriers
+		, VkPipelineStageFlags & srcStages
+		, VkPipelineStageFlags & dstStages);
+
+	void ExecutePass(VkCommandBuffer cmd, Pass & pass);
+	void BeginRendering(VkCommandBuffer cmd, const Pass & pass, const RasterPassContext & context);
+
+private:
+	const vkb::DispatchTable & Vk;
+	GpuAllocator & Allocator;
+	GpuProfiler * Profiler;
+
+	bool DynamicRendering;
+
+	std::vector<Pass> Passes;
+	std::vector<Resource> Resources;
+
+	// Transients survive frames until HashTransients() changes
+	std::vector<TransientImage> TransientImages;
+	Allocation TransientMemory;
+	uint64_t TransientHash = 0;
+
+	std::unordered_map<uint64_t, VkRenderPass> RenderPasses;
+	std::unordered_map<uint64_t, FramebufferEntry> Framebuffers;
+	uint64_t ExecuteCount = 0;
+};
+
+} // namespace core
@@ -0,0 +1,100 @@
+#include "SceneStore.h"
+
+#include <stdexcept>
+
+namespace core {
+
+////////////////////////////////////////////////////////////////////////////////
+
+EntityHandle SceneStore::Add(uint32_t mesh, uint32_t material, const Mat4 & transform, const Vec4 & localBounds) {
+	uint32_t slot;
+	if (!FreeSlots.empty()) {
+		slot = FreeSlots.back();
+		FreeSlots.pop_back();
+	} else {
+		slot = static_cast<uint32_t>(Slots.size());
+		Slots.emplace_back();
+	}
+
+	const uint32_t index = GetCount();
+	Slots[slot].Index = index;
+
+	Transforms.push_back(transform);
+	LocalBounds.push_back(localBounds);
+	WorldBounds.push_back(TransformSphere(transform, localBounds));
+	Meshes.push_back(mesh);
+	Materials.push_back(material);
+	OwnerSlots.push_back(slot);
+
+	return { slot, Slots[slot].Generation };
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void SceneStore::Remove(EntityHandle entity) {
+	const uint32_t index = Resolve(entity);
+	const uint32_t last = GetCount() - 1;
+
+	// Fill the hole with the last entity, so the arrays stay dense
+	if (index != last) {
+		Transforms[index] = Transforms[last];
+		LocalBounds[index] = LocalBounds[last];
+		WorldBounds[index] = WorldBounds[last];
+		Meshes[index] = Meshes[last];
+		Materials[index] = Materials[last];
+		OwnerSlots[index] = OwnerSlots[last];
+		Slots[OwnerSlots[index]].Index = index;
+	}
+
+	Transforms.pop_back();
+	LocalBounds.pop_back();
+	WorldBounds.pop_back();
+	Meshes.pop_back();
+	Materials.pop_back();
+	OwnerSlots.pop_back();
+
+	Slots[entity.Slot].Index = UINT32_MAX;
+	Slots[entity.Slot].Generation++;
+	FreeSlots.push_back(entity.Slot);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool SceneStore::Contains(EntityHandle entity) const {
+	return entity.Slot < Slots.size()
+		&& Slots[entity.Slot].Generation == entity.Generation
+		&& Slots[entity.Slot].Index != UINT32_MAX;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void SceneStore::SetTransform(EntityHandle entity, const Mat4 & transform) {
+	const uint32_t index = Resolve(entity);
+	Transforms[index] = transform;
+	WorldBounds[index] = TransformSphere(transform, LocalBounds[index]);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void SceneStore::SetMaterial(EntityHandle entity, uint32_t material) {
+	Materials[Resolve(entity)] = material;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+uint32_t SceneStore::GetIndex(EntityHandle entity) const {
+	return Resolve(entity);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+uint32_t SceneStore::Resolve(EntityHandle entity) const {
+	if (!Contains(entity))
+		throw std::runtime_error("Invalid entity handle");
+
+	return Slots[entity.Slot].Index;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+} // namespace core
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "Math.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace core {
+
+////////////////////////////////////////////////////////////////////////////////
+// Handle to an entity of a SceneStore. Stays valid while other entities are
+// added and removed, and turns invalid once its own entity is removed.
+struct EntityHandle {
+	uint32_t Slot = UINT32_MAX;
+	uint32_t Generation = 0;
+
+	bool IsValid() const { return Slot != UINT32_MAX; }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Structure of arrays store of the entities in a scene.
+//
+// Every property lives in its own tightly packed array, with one element per
+// entity in the same order, so passes over one property (culling the bounds,
+// sorting by mesh and material) stream through contiguous memory and an array
+// can be copied to the GPU as is. Removing an entity moves the last one into
+// its place to keep the arrays dense, handles map to the current position.
+//
+// Mesh and material ids are opaque to the store. Not thread safe.
+class SceneStore {
+public:
+	// localBounds is the mesh's bounding sphere in object space, xyz center and w radius
+	EntityHandle Add(uint32_t mesh, uint32_t material, const Mat4 & transform, const Vec4 & localBounds);
+	void Remove(EntityHandle entity);
+
+	bool Contains(EntityHandle entity) const;
+
+	// Also updates the world space bounds
+	void SetTransform(EntityHandle entity, const Mat4 & transform);
+	void SetMaterial(EntityHandle entity, uint32_t material);
+
+	// Position of the entity in the arrays, until the next removal
+	uint32_t GetIndex(EntityHandle entity) const;
+
+	uint32_t GetCount() const { return static_cast<uint32_t>(Transforms.size()); }
+
+	const std::vector<Mat4> & GetTransforms() const { return Transforms; }
+	// World space bounding spheres, xyz center and w radius
+	const std::vector<Vec4> & GetBounds() const { return WorldBounds; }
+	const std::vector<uint32_t> & GetMeshes() const { return Meshes; }
+	const std::vector<uint32_t> & GetMaterials() const { return Materials; }
+
+private:
+	struct Slot {
+		uint32_t Index = UINT32_MAX;
+		// Bumped on removal, so stale handles don't match a reused slot
+		uint32_t Generation = 0;
+	};
+
+	// Throws if the handle is stale
+	uint32_t Resolve(EntityHandle entity) const;
+
+private:
+	// Dense arrays, indexed by entity position
+	std::vector<Mat4> Transforms;
+	std::vector<Vec4> LocalBounds;
+	std::vector<Vec4> WorldBounds;
+	std::vector<uint32_t> Meshes;
+	std::vector<uint32_t> Materials;
+	// Slot of the entity at each position, to fix up the entity moved by a removal
+	std::vector<uint32_t> OwnerSlots;
+
+	// Handle indirection, indexed by EntityHandle::Slot
+	std::vector<Slot> Slots;
+	std::vector<uint32_t> FreeSlots;
+};
+
+} // namespace core
@@ -0,0 +1,513 @@
+#include "ShaderLibrary.h"
+
+#include "Hash.h"
+
+#include <shaderc/shaderc.hpp>
+// shaderc is linked statically from the SDK, these headers identify the compiler built in
+#if __has_include(<glslang/build_info.h>)
+#include <glslang/build_info.h>
+#endif
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+#include <Windows.h>
+
+namespace core {
+
+namespace {
+
+// Bump to invalidate every cached module, e.g. when the way keys are built changes
+constexpr uint32_t ShaderCacheVersion = 2;
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Identity of the compiler this build links, so an SDK upgrade invalidates what the old one compiled.
+// shaderc has no version of its own, it's the glslang it wraps and the SDK it came with.
+uint64_t HashCompilerVersion(uint64_t hash) {
+#if defined(GLSLANG_VERSION_MAJOR)
+	hash = HashValue(GLSLANG_VERSION_MAJOR, hash);
+	hash = HashValue(GLSLANG_VERSION_MINOR, hash);
+	hash = HashValue(GLSLANG_VERSION_PATCH, hash);
+	hash = HashString(GLSLANG_VERSION_FLAVOR, hash);
+#endif
+	return HashValue(VK_HEADER_VERSION_COMPLETE, hash);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool ReadTextFile(const std::string & path, std::string & outText) {
+	std::ifstream file(path, std::ios::ate | std::ios::binary);
+	if (!file.is_open())
+		return false;
+
+	size_t fileSize = (size_t)file.tellg();
+	outText.resize(fileSize);
+	file.seekg(0);
+	file.read(outText.data(), fileSize);
+	return static_cast<bool>(file);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Resolves #include directives relative to the including file.
+// The path of every file opened is added to includedPaths, if given.
+class FileIncluder : public shaderc::CompileOptions::IncluderInterface {
+public:
+	explicit FileIncluder(std::vector<std::string> * includedPaths)
+		: IncludedPaths(includedPaths)
+	{
+
+	}
+
+	shaderc_include_result * GetInclude(
+		const char * requestedSource
+		, shaderc_include_type type
+		, const char * requestingSource
+		, size_t includeDepth) override
+	{
+		auto include = new Include();
+		include->Result.user_data = include;
+
+		std::filesystem::path path = requestedSource;
+		if (type == shaderc_include_type_relative)
+			path = std::filesystem::path(requestingSource).parent_path() / path;
+
+		// An empty source name tells shaderc the include failed, the content holds the error
+		if (ReadTextFile(path.string(), include->Content)) {
+			include->Name = path.string();
+			if (IncludedPaths)
+				IncludedPaths->push_back(include->Name);
+		} else
+			include->Content = "Could not open include " + path.string();
+
+		include->Result.source_name = include->Name.c_str();
+		include->Result.source_name_length = include->Name.size();
+		include->Result.content = include->Content.c_str();
+		include->Result.content_length = include->Content.size();
+		return &include->Result;
+	}
+
+	void ReleaseInclude(shaderc_include_result * data) override {
+		delete static_cast<Include *>(data->user_data);
+	}
+
+private:
+	struct Include {
+		shaderc_include_result Result = {};
+		std::string Name;
+		std::string Content;
+	};
+
+	std::vector<std::string> * IncludedPaths;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+shaderc_optimization_level GetOptimizationLevel(ShaderOptimization optimization) {
+	switch (optimization) {
+	case ShaderOptimization::None: return shaderc_optimization_level_zero;
+	case ShaderOptimization::Size: return shaderc_optimization_level_size;
+	case ShaderOptimization::Performance: return shaderc_optimization_level_performance;
+	}
+
+	return shaderc_optimization_level_zero;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Options are not shared between threads, so every compile gets its own
+shaderc::CompileOptions MakeCompileOptions(
+	uint32_t targetEnvVersion
+	, const ShaderVariant & variant
+	, std::vector<std::string> * includedPaths = nullptr)
+{
+	shaderc::CompileOptions options;
+	options.SetTargetEnvironment(shaderc_target_env_vulkan, targetEnvVersion);
+	options.SetOptimizationLevel(GetOptimizationLevel(variant.Optimization));
+	options.SetIncluder(std::make_unique<FileIncluder>(includedPaths));
+
+	for (const auto & [name, value] : variant.Defines)
+		options.AddMacroDefinition(name, value);
+
+	return options;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// A file that can't be read right now, for instance while an editor replaces it, gets the
+// minimum time, so it counts as changed both when it disappears and when it comes back
+std::filesystem::file_time_type GetWriteTime(const std::string & path) {
+	std::error_code error;
+	const std::filesystem::file_time_type time = std::filesystem::last_write_time(path, error);
+	return error ? std::filesystem::file_time_type::min() : time;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Pick the stage from the file extension, otherwise the source needs a #pragma shader_stage
+shaderc_shader_kind GetShaderKind(const std::string & glslPath) {
+	const std::string extension = std::filesystem::path(glslPath).extension().string();
+
+	if (extension == ".vert") return shaderc_vertex_shader;
+	if (extension == ".frag") return shaderc_fragment_shader;
+	if (extension == ".comp") return shaderc_compute_shader;
+	if (extension == ".geom") return shaderc_geometry_shader;
+	if (extension == ".tesc") return shaderc_tess_control_shader;
+	if (extension == ".tese") return shaderc_tess_evaluation_shader;
+
+	return shaderc_glsl_infer_from_source;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void OutputCompileError(const std::string & errorString) {
+	OutputDebugString(std::wstring(errorString.begin(), errorString.end()).c_str());
+	OutputDebugString(L"\n");
+}
+
+} // anonymous namespace
+
+////////////////////////////////////////////////////////////////////////////////
+
+uint64_t ShaderVariant::Hash() const {
+	uint64_t hash = HashString(GlslPath);
+	for (const auto & [name, value] : Defines) {
+		hash = HashString(name, hash);
+		hash = HashString(value, hash);
+	}
+	hash = HashValue(Optimization, hash);
+	return hash;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+ShaderLibrary::ShaderLibrary(
+	const vkb::DispatchTable & vk
+	, JobSystem & jobs
+	, const std::string & cacheDirectory
+	, const std::string & archivePath
+	, uint32_t vulkanApiVersion)
+	: Vk(vk)
+	, Jobs(jobs)
+	, Compiler(std::make_unique<shaderc::Compiler>())
+	, Cache(cacheDirectory, archivePath)
+	// shaderc_env_version_vulkan_1_x are defined as the matching VK_API_VERSION_1_x
+	, TargetEnvVersion(VK_MAKE_API_VERSION(0, VK_API_VERSION_MAJOR(vulkanApiVersion), VK_API_VERSION_MINOR(vulkanApiVersion), 0))
+{
+	// Anything that changes the generated code for the same source has to be part of the key.
+	// The SPIR-V version is what the compiler emits, it stays the same across most compiler releases.
+	unsigned int spvVersion = 0;
+	unsigned int spvRevision = 0;
+	shaderc_get_spv_version(&spvVersion, &spvRevision);
+
+	CompilerHash = HashValue(ShaderCacheVersion);
+	CompilerHash = HashCompilerVersion(CompilerHash);
+	CompilerHash = HashValue(spvVersion, CompilerHash);
+	CompilerHash = HashValue(spvRevision, CompilerHash);
+	CompilerHash = HashValue(TargetEnvVersion, CompilerHash);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+ShaderLibrary::~ShaderLibrary() {
+	WaitAll();
+
+	for (Entry & entry : Entries) {
+		if (entry.Module != VK_NULL_HANDLE)
+			Vk.destroyShaderModule(entry.Module, nullptr);
+		if (entry.ReloadedModule != VK_NULL_HANDLE)
+			Vk.destroyShaderModule(entry.ReloadedModule, nullptr);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+ShaderHandle ShaderLibrary::LoadAsync(const ShaderVariant & variant) {
+	const uint64_t hash = variant.Hash();
+
+	Entry * entry;
+	ShaderHandle handle;
+	{
+		std::lock_guard<std::mutex> lock(EntriesMutex);
+
+		auto it = EntryIndices.find(hash);
+		if (it != EntryIndices.end())
+			return { it->second };
+
+		handle.Index = static_cast<uint32_t>(Entries.size());
+		entry = &Entries.emplace_back();
+		entry->Variant = variant;
+		EntryIndices.emplace(hash, handle.Index);
+	}
+
+	Jobs.Schedule([this, entry]() {
+		try {
+			LoadShaderModule(entry->Variant, entry->Module, entry->Sources);
+		} catch (...) {
+			entry->Error = std::current_exception();
+		}
+	}, &entry->Loaded);
+
+	return handle;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+ShaderHandle ShaderLibrary::LoadAsync(const std::string & glslPath) {
+	ShaderVariant variant;
+	variant.GlslPath = glslPath;
+	return LoadAsync(variant);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool ShaderLibrary::IsReady(ShaderHandle handle) {
+	return GetEntry(handle).Loaded.IsDone();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+VkShaderModule ShaderLibrary::Get(ShaderHandle handle) {
+	Entry & entry = GetEntry(handle);
+
+	// Wait() runs other jobs in the meantime, usually other shaders that are compiling
+	Jobs.Wait(entry.Loaded);
+
+	if (entry.Error)
+		std::rethrow_exception(entry.Error);
+
+	// ApplyReloads() may swap the module on another thread
+	std::lock_guard<std::mutex> lock(ModulesMutex);
+	return entry.Module;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void ShaderLibrary::WaitAll() {
+	std::unique_lock<std::mutex> lock(EntriesMutex);
+
+	// New loads may be started while we wait, so look up the size every iteration
+	for (size_t i = 0; i < Entries.size(); i++) {
+		Entry & entry = Entries[i];
+		lock.unlock();
+		Jobs.Wait(entry.Loaded);
+		lock.lock();
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool ShaderLibrary::PackCache() {
+	WaitAll();
+	return Cache.WriteArchive();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+uint32_t ShaderLibrary::RecompileChanged() {
+	std::lock_guard<std::mutex> recompileLock(RecompileMutex);
+
+	uint32_t recompiled = 0;
+
+	std::unique_lock<std::mutex> lock(EntriesMutex);
+	for (size_t i = 0; i < Entries.size(); i++) {
+		Entry & entry = Entries[i];
+		lock.unlock();
+
+		// Modules that are still loading will pick up the change themselves, and ones
+		// that failed to load have already thrown at whoever needed them
+		if (entry.Loaded.IsDone() && !entry.Error) {
+			const bool changed = std::any_of(entry.Sources.begin(), entry.Sources.end(), [](const SourceFile & source) {
+				return GetWriteTime(source.Path) != source.WriteTime;
+			});
+
+			if (changed && Recompile(entry))
+				recompiled++;
+		}
+
+		lock.lock();
+	}
+
+	return recompiled;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+std::vector<ShaderHandle> ShaderLibrary::ApplyReloads(std::vector<VkShaderModule> & outReplaced) {
+	std::vector<ShaderHandle> reloaded;
+	if (!ReloadsPending.exchange(false))
+		return reloaded;
+
+	std::lock_guard<std::mutex> entriesLock(EntriesMutex);
+	std::lock_guard<std::mutex> modulesLock(ModulesMutex);
+
+	for (uint32_t i = 0; i < Entries.size(); i++) {
+		Entry & entry = Entries[i];
+		if (entry.ReloadedModule == VK_NULL_HANDLE)
+			continue;
+
+		outReplaced.push_back(entry.Module);
+		entry.Module = entry.ReloadedModule;
+		entry.ReloadedModule = VK_NULL_HANDLE;
+		reloaded.push_back({ i });
+	}
+
+	return reloaded;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+ShaderLibrary::Entry & ShaderLibrary::GetEntry(ShaderHandle handle) {
+	std::lock_guard<std::mutex> lock(EntriesMutex);
+
+	if (handle.Index >= Entries.size())
+		throw std::runtime_error("Invalid shader handle");
+
+	return Entries[handle.Index];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool ShaderLibrary::Recompile(Entry & entry) {
+	// Stamp the current write times first, so a broken file is only retried once it is saved again
+	for (SourceFile & source : entry.Sources)
+		source.WriteTime = GetWriteTime(source.Path);
+
+	std::vector<SourceFile> sources;
+	VkShaderModule module;
+	try {
+		LoadShaderModule(entry.Variant, module, sources);
+	} catch (const std::exception & e) {
+		OutputCompileError(std::string("Keeping the previous module: ") + e.what());
+		// Includes may have been added or removed even though compiling failed
+		if (!sources.empty())
+			entry.Sources = std::move(sources);
+		return false;
+	}
+
+	entry.Sources = std::move(sources);
+
+	std::lock_guard<std::mutex> lock(ModulesMutex);
+
+	// Saved again before the last reload was applied, only the newest module matters
+	if (entry.ReloadedModule != VK_NULL_HANDLE)
+		Vk.destroyShaderModule(entry.ReloadedModule, nullptr);
+
+	entry.ReloadedModule = module;
+	ReloadsPending = true;
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void ShaderLibrary::LoadShaderModule(
+	const ShaderVariant & variant
+	, VkShaderModule & outShaderModule
+	, std::vector<SourceFile> & outSources)
+{
+	const std::string & glslPath = variant.GlslPath;
+
+	// Stamp the files before reading them, so a change made while compiling is noticed by the next check
+	const std::filesystem::file_time_type glslWriteTime = GetWriteTime(glslPath);
+
+	// Key the cache on the fully expanded source, so edits to included files are picked up too.
+	// Defines are expanded as well, so only the ones that change the source make a new entry.
+	std::string source;
+	std::vector<std::string> includes;
+	if (!PreprocessGlsl(variant, source, includes))
+		throw std::runtime_error("Failed to preprocess " + glslPath);
+
+	outSources.clear();
+	outSources.push_back({ glslPath, glslWriteTime });
+	for (const std::string & include : includes)
+		outSources.push_back({ include, GetWriteTime(include) });
+
+	const shaderc_shader_kind kind = GetShaderKind(glslPath);
+	uint64_t key = HashValue(kind, CompilerHash);
+	key = HashValue(variant.Optimization, key);
+	key = HashString(source, key);
+
+	std::vector<uint32_t> storage;
+	std::span<const uint32_t> code = Cache.Find(key, storage);
+	if (code.empty()) {
+		if (!CompileGlslToSpv(variant, source, storage))
+			throw std::runtime_error("Failed to compile " + glslPath + " to spv");
+
+		Cache.Store(key, storage);
+		code = storage;
+	}
+
+	VkShaderModuleCreateInfo createInfo = {};
+	createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	createInfo.pNext = nullptr;
+
+	createInfo.codeSize = code.size_bytes();
+	createInfo.pCode = code.data();
+
+	VkShaderModule shaderModule;
+	if (Vk.createShaderModule(&createInfo, nullptr, &shaderModule)) {
+		throw std::runtime_error("Failed to create shader module from " + glslPath);
+	}
+
+	outShaderModule = shaderModule;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool ShaderLibrary::PreprocessGlsl(
+	const ShaderVariant & variant
+	, std::string & outSource
+	, std::vector<std::string> & outIncludes)
+{
+	std::string glsl;
+	if (!ReadTextFile(variant.GlslPath, glsl))
+		return false;
+
+	shaderc::CompileOptions options = MakeCompileOptions(TargetEnvVersion, variant, &outIncludes);
+	auto result = Compiler->PreprocessGlsl(
+		glsl
+		, GetShaderKind(variant.GlslPath)
+		, variant.GlslPath.c_str()
+		, options
+	);
+
+	if (result.GetCompilationStatus() != shaderc_compilation_status_success) {
+		OutputCompileError(result.GetErrorMessage());
+		return false;
+	}
+
+	outSource.assign(result.cbegin(), result.cend());
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool ShaderLibrary::CompileGlslToSpv(
+	const ShaderVariant & variant
+	, const std::string & source
+	, std::vector<uint32_t> & outCode)
+{
+	// Includes and defines have already been expanded by PreprocessGlsl
+	shaderc::CompileOptions options = MakeCompileOptions(TargetEnvVersion, variant);
+	auto result = Compiler->CompileGlslToSpv(
+		source
+		, GetShaderKind(variant.GlslPath)
+		, variant.GlslPath.c_str()
+		, options
+	);
+
+	if (result.GetCompilationStatus() != shaderc_compilation_status_success) {
+		OutputCompileError(result.GetErrorMessage());
+		return false;
+	}
+
+	outCode.assign(result.cbegin(), result.cend());
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+} // namespace core
@@ -0,0 +1,172 @@
+#pragma once
+
+#include "JobSystem.h"
+#include "SpirvCache.h"
+#include "VkBootStrap/VkBootstrapDispatch.h"
+
+#include <atomic>
+#include <deque>
+#include <exception>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace shaderc {
+class Compiler;
+}
+
+namespace core {
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Handle to a shader module owned by a ShaderLibrary.
+// The module may still be compiling in the background.
+struct ShaderHandle {
+	uint32_t Index = UINT32_MAX;
+
+	bool IsValid() const { return Index != UINT32_MAX; }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// How hard the spir-v optimizer works on a module
+enum class ShaderOptimization {
+	None,
+	Size,
+	Performance,
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// A glsl file compiled with a set of macro definitions. Every distinct variant
+// gets its own module. Variants that expand to the same source, because a
+// define isn't used, share their spir-v cache entry.
+// Constants that only drive branches are better off as specialization
+// constants of the pipeline, they don't need a module each.
+struct ShaderVariant {
+	std::string GlslPath;
+	// #define name value, as if at the top of the file. Order matters for the hash.
+	std::vector<std::pair<std::string, std::string>> Defines;
+	ShaderOptimization Optimization = ShaderOptimization::Performance;
+
+	// Hash of every field, identifies the variant
+	uint64_t Hash() const;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Loads shader modules from glsl on the job system.
+// Modules missing from the spir-v cache are compiled in parallel, and callers
+// only block when they actually need a module.
+// Modules are compiled for the Vulkan version given on construction.
+//
+// Modules can be hot reloaded: RecompileChanged() rebuilds the modules whose
+// sources changed on disk, and ApplyReloads() swaps them in at a frame boundary.
+class ShaderLibrary {
+public:
+	ShaderLibrary(
+		const vkb::DispatchTable & vk
+		, JobSystem & jobs
+		, const std::string & cacheDirectory
+		, const std::string & archivePath
+		, uint32_t vulkanApiVersion);
+	// Waits for outstanding loads and destroys every module
+	~ShaderLibrary();
+
+	ShaderLibrary(const ShaderLibrary &) = delete;
+	ShaderLibrary & operator=(const ShaderLibrary &) = delete;
+
+	// Start loading a shader module. Loading the same variant twice returns the same handle.
+	ShaderHandle LoadAsync(const ShaderVariant & variant);
+	// The variant without defines
+	ShaderHandle LoadAsync(const std::string & glslPath);
+
+	// True once the module has finished loading (or failed to)
+	bool IsReady(ShaderHandle handle);
+
+	// Wait for the module to finish loading. Throws if it failed.
+	VkShaderModule Get(ShaderHandle handle);
+
+	// Wait for every outstanding load
+	void WaitAll();
+
+	// Pack every cached module into the cache archive so it can be shipped
+	bool PackCache();
+
+	// Recompile every loaded module whose glsl or includes changed since it was built.
+	// The new modules wait for ApplyReloads(), a module that fails to compile keeps the
+	// old one. Blocks while compiling, so call it from a background thread like the one
+	// a ShaderWatcher runs. Returns how many modules were recompiled.
+	uint32_t RecompileChanged();
+
+	// Swap recompiled modules in and return their handles, so the pipelines built from
+	// them can be rebuilt. Call at a frame boundary. Pipeline jobs may still be creating
+	// pipelines from the old modules, so those are handed to outReplaced, to be destroyed
+	// once every build that may have picked them up is done (see PipelineLibrary::Rebuild()).
+	std::vector<ShaderHandle> ApplyReloads(std::vector<VkShaderModule> & outReplaced);
+
+private:
+	// A file a module was built from, and its write time at the time
+	struct SourceFile {
+		std::string Path;
+		std::filesystem::file_time_type WriteTime;
+	};
+
+	struct Entry {
+		ShaderVariant Variant;
+		JobCounter Loaded;
+		// Guarded by ModulesMutex once loaded
+		VkShaderModule Module = VK_NULL_HANDLE;
+		std::exception_ptr Error;
+
+		// The glsl file and everything it includes. Written by the load job, then only by RecompileChanged().
+		std::vector<SourceFile> Sources;
+		// Recompiled module waiting for ApplyReloads(), guarded by ModulesMutex
+		VkShaderModule ReloadedModule = VK_NULL_HANDLE;
+	};
+
+	Entry & GetEntry(ShaderHandle handle);
+
+	// Rebuild the entry's module from its current sources. Returns false if that failed.
+	bool Recompile(Entry & entry);
+
+	// Throws if fails. outSources is filled in as soon as preprocessing succeeds.
+	void LoadShaderModule(
+		const ShaderVariant & variant
+		, VkShaderModule & outShaderModule
+		, std::vector<SourceFile> & outSources);
+
+	// Expand includes and the variant's macros. The result is what the cache key is computed from.
+	// outIncludes gets the path of every file that was included.
+	bool PreprocessGlsl(const ShaderVariant & variant, std::string & outSource, std::vector<std::string> & outIncludes);
+	// Compile preprocessed glsl to spv
+	bool CompileGlslToSpv(const ShaderVariant & variant, const std::string & source, std::vector<uint32_t> & outCode);
+
+private:
+	const vkb::DispatchTable & Vk;
+	JobSystem & Jobs;
+
+	// Compilation is const on the compiler, so one instance is shared by all threads
+	std::unique_ptr<shaderc::Compiler> Compiler;
+
+	SpirvCache Cache;
+	// shaderc_env_version, which uses the same encoding as Vulkan API versions
+	uint32_t TargetEnvVersion;
+	// Hash of the compiler version and target environment, mixed into every cache key
+	uint64_t CompilerHash;
+
+	// Guards Entries and EntryIndices. Entries never move once created.
+	std::mutex EntriesMutex;
+	std::deque<Entry> Entries;
+	// Keyed by ShaderVariant::Hash()
+	std::unordered_map<uint64_t, uint32_t> EntryIndices;
+
+	// Guards Module and ReloadedModule of every entry. Taken after EntriesMutex.
+	std::mutex ModulesMutex;
+	// Set when an entry has a ReloadedModule, so ApplyReloads() is free most frames
+	std::atomic<bool> ReloadsPending = false;
+	// Only one RecompileChanged() at a time
+	std::mutex RecompileMutex;
+};
+
+} // namespace core
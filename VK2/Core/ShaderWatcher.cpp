@@ -0,0 +1,44 @@
+#include "ShaderWatcher.h"
+
+#include "ShaderLibrary.h"
+
+namespace core {
+
+////////////////////////////////////////////////////////////////////////////////
+
+ShaderWatcher::ShaderWatcher(ShaderLibrary & shaders, std::chrono::milliseconds interval)
+	: Shaders(shaders)
+	, Interval(interval)
+{
+	// Started last, so the thread only sees initialized members
+	Thread = std::thread(&ShaderWatcher::Run, this);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+ShaderWatcher::~ShaderWatcher() {
+	{
+		std::lock_guard<std::mutex> lock(Mutex);
+		Stopping = true;
+	}
+	StopCondition.notify_one();
+
+	Thread.join();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void ShaderWatcher::Run() {
+	std::unique_lock<std::mutex> lock(Mutex);
+
+	while (!StopCondition.wait_for(lock, Interval, [this]() { return Stopping; })) {
+		lock.unlock();
+		// Compile errors are reported by the library, the previous modules stay in use
+		Shaders.RecompileChanged();
+		lock.lock();
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+} // namespace core
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace core {
+
+class ShaderLibrary;
+
+////////////////////////////////////////////////////////////////////////////////
+// Background thread that checks the sources of every loaded shader for changes
+// and recompiles the ones that changed. Recompiled modules only take effect once
+// the render loop calls ShaderLibrary::ApplyReloads(), so frames never wait on
+// the compiler.
+//
+// Polls write times instead of subscribing to file system notifications, it is
+// only a stat per source file and works the same for files outside the shader directory.
+class ShaderWatcher {
+public:
+	ShaderWatcher(ShaderLibrary & shaders, std::chrono::milliseconds interval);
+	// Stops the thread, after the compile in progress if there is one
+	~ShaderWatcher();
+
+	ShaderWatcher(const ShaderWatcher &) = delete;
+	ShaderWatcher & operator=(const ShaderWatcher &) = delete;
+
+private:
+	void Run();
+
+private:
+	ShaderLibrary & Shaders;
+	const std::chrono::milliseconds Interval;
+
+	// Guards Stopping, lets the destructor wake the thread up early
+	std::mutex Mutex;
+	std::condition_variable StopCondition;
+	bool Stopping = false;
+
+	std::thread Thread;
+};
+
+} // namespace core
@@ -0,0 +1,387 @@
+#include "SimdKernels.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CORE_SIMD_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#elif defined(_M_ARM64) || defined(__aarch64__)
+#define CORE_SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
+// MSVC compiles intrinsics of any instruction set, gcc and clang have to be told per function
+#if defined(CORE_SIMD_X86) && defined(__GNUC__)
+#define CORE_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define CORE_TARGET_AVX2
+#endif
+
+namespace core {
+
+namespace {
+
+using CullSpheresFn = uint32_t (*)(const Vec4 planes[6], const Vec4 * spheres, uint32_t count, uint32_t * outVisible);
+using ComposeTransformsFn = void (*)(const Mat4 & parent, const Mat4 * locals, Mat4 * outWorlds, uint32_t count);
+
+struct KernelTable {
+	SimdLevel Level;
+	CullSpheresFn CullSpheres;
+	ComposeTransformsFn ComposeTransforms;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Cull spheres [begin, end), also used for what's left over after the last full SIMD group
+uint32_t CullSpheresRange(const Vec4 planes[6], const Vec4 * spheres, uint32_t begin, uint32_t end, uint32_t * outVisible) {
+	uint32_t visibleCount = 0;
+	for (uint32_t i = begin; i < end; i++) {
+		const Vec4 & sphere = spheres[i];
+
+		bool inside = true;
+		for (int p = 0; p < 6 && inside; p++) {
+			const Vec4 & plane = planes[p];
+			inside = plane.X * sphere.X + plane.Y * sphere.Y + plane.Z * sphere.Z + plane.W >= -sphere.W;
+		}
+
+		outVisible[visibleCount] = i;
+		visibleCount += inside ? 1 : 0;
+	}
+	return visibleCount;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+#if !defined(CORE_SIMD_X86) && !defined(CORE_SIMD_NEON)
+
+uint32_t CullSpheresScalar(const Vec4 planes[6], const Vec4 * spheres, uint32_t count, uint32_t * outVisible) {
+	return CullSpheresRange(planes, spheres, 0, count, outVisible);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void ComposeTransformsScalar(const Mat4 & parent, const Mat4 * locals, Mat4 * outWorlds, uint32_t count) {
+	for (uint32_t i = 0; i < count; i++)
+		outWorlds[i] = parent * locals[i];
+}
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Append firstIndex + bit for every set bit of visibleMask. Every index is stored and only the
+// visible ones are kept, which avoids a hard to predict branch per object.
+inline uint32_t AppendVisible(uint32_t visibleMask, uint32_t firstIndex, uint32_t bitCount, uint32_t * outVisible) {
+	uint32_t visibleCount = 0;
+	for (uint32_t bit = 0; bit < bitCount; bit++) {
+		outVisible[visibleCount] = firstIndex + bit;
+		visibleCount += (visibleMask >> bit) & 1;
+	}
+	return visibleCount;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+#if defined(CORE_SIMD_X86)
+
+uint32_t CullSpheresSse2(const Vec4 planes[6], const Vec4 * spheres, uint32_t count, uint32_t * outVisible) {
+	__m128 planeX[6], planeY[6], planeZ[6], planeW[6];
+	for (int p = 0; p < 6; p++) {
+		planeX[p] = _mm_set1_ps(planes[p].X);
+		planeY[p] = _mm_set1_ps(planes[p].Y);
+		planeZ[p] = _mm_set1_ps(planes[p].Z);
+		planeW[p] = _mm_set1_ps(planes[p].W);
+	}
+
+	uint32_t visibleCount = 0;
+	uint32_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128 x = _mm_loadu_ps(&spheres[i].X);
+		__m128 y = _mm_loadu_ps(&spheres[i + 1].X);
+		__m128 z = _mm_loadu_ps(&spheres[i + 2].X);
+		__m128 radius = _mm_loadu_ps(&spheres[i + 3].X);
+		// Four spheres in, one component of all four per register out
+		_MM_TRANSPOSE4_PS(x, y, z, radius);
+
+		const __m128 negRadius = _mm_sub_ps(_mm_setzero_ps(), radius);
+		__m128 outside = _mm_setzero_ps();
+		for (int p = 0; p < 6; p++) {
+			__m128 distance = _mm_add_ps(_mm_mul_ps(x, planeX[p]), planeW[p]);
+			distance = _mm_add_ps(distance, _mm_mul_ps(y, planeY[p]));
+			distance = _mm_add_ps(distance, _mm_mul_ps(z, planeZ[p]));
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(distance, negRadius));
+		}
+
+		const uint32_t visibleMask = ~static_cast<uint32_t>(_mm_movemask_ps(outside)) & 0xF;
+		visibleCount += AppendVisible(visibleMask, i, 4, outVisible + visibleCount);
+	}
+
+	return visibleCount + CullSpheresRange(planes, spheres, i, count, outVisible + visibleCount);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void ComposeTransformsSse2(const Mat4 & parent, const Mat4 * locals, Mat4 * outWorlds, uint32_t count) {
+	const __m128 parent0 = _mm_loadu_ps(&parent.M[0]);
+	const __m128 parent1 = _mm_loadu_ps(&parent.M[4]);
+	const __m128 parent2 = _mm_loadu_ps(&parent.M[8]);
+	const __m128 parent3 = _mm_loadu_ps(&parent.M[12]);
+
+	for (uint32_t i = 0; i < count; i++) {
+		const float * local = locals[i].M;
+
+		// Column c of the result mixes the parent's columns by column c of the local transform
+		__m128 columns[4];
+		for (int c = 0; c < 4; c++) {
+			__m128 column = _mm_mul_ps(parent0, _mm_set1_ps(local[c * 4 + 0]));
+			column = _mm_add_ps(column, _mm_mul_ps(parent1, _mm_set1_ps(local[c * 4 + 1])));
+			column = _mm_add_ps(column, _mm_mul_ps(parent2, _mm_set1_ps(local[c * 4 + 2])));
+			column = _mm_add_ps(column, _mm_mul_ps(parent3, _mm_set1_ps(local[c * 4 + 3])));
+			columns[c] = column;
+		}
+
+		// The whole local transform is read before storing, in case it's being overwritten
+		for (int c = 0; c < 4; c++)
+			_mm_storeu_ps(&outWorlds[i].M[c * 4], columns[c]);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Sphere lo in the low half and sphere hi in the high half
+CORE_TARGET_AVX2 inline __m256 LoadSpherePair(const Vec4 & lo, const Vec4 & hi) {
+	return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(&lo.X)), _mm_loadu_ps(&hi.X), 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+CORE_TARGET_AVX2 uint32_t CullSpheresAvx2(const Vec4 planes[6], const Vec4 * spheres, uint32_t count, uint32_t * outVisible) {
+	__m256 planeX[6], planeY[6], planeZ[6], planeW[6];
+	for (int p = 0; p < 6; p++) {
+		planeX[p] = _mm256_set1_ps(planes[p].X);
+		planeY[p] = _mm256_set1_ps(planes[p].Y);
+		planeZ[p] = _mm256_set1_ps(planes[p].Z);
+		planeW[p] = _mm256_set1_ps(planes[p].W);
+	}
+
+	uint32_t visibleCount = 0;
+	uint32_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		const __m256 a = LoadSpherePair(spheres[i], spheres[i + 4]);
+		const __m256 b = LoadSpherePair(spheres[i + 1], spheres[i + 5]);
+		const __m256 c = LoadSpherePair(spheres[i + 2], spheres[i + 6]);
+		const __m256 d = LoadSpherePair(spheres[i + 3], spheres[i + 7]);
+
+		// Transpose both halves at once, lane n of each register ends up holding sphere i + n
+		const __m256 ab0 = _mm256_unpacklo_ps(a, b);
+		const __m256 cd0 = _mm256_unpacklo_ps(c, d);
+		const __m256 ab1 = _mm256_unpackhi_ps(a, b);
+		const __m256 cd1 = _mm256_unpackhi_ps(c, d);
+		const __m256 x = _mm256_shuffle_ps(ab0, cd0, _MM_SHUFFLE(1, 0, 1, 0));
+		const __m256 y = _mm256_shuffle_ps(ab0, cd0, _MM_SHUFFLE(3, 2, 3, 2));
+		const __m256 z = _mm256_shuffle_ps(ab1, cd1, _MM_SHUFFLE(1, 0, 1, 0));
+		const __m256 radius = _mm256_shuffle_ps(ab1, cd1, _MM_SHUFFLE(3, 2, 3, 2));
+
+		const __m256 negRadius = _mm256_sub_ps(_mm256_setzero_ps(), radius);
+		__m256 outside = _mm256_setzero_ps();
+		for (int p = 0; p < 6; p++) {
+			__m256 distance = _mm256_add_ps(_mm256_mul_ps(x, planeX[p]), planeW[p]);
+			distance = _mm256_add_ps(distance, _mm256_mul_ps(y, planeY[p]));
+			distance = _mm256_add_ps(distance, _mm256_mul_ps(z, planeZ[p]));
+			outside = _mm256_or_ps(outside, _mm256_cmp_ps(distance, negRadius, _CMP_LT_OQ));
+		}
+
+		const uint32_t visibleMask = ~static_cast<uint32_t>(_mm256_movemask_ps(outside)) & 0xFF;
+		visibleCount += AppendVisible(visibleMask, i, 8, outVisible + visibleCount);
+	}
+
+	return visibleCount + CullSpheresRange(planes, spheres, i, count, outVisible + visibleCount);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Two result columns at once, from two columns of the local transform
+CORE_TARGET_AVX2 inline __m256 ComposeColumnPair(
+	const __m256 parent[4]
+	, __m256 local)
+{
+	__m256 columns = _mm256_mul_ps(parent[0], _mm256_permute_ps(local, 0x00));
+	columns = _mm256_add_ps(columns, _mm256_mul_ps(parent[1], _mm256_permute_ps(local, 0x55)));
+	columns = _mm256_add_ps(columns, _mm256_mul_ps(parent[2], _mm256_permute_ps(local, 0xAA)));
+	columns = _mm256_add_ps(columns, _mm256_mul_ps(parent[3], _mm256_permute_ps(local, 0xFF)));
+	return columns;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+CORE_TARGET_AVX2 void ComposeTransformsAvx2(const Mat4 & parent, const Mat4 * locals, Mat4 * outWorlds, uint32_t count) {
+	// Every parent column in both halves
+	__m256 parentColumns[4];
+	for (int c = 0; c < 4; c++)
+		parentColumns[c] = _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(&parent.M[c * 4]));
+
+	for (uint32_t i = 0; i < count; i++) {
+		const __m256 local01 = _mm256_loadu_ps(&locals[i].M[0]);
+		const __m256 local23 = _mm256_loadu_ps(&locals[i].M[8]);
+
+		const __m256 world01 = ComposeColumnPair(parentColumns, local01);
+		const __m256 world23 = ComposeColumnPair(parentColumns, local23);
+
+		_mm256_storeu_ps(&outWorlds[i].M[0], world01);
+		_mm256_storeu_ps(&outWorlds[i].M[8], world23);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool HasAvx2() {
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+
+	// The OS has to save the ymm registers on context switches too
+	__cpuid(info, 1);
+	const bool osxsave = (info[2] & (1 << 27)) != 0;
+	const bool avx = (info[2] & (1 << 28)) != 0;
+	if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6)
+		return false;
+
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif // CORE_SIMD_X86
+
+////////////////////////////////////////////////////////////////////////////////
+
+#if defined(CORE_SIMD_NEON)
+
+uint32_t CullSpheresNeon(const Vec4 planes[6], const Vec4 * spheres, uint32_t count, uint32_t * outVisible) {
+	float32x4_t planeX[6], planeY[6], planeZ[6], planeW[6];
+	for (int p = 0; p < 6; p++) {
+		planeX[p] = vdupq_n_f32(planes[p].X);
+		planeY[p] = vdupq_n_f32(planes[p].Y);
+		planeZ[p] = vdupq_n_f32(planes[p].Z);
+		planeW[p] = vdupq_n_f32(planes[p].W);
+	}
+
+	static const uint32_t laneBits[4] = { 1, 2, 4, 8 };
+	const uint32x4_t bits = vld1q_u32(laneBits);
+
+	uint32_t visibleCount = 0;
+	uint32_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		// Deinterleaving load, one component of four spheres per register
+		const float32x4x4_t sphere = vld4q_f32(&spheres[i].X);
+
+		const float32x4_t negRadius = vnegq_f32(sphere.val[3]);
+		uint32x4_t outside = vdupq_n_u32(0);
+		for (int p = 0; p < 6; p++) {
+			float32x4_t distance = vmlaq_f32(planeW[p], sphere.val[0], planeX[p]);
+			distance = vmlaq_f32(distance, sphere.val[1], planeY[p]);
+			distance = vmlaq_f32(distance, sphere.val[2], planeZ[p]);
+			outside = vorrq_u32(outside, vcltq_f32(distance, negRadius));
+		}
+
+		const uint32_t outsideMask = vaddvq_u32(vandq_u32(outside, bits));
+		visibleCount += AppendVisible(~outsideMask & 0xF, i, 4, outVisible + visibleCount);
+	}
+
+	return visibleCount + CullSpheresRange(planes, spheres, i, count, outVisible + visibleCount);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void ComposeTransformsNeon(const Mat4 & parent, const Mat4 * locals, Mat4 * outWorlds, uint32_t count) {
+	const float32x4_t parent0 = vld1q_f32(&parent.M[0]);
+	const float32x4_t parent1 = vld1q_f32(&parent.M[4]);
+	const float32x4_t parent2 = vld1q_f32(&parent.M[8]);
+	const float32x4_t parent3 = vld1q_f32(&parent.M[12]);
+
+	for (uint32_t i = 0; i < count; i++) {
+		float32x4_t columns[4];
+		for (int c = 0; c < 4; c++) {
+			const float32x4_t local = vld1q_f32(&locals[i].M[c * 4]);
+			float32x4_t column = vmulq_laneq_f32(parent0, local, 0);
+			column = vmlaq_laneq_f32(column, parent1, local, 1);
+			column = vmlaq_laneq_f32(column, parent2, local, 2);
+			column = vmlaq_laneq_f32(column, parent3, local, 3);
+			columns[c] = column;
+		}
+
+		// The whole local transform is read before storing, in case it's being overwritten
+		for (int c = 0; c < 4; c++)
+			vst1q_f32(&outWorlds[i].M[c * 4], columns[c]);
+	}
+}
+
+#endif // CORE_SIMD_NEON
+
+////////////////////////////////////////////////////////////////////////////////
+
+KernelTable SelectKernels() {
+#if defined(CORE_SIMD_X86)
+	if (HasAvx2())
+		return { SimdLevel::Avx2, CullSpheresAvx2, ComposeTransformsAvx2 };
+	return { SimdLevel::Sse2, CullSpheresSse2, ComposeTransformsSse2 };
+#elif defined(CORE_SIMD_NEON)
+	return { SimdLevel::Neon, CullSpheresNeon, ComposeTransformsNeon };
+#else
+	return { SimdLevel::Scalar, CullSpheresScalar, ComposeTransformsScalar };
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+const KernelTable & GetKernels() {
+	static const KernelTable kernels = SelectKernels();
+	return kernels;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+} // anonymous namespace
+
+////////////////////////////////////////////////////////////////////////////////
+
+SimdLevel GetSimdLevel() {
+	return GetKernels().Level;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+const char * GetSimdLevelName(SimdLevel level) {
+	switch (level) {
+	case SimdLevel::Scalar:
+		return "Scalar";
+	case SimdLevel::Sse2:
+		return "SSE2";
+	case SimdLevel::Avx2:
+		return "AVX2";
+	case SimdLevel::Neon:
+		return "NEON";
+	}
+	return "Unknown";
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+uint32_t CullSpheres(const Vec4 planes[6], const Vec4 * spheres, uint32_t count, uint32_t * outVisible) {
+	return GetKernels().CullSpheres(planes, spheres, count, outVisible);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void ComposeTransforms(const Mat4 & parent, const Mat4 * locals, Mat4 * outWorlds, uint32_t count) {
+	GetKernels().ComposeTransforms(parent, locals, outWorlds, count);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+} // namespace core
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "Math.h"
+
+#include <cstdint>
+
+namespace core {
+
+////////////////////////////////////////////////////////////////////////////////
+// Instruction set the kernels below run with, the best one the CPU supports.
+// Picked once on first use, every call after that goes straight to it.
+enum class SimdLevel {
+	Scalar,
+	// 4 objects per instruction, always available on x64
+	Sse2,
+	// 8 objects per instruction
+	Avx2,
+	// 4 objects per instruction, always available on arm64
+	Neon,
+};
+
+SimdLevel GetSimdLevel();
+const char * GetSimdLevelName(SimdLevel level);
+
+////////////////////////////////////////////////////////////////////////////////
+// Batch kernels over tightly packed arrays, like the ones of a SceneStore.
+
+// Write the index of every sphere (xyz center, w radius) that isn't entirely outside one of the
+// planes, as given by ExtractFrustumPlanes. outVisible needs room for count indices.
+// Returns how many were written, in increasing order.
+uint32_t CullSpheres(const Vec4 planes[6], const Vec4 * spheres, uint32_t count, uint32_t * outVisible);
+
+// outWorlds[i] = parent * locals[i], to place a group of local transforms under a parent.
+// outWorlds may be the same array as locals.
+void ComposeTransforms(const Mat4 & parent, const Mat4 * locals, Mat4 * outWorlds, uint32_t count);
+
+} // namespace core
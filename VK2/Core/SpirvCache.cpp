@@ -0,0 +1,224 @@
+#include "SpirvCache.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <thread>
+
+namespace core {
+
+namespace {
+
+constexpr uint32_t ArchiveMagic = 0x53324B56; // "VK2S"
+constexpr uint32_t ArchiveVersion = 1;
+
+// Modules are aligned in the archive so they can be handed to Vulkan in place
+constexpr uint64_t ArchiveAlignment = 16;
+
+////////////////////////////////////////////////////////////////////////////////
+
+std::string KeyToString(uint64_t key) {
+	char str[17];
+	snprintf(str, sizeof(str), "%016llx", static_cast<unsigned long long>(key));
+	return str;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool ReadFile(const std::string & path, std::vector<uint32_t> & outWords) {
+	std::ifstream file(path, std::ios::ate | std::ios::binary);
+	if (!file.is_open())
+		return false;
+
+	size_t fileSize = (size_t)file.tellg();
+	if (fileSize == 0 || fileSize % sizeof(uint32_t) != 0)
+		return false;
+
+	outWords.resize(fileSize / sizeof(uint32_t));
+	file.seekg(0);
+	file.read(reinterpret_cast<char *>(outWords.data()), fileSize);
+	return static_cast<bool>(file);
+}
+
+} // anonymous namespace
+
+////////////////////////////////////////////////////////////////////////////////
+
+SpirvCache::SpirvCache(const std::string & cacheDirectory, const std::string & archivePath)
+	: CacheDirectory(cacheDirectory)
+	, ArchivePath(archivePath)
+{
+	std::filesystem::create_directories(CacheDirectory);
+
+	if (ArchivePath.empty() || !Archive.Open(ArchivePath))
+		return;
+
+	// Ignore archives that are truncated or were written by a different version
+	const uint8_t * data = Archive.GetData();
+	const size_t size = Archive.GetSize();
+	if (size < sizeof(ArchiveHeader)) {
+		Archive.Close();
+		return;
+	}
+
+	const ArchiveHeader * header = reinterpret_cast<const ArchiveHeader *>(data);
+	const size_t tocEnd = sizeof(ArchiveHeader) + header->EntryCount * sizeof(ArchiveEntry);
+	if (header->Magic != ArchiveMagic || header->Version != ArchiveVersion || tocEnd > size) {
+		Archive.Close();
+		return;
+	}
+
+	ArchiveEntries = std::span<const ArchiveEntry>(
+		reinterpret_cast<const ArchiveEntry *>(data + sizeof(ArchiveHeader))
+		, header->EntryCount
+	);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+std::span<const uint32_t> SpirvCache::Find(uint64_t key, std::vector<uint32_t> & storage) const {
+	std::span<const uint32_t> archived = FindInArchive(key);
+	if (!archived.empty())
+		return archived;
+
+	if (!ReadFile(GetLoosePath(key), storage))
+		return {};
+
+	return storage;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void SpirvCache::Store(uint64_t key, std::span<const uint32_t> code) const {
+	const std::string path = GetLoosePath(key);
+
+	// Write to a file unique to this thread, then move it into place,
+	// so concurrent stores of the same key never see a partial file
+	std::ostringstream tempPath;
+	tempPath << path << "." << std::this_thread::get_id() << ".tmp";
+
+	{
+		std::ofstream outFile(tempPath.str(), std::ios::binary);
+		if (!outFile.is_open())
+			return;
+
+		outFile.write(reinterpret_cast<const char *>(code.data()), code.size_bytes());
+		if (!outFile)
+			return;
+	}
+
+	std::error_code error;
+	std::filesystem::rename(tempPath.str(), path, error);
+	if (error)
+		std::filesystem::remove(tempPath.str(), error);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool SpirvCache::WriteArchive() {
+	if (ArchivePath.empty())
+		return false;
+
+	// Gather every module, loose files win over the old archive since they are newer
+	std::map<uint64_t, std::vector<uint32_t>> modules;
+	for (const ArchiveEntry & entry : ArchiveEntries) {
+		std::span<const uint32_t> code = FindInArchive(entry.Key);
+		modules[entry.Key].assign(code.begin(), code.end());
+	}
+
+	std::error_code error;
+	for (const auto & file : std::filesystem::directory_iterator(CacheDirectory, error)) {
+		if (file.path().extension() != ".spv")
+			continue;
+
+		const std::string stem = file.path().stem().string();
+		char * end = nullptr;
+		const uint64_t key = std::strtoull(stem.c_str(), &end, 16);
+		if (stem.size() != 16 || *end != '\0')
+			continue;
+
+		std::vector<uint32_t> code;
+		if (ReadFile(file.path().string(), code))
+			modules[key] = std::move(code);
+	}
+
+	// Lay out the table of contents followed by the aligned modules.
+	// std::map keeps the keys sorted for binary search on load.
+	std::vector<ArchiveEntry> entries;
+	entries.reserve(modules.size());
+
+	uint64_t offset = sizeof(ArchiveHeader) + modules.size() * sizeof(ArchiveEntry);
+	for (const auto & [key, code] : modules) {
+		offset = (offset + ArchiveAlignment - 1) & ~(ArchiveAlignment - 1);
+		entries.push_back({ key, offset, code.size() * sizeof(uint32_t) });
+		offset += code.size() * sizeof(uint32_t);
+	}
+
+	// The archive is mapped by us, so write next to it and swap it in
+	const std::string tempPath = ArchivePath + ".tmp";
+	{
+		std::ofstream outFile(tempPath, std::ios::binary);
+		if (!outFile.is_open())
+			return false;
+
+		ArchiveHeader header = { ArchiveMagic, ArchiveVersion, static_cast<uint32_t>(entries.size()), 0 };
+		outFile.write(reinterpret_cast<const char *>(&header), sizeof(header));
+		outFile.write(reinterpret_cast<const char *>(entries.data()), entries.size() * sizeof(ArchiveEntry));
+
+		size_t entryIdx = 0;
+		for (const auto & [key, code] : modules) {
+			const ArchiveEntry & entry = entries[entryIdx++];
+
+			static const char padding[ArchiveAlignment] = {};
+			outFile.write(padding, entry.Offset - static_cast<uint64_t>(outFile.tellp()));
+			outFile.write(reinterpret_cast<const char *>(code.data()), entry.Size);
+		}
+
+		if (!outFile)
+			return false;
+	}
+
+	// Windows won't replace a mapped file. Every module was copied out above, so let go of it.
+	// The new archive is picked up on the next launch.
+	ArchiveEntries = {};
+	Archive.Close();
+
+	std::filesystem::rename(tempPath, ArchivePath, error);
+	return !error;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+std::span<const uint32_t> SpirvCache::FindInArchive(uint64_t key) const {
+	auto it = std::lower_bound(
+		ArchiveEntries.begin()
+		, ArchiveEntries.end()
+		, key
+		, [](const ArchiveEntry & entry, uint64_t key) { return entry.Key < key; }
+	);
+
+	if (it == ArchiveEntries.end() || it->Key != key)
+		return {};
+
+	// Don't trust entries that point outside the file
+	if (it->Offset + it->Size > Archive.GetSize() || it->Offset % sizeof(uint32_t) != 0)
+		return {};
+
+	return std::span<const uint32_t>(
+		reinterpret_cast<const uint32_t *>(Archive.GetData() + it->Offset)
+		, it->Size / sizeof(uint32_t)
+	);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+std::string SpirvCache::GetLoosePath(uint64_t key) const {
+	return (std::filesystem::path(CacheDirectory) / (KeyToString(key) + ".spv")).string();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+} // namespace core
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "MappedFile.h"
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace core {
+
+////////////////////////////////////////////////////////////////////////////////
+// Persistent cache of compiled spir-v, keyed by a hash of everything that
+// affects the compiled output (preprocessed source, defines, compiler version
+// and target environment).
+//
+// Modules are stored as loose <key>.spv files in the cache directory. The
+// cache can also be packed into a single archive that is memory mapped at
+// startup, so a prebuilt cache can be shipped and loaded without copies.
+class SpirvCache {
+public:
+	// The archive is optional, it is only mapped if it exists
+	SpirvCache(const std::string & cacheDirectory, const std::string & archivePath);
+
+	SpirvCache(const SpirvCache &) = delete;
+	SpirvCache & operator=(const SpirvCache &) = delete;
+
+	// Look up a module. Returns an empty span on a miss.
+	// Hits in the archive point straight into the mapping, loose files are read into storage.
+	// Safe to call from multiple threads.
+	std::span<const uint32_t> Find(uint64_t key, std::vector<uint32_t> & storage) const;
+
+	// Write a module to the cache directory. Safe to call from multiple threads.
+	void Store(uint64_t key, std::span<const uint32_t> code) const;
+
+	// Pack the archive and every loose module into a new archive at archivePath.
+	// Unmaps the current archive, so other threads must not be using the cache.
+	bool WriteArchive();
+
+private:
+	// Layout of the archive file. All offsets are from the start of the file.
+	struct ArchiveHeader {
+		uint32_t Magic;
+		uint32_t Version;
+		uint32_t EntryCount;
+		uint32_t Reserved;
+	};
+
+	// Table of contents entry, sorted by key
+	struct ArchiveEntry {
+		uint64_t Key;
+		uint64_t Offset;
+		// Size of the module in bytes
+		uint64_t Size;
+	};
+
+	std::span<const uint32_t> FindInArchive(uint64_t key) const;
+
+	std::string GetLoosePath(uint64_t key) const;
+
+private:
+	std::string CacheDirectory;
+	std::string ArchivePath;
+
+	MappedFile Archive;
+	std::span<const ArchiveEntry> ArchiveEntries;
+};
+
+} // namespace core
@@ -0,0 +1,449 @@
+#include "StreamingUploader.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace core {
+
+namespace {
+
+// Covers the offset rules of buffer to buffer and buffer to image copies, including block compressed texels
+constexpr VkDeviceSize StagingAlignment = 16;
+
+} // namespace
+
+////////////////////////////////////////////////////////////////////////////////
+
+StreamingUploader::StreamingUploader(
+	const vkb::DispatchTable & vk
+	, GpuAllocator & allocator
+	, VkQueue transferQueue
+	, uint32_t transferQueueFamily
+	, uint32_t graphicsQueueFamily
+	, VkDeviceSize stagingSize)
+	: Vk(vk)
+	, Allocator(allocator)
+	, TransferQueue(transferQueue)
+	, TransferQueueFamily(transferQueueFamily)
+	, GraphicsQueueFamily(graphicsQueueFamily)
+	, Timeline(vk)
+	, StagingRanges(stagingSize)
+{
+	VkCommandPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.pNext = nullptr;
+
+	poolInfo.queueFamilyIndex = TransferQueueFamily;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+	if (Vk.createCommandPool(&poolInfo, nullptr, &CommandPool))
+		throw std::runtime_error("Failed to create transfer command pool");
+
+	if (stagingSize > 0) {
+		try {
+			StagingBuffer = Allocator.CreateBuffer(stagingSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, MemoryUsage::CpuToGpu);
+		} catch (...) {
+			Vk.destroyCommandPool(CommandPool, nullptr);
+			throw;
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+StreamingUploader::~StreamingUploader() {
+	for (Batch & batch : InFlight) {
+		for (PendingUpload & upload : batch.Uploads)
+			FreeStaging(upload.Staging);
+	}
+
+	for (PendingUpload & upload : Queued)
+		FreeStaging(upload.Staging);
+
+	if (StagingBuffer.Handle != VK_NULL_HANDLE)
+		Allocator.DestroyBuffer(StagingBuffer);
+
+	// Destroying command pool will destroy all command buffers that have been allocated from it
+	Vk.destroyCommandPool(CommandPool, nullptr);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+UploadTicket StreamingUploader::UploadBuffer(
+	VkBuffer dst
+	, VkDeviceSize dstOffset
+	, const void * data
+	, VkDeviceSize size
+	, bool concurrent)
+{
+	PendingUpload upload;
+	upload.Staging = AllocateStaging(data, size);
+	upload.DstBuffer = dst;
+	upload.DstOffset = dstOffset;
+	upload.Size = size;
+	upload.Concurrent = concurrent;
+
+	return Enqueue(std::move(upload));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+UploadTicket StreamingUploader::UploadImage(
+	VkImage dst
+	, const VkImageSubresourceRange & range
+	, const std::vector<VkBufferImageCopy> & regions
+	, VkImageLayout finalLayout
+	, const void * data
+	, VkDeviceSize size)
+{
+	PendingUpload upload;
+	upload.Staging = AllocateStaging(data, size);
+	upload.DstImage = dst;
+	upload.Range = range;
+	upload.Regions = regions;
+	upload.FinalLayout = finalLayout;
+	upload.Size = size;
+
+	return Enqueue(std::move(upload));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void StreamingUploader::Submit() {
+	// Bound the staging memory and command buffers tied up in the transfer queue.
+	// Only this thread touches InFlight, so it can be read without the lock.
+	const uint64_t completed = Timeline.GetCompleted();
+	const size_t executing = static_cast<size_t>(std::count_if(InFlight.begin(), InFlight.end(), [completed](const Batch & batch) {
+		return batch.Ticket > completed;
+	}));
+	if (executing >= MaxBatchesInFlight) {
+		// Batches on the queue finish in order, so the oldest one executing is the first to go
+		const UploadTicket oldest = InFlight[InFlight.size() - executing].Ticket;
+		if (!Timeline.Wait(oldest))
+			throw std::runtime_error("Failed to wait for uploads on the transfer queue");
+	}
+
+	// Held until the submit went through. Enqueue hands out the next timeline value as ticket,
+	// so nothing may be queued between taking the batch and claiming that value.
+	std::lock_guard<std::mutex> lock(QueuedMutex);
+	if (Queued.empty())
+		return;
+
+	if (FreeCommandBuffers.empty()) {
+		VkCommandBufferAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.pNext = nullptr;
+
+		allocInfo.commandPool = CommandPool;
+		allocInfo.commandBufferCount = 1;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+
+		VkCommandBuffer cmd;
+		if (Vk.allocateCommandBuffers(&allocInfo, &cmd))
+			throw std::runtime_error("Failed to allocate a transfer command buffer.");
+		FreeCommandBuffers.push_back(cmd);
+	}
+
+	Batch batch;
+	batch.Uploads.swap(Queued);
+	batch.Ticket = Timeline.GetLastSubmitted() + 1;
+	batch.Cmd = FreeCommandBuffers.back();
+	FreeCommandBuffers.pop_back();
+
+	RecordBatch(batch);
+
+	VkTimelineSemaphoreSubmitInfo timelineInfo = {};
+	timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+	timelineInfo.pNext = nullptr;
+
+	timelineInfo.signalSemaphoreValueCount = 1;
+	timelineInfo.pSignalSemaphoreValues = &batch.Ticket;
+
+	VkSemaphore timeline = Timeline.Get();
+
+	VkSubmitInfo submit = {};
+	submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submit.pNext = &timelineInfo;
+
+	submit.commandBufferCount = 1;
+	submit.pCommandBuffers = &batch.Cmd;
+
+	submit.signalSemaphoreCount = 1;
+	submit.pSignalSemaphores = &timeline;
+
+	if (Vk.queueSubmit(TransferQueue, 1, &submit, VK_NULL_HANDLE)) {
+		// The ticket was never claimed, so it still belongs to these uploads and the next submit signals it
+		Vk.resetCommandBuffer(batch.Cmd, 0);
+		FreeCommandBuffers.push_back(batch.Cmd);
+		Queued.swap(batch.Uploads);
+		throw std::runtime_error("Failed to submit uploads to the transfer queue");
+	}
+
+	// Only submitted values are claimed, anything waiting on one is sure to be signaled
+	Timeline.Advance();
+	InFlight.push_back(std::move(batch));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void StreamingUploader::AcquireCompleted(VkCommandBuffer cmd, SemaphoreWaits & waits) {
+	const uint64_t completed = Timeline.GetCompleted();
+
+	std::vector<VkBufferMemoryBarrier> bufferBarriers;
+	std::vector<VkImageMemoryBarrier> imageBarriers;
+	UploadTicket newestTicket = 0;
+
+	while (!InFlight.empty() && InFlight.front().Ticket <= completed) {
+		Batch & batch = InFlight.front();
+
+		for (PendingUpload & upload : batch.Uploads) {
+			if (NeedsOwnershipTransfer(upload)) {
+				if (upload.DstBuffer != VK_NULL_HANDLE)
+					bufferBarriers.push_back(MakeBufferOwnershipBarrier(upload));
+				else
+					imageBarriers.push_back(MakeImageOwnershipBarrier(upload));
+			}
+
+			// The copies have executed, the staging memory can be reused
+			FreeStaging(upload.Staging);
+		}
+
+		newestTicket = batch.Ticket;
+		Vk.resetCommandBuffer(batch.Cmd, 0);
+		FreeCommandBuffers.push_back(batch.Cmd);
+		InFlight.pop_front();
+	}
+
+	if (newestTicket == 0)
+		return;
+
+	if (!bufferBarriers.empty() || !imageBarriers.empty()) {
+		// Acquire half of the ownership transfer, the source access is ignored here.
+		// Consumers are unknown, so make the data visible to every stage.
+		Vk.cmdPipelineBarrier(
+			cmd
+			, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT
+			, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT
+			, 0
+			, 0, nullptr
+			, static_cast<uint32_t>(bufferBarriers.size()), bufferBarriers.data()
+			, static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data()
+		);
+	}
+
+	// The value has already been reached, so this never stalls the graphics queue.
+	// It provides the memory dependency on the transfer queue's writes.
+	waits.Add(Timeline.Get(), newestTicket, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+
+	AcquiredTicket = newestTicket;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+std::vector<uint32_t> StreamingUploader::GetQueueFamilies() const {
+	if (NeedsOwnershipTransfer())
+		return { TransferQueueFamily, GraphicsQueueFamily };
+	return { TransferQueueFamily };
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+StreamingUploader::StagingRange StreamingUploader::AllocateStaging(const void * data, VkDeviceSize size) {
+	StagingRange staging;
+	staging.Size = AlignUp(size, StagingAlignment);
+
+	bool pooled = false;
+	if (StagingBuffer.Handle != VK_NULL_HANDLE) {
+		std::lock_guard<std::mutex> lock(StagingMutex);
+		pooled = StagingRanges.Allocate(staging.Size, StagingAlignment, staging.Offset);
+	}
+
+	if (pooled) {
+		staging.Handle = StagingBuffer.Handle;
+	} else {
+		// Too large, or everything is still waiting to be copied
+		staging.Dedicated = Allocator.CreateBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, MemoryUsage::CpuToGpu);
+		staging.Handle = staging.Dedicated.Handle;
+		staging.Offset = 0;
+	}
+
+	uint8_t * mapped = pooled ? static_cast<uint8_t *>(StagingBuffer.Memory.Mapped) : static_cast<uint8_t *>(staging.Dedicated.Memory.Mapped);
+	memcpy(mapped + staging.Offset, data, size);
+	return staging;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void StreamingUploader::FreeStaging(StagingRange & staging) {
+	if (staging.Dedicated.Handle != VK_NULL_HANDLE) {
+		Allocator.DestroyBuffer(staging.Dedicated);
+	} else if (staging.Handle != VK_NULL_HANDLE) {
+		std::lock_guard<std::mutex> lock(StagingMutex);
+		StagingRanges.Free(staging.Offset, staging.Size);
+	}
+	staging.Handle = VK_NULL_HANDLE;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+UploadTicket StreamingUploader::Enqueue(PendingUpload && upload) {
+	std::lock_guard<std::mutex> lock(QueuedMutex);
+	Queued.push_back(std::move(upload));
+
+	// Everything queued now goes out with the next submit
+	return Timeline.GetLastSubmitted() + 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void StreamingUploader::RecordBatch(Batch & batch) {
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.pNext = nullptr;
+
+	beginInfo.pInheritanceInfo = nullptr;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	Vk.beginCommandBuffer(batch.Cmd, &beginInfo);
+
+	// Earlier batches may have written the same ranges, e.g. buffers streamed into every frame.
+	// Order their copies before this batch's, batches on the queue are otherwise free to overlap.
+	VkMemoryBarrier previousWrites = {};
+	previousWrites.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	previousWrites.pNext = nullptr;
+
+	previousWrites.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	previousWrites.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+	Vk.cmdPipelineBarrier(
+		batch.Cmd
+		, VK_PIPELINE_STAGE_TRANSFER_BIT
+		, VK_PIPELINE_STAGE_TRANSFER_BIT
+		, 0
+		, 1, &previousWrites
+		, 0, nullptr
+		, 0, nullptr
+	);
+
+	// Move every image into a layout it can be copied into
+	std::vector<VkImageMemoryBarrier> toTransferDst;
+	for (const PendingUpload & upload : batch.Uploads) {
+		if (upload.DstImage == VK_NULL_HANDLE)
+			continue;
+
+		VkImageMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.pNext = nullptr;
+
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = upload.DstImage;
+		barrier.subresourceRange = upload.Range;
+		toTransferDst.push_back(barrier);
+	}
+
+	if (!toTransferDst.empty()) {
+		Vk.cmdPipelineBarrier(
+			batch.Cmd
+			, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT
+			, VK_PIPELINE_STAGE_TRANSFER_BIT
+			, 0
+			, 0, nullptr
+			, 0, nullptr
+			, static_cast<uint32_t>(toTransferDst.size()), toTransferDst.data()
+		);
+	}
+
+	std::vector<VkBufferMemoryBarrier> bufferReleases;
+	std::vector<VkImageMemoryBarrier> imageReleases;
+
+	for (PendingUpload & upload : batch.Uploads) {
+		if (upload.DstBuffer != VK_NULL_HANDLE) {
+			VkBufferCopy copy = {};
+			copy.srcOffset = upload.Staging.Offset;
+			copy.dstOffset = upload.DstOffset;
+			copy.size = upload.Size;
+			Vk.cmdCopyBuffer(batch.Cmd, upload.Staging.Handle, upload.DstBuffer, 1, &copy);
+
+			if (NeedsOwnershipTransfer(upload))
+				bufferReleases.push_back(MakeBufferOwnershipBarrier(upload));
+		} else {
+			// Region offsets are relative to the upload's data, which starts somewhere in the staging buffer
+			std::vector<VkBufferImageCopy> regions = upload.Regions;
+			for (VkBufferImageCopy & region : regions)
+				region.bufferOffset += upload.Staging.Offset;
+
+			Vk.cmdCopyBufferToImage(
+				batch.Cmd
+				, upload.Staging.Handle
+				, upload.DstImage
+				, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
+				, static_cast<uint32_t>(regions.size())
+				, regions.data()
+			);
+
+			// Without an ownership transfer this is just the transition into the final layout
+			imageReleases.push_back(MakeImageOwnershipBarrier(upload));
+		}
+	}
+
+	// Release half of the ownership transfer, the destination access is ignored here
+	if (!bufferReleases.empty() || !imageReleases.empty()) {
+		Vk.cmdPipelineBarrier(
+			batch.Cmd
+			, VK_PIPELINE_STAGE_TRANSFER_BIT
+			, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT
+			, 0
+			, 0, nullptr
+			, static_cast<uint32_t>(bufferReleases.size()), bufferReleases.data()
+			, static_cast<uint32_t>(imageReleases.size()), imageReleases.data()
+		);
+	}
+
+	Vk.endCommandBuffer(batch.Cmd);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+VkBufferMemoryBarrier StreamingUploader::MakeBufferOwnershipBarrier(const PendingUpload & upload) const {
+	VkBufferMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.pNext = nullptr;
+
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+	barrier.srcQueueFamilyIndex = TransferQueueFamily;
+	barrier.dstQueueFamilyIndex = GraphicsQueueFamily;
+	barrier.buffer = upload.DstBuffer;
+	barrier.offset = upload.DstOffset;
+	barrier.size = upload.Size;
+	return barrier;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+VkImageMemoryBarrier StreamingUploader::MakeImageOwnershipBarrier(const PendingUpload & upload) const {
+	VkImageMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.pNext = nullptr;
+
+	// The layout transition is part of the transfer, both halves have to specify it
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.newLayout = upload.FinalLayout;
+	barrier.srcQueueFamilyIndex = NeedsOwnershipTransfer() ? TransferQueueFamily : VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = NeedsOwnershipTransfer() ? GraphicsQueueFamily : VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = upload.DstImage;
+	barrier.subresourceRange = upload.Range;
+	return barrier;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+} // namespace core
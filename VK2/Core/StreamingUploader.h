@@ -0,0 +1,169 @@
+#pragma once
+
+#include "GpuAllocator.h"
+#include "RangeAllocator.h"
+#include "TimelineSemaphore.h"
+#include "VkBootStrap/VkBootstrapDispatch.h"
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+namespace core {
+
+// Transfer timeline value at which an upload has landed in its destination
+using UploadTicket = uint64_t;
+
+////////////////////////////////////////////////////////////////////////////////
+// Streams buffer and image data to the GPU on the dedicated transfer queue
+// (or the best available fallback), so large uploads never stall the
+// graphics queue or the frame loop.
+//
+// Any thread can queue an upload, which copies the data into staging memory
+// right away. Staging memory is sub-allocated from one persistent buffer, only
+// uploads that don't fit get a buffer of their own. Submit() then records and
+// submits everything queued on the transfer queue, signaling the transfer
+// timeline. Once the timeline has passed an upload's ticket, the graphics
+// queue picks up ownership of the destination resource through
+// AcquireCompleted(), which never makes the graphics queue wait on unfinished
+// transfers.
+//
+// Buffers created with concurrent sharing between GetQueueFamilies() skip the
+// ownership transfer, so they can be streamed into over and over, e.g. for
+// data that is rewritten every frame.
+class StreamingUploader {
+public:
+	StreamingUploader(
+		const vkb::DispatchTable & vk
+		, GpuAllocator & allocator
+		, VkQueue transferQueue
+		, uint32_t transferQueueFamily
+		, uint32_t graphicsQueueFamily
+		, VkDeviceSize stagingSize);
+	// The device must be idle
+	~StreamingUploader();
+
+	StreamingUploader(const StreamingUploader &) = delete;
+	StreamingUploader & operator=(const StreamingUploader &) = delete;
+
+	// Queue a copy into a buffer. Thread safe.
+	// concurrent has to be true for buffers created with concurrent sharing between GetQueueFamilies(),
+	// and false for exclusive ones, which are handed over to the graphics queue once the copy is done.
+	UploadTicket UploadBuffer(
+		VkBuffer dst
+		, VkDeviceSize dstOffset
+		, const void * data
+		, VkDeviceSize size
+		, bool concurrent = false);
+
+	// Queue a copy into an image, which ends up in finalLayout. Thread safe.
+	// Region buffer offsets are relative to data.
+	UploadTicket UploadImage(
+		VkImage dst
+		, const VkImageSubresourceRange & range
+		, const std::vector<VkBufferImageCopy> & regions
+		, VkImageLayout finalLayout
+		, const void * data
+		, VkDeviceSize size);
+
+	// Submit everything queued since the last call.
+	// Waits for the oldest batch if MaxBatchesInFlight are still executing.
+	// Must be called from the thread that submits to the graphics queue, since the
+	// transfer queue may be the same VkQueue.
+	void Submit();
+
+	// Record the graphics side of ownership transfers for every finished upload into cmd,
+	// and add a wait on the transfer timeline to the graphics submission.
+	// Also frees the staging memory of those uploads. Call once per frame before recording work that uses them.
+	void AcquireCompleted(VkCommandBuffer cmd, SemaphoreWaits & waits);
+
+	// True once the upload has finished and been acquired by the graphics queue, so it is safe to use
+	bool IsComplete(UploadTicket ticket) const { return ticket <= AcquiredTicket; }
+
+	TimelineSemaphore & GetTimeline() { return Timeline; }
+
+	// Transfer and graphics family, what buffers streamed into with concurrent sharing have to be shared between
+	std::vector<uint32_t> GetQueueFamilies() const;
+
+	// Batches submitted to the transfer queue that may execute at the same time
+	static constexpr size_t MaxBatchesInFlight = 4;
+
+private:
+	// Where an upload's data waits to be copied
+	struct StagingRange {
+		// Only created for uploads that didn't fit into StagingBuffer
+		Buffer Dedicated;
+		VkBuffer Handle = VK_NULL_HANDLE;
+		VkDeviceSize Offset = 0;
+		VkDeviceSize Size = 0;
+	};
+
+	struct PendingUpload {
+		StagingRange Staging;
+		VkBuffer DstBuffer = VK_NULL_HANDLE;
+		VkDeviceSize DstOffset = 0;
+		VkDeviceSize Size = 0;
+		// Concurrent sharing, no ownership transfer
+		bool Concurrent = false;
+
+		VkImage DstImage = VK_NULL_HANDLE;
+		VkImageSubresourceRange Range = {};
+		std::vector<VkBufferImageCopy> Regions;
+		VkImageLayout FinalLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	};
+
+	// Uploads submitted together, alive until the timeline passes Ticket
+	struct Batch {
+		UploadTicket Ticket = 0;
+		VkCommandBuffer Cmd = VK_NULL_HANDLE;
+		std::vector<PendingUpload> Uploads;
+	};
+
+	// Copy data into staging memory, falling back to a buffer of its own if StagingBuffer is full.
+	// Thread safe. Throws if fails.
+	StagingRange AllocateStaging(const void * data, VkDeviceSize size);
+	// Thread safe
+	void FreeStaging(StagingRange & staging);
+
+	// Queue an upload, returning the ticket of the next submit. Thread safe.
+	UploadTicket Enqueue(PendingUpload && upload);
+
+	void RecordBatch(Batch & batch);
+
+	// Barrier handing the resource over from the transfer to the graphics family.
+	// Used for both the release and the acquire half.
+	VkBufferMemoryBarrier MakeBufferOwnershipBarrier(const PendingUpload & upload) const;
+	VkImageMemoryBarrier MakeImageOwnershipBarrier(const PendingUpload & upload) const;
+
+	bool NeedsOwnershipTransfer() const { return TransferQueueFamily != GraphicsQueueFamily; }
+	bool NeedsOwnershipTransfer(const PendingUpload & upload) const { return NeedsOwnershipTransfer() && !upload.Concurrent; }
+
+private:
+	const vkb::DispatchTable & Vk;
+	GpuAllocator & Allocator;
+
+	VkQueue TransferQueue;
+	uint32_t TransferQueueFamily;
+	uint32_t GraphicsQueueFamily;
+
+	TimelineSemaphore Timeline;
+	VkCommandPool CommandPool = VK_NULL_HANDLE;
+	std::vector<VkCommandBuffer> FreeCommandBuffers;
+
+	// Persistent staging memory, ranges are freed once their batch has executed
+	Buffer StagingBuffer;
+	std::mutex StagingMutex;
+	RangeAllocator StagingRanges;
+
+	// Guards Queued, held through Submit() so tickets match the values actually submitted
+	std::mutex QueuedMutex;
+	std::vector<PendingUpload> Queued;
+
+	// Submitted batches, oldest first
+	std::deque<Batch> InFlight;
+	// Newest ticket that has been acquired by the graphics queue
+	std::atomic<UploadTicket> AcquiredTicket = 0;
+};
+
+} // namespace core
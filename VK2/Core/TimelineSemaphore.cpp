@@ -0,0 +1,59 @@
+#include "TimelineSemaphore.h"
+
+#include <stdexcept>
+
+namespace core {
+
+////////////////////////////////////////////////////////////////////////////////
+
+TimelineSemaphore::TimelineSemaphore(const vkb::DispatchTable & vk, uint64_t initialValue)
+	: Vk(vk)
+	, LastSubmitted(initialValue)
+{
+	VkSemaphoreTypeCreateInfo typeInfo = {};
+	typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+	typeInfo.pNext = nullptr;
+
+	typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+	typeInfo.initialValue = initialValue;
+
+	VkSemaphoreCreateInfo semaphoreInfo = {};
+	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	semaphoreInfo.pNext = &typeInfo;
+	semaphoreInfo.flags = 0;
+
+	if (Vk.createSemaphore(&semaphoreInfo, nullptr, &Semaphore))
+		throw std::runtime_error("Failed to create timeline semaphore");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+TimelineSemaphore::~TimelineSemaphore() {
+	Vk.destroySemaphore(Semaphore, nullptr);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+uint64_t TimelineSemaphore::GetCompleted() const {
+	uint64_t value = 0;
+	Vk.getSemaphoreCounterValue(Semaphore, &value);
+	return value;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool TimelineSemaphore::Wait(uint64_t value, uint64_t timeout) const {
+	VkSemaphoreWaitInfo waitInfo = {};
+	waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+	waitInfo.pNext = nullptr;
+
+	waitInfo.semaphoreCount = 1;
+	waitInfo.pSemaphores = &Semaphore;
+	waitInfo.pValues = &value;
+
+	return Vk.waitSemaphores(&waitInfo, timeout) == VK_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+} // namespace core
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "VkBootStrap/VkBootstrapDispatch.h"
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+namespace core {
+
+////////////////////////////////////////////////////////////////////////////////
+// Wrapper around a VK_SEMAPHORE_TYPE_TIMELINE semaphore.
+// The value only ever increases: every submission signals the next value, and
+// anything waiting for a value is released once the GPU gets there.
+class TimelineSemaphore {
+public:
+	TimelineSemaphore(const vkb::DispatchTable & vk, uint64_t initialValue = 0);
+	~TimelineSemaphore();
+
+	TimelineSemaphore(const TimelineSemaphore &) = delete;
+	TimelineSemaphore & operator=(const TimelineSemaphore &) = delete;
+
+	VkSemaphore Get() const { return Semaphore; }
+
+	// Reserve the value the next submission will signal. Thread safe.
+	uint64_t Advance() { return ++LastSubmitted; }
+
+	// Highest value handed out by Advance()
+	uint64_t GetLastSubmitted() const { return LastSubmitted; }
+
+	// Highest value the GPU has signaled so far
+	uint64_t GetCompleted() const;
+
+	bool IsComplete(uint64_t value) const { return GetCompleted() >= value; }
+
+	// Block until the GPU has signaled the value. Returns false on timeout.
+	bool Wait(uint64_t value, uint64_t timeout = UINT64_MAX) const;
+
+private:
+	const vkb::DispatchTable & Vk;
+	VkSemaphore Semaphore = VK_NULL_HANDLE;
+	std::atomic<uint64_t> LastSubmitted;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Semaphores a queue submission waits on, gathered from several systems
+struct SemaphoreWaits {
+	std::vector<VkSemaphore> Semaphores;
+	// Ignored for binary semaphores
+	std::vector<uint64_t> Values;
+	std::vector<VkPipelineStageFlags> Stages;
+
+	void Add(VkSemaphore semaphore, uint64_t value, VkPipelineStageFlags stage) {
+		Semaphores.push_back(semaphore);
+		Values.push_back(value);
+		Stages.push_back(stage);
+	}
+
+	void Clear() {
+		Semaphores.clear();
+		Values.clear();
+		Stages.clear();
+	}
+};
+
+} // namespace core
@@ -0,0 +1,67 @@
+#include "UploadRing.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace core {
+
+////////////////////////////////////////////////////////////////////////////////
+
+UploadRing::UploadRing(GpuAllocator & allocator, uint32_t frameCount, VkDeviceSize bytesPerFrame, const std::vector<uint32_t> & queueFamilies)
+	: Allocator(allocator)
+{
+	const VkPhysicalDeviceLimits & limits = Allocator.GetLimits();
+	UniformAlignment = std::max(limits.minUniformBufferOffsetAlignment, limits.minStorageBufferOffsetAlignment);
+
+	// Keep every region aligned, so offsets within a region only need to be aligned relative to it
+	BytesPerFrame = AlignUp(bytesPerFrame, UniformAlignment);
+
+	RingBuffer = Allocator.CreateBuffer(
+		BytesPerFrame * frameCount
+		, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT
+			| VK_BUFFER_USAGE_INDEX_BUFFER_BIT
+			| VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT
+			| VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+			| VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT
+			| VK_BUFFER_USAGE_TRANSFER_SRC_BIT
+		, MemoryUsage::CpuToGpu
+		, queueFamilies
+	);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+UploadRing::~UploadRing() {
+	Allocator.DestroyBuffer(RingBuffer);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void UploadRing::BeginFrame(uint32_t frameIndex) {
+	FrameOffset = frameIndex * BytesPerFrame;
+	Head = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+UploadAllocation UploadRing::Allocate(VkDeviceSize size, VkDeviceSize alignment) {
+	// Lock free bump allocation, retry if another thread moved the head in the meantime
+	VkDeviceSize head = Head.load(std::memory_order_relaxed);
+	VkDeviceSize offset;
+	do {
+		offset = AlignUp(head, alignment);
+		if (offset + size > BytesPerFrame)
+			throw std::runtime_error("Upload ring is out of space for this frame");
+	} while (!Head.compare_exchange_weak(head, offset + size, std::memory_order_relaxed));
+
+	UploadAllocation allocation;
+	allocation.Buffer = RingBuffer.Handle;
+	allocation.Offset = FrameOffset + offset;
+	allocation.Size = size;
+	allocation.Mapped = static_cast<uint8_t *>(RingBuffer.Memory.Mapped) + FrameOffset + offset;
+	return allocation;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+} // namespace core
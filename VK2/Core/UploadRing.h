@@ -0,0 +1,70 @@
+#pragma once
+
+#include "GpuAllocator.h"
+
+#include <atomic>
+#include <cstring>
+
+namespace core {
+
+////////////////////////////////////////////////////////////////////////////////
+// A sub-range of the upload ring, valid for the frame it was allocated in
+struct UploadAllocation {
+	VkBuffer Buffer = VK_NULL_HANDLE;
+	VkDeviceSize Offset = 0;
+	VkDeviceSize Size = 0;
+	// Host pointer to write the data through
+	void * Mapped = nullptr;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Persistently mapped, host coherent buffer with one region per frame in
+// flight, for data that changes every frame (uniforms, instance data,
+// dynamic vertices). The GPU reads the data straight from the buffer, there
+// is no staging copy, no vkMapMemory and no allocation per frame.
+//
+// A frame's region may only be reused once the GPU has finished that frame,
+// which the frame ring already guarantees before recording.
+class UploadRing {
+public:
+	// With more than one queue family, the ring is shared concurrently for data read on each of their queues
+	UploadRing(GpuAllocator & allocator, uint32_t frameCount, VkDeviceSize bytesPerFrame, const std::vector<uint32_t> & queueFamilies = {});
+	~UploadRing();
+
+	UploadRing(const UploadRing &) = delete;
+	UploadRing & operator=(const UploadRing &) = delete;
+
+	// Switch to the region of the given frame, throwing away what was written there last time
+	void BeginFrame(uint32_t frameIndex);
+
+	// Sub-allocate from the current frame's region. Safe to call from multiple threads.
+	// Throws if the region is full.
+	UploadAllocation Allocate(VkDeviceSize size, VkDeviceSize alignment);
+
+	// Allocate and copy an array of trivially copyable data
+	template <typename T>
+	UploadAllocation Push(const T * data, size_t count, VkDeviceSize alignment = alignof(T)) {
+		UploadAllocation allocation = Allocate(sizeof(T) * count, alignment);
+		memcpy(allocation.Mapped, data, sizeof(T) * count);
+		return allocation;
+	}
+
+	// Alignment that satisfies uniform and storage buffer offset rules
+	VkDeviceSize GetUniformAlignment() const { return UniformAlignment; }
+
+	VkBuffer GetBuffer() const { return RingBuffer.Handle; }
+
+private:
+	GpuAllocator & Allocator;
+	Buffer RingBuffer;
+
+	VkDeviceSize BytesPerFrame;
+	VkDeviceSize UniformAlignment;
+
+	// Start of the current frame's region within the buffer
+	VkDeviceSize FrameOffset = 0;
+	// Bytes used in the current frame's region
+	std::atomic<VkDeviceSize> Head = 0;
+};
+
+} // namespace core
@@ -0,0 +1,12 @@
+// Descriptor heap bound as set 0 by every bindless pipeline, has to match BindlessHeap.h.
+// Resources are found by index, the indices are usually passed in push constants.
+#extension GL_EXT_nonuniform_qualifier : require
+
+#define BINDLESS_STORAGE_BUFFERS 0
+#define BINDLESS_SAMPLED_IMAGES 1
+#define BINDLESS_STORAGE_IMAGES 2
+
+// Storage buffer blocks differ per shader, each one declares its own array on
+// BINDLESS_STORAGE_BUFFERS. Every declaration aliases the same descriptors.
+layout (set = 0, binding = BINDLESS_SAMPLED_IMAGES) uniform sampler2D bindlessTextures[];
+layout (set = 0, binding = BINDLESS_STORAGE_IMAGES, r32f) uniform image2D bindlessImagesR32f[];
@@ -0,0 +1,13 @@
+#version 450
+#pragma shader_stage(fragment)
+
+layout (location = 0) flat in uint inInstance;
+
+layout (location = 0) out vec4 outFragColor;
+
+void main() {
+	// Tell instances apart by hashing their index into a color
+	uint hash = inInstance * 2654435761u;
+	vec3 color = vec3((hash >> 8) & 255u, (hash >> 16) & 255u, (hash >> 24) & 255u) / 255.0;
+	outFragColor = vec4(0.25 + 0.75 * color, 1.0);
+}
@@ -0,0 +1,28 @@
+#version 450
+#pragma shader_stage(vertex)
+
+#include "bindless.glsl"
+
+layout (location = 0) in vec3 vPosition;
+
+// The scene store's transforms
+layout (set = 0, binding = BINDLESS_STORAGE_BUFFERS) readonly buffer TransformBuffer { mat4 transforms[]; } transformBuffers[];
+// Store index of each instance drawn, indexed by gl_InstanceIndex
+layout (set = 0, binding = BINDLESS_STORAGE_BUFFERS) readonly buffer InstanceIdBuffer { uint instanceIds[]; } instanceIdBuffers[];
+
+// Has to match GpuScene.cpp
+layout (push_constant) uniform Constants {
+	mat4 ViewProj;
+	// Heap indices
+	uint Transforms;
+	uint InstanceIds;
+};
+
+layout (location = 0) flat out uint outInstance;
+
+void main() {
+	// Draws start at their first entry of the id list, with the culling pass or the batches filling it in
+	uint instance = instanceIdBuffers[InstanceIds].instanceIds[gl_InstanceIndex];
+	gl_Position = ViewProj * transformBuffers[Transforms].transforms[instance] * vec4(vPosition, 1.0);
+	outInstance = instance;
+}
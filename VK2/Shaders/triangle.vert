@@ -1,14 +1,9 @@
 #version 450
 #pragma shader_stage(vertex)
 
-void main() {
-
-	// constant triangle coordinates. update in the future
-	const vec3 positions[3] = vec3[3](
-		vec3(1.f, 1.f, 0.0f),
-		vec3(-1.f, 1.f, 0.0f),
-		vec3(0.f, -1.f, 0.0f)
-	);
+// Written to the upload ring every frame
+layout (location = 0) in vec3 vPosition;
 
-	gl_Position = vec4(positions[gl_VertexIndex], 1.0f);
+void main() {
+	gl_Position = vec4(vPosition, 1.0f);
 }
\ No newline at end of file
@@ -35,11 +35,45 @@ Create and destroy a Vulkan surface on an SDL window.
 #define SDL_MAIN_HANDLED
 
 #include "Core/Engine.h"
+#include "Core/MultiGpu.h"
 
 #include <memory>
+#include <string>
 
-int main()
+int main(int argc, char * argv[])
 {
-    std::shared_ptr<core::Engine> engine = std::make_shared<core::Engine>("Test App");
+    core::EngineSettings settings;
+    bool allGpus = false;
+
+    // --headless renders offscreen, for machines without a display.
+    // --all-gpus splits a headless run across every suitable GPU.
+    // --benchmark runs a fixed number of frames and writes the frame times as JSON,
+    // its workload is set with --frames=, --draws=, --overdraw=, --stream-kb= and --results=
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        const std::string value = arg.substr(arg.find('=') + 1);
+
+        if (arg == "--headless")
+            settings.Headless = true;
+        else if (arg == "--all-gpus")
+            allGpus = true;
+        else if (arg == "--benchmark")
+            settings.Benchmark.Enabled = true;
+        else if (arg.rfind("--frames=", 0) == 0)
+            settings.Benchmark.Frames = std::stoul(value);
+        else if (arg.rfind("--draws=", 0) == 0)
+            settings.Benchmark.DrawCount = std::stoul(value);
+        else if (arg.rfind("--overdraw=", 0) == 0)
+            settings.Benchmark.Overdraw = std::stoul(value);
+        else if (arg.rfind("--stream-kb=", 0) == 0)
+            settings.Benchmark.StreamedBytesPerFrame = std::stoull(value) * 1024;
+        else if (arg.rfind("--results=", 0) == 0)
+            settings.Benchmark.ResultsPath = value;
+    }
+
+    if (allGpus)
+        return core::MultiGpuRunner("Test App", settings).Exec();
+
+    std::shared_ptr<core::Engine> engine = std::make_shared<core::Engine>("Test App", settings);
     return engine->Exec();
 }